@@ -0,0 +1,344 @@
+/*!
+ * \file
+ * \brief
+ */
+
+#include <memory>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#include "CloudWriter.hpp"
+#include "Common/Logger.hpp"
+#include "Common/Timer.hpp"
+
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+
+namespace Processors {
+namespace CloudWriter {
+
+/// Fields present in raw frame header.
+enum RawFields {
+	RAW_NORMALS = 1, RAW_COLOR = 2, RAW_LABELS = 4
+};
+
+/// Appends binary value to header.
+template<typename T>
+static void append(std::string & str, T value) {
+	str.append((const char *) &value, sizeof(value));
+}
+
+CloudWriter::CloudWriter(const std::string & name) :
+		Base::Component(name),
+		prop_directory("directory", std::string(".")),
+		prop_prefix("prefix", std::string("cloud")),
+		prop_format("format", std::string("ply")),
+		prop_queue_size("queue_size", 8),
+		prop_policy("policy", std::string("drop")),
+		m_stats(name),
+		m_format(PLY),
+		m_block(false),
+		m_queue_size(8),
+		m_seq(0),
+		m_stop(false),
+		m_written(0),
+		m_dropped(0),
+		m_bytes(0) {
+	registerProperty(prop_directory);
+	registerProperty(prop_prefix);
+	registerProperty(prop_format);
+	registerProperty(prop_queue_size);
+	registerProperty(prop_policy);
+	registerProperty(m_stats.prop_statistics);
+	registerProperty(m_stats.prop_statistics_period);
+	registerProperty(m_stats.prop_trace_file);
+	registerProperty(m_stats.prop_allocations);
+	registerProperty(m_stats.prop_frame_sync);
+	m_writer_stats = m_stats.add("writer");
+}
+
+CloudWriter::~CloudWriter() {
+	onStop();
+}
+
+void CloudWriter::prepareInterface() {
+	// Register data streams, events and event handlers HERE!
+	registerStream("in_xyz", &in_xyz);
+	registerStream("in_normals", &in_normals);
+	registerStream("in_color", &in_color);
+	registerStream("in_labels", &in_labels);
+	registerStream("in_frame_info", &m_stats.in_frame_info);
+	registerStream("out_frame_info", &m_stats.out_frame_info);
+
+	// Register handlers
+	registerHandler("onNewCloud", m_stats.wrap("onNewCloud", boost::bind(&CloudWriter::onNewCloud, this)));
+	addDependency("onNewCloud", &in_xyz);
+}
+
+bool CloudWriter::onInit() {
+	m_stats.init(boost::bind(&CloudWriter::addDependency, this, _1, _2));
+	return true;
+}
+
+bool CloudWriter::onFinish() {
+	return true;
+}
+
+bool CloudWriter::onStop() {
+	if (!m_thread.joinable())
+		return true;
+
+	// queued frames are written before the writer ends
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		m_stop = true;
+	}
+	m_not_empty.notify_one();
+	m_thread.join();
+	m_thread = boost::thread();
+
+	CLOG(LINFO) << "Written " << m_written.load() << " frames (" << m_bytes.load() / (1 << 20) << " MB), dropped "
+			<< m_dropped.load();
+	return true;
+}
+
+bool CloudWriter::onStart() {
+	std::string format = prop_format;
+	if (format == "pcd") {
+		m_format = PCD;
+	} else if (format == "raw") {
+		m_format = RAW;
+	} else {
+		if (format != "ply")
+			CLOG(LWARNING) << "Unknown format " << format << ", using ply";
+		m_format = PLY;
+	}
+
+	std::string policy = prop_policy;
+	if (policy != "drop" && policy != "block")
+		CLOG(LWARNING) << "Unknown policy " << policy << ", using drop";
+	m_block = policy == "block";
+	m_queue_size = std::max(1, (int) prop_queue_size);
+
+	boost::system::error_code ec;
+	boost::filesystem::create_directories(std::string(prop_directory), ec);
+	if (ec)
+		CLOG(LERROR) << "Can't create directory " << std::string(prop_directory) << ": " << ec.message();
+
+	m_stop = false;
+	m_thread = boost::thread(boost::bind(&CloudWriter::run, this));
+	return true;
+}
+
+void CloudWriter::onNewCloud() {
+	cv::Mat xyz = in_xyz.read();
+	if (xyz.type() != CV_32FC3) {
+		CLOG(LERROR) << "Wrong cloud type, CV_32FC3 expected";
+		m_stats.skip();
+		return;
+	}
+
+	const Types::FrameInfo & info = m_stats.frame();
+	boost::uint64_t seq = info.valid ? info.seq : m_seq;
+	++m_seq;
+
+	// full queue is checked before copying, dropped frame costs nothing
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		while (m_queue.size() >= m_queue_size) {
+			if (!m_block) {
+				m_dropped.fetch_add(1, boost::memory_order_relaxed);
+				m_writer_stats->skip();
+				return;
+			}
+			m_not_full.wait(lock);
+		}
+	}
+
+	// own copies, as input buffers are reused with next frames
+	Frame frame;
+	frame.seq = seq;
+	frame.info = info;
+	frame.xyz = xyz.clone();
+
+	if (!in_normals.empty()) {
+		cv::Mat normals = in_normals.read();
+		if (normals.size() == xyz.size() && normals.type() == CV_32FC3)
+			frame.normals = normals.clone();
+		else
+			CLOG(LWARNING) << "Normals don't match cloud, ignoring them";
+	}
+
+	if (!in_color.empty()) {
+		cv::Mat color = in_color.read();
+		if (color.size() == xyz.size() && color.type() == CV_8UC3)
+			frame.color = color.clone();
+		else
+			CLOG(LWARNING) << "Colors don't match cloud, ignoring them";
+	}
+
+	// runs are never modified, so they are shared with the writer
+	if (!in_labels.empty()) {
+		Types::LabelRuns labels = in_labels.read();
+		if (labels.size() == xyz.size())
+			frame.labels = labels;
+		else
+			CLOG(LWARNING) << "Labels don't match cloud, ignoring them";
+	}
+
+	// the only producer, so there is still free space
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		m_queue.push_back(frame);
+	}
+	m_not_empty.notify_one();
+}
+
+void CloudWriter::run() {
+	for (;;) {
+		Frame frame;
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			while (m_queue.empty() && !m_stop)
+				m_not_empty.wait(lock);
+			if (m_queue.empty())
+				return;
+			frame = m_queue.front();
+			m_queue.pop_front();
+		}
+		m_not_full.notify_one();
+
+		Common::Timer timer;
+		timer.restart();
+		try {
+			m_bytes.fetch_add(write(frame), boost::memory_order_relaxed);
+			m_written.fetch_add(1, boost::memory_order_relaxed);
+			// frame is output once it is on disk
+			m_stats.publish(frame.info);
+		} catch (const std::exception & ex) {
+			LOG(LERROR) << "Writing frame " << frame.seq << " failed: " << ex.what();
+			m_writer_stats->skip();
+		}
+		m_writer_stats->call(timer.elapsed());
+	}
+}
+
+size_t CloudWriter::write(const Frame & frame) {
+	const cv::Mat & xyz = frame.xyz;
+	bool normals = !frame.normals.empty();
+	bool color = !frame.color.empty();
+	cv::Mat labels;
+	if (frame.labels.size() == xyz.size())
+		labels = frame.labels.decode();
+	bool has_labels = !labels.empty();
+
+	size_t points = xyz.total();
+	size_t record = 12 + (normals ? 12 : 0) + (color ? 4 : 0) + (has_labels ? 4 : 0);
+
+	// header
+	std::string header;
+	std::ostringstream name;
+	name << std::string(prop_directory) << "/" << std::string(prop_prefix);
+	if (m_format == PLY) {
+		std::ostringstream ss;
+		ss << "ply\nformat binary_little_endian 1.0\n"
+				<< "comment organized " << xyz.cols << " x " << xyz.rows << ", frame " << frame.seq << "\n"
+				<< "element vertex " << points << "\n"
+				<< "property float x\nproperty float y\nproperty float z\n";
+		if (normals)
+			ss << "property float nx\nproperty float ny\nproperty float nz\n";
+		// the same bytes as packed rgb of PCD
+		if (color)
+			ss << "property uchar blue\nproperty uchar green\nproperty uchar red\nproperty uchar alpha\n";
+		if (has_labels)
+			ss << "property int label\n";
+		ss << "end_header\n";
+		header = ss.str();
+		name << "_" << std::setw(6) << std::setfill('0') << frame.seq << ".ply";
+	} else if (m_format == PCD) {
+		std::string fields = "x y z", size = "4 4 4", type = "F F F", count = "1 1 1";
+		if (normals) {
+			fields += " normal_x normal_y normal_z";
+			size += " 4 4 4";
+			type += " F F F";
+			count += " 1 1 1";
+		}
+		if (color) {
+			fields += " rgb";
+			size += " 4";
+			type += " F";
+			count += " 1";
+		}
+		if (has_labels) {
+			fields += " label";
+			size += " 4";
+			type += " U";
+			count += " 1";
+		}
+		std::ostringstream ss;
+		ss << "# .PCD v0.7 - Point Cloud Data file format\nVERSION 0.7\n"
+				<< "FIELDS " << fields << "\nSIZE " << size << "\nTYPE " << type << "\nCOUNT " << count << "\n"
+				<< "WIDTH " << xyz.cols << "\nHEIGHT " << xyz.rows << "\nVIEWPOINT 0 0 0 1 0 0 0\n"
+				<< "POINTS " << points << "\nDATA binary\n";
+		header = ss.str();
+		name << "_" << std::setw(6) << std::setfill('0') << frame.seq << ".pcd";
+	} else {
+		header = "DCLR";
+		append<boost::uint64_t>(header, frame.seq);
+		append<boost::int32_t>(header, xyz.rows);
+		append<boost::int32_t>(header, xyz.cols);
+		append<boost::int32_t>(header,
+				(normals ? RAW_NORMALS : 0) | (color ? RAW_COLOR : 0) | (has_labels ? RAW_LABELS : 0));
+		name << ".raw";
+	}
+
+	// points, interleaved in row order
+	m_buffer.resize(header.size() + points * record);
+	std::memcpy(&m_buffer[0], header.data(), header.size());
+	char * p = &m_buffer[header.size()];
+	for (int i = 0; i < xyz.rows; ++i) {
+		const cv::Point3f * x = xyz.ptr<cv::Point3f>(i);
+		const cv::Point3f * n = normals ? frame.normals.ptr<cv::Point3f>(i) : NULL;
+		const uchar * c = color ? frame.color.ptr<uchar>(i) : NULL;
+		const int * l = has_labels ? labels.ptr<int>(i) : NULL;
+		for (int j = 0; j < xyz.cols; ++j) {
+			std::memcpy(p, &x[j], 12);
+			p += 12;
+			if (n) {
+				std::memcpy(p, &n[j], 12);
+				p += 12;
+			}
+			if (c) {
+				p[0] = c[3 * j];
+				p[1] = c[3 * j + 1];
+				p[2] = c[3 * j + 2];
+				p[3] = 0;
+				p += 4;
+			}
+			if (l) {
+				std::memcpy(p, &l[j], 4);
+				p += 4;
+			}
+		}
+	}
+
+	// single large sequential write
+	std::string path = name.str();
+	std::FILE * file = std::fopen(path.c_str(), m_format == RAW ? "ab" : "wb");
+	if (!file)
+		throw std::runtime_error("can't open " + path);
+	size_t written = std::fwrite(&m_buffer[0], 1, m_buffer.size(), file);
+	bool closed = std::fclose(file) == 0;
+	if (written != m_buffer.size() || !closed)
+		throw std::runtime_error("can't write " + path);
+
+	return written;
+}
+
+} //: namespace CloudWriter
+} //: namespace Processors
@@ -0,0 +1,180 @@
+/*!
+ * \file
+ * \brief
+ */
+
+#ifndef CLOUDWRITER_HPP_
+#define CLOUDWRITER_HPP_
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "Base/Component_Aux.hpp"
+#include "Base/Component.hpp"
+#include "Base/DataStream.hpp"
+#include "Base/Property.hpp"
+#include "Base/EventHandler2.hpp"
+
+#include <opencv2/opencv.hpp>
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/thread.hpp>
+
+#include "Types/HandlerStatistics.hpp"
+#include "Types/LabelRuns.hpp"
+
+namespace Processors {
+namespace CloudWriter {
+
+/*!
+ * \class CloudWriter
+ * \brief CloudWriter sink class.
+ *
+ * Dumps organized clouds (in_xyz, CV_32FC3) to disk, together with normals
+ * (CV_32FC3), colors (CV_8UC3) and segment labels, if these optional inputs
+ * are connected and match cloud size. Handler only copies frame into a
+ * bounded queue, served by a dedicated writer thread, so disk stalls never
+ * reach the executor. When the queue is full, frame is either dropped
+ * (policy "drop") or handler waits for free space ("block").
+ *
+ * Every frame is serialized into one buffer and written with a single
+ * call. Formats are binary PLY or PCD (one file per frame, points in row
+ * order, invalid ones included) or raw, appended to a single file:
+ * per frame header (magic "DCLR", 64-bit sequence number, then rows, cols
+ * and field mask as 32-bit integers; 1 - normals, 2 - colors, 4 - labels)
+ * followed by points in the same layout. All values are little endian.
+ * Point fields are x, y, z, then nx, ny, nz (normals), rgb (colors, packed
+ * as in PCD) and label (32-bit integer), if present.
+ *
+ * Writer time is reported as "writer" in handler statistics, dropped frames
+ * are counted there as skipped.
+ */
+class CloudWriter: public Base::Component {
+public:
+	/*!
+	 * Constructor.
+	 */
+	CloudWriter(const std::string & name = "CloudWriter");
+
+	/*!
+	 * Destructor
+	 */
+	virtual ~CloudWriter();
+
+	/*!
+	 * Prepare components interface (register streams and handlers).
+	 * At this point, all properties are already initialized and loaded to
+	 * values set in config file.
+	 */
+	void prepareInterface();
+
+protected:
+
+	/*!
+	 * Connects source to given device.
+	 */
+	bool onInit();
+
+	/*!
+	 * Disconnect source from device, closes streams, etc.
+	 */
+	bool onFinish();
+
+	/*!
+	 * Start component
+	 */
+	bool onStart();
+
+	/*!
+	 * Stop component
+	 */
+	bool onStop();
+
+
+	// Input data streams
+	Base::DataStreamIn<cv::Mat> in_xyz;
+	Base::DataStreamIn<cv::Mat, Base::DataStreamBuffer::Newest> in_normals;
+	Base::DataStreamIn<cv::Mat, Base::DataStreamBuffer::Newest> in_color;
+	Base::DataStreamIn<Types::LabelRuns, Base::DataStreamBuffer::Newest> in_labels;
+
+	// Properties
+
+	/// Output directory, created if needed.
+	Base::Property<std::string> prop_directory;
+
+	/// File name prefix, followed by frame number.
+	Base::Property<std::string> prop_prefix;
+
+	/// File format: ply, pcd or raw.
+	Base::Property<std::string> prop_format;
+
+	/// Maximal number of frames waiting for the writer.
+	Base::Property<int> prop_queue_size;
+
+	/// Full queue policy: drop or block.
+	Base::Property<std::string> prop_policy;
+
+	/// Handler latency statistics
+	Types::ComponentStatistics m_stats;
+
+	// Handlers
+	void onNewCloud();
+
+private:
+	struct Frame {
+		boost::uint64_t seq;
+		Types::FrameInfo info;
+		cv::Mat xyz;
+		cv::Mat normals;
+		cv::Mat color;
+		Types::LabelRuns labels;
+	};
+
+	enum Format {
+		PLY, PCD, RAW
+	};
+
+	/// Writer thread loop.
+	void run();
+
+	/// Serializes and writes single frame, returns number of bytes written.
+	size_t write(const Frame & frame);
+
+	/// Format and policy, fixed while running
+	Format m_format;
+	bool m_block;
+	size_t m_queue_size;
+
+	/// Frame counter, used when source provides no frame info
+	boost::uint64_t m_seq;
+
+	std::deque<Frame> m_queue;
+	bool m_stop;
+	boost::mutex m_mutex;
+	boost::condition_variable m_not_empty;
+	boost::condition_variable m_not_full;
+	boost::thread m_thread;
+
+	/// Counters, readable while writer runs
+	boost::atomic<boost::uint64_t> m_written;
+	boost::atomic<boost::uint64_t> m_dropped;
+	boost::atomic<boost::uint64_t> m_bytes;
+
+	/// Writer time, dropped frames are counted as skipped
+	Types::HandlerStatistics * m_writer_stats;
+
+	/// Buffer of serialized frame, reused by writer
+	std::vector<char> m_buffer;
+};
+
+} //: namespace CloudWriter
+} //: namespace Processors
+
+/*
+ * Register processor component.
+ */
+REGISTER_COMPONENT("CloudWriter", Processors::CloudWriter::CloudWriter)
+
+#endif /* CLOUDWRITER_HPP_ */
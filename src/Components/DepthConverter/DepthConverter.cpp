@@ -0,0 +1,161 @@
+/*!
+ * \file
+ * \brief
+ */
+
+#include <memory>
+#include <string>
+#include <cmath>
+
+#include "DepthConverter.hpp"
+#include "Common/Logger.hpp"
+#include "Types/DepthConversion.hpp"
+
+#include <boost/bind.hpp>
+
+namespace Processors {
+namespace DepthConverter {
+
+DepthConverter::DepthConverter(const std::string & name) :
+		Base::Component(name),
+		prop_depth_scale("depth_scale", 0.001f),
+		prop_fx("fx", 525.0f),
+		prop_fy("fy", 525.0f),
+		prop_cx("cx", 319.5f),
+		prop_cy("cy", 239.5f),
+		prop_range_filter("range_filter", false),
+		prop_z_min("z_min", 0),
+		prop_z_max("z_max", 10),
+		prop_dense_output("dense_output", true),
+		prop_inverse("inverse", false),
+		m_stats(name) {
+	registerProperty(prop_depth_scale);
+	registerProperty(prop_fx);
+	registerProperty(prop_fy);
+	registerProperty(prop_cx);
+	registerProperty(prop_cy);
+	registerProperty(prop_range_filter);
+	registerProperty(prop_z_min);
+	registerProperty(prop_z_max);
+	registerProperty(prop_dense_output);
+	registerProperty(prop_inverse);
+	registerProperty(m_stats.prop_statistics);
+	registerProperty(m_stats.prop_statistics_period);
+	registerProperty(m_stats.prop_trace_file);
+	registerProperty(m_stats.prop_allocations);
+	registerProperty(m_stats.prop_frame_sync);
+}
+
+DepthConverter::~DepthConverter() {
+}
+
+void DepthConverter::prepareInterface() {
+	// Register data streams, events and event handlers HERE!
+	registerStream("in_depth", &in_depth);
+	registerStream("in_camera_info", &in_camera_info);
+	registerStream("in_homogMatrix", &in_homogMatrix);
+	registerStream("out_depth", &out_depth);
+	registerStream("out_mask", &out_mask);
+	registerStream("out_cloud", &out_cloud);
+	registerStream("in_frame_info", &m_stats.in_frame_info);
+	registerStream("out_frame_info", &m_stats.out_frame_info);
+
+	// Register handlers
+	registerHandler("onDepth", m_stats.wrap("onDepth", boost::bind(&DepthConverter::onDepth, this)));
+	addDependency("onDepth", &in_depth);
+
+	registerHandler("onDepthTransform", m_stats.wrap("onDepthTransform", boost::bind(&DepthConverter::onDepthTransform, this)));
+	addDependency("onDepthTransform", &in_depth);
+	addDependency("onDepthTransform", &in_homogMatrix);
+}
+
+bool DepthConverter::onInit() {
+	m_stats.init(boost::bind(&DepthConverter::addDependency, this, _1, _2));
+	return true;
+}
+
+bool DepthConverter::onFinish() {
+	return true;
+}
+
+bool DepthConverter::onStop() {
+	return true;
+}
+
+bool DepthConverter::onStart() {
+	return true;
+}
+
+void DepthConverter::onDepth() {
+	convert(false);
+}
+
+void DepthConverter::onDepthTransform() {
+	convert(true);
+}
+
+void DepthConverter::updateRays(cv::Size size) {
+	cv::Mat K, D;
+	if (!in_camera_info.empty()) {
+		Types::CameraInfo info = in_camera_info.read();
+		K = info.cameraMatrix();
+		D = info.distCoeffs();
+	} else {
+		K = cv::Mat::eye(3, 3, CV_64F);
+		K.at<double>(0, 0) = prop_fx;
+		K.at<double>(1, 1) = prop_fy;
+		K.at<double>(0, 2) = prop_cx;
+		K.at<double>(1, 2) = prop_cy;
+	}
+
+	if (!m_rays || !m_rays->matches(K, D, size)) {
+		CLOG(LINFO) << "Building ray table for " << size.width << "x" << size.height;
+		m_rays.reset(new Types::RayTable(K, D, size));
+	}
+}
+
+void DepthConverter::convert(bool transform) {
+	try {
+		cv::Mat depth = in_depth.read();
+
+		if (depth.type() != CV_16UC1) {
+			CLOG(LERROR) << "Wrong depth type, CV_16UC1 expected";
+			m_stats.skip();
+			return;
+		}
+
+		cv::Matx44f H;
+		if (transform) {
+			Types::HomogMatrix hm = in_homogMatrix.read();
+			if (prop_inverse)
+				hm.matrix() = hm.matrix().inverse();
+			cv::Matx44d Hd = hm;
+			for (int i = 0; i < 4; ++i)
+				for (int j = 0; j < 4; ++j)
+					H(i, j) = Hd(i, j);
+		}
+
+		updateRays(depth.size());
+
+		if (!transform) {
+			m_stats.publish();
+			out_cloud.write(Types::DepthCloud(depth, m_rays, prop_depth_scale));
+			if (!prop_dense_output)
+				return;
+		}
+
+		cv::Mat cloud, mask;
+		Types::convertDepth(depth, *m_rays, prop_depth_scale, prop_range_filter, prop_z_min, prop_z_max,
+				transform ? &H : NULL, cloud, mask);
+
+		m_stats.publish();
+		out_mask.write(mask);
+		out_depth.write(cloud);
+	} catch (...) {
+		CLOG(LERROR) << "Error occured in processing input";
+		m_stats.skip();
+	}
+}
+
+} //: namespace DepthConverter
+} //: namespace Processors
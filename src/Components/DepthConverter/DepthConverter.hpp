@@ -0,0 +1,140 @@
+/*!
+ * \file
+ * \brief
+ */
+
+#ifndef DEPTHCONVERTER_HPP_
+#define DEPTHCONVERTER_HPP_
+
+#include "Base/Component_Aux.hpp"
+#include "Base/Component.hpp"
+#include "Base/DataStream.hpp"
+#include "Base/Property.hpp"
+#include "Base/EventHandler2.hpp"
+
+#include <boost/shared_ptr.hpp>
+
+#include <opencv2/opencv.hpp>
+
+#include <Types/CameraInfo.hpp>
+#include "Types/HomogMatrix.hpp"
+#include "Types/HandlerStatistics.hpp"
+#include "Types/RayTable.hpp"
+#include "Types/DepthCloud.hpp"
+
+namespace Processors {
+namespace DepthConverter {
+
+/*!
+ * \class DepthConverter
+ * \brief DepthConverter processor class.
+ *
+ * Converts 16-bit depth map (in_depth) into organized XYZ cloud (CV_32FC3).
+ * Viewing rays are cached per pixel and rebuilt only when camera intrinsics
+ * change. Optionally, z-range filter (as in PassThrough) and rigid transformation
+ * (as in DepthTransform, onDepthTransform handler) are applied in the same pass.
+ * Invalid points are set to 0, points transformed out of range to INVALID_COORDINATE.
+ *
+ * onDepth also publishes lazy Types::DepthCloud (out_cloud), which shares depth
+ * map and ray table without any conversion. If dense output is disabled, that
+ * is the only output of onDepth.
+ */
+class DepthConverter: public Base::Component {
+public:
+	/*!
+	 * Constructor.
+	 */
+	DepthConverter(const std::string & name = "DepthConverter");
+
+	/*!
+	 * Destructor
+	 */
+	virtual ~DepthConverter();
+
+	/*!
+	 * Prepare components interface (register streams and handlers).
+	 * At this point, all properties are already initialized and loaded to
+	 * values set in config file.
+	 */
+	void prepareInterface();
+
+protected:
+
+	/*!
+	 * Connects source to given device.
+	 */
+	bool onInit();
+
+	/*!
+	 * Disconnect source from device, closes streams, etc.
+	 */
+	bool onFinish();
+
+	/*!
+	 * Start component
+	 */
+	bool onStart();
+
+	/*!
+	 * Stop component
+	 */
+	bool onStop();
+
+
+	// Input data streams
+	Base::DataStreamIn<cv::Mat> in_depth;
+	Base::DataStreamIn<Types::CameraInfo, Base::DataStreamBuffer::Newest> in_camera_info;
+	Base::DataStreamIn<Types::HomogMatrix, Base::DataStreamBuffer::Newest> in_homogMatrix;
+
+	// Output data streams
+	Base::DataStreamOut<cv::Mat> out_depth;
+	Base::DataStreamOut<cv::Mat> out_mask;
+	Base::DataStreamOut<Types::DepthCloud> out_cloud;
+
+	// Properties
+
+	/// Depth units in meters (Kinect delivers millimeters).
+	Base::Property<float> prop_depth_scale;
+
+	/// Intrinsics used when no camera info is connected.
+	Base::Property<float> prop_fx;
+	Base::Property<float> prop_fy;
+	Base::Property<float> prop_cx;
+	Base::Property<float> prop_cy;
+
+	/// Enables z-range filter.
+	Base::Property<bool> prop_range_filter;
+	Base::Property<float> prop_z_min;
+	Base::Property<float> prop_z_max;
+
+	/// Produces dense CV_32FC3 cloud in onDepth.
+	Base::Property<bool> prop_dense_output;
+
+	/// Performs inverse transformation.
+	Base::Property<bool> prop_inverse;
+
+	/// Handler latency statistics
+	Types::ComponentStatistics m_stats;
+
+	// Handlers
+	void onDepth();
+	void onDepthTransform();
+
+private:
+	void convert(bool transform);
+
+	/// Rebuilds ray table if intrinsics or image size changed.
+	void updateRays(cv::Size size);
+
+	boost::shared_ptr<Types::RayTable> m_rays;
+};
+
+} //: namespace DepthConverter
+} //: namespace Processors
+
+/*
+ * Register processor component.
+ */
+REGISTER_COMPONENT("DepthConverter", Processors::DepthConverter::DepthConverter)
+
+#endif /* DEPTHCONVERTER_HPP_ */
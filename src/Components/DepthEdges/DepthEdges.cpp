@@ -0,0 +1,233 @@
+/*!
+ * \file
+ * \brief
+ */
+
+#include <memory>
+#include <string>
+#include <cmath>
+#include <algorithm>
+
+#include "DepthEdges.hpp"
+#include "Common/Logger.hpp"
+
+#include "Types/PointValidity.hpp"
+
+#include <boost/bind.hpp>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace Processors {
+namespace DepthEdges {
+
+/*!
+ * Edge bits of single pixel with depth c and neighbours l, r, u, d (0 if
+ * invalid). Jump is relative to the nearer depth of the pair, so both of its
+ * pixels agree on it: nearer one is occluding, farther one occluded.
+ */
+static inline uchar edgeBits(float c, float l, float r, float u, float d, float disc, float curv) {
+	if (c <= 0)
+		return 0;
+
+	uchar bits = 0;
+	float n[4] = { l, r, u, d };
+	for (int k = 0; k < 4; ++k) {
+		if (n[k] <= 0)
+			continue;
+		if (n[k] - c > disc * c)
+			bits |= Types::EDGE_OCCLUDING;
+		if (c - n[k] > disc * n[k])
+			bits |= Types::EDGE_OCCLUDED;
+	}
+
+	if (!bits && curv > 0) {
+		float ct = curv * c;
+		if ((l > 0 && r > 0 && std::fabs(l + r - 2 * c) > ct) || (u > 0 && d > 0 && std::fabs(u + d - 2 * c) > ct))
+			bits |= Types::EDGE_CURVATURE;
+	}
+
+	return bits;
+}
+
+/*!
+ * Marks edges in rows of depth map, border pixels are never marked.
+ */
+class EdgeBody: public cv::ParallelLoopBody {
+public:
+	EdgeBody(const cv::Mat & z, cv::Mat & edges, float disc, float curv) :
+		z(z), edges(edges), disc(disc), curv(curv) {
+	}
+
+	void operator()(const cv::Range & r) const {
+		for (int i = r.start; i < r.end; ++i) {
+			uchar * e = edges.ptr<uchar>(i);
+			e[0] = e[z.cols - 1] = 0;
+			if (i == 0 || i == z.rows - 1) {
+				std::fill(e, e + z.cols, 0);
+				continue;
+			}
+			row(z.ptr<float>(i), z.ptr<float>(i - 1), z.ptr<float>(i + 1), e);
+		}
+	}
+
+private:
+	void row(const float * zc, const float * zu, const float * zd, uchar * e) const {
+		int j = 1;
+#if defined(__SSE2__)
+		const __m128 vzero = _mm_setzero_ps();
+		const __m128 vdisc = _mm_set1_ps(disc);
+		const __m128 vcurv = _mm_set1_ps(curv);
+		const __m128 vabs = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+		const __m128 vtwo = _mm_set1_ps(2.0f);
+		for (; j <= z.cols - 5; j += 4) {
+			__m128 c = _mm_loadu_ps(zc + j);
+			__m128 l = _mm_loadu_ps(zc + j - 1);
+			__m128 r = _mm_loadu_ps(zc + j + 1);
+			__m128 u = _mm_loadu_ps(zu + j);
+			__m128 d = _mm_loadu_ps(zd + j);
+			__m128 thr = _mm_mul_ps(c, vdisc);
+
+			__m128 vl = _mm_cmpgt_ps(l, vzero);
+			__m128 vr = _mm_cmpgt_ps(r, vzero);
+			__m128 vu = _mm_cmpgt_ps(u, vzero);
+			__m128 vd = _mm_cmpgt_ps(d, vzero);
+
+			__m128 farther = _mm_or_ps(
+					_mm_or_ps(_mm_and_ps(vl, _mm_cmpgt_ps(_mm_sub_ps(l, c), thr)),
+							_mm_and_ps(vr, _mm_cmpgt_ps(_mm_sub_ps(r, c), thr))),
+					_mm_or_ps(_mm_and_ps(vu, _mm_cmpgt_ps(_mm_sub_ps(u, c), thr)),
+							_mm_and_ps(vd, _mm_cmpgt_ps(_mm_sub_ps(d, c), thr))));
+			// threshold of the nearer neighbour
+			__m128 nearer = _mm_or_ps(
+					_mm_or_ps(_mm_and_ps(vl, _mm_cmpgt_ps(_mm_sub_ps(c, l), _mm_mul_ps(l, vdisc))),
+							_mm_and_ps(vr, _mm_cmpgt_ps(_mm_sub_ps(c, r), _mm_mul_ps(r, vdisc)))),
+					_mm_or_ps(_mm_and_ps(vu, _mm_cmpgt_ps(_mm_sub_ps(c, u), _mm_mul_ps(u, vdisc))),
+							_mm_and_ps(vd, _mm_cmpgt_ps(_mm_sub_ps(c, d), _mm_mul_ps(d, vdisc)))));
+
+			__m128 vc = _mm_cmpgt_ps(c, vzero);
+			farther = _mm_and_ps(farther, vc);
+			nearer = _mm_and_ps(nearer, vc);
+
+			int occluding = _mm_movemask_ps(farther);
+			int occluded = _mm_movemask_ps(nearer);
+			int crease = 0;
+			if (curv > 0) {
+				__m128 ct = _mm_mul_ps(c, vcurv);
+				__m128 twoc = _mm_mul_ps(c, vtwo);
+				__m128 horizontal = _mm_and_ps(_mm_and_ps(vl, vr),
+						_mm_cmpgt_ps(_mm_and_ps(_mm_sub_ps(_mm_add_ps(l, r), twoc), vabs), ct));
+				__m128 vertical = _mm_and_ps(_mm_and_ps(vu, vd),
+						_mm_cmpgt_ps(_mm_and_ps(_mm_sub_ps(_mm_add_ps(u, d), twoc), vabs), ct));
+				crease = _mm_movemask_ps(_mm_and_ps(_mm_or_ps(horizontal, vertical), vc)) & ~(occluding | occluded);
+			}
+
+			for (int k = 0; k < 4; ++k)
+				e[j + k] = ((occluding >> k) & 1) * Types::EDGE_OCCLUDING + ((occluded >> k) & 1) * Types::EDGE_OCCLUDED
+						+ ((crease >> k) & 1) * Types::EDGE_CURVATURE;
+		}
+#endif
+		for (; j < z.cols - 1; ++j)
+			e[j] = edgeBits(zc[j], zc[j - 1], zc[j + 1], zu[j], zd[j], disc, curv);
+	}
+
+	const cv::Mat & z;
+	cv::Mat & edges;
+	float disc;
+	float curv;
+};
+
+DepthEdges::DepthEdges(const std::string & name) :
+		Base::Component(name),
+		prop_depth_scale("depth_scale", 0.001f),
+		prop_discontinuity("discontinuity", 0.05f),
+		prop_curvature("curvature", 0.0f),
+		m_stats(name) {
+	registerProperty(prop_depth_scale);
+	registerProperty(prop_discontinuity);
+	registerProperty(prop_curvature);
+	registerProperty(m_stats.prop_statistics);
+	registerProperty(m_stats.prop_statistics_period);
+	registerProperty(m_stats.prop_trace_file);
+	registerProperty(m_stats.prop_allocations);
+	registerProperty(m_stats.prop_frame_sync);
+}
+
+DepthEdges::~DepthEdges() {
+}
+
+void DepthEdges::prepareInterface() {
+	// Register data streams, events and event handlers HERE!
+	registerStream("in_depth", &in_depth);
+	registerStream("in_xyz", &in_xyz);
+	registerStream("out_edges", &out_edges);
+	registerStream("in_frame_info", &m_stats.in_frame_info);
+	registerStream("out_frame_info", &m_stats.out_frame_info);
+
+	// Register handlers
+	registerHandler("onNewDepth", m_stats.wrap("onNewDepth", boost::bind(&DepthEdges::onNewDepth, this)));
+	addDependency("onNewDepth", &in_depth);
+
+	registerHandler("onNewCloud", m_stats.wrap("onNewCloud", boost::bind(&DepthEdges::onNewCloud, this)));
+	addDependency("onNewCloud", &in_xyz);
+}
+
+bool DepthEdges::onInit() {
+	m_stats.init(boost::bind(&DepthEdges::addDependency, this, _1, _2));
+	return true;
+}
+
+bool DepthEdges::onFinish() {
+	return true;
+}
+
+bool DepthEdges::onStop() {
+	return true;
+}
+
+bool DepthEdges::onStart() {
+	return true;
+}
+
+void DepthEdges::detect() {
+	cv::Mat edges(m_z.size(), CV_8UC1);
+	cv::parallel_for_(cv::Range(0, m_z.rows), EdgeBody(m_z, edges, prop_discontinuity, prop_curvature));
+	m_stats.publish();
+	out_edges.write(edges);
+}
+
+void DepthEdges::onNewDepth() {
+	cv::Mat depth = in_depth.read();
+	if (depth.type() != CV_16UC1) {
+		CLOG(LERROR) << "Wrong depth type, CV_16UC1 expected";
+		m_stats.skip();
+		return;
+	}
+
+	// zero depth stays zero, so invalid points are kept
+	depth.convertTo(m_z, CV_32F, prop_depth_scale);
+	detect();
+}
+
+void DepthEdges::onNewCloud() {
+	cv::Mat img = in_xyz.read();
+	if (img.type() != CV_32FC3) {
+		CLOG(LERROR) << "Wrong cloud type, CV_32FC3 expected";
+		m_stats.skip();
+		return;
+	}
+
+	m_z.create(img.size(), CV_32FC1);
+	for (int i = 0; i < img.rows; ++i) {
+		const cv::Point3f * p = img.ptr<cv::Point3f>(i);
+		float * z = m_z.ptr<float>(i);
+		for (int j = 0; j < img.cols; ++j)
+			z[j] = Types::validPoint(p[j]) && p[j].z > 0 ? p[j].z : 0;
+	}
+
+	detect();
+}
+
+} //: namespace DepthEdges
+} //: namespace Processors
@@ -0,0 +1,116 @@
+/*!
+ * \file
+ * \brief
+ */
+
+#ifndef DEPTHEDGES_HPP_
+#define DEPTHEDGES_HPP_
+
+#include "Base/Component_Aux.hpp"
+#include "Base/Component.hpp"
+#include "Base/DataStream.hpp"
+#include "Base/Property.hpp"
+#include "Base/EventHandler2.hpp"
+
+#include <opencv2/opencv.hpp>
+
+#include "Types/HandlerStatistics.hpp"
+#include "Types/EdgeMask.hpp"
+
+namespace Processors {
+namespace DepthEdges {
+
+/*!
+ * \class DepthEdges
+ * \brief DepthEdges processor class.
+ *
+ * Detects occluding, occluded and high curvature edges in 16-bit depth map
+ * (in_depth) or organized cloud (in_xyz). Each pixel is compared with its
+ * four neighbours in one vectorized pass over depth. Result is CV_8UC1 mask
+ * of Types::EdgeType bits (out_edges), consumed by normal estimators and
+ * Segmentation to skip work across edges.
+ */
+class DepthEdges: public Base::Component {
+public:
+	/*!
+	 * Constructor.
+	 */
+	DepthEdges(const std::string & name = "DepthEdges");
+
+	/*!
+	 * Destructor
+	 */
+	virtual ~DepthEdges();
+
+	/*!
+	 * Prepare components interface (register streams and handlers).
+	 * At this point, all properties are already initialized and loaded to
+	 * values set in config file.
+	 */
+	void prepareInterface();
+
+protected:
+
+	/*!
+	 * Connects source to given device.
+	 */
+	bool onInit();
+
+	/*!
+	 * Disconnect source from device, closes streams, etc.
+	 */
+	bool onFinish();
+
+	/*!
+	 * Start component
+	 */
+	bool onStart();
+
+	/*!
+	 * Stop component
+	 */
+	bool onStop();
+
+
+	// Input data streams
+	Base::DataStreamIn<cv::Mat> in_depth;
+	Base::DataStreamIn<cv::Mat> in_xyz;
+
+	// Output data streams
+	Base::DataStreamOut<cv::Mat> out_edges;
+
+	// Properties
+
+	/// Depth units in meters (Kinect delivers millimeters).
+	Base::Property<float> prop_depth_scale;
+
+	/// Depth jump between neighbours, relative to the nearer one, treated as discontinuity.
+	Base::Property<float> prop_discontinuity;
+
+	/// Second difference of depth, relative to depth, treated as crease (0 disables).
+	Base::Property<float> prop_curvature;
+
+	/// Handler latency statistics
+	Types::ComponentStatistics m_stats;
+
+	// Handlers
+	void onNewDepth();
+	void onNewCloud();
+
+private:
+	/// Detects edges in m_z.
+	void detect();
+
+	/// Depth in meters, 0 for invalid points.
+	cv::Mat m_z;
+};
+
+} //: namespace DepthEdges
+} //: namespace Processors
+
+/*
+ * Register processor component.
+ */
+REGISTER_COMPONENT("DepthEdges", Processors::DepthEdges::DepthEdges)
+
+#endif /* DEPTHEDGES_HPP_ */
@@ -19,6 +19,7 @@ DepthMapGenerator::DepthMapGenerator(const std::string & name) : Base::Component
 	LOG(LTRACE) << "Hello DepthMapGenerator\n";
 	m_width = 640;
 	m_height = 480;
+	m_seq = 0;
 }
 
 DepthMapGenerator::~DepthMapGenerator()
@@ -29,6 +30,7 @@ DepthMapGenerator::~DepthMapGenerator()
 void DepthMapGenerator::prepareInterface() {
 
 	registerStream("out_img", &out_img);
+	registerStream("out_frame_info", &out_frame_info);
 }
 
 bool DepthMapGenerator::onInit()
@@ -48,6 +50,7 @@ bool DepthMapGenerator::onFinish()
 bool DepthMapGenerator::onStep()
 {
 	LOG(LTRACE) << "DepthMapGenerator::step\n";
+	Types::FrameInfo info(++m_seq, Types::FrameInfo::now(), cv::Rect(0, 0, m_width, m_height));
 	m_image.create(cv::Size(m_width, m_height), CV_32FC3);
 
 	cv::RNG rng;
@@ -73,6 +76,7 @@ bool DepthMapGenerator::onStep()
 		}
 	}
 
+	out_frame_info.write(info);
 	out_img.write(m_image);
 
 	return true;
@@ -10,6 +10,8 @@
 #include "Base/Component.hpp"
 #include "Base/DataStream.hpp"
 
+#include "Types/FrameInfo.hpp"
+
 #include <opencv2/core/core.hpp>
 
 namespace Processors {
@@ -64,10 +66,14 @@ protected:
 	/// Output data stream - generated image
 	Base::DataStreamOut <cv::Mat> out_img;
 
+	/// Output data stream - info of generated frame
+	Base::DataStreamOut <Types::FrameInfo> out_frame_info;
+
 
 	cv::Mat m_image;
 	int m_width;
 	int m_height;
+	boost::uint64_t m_seq;
 };
 
 }//: namespace DepthMapGenerator
@@ -8,8 +8,16 @@
 
 #include "DepthNormalEstimator.hpp"
 #include "Common/Logger.hpp"
+#include "Common/Timer.hpp"
+
+#include "Types/Decimation.hpp"
+#include "Types/DepthNormalKernels.hpp"
+#include "Types/ReferenceKernels.hpp"
 
 #include <cmath>
+#include <algorithm>
+
+#include <boost/bind.hpp>
 
 #include <opencv2/imgproc/imgproc.hpp>
 
@@ -18,10 +26,45 @@ namespace DepthNormalEstimator {
 
 DepthNormalEstimator::DepthNormalEstimator(const std::string & name) :
 		Base::Component(name),
-		prop_difference_threshold("difference_threshold", 20, "range") {
+		prop_difference_threshold("difference_threshold", 20, "range"),
+		prop_dense("dense", true),
+		prop_publish_query("publish_query", false),
+		prop_adaptive("adaptive", false),
+		prop_window_scale("window_scale", 4.0f),
+		prop_min_window("min_window", 2),
+		prop_max_window("max_window", 12),
+		prop_decimation("decimation", 1),
+		prop_async("async", false),
+		prop_verify("verify", false),
+		prop_incremental("incremental", false),
+		prop_change_threshold("change_threshold", 5.0f),
+		prop_tile_size("tile_size", 32),
+		m_stats(name),
+		m_tiles_focal(0),
+		m_tiles_threshold(0),
+		m_queried(false) {
 	LOG(LTRACE)<< "Hello DepthNormalEstimator\n";
 
 	registerProperty(prop_difference_threshold);
+	registerProperty(prop_dense);
+	registerProperty(prop_publish_query);
+	registerProperty(prop_adaptive);
+	registerProperty(prop_window_scale);
+	registerProperty(prop_min_window);
+	registerProperty(prop_max_window);
+	registerProperty(prop_decimation);
+	registerProperty(prop_async);
+	registerProperty(prop_verify);
+	registerProperty(prop_incremental);
+	registerProperty(prop_change_threshold);
+	registerProperty(prop_tile_size);
+	registerProperty(m_stats.prop_statistics);
+	registerProperty(m_stats.prop_statistics_period);
+	registerProperty(m_stats.prop_trace_file);
+	registerProperty(m_stats.prop_allocations);
+	registerProperty(m_stats.prop_frame_sync);
+	m_async_stats = m_stats.add("async");
+	m_verify_stats = m_stats.add("verify");
 }
 
 DepthNormalEstimator::~DepthNormalEstimator() {
@@ -29,20 +72,32 @@ DepthNormalEstimator::~DepthNormalEstimator() {
 }
 
 void DepthNormalEstimator::prepareInterface() {
-	h_onNewImage.setup(this, &DepthNormalEstimator::onNewImage);
-
 	registerStream("in_depth", &in_img);
 	registerStream("out_img", &out_img);
 	registerStream("out_normals", &out_normals);
+	registerStream("in_frame_info", &m_stats.in_frame_info);
+	registerStream("out_frame_info", &m_stats.out_frame_info);
 
-	registerHandler("onNewImage", &h_onNewImage);
+	registerHandler("onNewImage", m_stats.wrap("onNewImage", boost::bind(&DepthNormalEstimator::onNewImage, this)));
 	addDependency("onNewImage", &in_img);
 
+	registerStream("in_depth_cloud", &in_depth_cloud);
+	registerHandler("onNewCloud", m_stats.wrap("onNewCloud", boost::bind(&DepthNormalEstimator::onNewCloud, this)));
+	addDependency("onNewCloud", &in_depth_cloud);
+
+	registerStream("in_edges", &in_edges);
+
+	registerStream("in_query", &in_query);
+	registerStream("out_query_normals", &out_query_normals);
+	registerStream("out_query", &out_query);
+	registerHandler("onQuery", m_stats.wrap("onQuery", boost::bind(&DepthNormalEstimator::onQuery, this), false));
+	addDependency("onQuery", &in_query);
+
 }
 
 bool DepthNormalEstimator::onInit() {
 	LOG(LTRACE)<< "DepthNormalEstimator::initialize\n";
-
+	m_stats.init(boost::bind(&DepthNormalEstimator::addDependency, this, _1, _2));
 	return true;
 }
 
@@ -58,124 +113,257 @@ bool DepthNormalEstimator::onStep() {
 }
 
 bool DepthNormalEstimator::onStop() {
+	if (m_async.running()) {
+		m_async.stop();
+		m_async.flush();
+		LOG(LINFO) << "Async worker dropped " << m_async.dropped() << " frames";
+	}
 	return true;
 }
 
 bool DepthNormalEstimator::onStart() {
+	if (prop_async)
+		m_async.start(m_async_stats, m_stats.tracker());
 	return true;
 }
 
-static void accumBilateral(long delta, long i, long j, long * A, long * b,
-		int threshold) {
-	long f = std::abs(delta) < threshold ? 1 : 0;
+/// Distance of sampled neighbours.
+static const int l_r = Types::DEPTH_NORMAL_SPACING;
+
+/// Evaluates normals of depth at given pixels, bound into Types::NormalQuery.
+static void queryNormals(const cv::Mat & depth, const cv::Mat & edge_sum, double focal, int difference_threshold,
+		const std::vector<cv::Point> & pixels, std::vector<cv::Point3f> & normals) {
+	normals.resize(pixels.size());
+	for (size_t k = 0; k < pixels.size(); ++k) {
+		const cv::Point & p = pixels[k];
+		if (p.y < l_r || p.x < l_r || p.y >= depth.rows - l_r - 1 || p.x >= depth.cols - l_r - 1
+				|| (!edge_sum.empty() && Types::windowHasEdge(edge_sum, p.y, p.x, l_r)))
+			normals[k] = cv::Point3f(-1, -1, -1);
+		else
+			normals[k] = Types::depthNormalAt(depth, p.x, p.y, focal, difference_threshold);
+	}
+}
 
-	const long fi = f * i;
-	const long fj = f * j;
+void DepthNormalEstimator::onNewImage() {
+	process(in_img.read(), 530);
+}
 
-	A[0] += fi * i;
-	A[1] += fi * j;
-	A[3] += fj * j;
-	b[0] += fi * delta;
-	b[1] += fj * delta;
+void DepthNormalEstimator::onNewCloud() {
+	// lazy cloud carries raw depth together with real intrinsics
+	Types::DepthCloud cloud = in_depth_cloud.read();
+	process(cloud.depth(), cloud.focal());
 }
 
-void DepthNormalEstimator::onNewImage() {
-	img = in_img.read();
-	cv::Mat tmp = cv::Mat::zeros(img.size(), CV_8U);
-	out = cv::Mat::zeros(img.size(), CV_8UC3);
-	normals = cv::Mat::zeros(img.size(), CV_32FC3);
-
-	long distance_threshold = 2000;
-	int difference_threshold = prop_difference_threshold;
-
-	IplImage src_ipl = img;
-	IplImage* ap_depth_data = &src_ipl;
-	IplImage dst_ipl = tmp;
-	IplImage* dst_ipl_ptr = &dst_ipl;
-
-	unsigned short * lp_depth = (unsigned short *) ap_depth_data->imageData;
-
-	const int l_W = ap_depth_data->width;
-	const int l_H = ap_depth_data->height;
-
-	const int l_r = 5; // used to be 7
-	const int l_offset0 = -l_r - l_r * l_W;
-	const int l_offset1 = 0 - l_r * l_W;
-	const int l_offset2 = +l_r - l_r * l_W;
-	const int l_offset3 = -l_r;
-	const int l_offset4 = +l_r;
-	const int l_offset5 = -l_r + l_r * l_W;
-	const int l_offset6 = 0 + l_r * l_W;
-	const int l_offset7 = +l_r + l_r * l_W;
-
-	for (int l_y = l_r; l_y < l_H - l_r - 1; ++l_y) {
-		unsigned short * lp_line = lp_depth + (l_y * l_W + l_r);
-
-		for (int l_x = l_r; l_x < l_W - l_r - 1; ++l_x) {
-			long l_d = lp_line[0];
-
-			if (l_d < distance_threshold) {
-				// accum
-				long l_A[4];
-				l_A[0] = l_A[1] = l_A[2] = l_A[3] = 0;
-				long l_b[2];
-				l_b[0] = l_b[1] = 0;
-				accumBilateral(lp_line[l_offset0] - l_d, -l_r, -l_r, l_A, l_b,
-						difference_threshold);
-				accumBilateral(lp_line[l_offset1] - l_d, 0, -l_r, l_A, l_b,
-						difference_threshold);
-				accumBilateral(lp_line[l_offset2] - l_d, +l_r, -l_r, l_A, l_b,
-						difference_threshold);
-				accumBilateral(lp_line[l_offset3] - l_d, -l_r, 0, l_A, l_b,
-						difference_threshold);
-				accumBilateral(lp_line[l_offset4] - l_d, +l_r, 0, l_A, l_b,
-						difference_threshold);
-				accumBilateral(lp_line[l_offset5] - l_d, -l_r, +l_r, l_A, l_b,
-						difference_threshold);
-				accumBilateral(lp_line[l_offset6] - l_d, 0, +l_r, l_A, l_b,
-						difference_threshold);
-				accumBilateral(lp_line[l_offset7] - l_d, +l_r, +l_r, l_A, l_b,
-						difference_threshold);
-
-				// solve
-				long l_det = l_A[0] * l_A[3] - l_A[1] * l_A[1];
-				long l_ddx = l_A[3] * l_b[0] - l_A[1] * l_b[1];
-				long l_ddy = -l_A[1] * l_b[0] + l_A[0] * l_b[1];
-
-				/// @todo Magic number 1150 is focal length? This is something like
-				/// f in SXGA mode, but in VGA is more like 530.
-				float l_nx = static_cast<float>(530 * l_ddx);
-				float l_ny = static_cast<float>(530 * l_ddy);
-				float l_nz = static_cast<float>(-l_det * l_d);
-
-				float l_sqrt = sqrt(l_nx * l_nx + l_ny * l_ny + l_nz * l_nz);
-
-				if (l_sqrt > 0) {
-					float l_norminv = 1.0f / (l_sqrt);
-
-					l_nx *= l_norminv;
-					l_ny *= l_norminv;
-					l_nz *= l_norminv;
-
-					normals.at<cv::Point3f>(l_y, l_x) = cv::Point3f(-l_nx,
-							-l_ny, -l_nz);
-
-				} else {
-					normals.at<cv::Point3f>(l_y, l_x) = cv::Point3f(-1, -1, -1);
-				}
-			} else {
-				normals.at<cv::Point3f>(l_y, l_x) = cv::Point3f(-1, -1, -1);
-			}
-			++lp_line;
-		}
+void DepthNormalEstimator::process(const cv::Mat & depth, double focal) {
+	cv::Mat edges, edge_sum;
+	readEdges(depth.size(), edges, edge_sum);
+
+	// own copy only if it outlives the handler, as input buffers are reused
+	// with next frames; shared (read only) by query callback and worker
+	bool query = prop_publish_query || m_queried;
+	cv::Mat copy = query || (prop_dense && m_async.running()) ? depth.clone() : depth;
+
+	// frame info goes with the dense map if there is one
+	if (!prop_dense)
+		m_stats.publish();
+
+	// queries are always served at full resolution
+	if (query)
+		publishQuery(copy, edge_sum, focal);
+
+	if (prop_dense) {
+		if (m_async.running())
+			edges = edges.clone();
+		m_async.execute(boost::bind(&DepthNormalEstimator::dense, this, copy, edges, edge_sum, focal, params(),
+				m_stats.frame()));
 	}
-	//cvSmooth(m_dep[0], m_dep[0], CV_MEDIAN, 5, 5);
+}
+
+DepthNormalEstimator::Params DepthNormalEstimator::params() const {
+	Params params;
+	params.difference_threshold = prop_difference_threshold;
+	params.adaptive = prop_adaptive;
+	params.window_scale = prop_window_scale;
+	params.min_window = std::max(1, (int) prop_min_window);
+	params.max_window = std::max(1, (int) prop_max_window);
+	params.decimation = prop_decimation;
+	params.verify = prop_verify;
+	params.incremental = prop_incremental;
+	params.change_threshold = prop_change_threshold;
+	params.tile_size = std::max((int) prop_tile_size, 8);
+	return params;
+}
+
+void DepthNormalEstimator::dense(cv::Mat depth, cv::Mat edges, cv::Mat edge_sum, double focal, Params params,
+		Types::FrameInfo info) {
+	m_info = info;
+	m_params = params;
+	img = depth;
+	m_edge_sum = edge_sum;
+	m_edges = edges;
+	// focal length in pixels shrinks together with the image, while depth
+	// difference between neighbours n times further apart grows n times
+	int n = decimate(edges);
+	int difference_threshold = m_params.difference_threshold * n;
+	estimate(focal / n, difference_threshold);
+
+	m_async.complete(boost::bind(&DepthNormalEstimator::write, this, out.clone(), normals.clone(), m_info));
+	// reference has focal length of Kinect in VGA mode built in
+	if (m_params.verify && !m_params.adaptive && focal / n == 530)
+		verify(difference_threshold);
+}
+
+void DepthNormalEstimator::write(cv::Mat out, cv::Mat normals, Types::FrameInfo info) {
+	m_stats.publish(info);
+	out_img.write(out);
+	out_normals.write(normals);
+}
+
+void DepthNormalEstimator::verify(int difference_threshold) {
+	Common::Timer timer;
+	timer.restart();
+
+	cv::Mat ref = Types::Reference::depthNormals(img, difference_threshold);
+
+	// windows straddling edges are skipped by estimator only
+	if (!m_edge_sum.empty())
+		for (int i = l_r; i < img.rows - l_r - 1; ++i)
+			for (int j = l_r; j < img.cols - l_r - 1; ++j)
+				if (Types::windowHasEdge(m_edge_sum, i, j, l_r))
+					ref.at<cv::Point3f>(i, j) = cv::Point3f(-1, -1, -1);
+
+	boost::int64_t ulp = Types::Reference::maxUlp(normals, ref);
+
+	m_verify_stats->call(timer.elapsed());
+	if (ulp > Types::Reference::NORMAL_ULP) {
+		LOG(LERROR) << "Normals differ from reference by " << ulp << " ULP";
+		m_verify_stats->skip();
+	}
+}
+
+void DepthNormalEstimator::publishQuery(const cv::Mat & depth, const cv::Mat & edge_sum, double focal) {
+	m_query = boost::bind(&queryNormals, depth, edge_sum, focal, (int) prop_difference_threshold, _1, _2);
+	m_query_size = depth.size();
+	if (prop_publish_query)
+		out_query.write(m_query);
+}
+
+void DepthNormalEstimator::onQuery() {
+	cv::Mat query = in_query.read();
+	// frames are kept for queries from now on
+	m_queried = true;
+	if (m_query.empty()) {
+		LOG(LWARNING) << "No frame to query yet";
+		m_stats.skip();
+		return;
+	}
+
+	std::vector<cv::Point> pixels;
+	if (!Types::queryPixels(query, m_query_size, pixels)) {
+		LOG(LERROR) << "Wrong query, CV_32SC2 list or CV_8UC1 mask expected";
+		m_stats.skip();
+		return;
+	}
+
+	std::vector<cv::Point3f> result;
+	m_query(pixels, result);
+	out_query_normals.write(Types::queryResult(result));
+}
+
+bool DepthNormalEstimator::readEdges(cv::Size size, cv::Mat & edges, cv::Mat & edge_sum) {
+	if (in_edges.empty())
+		return false;
+
+	cv::Mat mask = in_edges.read();
+	if (mask.size() != size || mask.type() != CV_8UC1) {
+		LOG(LWARNING) << "Edge mask doesn't match input, ignoring it";
+		return false;
+	}
+	edges = mask;
+	Types::edgeIntegral(edges, Types::EDGE_DISCONTINUITY, edge_sum);
+	return true;
+}
+
+int DepthNormalEstimator::decimate(const cv::Mat & edges) {
+	int n = m_params.decimation;
+	if (n != 2 && n != 4) {
+		if (n != 1)
+			LOG(LWARNING) << "Decimation " << n << " not supported, using 1";
+		return 1;
+	}
+
+	img = Types::decimate(img, n);
+	if (!edges.empty()) {
+		// never written in place, full resolution sum is shared with queries
+		m_edge_sum.release();
+		m_edges = Types::decimateOr(edges, n);
+		Types::edgeIntegral(m_edges, Types::EDGE_DISCONTINUITY, m_edge_sum);
+	}
+	return n;
+}
+
+void DepthNormalEstimator::estimateAdaptive(double focal, int difference_threshold) {
+	out = cv::Mat::zeros(img.size(), CV_8UC3);
+	Types::estimateDepthNormalsAdaptive(img, m_edge_sum, focal, difference_threshold, m_params.window_scale,
+			m_params.min_window, m_params.max_window, normals);
+
 	cv::convertScaleAbs(normals, out, 128, 128);
 	cv::cvtColor(out, out, CV_RGB2BGR);
+}
 
-	out_img.write(out.clone());
+void DepthNormalEstimator::estimateIncremental(double focal, int difference_threshold) {
+	if (focal != m_tiles_focal || difference_threshold != m_tiles_threshold) {
+		m_tiles.reset();
+		m_tiles_focal = focal;
+		m_tiles_threshold = difference_threshold;
+	}
+	m_tiles.update(img, m_edges, m_params.change_threshold, m_params.tile_size);
+
+	// from now on everything is computed from state, so that verification
+	// compares results with reference of the same input
+	img = m_tiles.state();
+	if (m_tiles.full())
+		normals = cv::Mat::zeros(img.size(), CV_32FC3);
+
+	if (m_tiles.changed() > 0) {
+		// private buffer, queries use integral of the current edges
+		if (!m_tiles.edges().empty())
+			Types::edgeIntegral(m_tiles.edges(), Types::EDGE_DISCONTINUITY, m_tiles_edge_sum);
+		else
+			m_tiles_edge_sum.release();
+
+		// normal depends on pixels l_r away in every direction
+		m_tiles.mask(l_r, l_r, m_dirty);
+		Types::updateDepthNormals(img, m_tiles_edge_sum, m_dirty, focal, difference_threshold, normals);
+
+		cv::convertScaleAbs(normals, out, 128, 128);
+		cv::cvtColor(out, out, CV_RGB2BGR);
+	}
+	m_edge_sum = m_tiles_edge_sum;
+
+	LOG(LDEBUG) << m_tiles.changed() << " of " << m_tiles.tiles() << " tiles changed";
+}
 
-	out_normals.write(normals.clone());
+void DepthNormalEstimator::estimate(double focal, int difference_threshold) {
+	if (m_params.incremental && !m_params.adaptive) {
+		estimateIncremental(focal, difference_threshold);
+		return;
+	}
+	// normals don't match state any more
+	m_tiles.reset();
+
+	if (m_params.adaptive) {
+		estimateAdaptive(focal, difference_threshold);
+		return;
+	}
+
+	out = cv::Mat::zeros(img.size(), CV_8UC3);
+
+	// windows straddling depth discontinuities are skipped
+	Types::estimateDepthNormals(img, m_edge_sum, focal, difference_threshold, normals);
+	//cvSmooth(m_dep[0], m_dep[0], CV_MEDIAN, 5, 5);
+	cv::convertScaleAbs(normals, out, 128, 128);
+	cv::cvtColor(out, out, CV_RGB2BGR);
 }
 
 } //: namespace DepthNormalEstimator
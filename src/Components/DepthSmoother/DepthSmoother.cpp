@@ -0,0 +1,254 @@
+/*!
+ * \file
+ * \brief
+ */
+
+#include <memory>
+#include <string>
+#include <cmath>
+#include <algorithm>
+
+#include "DepthSmoother.hpp"
+#include "Common/Logger.hpp"
+#include "Types/PointValidity.hpp"
+
+#include <boost/bind.hpp>
+
+namespace Processors {
+namespace DepthSmoother {
+
+/// Domain distance put between invalid and any other point, makes its weight 0.
+static const float NO_LINK = 1e6f;
+
+/*!
+ * Recursive filter along rows, both directions. W holds weights linking
+ * pixel with its left neighbour.
+ */
+class HorizontalBody: public cv::ParallelLoopBody {
+public:
+	HorizontalBody(cv::Mat & z, const cv::Mat & w) :
+		z(z), w(w) {
+	}
+
+	void operator()(const cv::Range & r) const {
+		for (int i = r.start; i < r.end; ++i) {
+			float * zp = z.ptr<float>(i);
+			const float * wp = w.ptr<float>(i);
+			for (int j = 1; j < z.cols; ++j)
+				zp[j] += wp[j] * (zp[j - 1] - zp[j]);
+			for (int j = z.cols - 2; j >= 0; --j)
+				zp[j] += wp[j + 1] * (zp[j + 1] - zp[j]);
+		}
+	}
+
+private:
+	cv::Mat & z;
+	const cv::Mat & w;
+};
+
+/*!
+ * Recursive filter along columns, both directions. Processes blocks of
+ * columns, so that inner loop runs along a row and is vectorized.
+ * W holds weights linking pixel with its upper neighbour.
+ */
+class VerticalBody: public cv::ParallelLoopBody {
+public:
+	static const int BLOCK = 64;
+
+	VerticalBody(cv::Mat & z, const cv::Mat & w) :
+		z(z), w(w) {
+	}
+
+	void operator()(const cv::Range & r) const {
+		int c0 = r.start * BLOCK;
+		int c1 = std::min(r.end * BLOCK, z.cols);
+		for (int i = 1; i < z.rows; ++i) {
+			float * zc = z.ptr<float>(i);
+			const float * zp = z.ptr<float>(i - 1);
+			const float * wp = w.ptr<float>(i);
+			for (int j = c0; j < c1; ++j)
+				zc[j] += wp[j] * (zp[j] - zc[j]);
+		}
+		for (int i = z.rows - 2; i >= 0; --i) {
+			float * zc = z.ptr<float>(i);
+			const float * zn = z.ptr<float>(i + 1);
+			const float * wp = w.ptr<float>(i + 1);
+			for (int j = c0; j < c1; ++j)
+				zc[j] += wp[j] * (zn[j] - zc[j]);
+		}
+	}
+
+private:
+	cv::Mat & z;
+	const cv::Mat & w;
+};
+
+DepthSmoother::DepthSmoother(const std::string & name) :
+		Base::Component(name),
+		prop_sigma_s("sigma_s", 10.0f),
+		prop_sigma_r("sigma_r", 0.02f),
+		prop_iterations("iterations", 3),
+		prop_depth_scale("depth_scale", 0.001f),
+		m_stats(name) {
+	registerProperty(prop_sigma_s);
+	registerProperty(prop_sigma_r);
+	registerProperty(prop_iterations);
+	registerProperty(prop_depth_scale);
+	registerProperty(m_stats.prop_statistics);
+	registerProperty(m_stats.prop_statistics_period);
+	registerProperty(m_stats.prop_trace_file);
+	registerProperty(m_stats.prop_allocations);
+	registerProperty(m_stats.prop_frame_sync);
+}
+
+DepthSmoother::~DepthSmoother() {
+}
+
+void DepthSmoother::prepareInterface() {
+	// Register data streams, events and event handlers HERE!
+	registerStream("in_xyz", &in_xyz);
+	registerStream("in_depth", &in_depth);
+	registerStream("out_xyz", &out_xyz);
+	registerStream("out_depth", &out_depth);
+	registerStream("in_frame_info", &m_stats.in_frame_info);
+	registerStream("out_frame_info", &m_stats.out_frame_info);
+
+	// Register handlers
+	registerHandler("onNewCloud", m_stats.wrap("onNewCloud", boost::bind(&DepthSmoother::onNewCloud, this)));
+	addDependency("onNewCloud", &in_xyz);
+
+	registerHandler("onNewDepth", m_stats.wrap("onNewDepth", boost::bind(&DepthSmoother::onNewDepth, this)));
+	addDependency("onNewDepth", &in_depth);
+}
+
+bool DepthSmoother::onInit() {
+	m_stats.init(boost::bind(&DepthSmoother::addDependency, this, _1, _2));
+	return true;
+}
+
+bool DepthSmoother::onFinish() {
+	return true;
+}
+
+bool DepthSmoother::onStop() {
+	return true;
+}
+
+bool DepthSmoother::onStart() {
+	return true;
+}
+
+void DepthSmoother::filter() {
+	int rows = m_z.rows;
+	int cols = m_z.cols;
+	float ratio = prop_sigma_s / prop_sigma_r;
+
+	// domain transform derivatives, computed once from input depth
+	m_dt_h.create(m_z.size(), CV_32FC1);
+	m_dt_v.create(m_z.size(), CV_32FC1);
+	for (int i = 0; i < rows; ++i) {
+		const float * z = m_z.ptr<float>(i);
+		const float * zp = m_z.ptr<float>(i > 0 ? i - 1 : 0);
+		const uchar * v = m_valid.ptr<uchar>(i);
+		const uchar * vp = m_valid.ptr<uchar>(i > 0 ? i - 1 : 0);
+		float * dh = m_dt_h.ptr<float>(i);
+		float * dv = m_dt_v.ptr<float>(i);
+		dh[0] = NO_LINK;
+		for (int j = 1; j < cols; ++j)
+			dh[j] = (v[j] && v[j - 1]) ? 1 + ratio * std::fabs(z[j] - z[j - 1]) : NO_LINK;
+		for (int j = 0; j < cols; ++j)
+			dv[j] = (i > 0 && v[j] && vp[j]) ? 1 + ratio * std::fabs(z[j] - zp[j]) : NO_LINK;
+	}
+
+	int n = prop_iterations;
+	cv::Mat w_h, w_v;
+	for (int k = 0; k < n; ++k) {
+		// sigma of k-th iteration, so that total variance matches sigma_s
+		double sigma = prop_sigma_s * std::sqrt(3.0) * std::pow(2.0, n - k - 1) / std::sqrt(std::pow(4.0, n) - 1);
+		double ln_a = -std::sqrt(2.0) / sigma;
+
+		m_dt_h.convertTo(w_h, CV_32F, ln_a);
+		cv::exp(w_h, w_h);
+		m_dt_v.convertTo(w_v, CV_32F, ln_a);
+		cv::exp(w_v, w_v);
+
+		cv::parallel_for_(cv::Range(0, rows), HorizontalBody(m_z, w_h));
+		cv::parallel_for_(cv::Range(0, (cols + VerticalBody::BLOCK - 1) / VerticalBody::BLOCK), VerticalBody(m_z, w_v));
+	}
+}
+
+void DepthSmoother::onNewCloud() {
+	cv::Mat img = in_xyz.read();
+	if (img.type() != CV_32FC3) {
+		CLOG(LERROR) << "Wrong cloud type, CV_32FC3 expected";
+		m_stats.skip();
+		return;
+	}
+
+	m_z.create(img.size(), CV_32FC1);
+	m_valid.create(img.size(), CV_8UC1);
+	for (int i = 0; i < img.rows; ++i) {
+		const cv::Point3f * p = img.ptr<cv::Point3f>(i);
+		float * z = m_z.ptr<float>(i);
+		uchar * v = m_valid.ptr<uchar>(i);
+		for (int j = 0; j < img.cols; ++j) {
+			v[j] = (p[j].z > 0 && p[j].z < Types::POINT_MAX_RANGE) ? 255 : 0;
+			z[j] = v[j] ? p[j].z : 0;
+		}
+	}
+
+	filter();
+
+	// move points along their viewing rays
+	cv::Mat out(img.size(), CV_32FC3);
+	for (int i = 0; i < img.rows; ++i) {
+		const cv::Point3f * p = img.ptr<cv::Point3f>(i);
+		const float * z = m_z.ptr<float>(i);
+		const uchar * v = m_valid.ptr<uchar>(i);
+		cv::Point3f * o = out.ptr<cv::Point3f>(i);
+		for (int j = 0; j < img.cols; ++j)
+			o[j] = v[j] ? p[j] * (z[j] / p[j].z) : p[j];
+	}
+
+	m_stats.publish();
+	out_xyz.write(out);
+}
+
+void DepthSmoother::onNewDepth() {
+	cv::Mat depth = in_depth.read();
+	if (depth.type() != CV_16UC1) {
+		CLOG(LERROR) << "Wrong depth type, CV_16UC1 expected";
+		m_stats.skip();
+		return;
+	}
+
+	float scale = prop_depth_scale;
+	m_z.create(depth.size(), CV_32FC1);
+	m_valid.create(depth.size(), CV_8UC1);
+	for (int i = 0; i < depth.rows; ++i) {
+		const unsigned short * d = depth.ptr<unsigned short>(i);
+		float * z = m_z.ptr<float>(i);
+		uchar * v = m_valid.ptr<uchar>(i);
+		for (int j = 0; j < depth.cols; ++j) {
+			z[j] = d[j] * scale;
+			v[j] = d[j] ? 255 : 0;
+		}
+	}
+
+	filter();
+
+	cv::Mat out(depth.size(), CV_16UC1);
+	for (int i = 0; i < depth.rows; ++i) {
+		const float * z = m_z.ptr<float>(i);
+		const uchar * v = m_valid.ptr<uchar>(i);
+		unsigned short * o = out.ptr<unsigned short>(i);
+		for (int j = 0; j < depth.cols; ++j)
+			o[j] = v[j] ? cv::saturate_cast<unsigned short>(z[j] / scale) : 0;
+	}
+
+	m_stats.publish();
+	out_depth.write(out);
+}
+
+} //: namespace DepthSmoother
+} //: namespace Processors
@@ -0,0 +1,123 @@
+/*!
+ * \file
+ * \brief
+ */
+
+#ifndef DEPTHSMOOTHER_HPP_
+#define DEPTHSMOOTHER_HPP_
+
+#include "Base/Component_Aux.hpp"
+#include "Base/Component.hpp"
+#include "Base/DataStream.hpp"
+#include "Base/Property.hpp"
+#include "Base/EventHandler2.hpp"
+
+#include <opencv2/opencv.hpp>
+
+#include "Types/HandlerStatistics.hpp"
+
+namespace Processors {
+namespace DepthSmoother {
+
+/*!
+ * \class DepthSmoother
+ * \brief DepthSmoother processor class.
+ *
+ * Edge-preserving smoothing of depth with recursive domain transform filter
+ * (Gastal, Oliveira 2011). Cost per pixel does not depend on sigma_s. Depth
+ * jumps larger than a few sigma_r are not smoothed over, invalid points are
+ * never mixed with valid ones.
+ *
+ * Accepts organized cloud in camera frame (in_xyz, CV_32FC3, points are moved
+ * along their viewing rays) or raw 16-bit depth map (in_depth).
+ */
+class DepthSmoother: public Base::Component {
+public:
+	/*!
+	 * Constructor.
+	 */
+	DepthSmoother(const std::string & name = "DepthSmoother");
+
+	/*!
+	 * Destructor
+	 */
+	virtual ~DepthSmoother();
+
+	/*!
+	 * Prepare components interface (register streams and handlers).
+	 * At this point, all properties are already initialized and loaded to
+	 * values set in config file.
+	 */
+	void prepareInterface();
+
+protected:
+
+	/*!
+	 * Connects source to given device.
+	 */
+	bool onInit();
+
+	/*!
+	 * Disconnect source from device, closes streams, etc.
+	 */
+	bool onFinish();
+
+	/*!
+	 * Start component
+	 */
+	bool onStart();
+
+	/*!
+	 * Stop component
+	 */
+	bool onStop();
+
+
+	// Input data streams
+	Base::DataStreamIn<cv::Mat> in_xyz;
+	Base::DataStreamIn<cv::Mat> in_depth;
+
+	// Output data streams
+	Base::DataStreamOut<cv::Mat> out_xyz;
+	Base::DataStreamOut<cv::Mat> out_depth;
+
+	// Properties
+
+	/// Spatial extent of the filter (in pixels).
+	Base::Property<float> prop_sigma_s;
+
+	/// Depth difference (in meters) treated as an edge.
+	Base::Property<float> prop_sigma_r;
+
+	/// Number of filtering iterations (horizontal + vertical pass each).
+	Base::Property<int> prop_iterations;
+
+	/// Depth units of in_depth in meters.
+	Base::Property<float> prop_depth_scale;
+
+	/// Handler latency statistics
+	Types::ComponentStatistics m_stats;
+
+	// Handlers
+	void onNewCloud();
+	void onNewDepth();
+
+private:
+	/// Filters m_z in place, invalid points are marked by m_valid.
+	void filter();
+
+	cv::Mat m_z;
+	cv::Mat m_valid;
+	cv::Mat m_dt_h;
+	cv::Mat m_dt_v;
+};
+
+} //: namespace DepthSmoother
+} //: namespace Processors
+
+/*
+ * Register processor component.
+ */
+REGISTER_COMPONENT("DepthSmoother", Processors::DepthSmoother::DepthSmoother)
+
+#endif /* DEPTHSMOOTHER_HPP_ */
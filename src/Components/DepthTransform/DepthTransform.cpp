@@ -10,6 +10,8 @@
 #include "DepthTransform.hpp"
 #include "Common/Logger.hpp"
 #include <Types/MatrixTranslator.hpp>
+#include <Types/CloudKernels.hpp>
+#include <Types/PointValidity.hpp>
 
 #include <boost/bind.hpp>
 #include <boost/format.hpp>
@@ -22,10 +24,16 @@ using Types::HomogMatrix;
 DepthTransform::DepthTransform(const std::string & name) :
 	Base::Component(name),
 	prop_inverse("inverse", false),
-	pass_through("pass_through", false)
+	pass_through("pass_through", false),
+	m_stats(name)
 {
 	registerProperty(prop_inverse);
 	registerProperty(pass_through);
+	registerProperty(m_stats.prop_statistics);
+	registerProperty(m_stats.prop_statistics_period);
+	registerProperty(m_stats.prop_trace_file);
+	registerProperty(m_stats.prop_allocations);
+	registerProperty(m_stats.prop_frame_sync);
 }
 
 DepthTransform::~DepthTransform() {
@@ -38,16 +46,18 @@ void DepthTransform::prepareInterface() {
 	registerStream("in_homogMatrix", &in_homogMatrix);
 	registerStream("in_depth_xyz", &in_image_xyz);
 	registerStream("out_depth_xyz", &out_image_xyz);
+	registerStream("in_frame_info", &m_stats.in_frame_info);
+	registerStream("out_frame_info", &m_stats.out_frame_info);
 
 	// Register handlers
-	registerHandler("DepthTransformation", boost::bind(&DepthTransform::DepthTransformation, this));
+	registerHandler("DepthTransformation", m_stats.wrap("DepthTransformation", boost::bind(&DepthTransform::DepthTransformation, this)));
 	addDependency("DepthTransformation", &in_image_xyz);
 	addDependency("DepthTransformation", &in_homogMatrix);
 
 }
 
 bool DepthTransform::onInit() {
-
+	m_stats.init(boost::bind(&DepthTransform::addDependency, this, _1, _2));
 	return true;
 }
 
@@ -84,6 +94,7 @@ void DepthTransform::DepthTransformation() {
 	// If passthrough - return the input image.
 	if (pass_through) {
 		CLOG(LINFO) << "Passthough mode on - returning original image";
+		m_stats.publish();
 		out_image_xyz.write(img);
 		return;
 	}//: if
@@ -91,6 +102,7 @@ void DepthTransform::DepthTransformation() {
 	// check, if image has proper number of channels
 	if (img.channels() != 3) {
 		CLOG(LERROR) << "Wrong number of channels";
+		m_stats.skip();
 		return;
 	}//: if
 	
@@ -98,50 +110,53 @@ void DepthTransform::DepthTransformation() {
 	int img_type = img.depth();
 	if ( (img_type != CV_32F) && (img_type != CV_64F) ) {
 		CLOG(LERROR) << "Wrong depth";
+		m_stats.skip();
 		return;
 	}
 	
 
 	// Perform transformation of coordinates.
 	cv::Matx44d H = hm;
-	perspectiveTransform(img, out_img, H);
-
-
-	// Check size.	
-	int rows = out_img.rows;
-	int cols = out_img.cols;
-	int i,j;
 
 	if (img_type == CV_32F) {
-		// float variant
-		float* p;
-		for( i = 0; i < rows; ++i) {
-			p = out_img.ptr<float>(i);
-			for ( j = 0; j < cols; ++j) {
-				// Filter invalid numbers.
-				if ( (fabs(p[3*j ]) > MAX_RANGE) ||  (fabs(p[3*j + 1]) > MAX_RANGE) || (fabs(p[3*j + 2]) > MAX_RANGE) )
-					p[3*j] = p[3*j+1] = p[3*j+2] = INVALID_COORDINATE;
+		// float variant, transformation and range check in one pass
+		out_img.create(img.size(), img.type());
+		for (int i = 0; i < img.rows; ++i) {
+			const cv::Point3f * src = img.ptr<cv::Point3f>(i);
+			cv::Point3f * dst = out_img.ptr<cv::Point3f>(i);
+			for (int j = 0; j < img.cols; ++j) {
+				dst[j] = src[j];
+				Types::transformPoint(dst[j], H.val);
 			}//: for
 		}//: for
 	} else {
 		// double variant
+		perspectiveTransform(img, out_img, H);
+
+		// Check size.
+		int rows = out_img.rows;
+		int cols = out_img.cols;
+		int i,j;
 		double* p;
 		for( i = 0; i < rows; ++i) {
 			p = out_img.ptr<double>(i);
 			for ( j = 0; j < cols; ++j) {
 				// Filter invalid numbers.
-				if ( (fabs(p[3*j ]) > MAX_RANGE) ||  (fabs(p[3*j + 1]) > MAX_RANGE) || (fabs(p[3*j + 2]) > MAX_RANGE) )
-					p[3*j] = p[3*j+1] = p[3*j+2] = INVALID_COORDINATE;
+				if ( (fabs(p[3*j ]) > Types::POINT_MAX_RANGE) ||  (fabs(p[3*j + 1]) > Types::POINT_MAX_RANGE)
+						|| (fabs(p[3*j + 2]) > Types::POINT_MAX_RANGE) )
+					p[3*j] = p[3*j+1] = p[3*j+2] = Types::INVALID_COORDINATE;
 			}//: for
 		}//: for
 	}//: if
 
 	// Return image.
+	m_stats.publish();
 	out_image_xyz.write(out_img);
 
 	} catch (...)
 	{
 		LOG(LERROR) << "Error occured in processing input";
+		m_stats.skip();
 	}
 }
 
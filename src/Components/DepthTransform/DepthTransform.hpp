@@ -19,6 +19,7 @@
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include "Types/HomogMatrix.hpp"
+#include "Types/HandlerStatistics.hpp"
 /*#include <pcl/point_types.h>
 #include <pcl/point_cloud.h>
 #include <pcl/io/pcd_io.h>
@@ -98,16 +99,11 @@ protected:
 	/// Property - if set, no transformation is applied.
         Base::Property<bool> pass_through;
 
+	/// Handler latency statistics.
+	Types::ComponentStatistics m_stats;
+
 	// Handlers
 	void DepthTransformation();
-
-private:
-	/// Maximal range <-300,300> (in meters).
-	static const double MAX_RANGE = 300;
-
-	/// Invalid coordinate.
-	static const float INVALID_COORDINATE = 100000;
-
 };
 
 } //: namespace DepthTransform
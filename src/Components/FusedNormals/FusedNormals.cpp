@@ -0,0 +1,369 @@
+/*!
+ * \file
+ * \brief
+ */
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <limits>
+#include <sstream>
+
+#include "FusedNormals.hpp"
+#include "Common/Logger.hpp"
+#include "Common/Timer.hpp"
+
+#include <boost/bind.hpp>
+
+#include "Types/CloudKernels.hpp"
+#include "Types/FusedChain.hpp"
+#include "Types/AutoTune.hpp"
+#include "Types/ReferenceKernels.hpp"
+
+namespace Processors {
+namespace FusedNormals {
+
+/// Normal window radius (in pixels).
+static const int WINDOW = Types::NORMAL_WINDOW;
+
+/*!
+ * Unfused chain, pass over whole frame per stage, as done by PassThrough,
+ * DepthTransform (with cv::perspectiveTransform) and NormalEstimator.
+ */
+static void unfusedChain(const cv::Mat & src, const cv::Matx44d & H, bool transform, float z_min, float z_max,
+		float radius, cv::Mat & xyz, cv::Mat & mask, cv::Mat & normals, cv::Mat * out = NULL) {
+	cv::Mat img = src.clone();
+	Types::passThrough(img, z_min, z_max, mask);
+
+	if (transform) {
+		cv::perspectiveTransform(img, xyz, H);
+		for (int i = 0; i < xyz.rows; ++i) {
+			cv::Point3f * p = xyz.ptr<cv::Point3f>(i);
+			for (int j = 0; j < xyz.cols; ++j)
+				if ((std::fabs(p[j].x) > Types::POINT_MAX_RANGE) || (std::fabs(p[j].y) > Types::POINT_MAX_RANGE)
+						|| (std::fabs(p[j].z) > Types::POINT_MAX_RANGE))
+					p[j] = cv::Point3f(Types::INVALID_COORDINATE, Types::INVALID_COORDINATE, Types::INVALID_COORDINATE);
+		}
+	} else {
+		xyz = img;
+	}
+
+	Types::estimateNormals(xyz, radius, normals, out);
+}
+
+/// Synthetic frame for tuning: slanted wall with a bump, noise and invalid points, as seen by Kinect-like camera.
+static cv::Mat syntheticCloud(cv::Size size) {
+	cv::Mat cloud(size, CV_32FC3);
+	cv::RNG rng(12345);
+	double f = 525.0 * size.width / 640;
+	for (int i = 0; i < size.height; ++i) {
+		cv::Point3f * p = cloud.ptr<cv::Point3f>(i);
+		for (int j = 0; j < size.width; ++j) {
+			if (rng.uniform(0, 100) == 0) {
+				float nan = std::numeric_limits<float>::quiet_NaN();
+				p[j] = cv::Point3f(nan, nan, nan);
+				continue;
+			}
+			double dx = (j - 0.5 * size.width) / size.width;
+			double dy = (i - 0.5 * size.height) / size.width;
+			double z = 1.5 + 0.5 * j / size.width - 0.2 * std::exp(-20 * (dx * dx + dy * dy)) + rng.gaussian(0.002);
+			p[j] = cv::Point3f((j - 0.5 * size.width) * z / f, (i - 0.5 * size.height) * z / f, z);
+		}
+	}
+	return cloud;
+}
+
+/// Largest coordinate difference of two CV_32FC3 images, NaNs are equal to each other.
+static double maxDifference(const cv::Mat & a, const cv::Mat & b) {
+	double ret = 0;
+	for (int i = 0; i < a.rows; ++i) {
+		const float * pa = a.ptr<float>(i);
+		const float * pb = b.ptr<float>(i);
+		for (int j = 0; j < a.cols * 3; ++j) {
+			if (std::isnan(pa[j]) && std::isnan(pb[j]))
+				continue;
+			double d = std::fabs((double) pa[j] - pb[j]);
+			if (!(d <= ret))
+				ret = d;
+		}
+	}
+	return ret;
+}
+
+FusedNormals::FusedNormals(const std::string & name) :
+		Base::Component(name),
+		prop_z_min("z_min", 0),
+		prop_z_max("z_max", 10),
+		prop_inverse("inverse", false),
+		prop_radius("radius", 0.0075),
+		prop_benchmark("benchmark", false),
+		prop_tile_rows("tile_rows", 32),
+		prop_tile_cols("tile_cols", 128),
+		prop_threads("threads", 0),
+		prop_auto_tune("auto_tune", false),
+		prop_tuning_cache("tuning_cache", std::string()),
+		prop_verify("verify", false),
+		m_stats(name) {
+	registerProperty(prop_z_min);
+	registerProperty(prop_z_max);
+	registerProperty(prop_inverse);
+	registerProperty(prop_radius);
+	registerProperty(prop_benchmark);
+	registerProperty(prop_tile_rows);
+	registerProperty(prop_tile_cols);
+	registerProperty(prop_threads);
+	registerProperty(prop_auto_tune);
+	registerProperty(prop_tuning_cache);
+	registerProperty(prop_verify);
+	registerProperty(m_stats.prop_statistics);
+	registerProperty(m_stats.prop_statistics_period);
+	registerProperty(m_stats.prop_trace_file);
+	registerProperty(m_stats.prop_allocations);
+	registerProperty(m_stats.prop_frame_sync);
+	m_verify_stats = m_stats.add("verify");
+}
+
+FusedNormals::~FusedNormals() {
+}
+
+void FusedNormals::prepareInterface() {
+	// Register data streams, events and event handlers HERE!
+	registerStream("in_xyz", &in_xyz);
+	registerStream("in_homogMatrix", &in_homogMatrix);
+	registerStream("out_xyz", &out_xyz);
+	registerStream("out_mask", &out_mask);
+	registerStream("out_normals", &out_normals);
+	registerStream("out_img", &out_img);
+	registerStream("in_frame_info", &m_stats.in_frame_info);
+	registerStream("out_frame_info", &m_stats.out_frame_info);
+
+	// Register handlers
+	registerHandler("onNewImage", m_stats.wrap("onNewImage", boost::bind(&FusedNormals::onNewImage, this)));
+	addDependency("onNewImage", &in_xyz);
+}
+
+bool FusedNormals::onInit() {
+	m_stats.init(boost::bind(&FusedNormals::addDependency, this, _1, _2));
+	return true;
+}
+
+bool FusedNormals::onFinish() {
+	return true;
+}
+
+bool FusedNormals::onStop() {
+	return true;
+}
+
+bool FusedNormals::onStart() {
+	m_settings.fused = true;
+	m_settings.tile_rows = std::max(1, (int) prop_tile_rows);
+	m_settings.tile_cols = std::max(1, (int) prop_tile_cols);
+	m_settings.threads = std::max(0, (int) prop_threads);
+	m_tuned_size = cv::Size();
+	return true;
+}
+
+void FusedNormals::onNewImage() {
+	cv::Mat img = in_xyz.read();
+	if (img.type() != CV_32FC3) {
+		CLOG(LERROR) << "Wrong cloud type, CV_32FC3 expected";
+		m_stats.skip();
+		return;
+	}
+
+	bool transform = !in_homogMatrix.empty();
+	cv::Matx44d H = cv::Matx44d::eye();
+	if (transform) {
+		Types::HomogMatrix hm = in_homogMatrix.read();
+		if (prop_inverse)
+			hm.matrix() = hm.matrix().inverse();
+		H = hm;
+	}
+
+	if (prop_auto_tune && img.size() != m_tuned_size)
+		tune(img.size());
+
+	cv::Mat xyz, mask, normals, out;
+	run(m_settings, img, H, transform, xyz, mask, normals, out);
+
+	m_stats.publish();
+	out_xyz.write(xyz);
+	out_mask.write(mask);
+	out_normals.write(normals);
+	out_img.write(out);
+
+	if (prop_benchmark)
+		benchmark(img, H, transform);
+
+	if (prop_verify)
+		verify(img, H, transform, xyz, mask, normals);
+}
+
+void FusedNormals::run(const Settings & settings, const cv::Mat & img, const cv::Matx44d & H, bool transform,
+		cv::Mat & xyz, cv::Mat & mask, cv::Mat & normals, cv::Mat & out) {
+	if (!settings.fused) {
+		unfusedChain(img, H, transform, prop_z_min, prop_z_max, prop_radius, xyz, mask, normals, &out);
+		return;
+	}
+
+	Types::fusedChain(img, H, transform, prop_z_min, prop_z_max, prop_radius, settings.tile_rows, settings.tile_cols,
+			settings.threads, xyz, mask, normals, out);
+}
+
+std::string FusedNormals::describe(const Settings & settings) {
+	std::ostringstream ss;
+	if (settings.fused)
+		ss << "fused, tile " << settings.tile_rows << "x" << settings.tile_cols << ", threads "
+				<< (settings.threads > 0 ? settings.threads : cv::getNumThreads());
+	else
+		ss << "unfused";
+	return ss.str();
+}
+
+double FusedNormals::trial(const Settings & settings, const cv::Mat & frame) {
+	cv::Mat xyz, mask, normals, out;
+	return Types::measure(boost::bind(&FusedNormals::run, this, settings, boost::cref(frame), cv::Matx44d::eye(), true,
+			boost::ref(xyz), boost::ref(mask), boost::ref(normals), boost::ref(out)));
+}
+
+void FusedNormals::tune(cv::Size size) {
+	std::ostringstream key;
+	key << "FusedNormals " << size.width << "x" << size.height << " " << Types::cpuModel();
+	Types::TuningCache cache(prop_tuning_cache);
+
+	std::vector<int> values;
+	if (cache.load(key.str(), values) && values.size() == 4) {
+		m_settings.fused = values[0] != 0;
+		m_settings.tile_rows = std::max(1, values[1]);
+		m_settings.tile_cols = std::max(1, values[2]);
+		m_settings.threads = std::max(0, values[3]);
+		m_tuned_size = size;
+		CLOG(LINFO) << "Tuned settings from " << cache.path() << ": " << describe(m_settings);
+		return;
+	}
+
+	// trials run before this frame is processed, so they don't share thread pool with it
+	CLOG(LINFO) << "Tuning settings for " << size.width << "x" << size.height;
+	m_settings = search(size, m_settings);
+	m_tuned_size = size;
+
+	values.clear();
+	values.push_back(m_settings.fused);
+	values.push_back(m_settings.tile_rows);
+	values.push_back(m_settings.tile_cols);
+	values.push_back(m_settings.threads);
+	if (!cache.store(key.str(), values))
+		CLOG(LWARNING) << "Can't write tuning cache " << cache.path();
+}
+
+FusedNormals::Settings FusedNormals::search(cv::Size size, const Settings & current) {
+	Common::Timer timer;
+	timer.restart();
+	cv::Mat frame = syntheticCloud(size);
+
+	// tile size first, with all threads, then thread count for the best tile
+	static const int TILE_SIZES[][2] = { { 16, 64 }, { 32, 128 }, { 32, 256 }, { 64, 128 }, { 64, 256 }, { 16, 0 } };
+	Settings best = current;
+	best.fused = true;
+	best.threads = 0;
+	double best_time = trial(best, frame);
+	for (size_t i = 0; i < sizeof(TILE_SIZES) / sizeof(TILE_SIZES[0]); ++i) {
+		Settings s = best;
+		s.tile_rows = TILE_SIZES[i][0];
+		// zero width means rows of whole frame
+		s.tile_cols = TILE_SIZES[i][1] ? TILE_SIZES[i][1] : size.width;
+		double t = trial(s, frame);
+		if (t < best_time) {
+			best = s;
+			best_time = t;
+		}
+	}
+
+	int max_threads = std::max(1, cv::getNumThreads());
+	for (int threads = 1; threads < max_threads; threads *= 2) {
+		Settings s = best;
+		s.threads = threads;
+		double t = trial(s, frame);
+		if (t < best_time) {
+			best = s;
+			best_time = t;
+		}
+	}
+
+	Settings unfused = best;
+	unfused.fused = false;
+	if (trial(unfused, frame) < best_time)
+		best = unfused;
+
+	CLOG(LNOTICE) << "Tuned in " << timer.elapsed() << " s: " << describe(best);
+	return best;
+}
+
+void FusedNormals::benchmark(const cv::Mat & img, const cv::Matx44d & H, bool transform) {
+	Settings fused = m_settings;
+	fused.fused = true;
+	Settings unfused = m_settings;
+	unfused.fused = false;
+
+	cv::Mat xyz, mask, normals, out;
+	Common::Timer timer;
+	timer.restart();
+	run(fused, img, H, transform, xyz, mask, normals, out);
+	double fused_time = timer.elapsed();
+
+	cv::Mat ref_xyz, ref_mask, ref_normals, ref_out;
+	timer.restart();
+	run(unfused, img, H, transform, ref_xyz, ref_mask, ref_normals, ref_out);
+	double unfused_time = timer.elapsed();
+
+	// bytes streamed through memory per pixel (cloud 12, mask 1, image 3):
+	// PassThrough clones and filters cloud (4 x 12) and writes mask,
+	// DepthTransform transforms and range checks it (4 x 12), NormalEstimator
+	// reads it and writes derivatives (12 + 24), reads all three again in
+	// window pass (36) and writes normals and image (12 + 3)
+	double pixels = img.total();
+	double unfused_bytes = pixels * (48 + 1 + 48 + 36 + 36 + 15);
+
+	// fused chain reads tiles with halos and writes cloud, mask, normals and image once
+	double halo_pixels = 0;
+	for (int t = 0; t < Types::ChainTile::count(img.size(), fused.tile_rows, fused.tile_cols); ++t) {
+		Types::ChainTile tile(img.size(), t, fused.tile_rows, fused.tile_cols);
+		halo_pixels += (tile.hr1 - tile.hr0) * (tile.hc1 - tile.hc0);
+	}
+	double fused_bytes = halo_pixels * 12 + pixels * (12 + 1 + 12 + 3);
+
+	CLOG(LNOTICE) << "fused " << fused_time * 1000 << " ms, ~" << fused_bytes / (1 << 20) << " MB; unfused "
+			<< unfused_time * 1000 << " ms, ~" << unfused_bytes / (1 << 20) << " MB; max difference: xyz "
+			<< maxDifference(xyz, ref_xyz) << ", mask " << cv::norm(mask, ref_mask, cv::NORM_INF) << ", normals "
+			<< maxDifference(normals, ref_normals);
+}
+
+void FusedNormals::verify(const cv::Mat & img, const cv::Matx44d & H, bool transform, const cv::Mat & xyz,
+		const cv::Mat & mask, const cv::Mat & normals) {
+	Common::Timer timer;
+	timer.restart();
+
+	cv::Mat ref_mask;
+	cv::Mat ref_xyz = Types::Reference::passThrough(img, prop_z_min, prop_z_max, ref_mask);
+	if (transform)
+		ref_xyz = Types::Reference::depthTransformation(ref_xyz, H);
+	cv::Mat ref_normals = Types::Reference::normals(ref_xyz, prop_radius, WINDOW);
+
+	boost::int64_t xyz_ulp = Types::Reference::maxUlp(xyz, ref_xyz);
+	boost::int64_t normals_ulp = Types::Reference::maxUlp(normals, ref_normals);
+	bool same_mask = cv::norm(mask, ref_mask, cv::NORM_INF) == 0;
+
+	m_verify_stats->call(timer.elapsed());
+	if (xyz_ulp > Types::Reference::POINT_ULP || normals_ulp > Types::Reference::NORMAL_ULP || !same_mask) {
+		CLOG(LERROR) << "Outputs differ from reference: xyz by " << xyz_ulp << " ULP, normals by " << normals_ulp
+				<< " ULP, mask " << (same_mask ? "same" : "differs");
+		m_verify_stats->skip();
+	}
+}
+
+} //: namespace FusedNormals
+} //: namespace Processors
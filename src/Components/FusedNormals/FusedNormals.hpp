@@ -0,0 +1,185 @@
+/*!
+ * \file
+ * \brief
+ */
+
+#ifndef FUSEDNORMALS_HPP_
+#define FUSEDNORMALS_HPP_
+
+#include "Base/Component_Aux.hpp"
+#include "Base/Component.hpp"
+#include "Base/DataStream.hpp"
+#include "Base/Property.hpp"
+#include "Base/EventHandler2.hpp"
+
+#include <opencv2/opencv.hpp>
+
+#include "Types/HomogMatrix.hpp"
+#include "Types/HandlerStatistics.hpp"
+
+namespace Processors {
+namespace FusedNormals {
+
+/*!
+ * \class FusedNormals
+ * \brief FusedNormals processor class.
+ *
+ * Runs PassThrough -> DepthTransform -> NormalEstimator chain in one pass
+ * over organized cloud (in_xyz, CV_32FC3). Frame is processed in tiles, each
+ * extended with halo of normal window radius, so intermediate clouds and
+ * derivatives stay in cache and only final outputs are written to memory.
+ * Results are the same as of the separate components: range filtered and
+ * transformed cloud (out_xyz), PassThrough mask (out_mask), normals
+ * (out_normals) and their visualization (out_img). Border normals, not
+ * computed by NormalEstimator, are (-1, -1, -1).
+ *
+ * Transformation (in_homogMatrix) is optional, without it cloud is only
+ * filtered. In benchmark mode the unfused chain is run on every frame too,
+ * time, estimated memory traffic and largest difference of both are logged.
+ *
+ * Tile size and number of threads can be set, or tuned automatically for
+ * each resolution. Tuning times both chain variants with several tile sizes
+ * and thread counts on a synthetic frame and keeps the fastest settings,
+ * which are cached per CPU model (see Types::TuningCache), so next runs on
+ * the same machine skip it. It runs synchronously in the handler of the
+ * first frame of a resolution, so that no live frame competes with trials
+ * for the thread pool; that frame waits for it.
+ */
+class FusedNormals: public Base::Component {
+public:
+	/*!
+	 * Constructor.
+	 */
+	FusedNormals(const std::string & name = "FusedNormals");
+
+	/*!
+	 * Destructor
+	 */
+	virtual ~FusedNormals();
+
+	/*!
+	 * Prepare components interface (register streams and handlers).
+	 * At this point, all properties are already initialized and loaded to
+	 * values set in config file.
+	 */
+	void prepareInterface();
+
+protected:
+
+	/*!
+	 * Connects source to given device.
+	 */
+	bool onInit();
+
+	/*!
+	 * Disconnect source from device, closes streams, etc.
+	 */
+	bool onFinish();
+
+	/*!
+	 * Start component
+	 */
+	bool onStart();
+
+	/*!
+	 * Stop component
+	 */
+	bool onStop();
+
+
+	// Input data streams
+	Base::DataStreamIn<cv::Mat> in_xyz;
+	Base::DataStreamIn<Types::HomogMatrix, Base::DataStreamBuffer::Newest> in_homogMatrix;
+
+	// Output data streams
+	Base::DataStreamOut<cv::Mat> out_xyz;
+	Base::DataStreamOut<cv::Mat> out_mask;
+	Base::DataStreamOut<cv::Mat> out_normals;
+	Base::DataStreamOut<cv::Mat> out_img;
+
+	// Properties
+
+	/// Range of z coordinate (before transformation), as in PassThrough.
+	Base::Property<float> prop_z_min;
+	Base::Property<float> prop_z_max;
+
+	/// Use inverse of in_homogMatrix, as in DepthTransform.
+	Base::Property<bool> prop_inverse;
+
+	/// Neighbourhood radius (in meters), as in NormalEstimator.
+	Base::Property<float> prop_radius;
+
+	/// Runs unfused chain as well and logs comparison of both.
+	Base::Property<bool> prop_benchmark;
+
+	/// Tile size (in points).
+	Base::Property<int> prop_tile_rows;
+	Base::Property<int> prop_tile_cols;
+
+	/// Number of threads, 0 uses all of them.
+	Base::Property<int> prop_threads;
+
+	/// Tunes chain variant, tile size and number of threads, overriding the above.
+	Base::Property<bool> prop_auto_tune;
+
+	/// Tuning cache file, empty selects default one in home directory.
+	Base::Property<std::string> prop_tuning_cache;
+
+	/// Checks every frame against reference implementations of the separate components.
+	Base::Property<bool> prop_verify;
+
+	/// Handler latency statistics
+	Types::ComponentStatistics m_stats;
+
+	// Handlers
+	void onNewImage();
+
+private:
+	struct Settings {
+		/// Tiled chain, otherwise separate pass over whole frame per stage
+		bool fused;
+		int tile_rows;
+		int tile_cols;
+		int threads;
+	};
+
+	/// Runs chain with given settings.
+	void run(const Settings & settings, const cv::Mat & img, const cv::Matx44d & H, bool transform,
+			cv::Mat & xyz, cv::Mat & mask, cv::Mat & normals, cv::Mat & out);
+
+	/// Selects the fastest settings for given resolution from cache, or tunes them if they aren't there.
+	void tune(cv::Size size);
+
+	/// Times settings on synthetic frame of given size, returns the fastest ones.
+	Settings search(cv::Size size, const Settings & current);
+
+	/// Time of chain run with given settings on given frame.
+	double trial(const Settings & settings, const cv::Mat & frame);
+
+	static std::string describe(const Settings & settings);
+
+	/// Compares fused and unfused chain run on the same frame.
+	void benchmark(const cv::Mat & img, const cv::Matx44d & H, bool transform);
+
+	/// Compares outputs with Types::Reference kernels run on the same frame.
+	void verify(const cv::Mat & img, const cv::Matx44d & H, bool transform, const cv::Mat & xyz,
+			const cv::Mat & mask, const cv::Mat & normals);
+
+	Settings m_settings;
+
+	/// Time of verification, frames differing from reference are counted as skipped
+	Types::HandlerStatistics * m_verify_stats;
+
+	/// Resolution settings were tuned for
+	cv::Size m_tuned_size;
+};
+
+} //: namespace FusedNormals
+} //: namespace Processors
+
+/*
+ * Register processor component.
+ */
+REGISTER_COMPONENT("FusedNormals", Processors::FusedNormals::FusedNormals)
+
+#endif /* FUSEDNORMALS_HPP_ */
@@ -0,0 +1,313 @@
+/*!
+ * \file
+ * \brief
+ */
+
+#include <memory>
+#include <string>
+#include <cmath>
+#include <algorithm>
+
+#include "IcpOdometry.hpp"
+#include "Common/Logger.hpp"
+
+#include "Types/PointValidity.hpp"
+
+#include <boost/bind.hpp>
+
+namespace Processors {
+namespace IcpOdometry {
+
+/// Upper triangle of 6x6 matrix, 6 elements of vector, squared error and count.
+static const int PARTIAL_SIZE = 21 + 6 + 2;
+
+/*!
+ * Accumulates point-to-plane linear system, one partial sum per row.
+ * Points of current frame are transformed with (R, t) and projected into
+ * previous frame to find their correspondences.
+ */
+class ReduceBody: public cv::ParallelLoopBody {
+public:
+	ReduceBody(const cv::Mat & xyz, const cv::Mat & normals, const cv::Mat & prev_xyz, const cv::Mat & prev_normals,
+			const cv::Matx33f & K, const float * R, const float * t, float dist, float cos_thr, cv::Mat & partial) :
+		xyz(xyz), normals(normals), prev_xyz(prev_xyz), prev_normals(prev_normals), K(K), R(R), t(t),
+				dist2(dist * dist), cos_thr(cos_thr), partial(partial) {
+	}
+
+	void operator()(const cv::Range & r) const {
+		const float fx = K(0, 0), fy = K(1, 1), cx = K(0, 2), cy = K(1, 2);
+		for (int i = r.start; i < r.end; ++i) {
+			double * s = partial.ptr<double>(i);
+			std::fill(s, s + PARTIAL_SIZE, 0.0);
+
+			const cv::Point3f * p = xyz.ptr<cv::Point3f>(i);
+			const cv::Point3f * n = normals.ptr<cv::Point3f>(i);
+			for (int j = 0; j < xyz.cols; ++j) {
+				if (!Types::validPoint(p[j]) || !Types::validNormal(n[j]))
+					continue;
+
+				float qx = R[0] * p[j].x + R[1] * p[j].y + R[2] * p[j].z + t[0];
+				float qy = R[3] * p[j].x + R[4] * p[j].y + R[5] * p[j].z + t[1];
+				float qz = R[6] * p[j].x + R[7] * p[j].y + R[8] * p[j].z + t[2];
+				if (qz <= 0)
+					continue;
+
+				int u = cvRound(fx * qx / qz + cx);
+				int v = cvRound(fy * qy / qz + cy);
+				if (u < 0 || v < 0 || u >= prev_xyz.cols || v >= prev_xyz.rows)
+					continue;
+
+				const cv::Point3f & pp = prev_xyz.at<cv::Point3f>(v, u);
+				const cv::Point3f & pn = prev_normals.at<cv::Point3f>(v, u);
+				if (!Types::validPoint(pp) || !Types::validNormal(pn))
+					continue;
+
+				float dx = qx - pp.x, dy = qy - pp.y, dz = qz - pp.z;
+				if (dx * dx + dy * dy + dz * dz > dist2)
+					continue;
+
+				float rnx = R[0] * n[j].x + R[1] * n[j].y + R[2] * n[j].z;
+				float rny = R[3] * n[j].x + R[4] * n[j].y + R[5] * n[j].z;
+				float rnz = R[6] * n[j].x + R[7] * n[j].y + R[8] * n[j].z;
+				if (std::fabs(rnx * pn.x + rny * pn.y + rnz * pn.z) < cos_thr * cv::norm(pn) * cv::norm(n[j]))
+					continue;
+
+				// residual and its derivatives over rotation (q x n) and translation (n)
+				double e = dx * pn.x + dy * pn.y + dz * pn.z;
+				double J[6] = { qy * pn.z - qz * pn.y, qz * pn.x - qx * pn.z, qx * pn.y - qy * pn.x, pn.x, pn.y, pn.z };
+
+				int k = 0;
+				for (int a = 0; a < 6; ++a)
+					for (int b = a; b < 6; ++b)
+						s[k++] += J[a] * J[b];
+				for (int a = 0; a < 6; ++a)
+					s[k++] += J[a] * e;
+				s[k++] += e * e;
+				s[k++] += 1;
+			}
+		}
+	}
+
+private:
+	const cv::Mat & xyz;
+	const cv::Mat & normals;
+	const cv::Mat & prev_xyz;
+	const cv::Mat & prev_normals;
+	cv::Matx33f K;
+	const float * R;
+	const float * t;
+	float dist2;
+	float cos_thr;
+	cv::Mat & partial;
+};
+
+IcpOdometry::IcpOdometry(const std::string & name) :
+		Base::Component(name),
+		prop_fx("fx", 525.0f),
+		prop_fy("fy", 525.0f),
+		prop_cx("cx", 319.5f),
+		prop_cy("cy", 239.5f),
+		prop_levels("levels", 3),
+		prop_iterations("iterations", 10),
+		prop_distance_threshold("distance_threshold", 0.1f),
+		prop_angle_threshold("angle_threshold", 30.0f),
+		prop_min_correspondences("min_correspondences", 1000),
+		m_stats(name),
+		m_pose(Eigen::Matrix4d::Identity()),
+		m_reset(true) {
+	registerProperty(prop_fx);
+	registerProperty(prop_fy);
+	registerProperty(prop_cx);
+	registerProperty(prop_cy);
+	registerProperty(prop_levels);
+	registerProperty(prop_iterations);
+	registerProperty(prop_distance_threshold);
+	registerProperty(prop_angle_threshold);
+	registerProperty(prop_min_correspondences);
+	registerProperty(m_stats.prop_statistics);
+	registerProperty(m_stats.prop_statistics_period);
+	registerProperty(m_stats.prop_trace_file);
+	registerProperty(m_stats.prop_allocations);
+	registerProperty(m_stats.prop_frame_sync);
+}
+
+IcpOdometry::~IcpOdometry() {
+}
+
+void IcpOdometry::prepareInterface() {
+	// Register data streams, events and event handlers HERE!
+	registerStream("in_xyz", &in_xyz);
+	registerStream("in_normals", &in_normals);
+	registerStream("in_camera_info", &in_camera_info);
+	registerStream("out_homogMatrix", &out_homogMatrix);
+	registerStream("in_frame_info", &m_stats.in_frame_info);
+	registerStream("out_frame_info", &m_stats.out_frame_info);
+
+	// Register handlers
+	registerHandler("onNewCloud", m_stats.wrap("onNewCloud", boost::bind(&IcpOdometry::onNewCloud, this)));
+	addDependency("onNewCloud", &in_xyz);
+	addDependency("onNewCloud", &in_normals);
+
+	registerHandler("onReset", boost::bind(&IcpOdometry::onReset, this));
+}
+
+bool IcpOdometry::onInit() {
+	m_stats.init(boost::bind(&IcpOdometry::addDependency, this, _1, _2));
+	return true;
+}
+
+bool IcpOdometry::onFinish() {
+	return true;
+}
+
+bool IcpOdometry::onStop() {
+	return true;
+}
+
+bool IcpOdometry::onStart() {
+	return true;
+}
+
+void IcpOdometry::onReset() {
+	CLOG(LINFO) << "Resetting pose";
+	m_pose = Eigen::Matrix4d::Identity();
+	m_reset = true;
+}
+
+void IcpOdometry::buildPyramid(const cv::Mat & xyz, const cv::Mat & normals, std::vector<cv::Mat> & xyz_pyr,
+		std::vector<cv::Mat> & normals_pyr) {
+	int levels = std::min(std::max(1, (int) prop_levels), 8);
+	xyz_pyr.resize(levels);
+	normals_pyr.resize(levels);
+	xyz.copyTo(xyz_pyr[0]);
+	normals.copyTo(normals_pyr[0]);
+
+	// nearest neighbour, so that invalid points are never mixed with valid ones
+	for (int l = 1; l < levels; ++l) {
+		cv::Size size(xyz_pyr[l - 1].cols / 2, xyz_pyr[l - 1].rows / 2);
+		cv::resize(xyz_pyr[l - 1], xyz_pyr[l], size, 0, 0, cv::INTER_NEAREST);
+		cv::resize(normals_pyr[l - 1], normals_pyr[l], size, 0, 0, cv::INTER_NEAREST);
+	}
+}
+
+int IcpOdometry::align(int level, const cv::Matx33f & K, Eigen::Matrix4d & T) {
+	const cv::Mat & xyz = m_xyz[level];
+	float dist = prop_distance_threshold * (1 << level);
+	float cos_thr = std::cos(prop_angle_threshold * CV_PI / 180);
+	int iterations = std::max(1, (int) prop_iterations);
+
+	m_partial.create(xyz.rows, PARTIAL_SIZE, CV_64FC1);
+
+	int count = 0;
+	for (int it = 0; it < iterations; ++it) {
+		float R[9], t[3];
+		for (int i = 0; i < 3; ++i) {
+			for (int j = 0; j < 3; ++j)
+				R[3 * i + j] = T(i, j);
+			t[i] = T(i, 3);
+		}
+
+		cv::parallel_for_(cv::Range(0, xyz.rows),
+				ReduceBody(xyz, m_normals[level], m_prev_xyz[level], m_prev_normals[level], K, R, t, dist, cos_thr, m_partial));
+
+		double s[PARTIAL_SIZE] = { 0 };
+		for (int i = 0; i < m_partial.rows; ++i) {
+			const double * row = m_partial.ptr<double>(i);
+			for (int k = 0; k < PARTIAL_SIZE; ++k)
+				s[k] += row[k];
+		}
+
+		count = s[PARTIAL_SIZE - 1];
+		if (count < 6)
+			return count;
+
+		Eigen::Matrix<double, 6, 6> A;
+		Eigen::Matrix<double, 6, 1> b;
+		int k = 0;
+		for (int i = 0; i < 6; ++i)
+			for (int j = i; j < 6; ++j)
+				A(i, j) = A(j, i) = s[k++];
+		for (int i = 0; i < 6; ++i)
+			b(i) = s[k++];
+
+		Eigen::Matrix<double, 6, 1> x = A.ldlt().solve(-b);
+		if (!x.allFinite())
+			return 0;
+
+		Eigen::Vector3d w = x.head<3>();
+		Eigen::Matrix4d dT = Eigen::Matrix4d::Identity();
+		if (w.norm() > 0)
+			dT.topLeftCorner<3, 3>() = Eigen::AngleAxisd(w.norm(), w.normalized()).toRotationMatrix();
+		dT.topRightCorner<3, 1>() = x.tail<3>();
+		T = dT * T;
+
+		CLOG(LTRACE) << "Level " << level << ", iteration " << it << ": " << count << " correspondences, rms "
+				<< std::sqrt(s[PARTIAL_SIZE - 2] / count);
+
+		if (x.norm() < 1e-6)
+			break;
+	}
+
+	return count;
+}
+
+void IcpOdometry::onNewCloud() {
+	cv::Mat xyz = in_xyz.read();
+	cv::Mat normals = in_normals.read();
+	if (xyz.type() != CV_32FC3 || normals.type() != CV_32FC3) {
+		CLOG(LERROR) << "Wrong cloud or normals type, CV_32FC3 expected";
+		m_stats.skip();
+		return;
+	}
+	if (xyz.size() != normals.size()) {
+		CLOG(LERROR) << "Cloud and normals sizes differ";
+		m_stats.skip();
+		return;
+	}
+
+	buildPyramid(xyz, normals, m_xyz, m_normals);
+
+	if (m_reset || m_prev_xyz.size() != m_xyz.size() || m_prev_xyz[0].size() != xyz.size()) {
+		m_reset = false;
+	} else {
+		float fx = prop_fx, fy = prop_fy, cx = prop_cx, cy = prop_cy;
+		if (!in_camera_info.empty()) {
+			Types::CameraInfo info = in_camera_info.read();
+			fx = info.fx();
+			fy = info.fy();
+			cx = info.cx();
+			cy = info.cy();
+		}
+
+		// motion of the camera, maps current frame into previous one
+		Eigen::Matrix4d T = Eigen::Matrix4d::Identity();
+		int count = 0;
+		for (int level = m_xyz.size() - 1; level >= 0; --level) {
+			float scale = 1.0f / (1 << level);
+			cv::Matx33f K = cv::Matx33f::eye();
+			K(0, 0) = fx * scale;
+			K(1, 1) = fy * scale;
+			K(0, 2) = (cx + 0.5f) * scale - 0.5f;
+			K(1, 2) = (cy + 0.5f) * scale - 0.5f;
+			count = align(level, K, T);
+		}
+
+		if (count < prop_min_correspondences) {
+			CLOG(LWARNING) << "Tracking lost, only " << count << " correspondences";
+		} else {
+			m_pose = m_pose * T;
+		}
+	}
+
+	std::swap(m_xyz, m_prev_xyz);
+	std::swap(m_normals, m_prev_normals);
+
+	Types::HomogMatrix hm;
+	hm.matrix() = m_pose;
+	CLOG(LDEBUG) << "Camera pose:\n" << hm;
+	m_stats.publish();
+	out_homogMatrix.write(hm);
+}
+
+} //: namespace IcpOdometry
+} //: namespace Processors
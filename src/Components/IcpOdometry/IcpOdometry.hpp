@@ -0,0 +1,154 @@
+/*!
+ * \file
+ * \brief
+ */
+
+#ifndef ICPODOMETRY_HPP_
+#define ICPODOMETRY_HPP_
+
+#include "Base/Component_Aux.hpp"
+#include "Base/Component.hpp"
+#include "Base/DataStream.hpp"
+#include "Base/Property.hpp"
+#include "Base/EventHandler2.hpp"
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include <Types/CameraInfo.hpp>
+#include "Types/HomogMatrix.hpp"
+#include "Types/HandlerStatistics.hpp"
+
+namespace Processors {
+namespace IcpOdometry {
+
+/*!
+ * \class IcpOdometry
+ * \brief IcpOdometry processor class.
+ *
+ * Estimates camera motion between consecutive organized clouds (in_xyz,
+ * in camera frame, with normals in in_normals) with point-to-plane ICP.
+ * Correspondences are found by projecting points of current frame into the
+ * previous one (projective data association), linear system is accumulated
+ * in parallel over rows and solved coarse-to-fine on image pyramid.
+ *
+ * out_homogMatrix is the pose of the camera in frame of the first cloud
+ * (maps camera coordinates to world ones), so it can be fed directly to
+ * DepthTransform. When tracking fails pose is kept and the current frame
+ * becomes new reference.
+ */
+class IcpOdometry: public Base::Component {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	/*!
+	 * Constructor.
+	 */
+	IcpOdometry(const std::string & name = "IcpOdometry");
+
+	/*!
+	 * Destructor
+	 */
+	virtual ~IcpOdometry();
+
+	/*!
+	 * Prepare components interface (register streams and handlers).
+	 * At this point, all properties are already initialized and loaded to
+	 * values set in config file.
+	 */
+	void prepareInterface();
+
+protected:
+
+	/*!
+	 * Connects source to given device.
+	 */
+	bool onInit();
+
+	/*!
+	 * Disconnect source from device, closes streams, etc.
+	 */
+	bool onFinish();
+
+	/*!
+	 * Start component
+	 */
+	bool onStart();
+
+	/*!
+	 * Stop component
+	 */
+	bool onStop();
+
+
+	// Input data streams
+	Base::DataStreamIn<cv::Mat> in_xyz;
+	Base::DataStreamIn<cv::Mat> in_normals;
+	Base::DataStreamIn<Types::CameraInfo, Base::DataStreamBuffer::Newest> in_camera_info;
+
+	// Output data streams
+	Base::DataStreamOut<Types::HomogMatrix> out_homogMatrix;
+
+	// Properties
+
+	/// Intrinsics used when no camera info is connected.
+	Base::Property<float> prop_fx;
+	Base::Property<float> prop_fy;
+	Base::Property<float> prop_cx;
+	Base::Property<float> prop_cy;
+
+	/// Number of pyramid levels.
+	Base::Property<int> prop_levels;
+
+	/// Maximal number of iterations on each level.
+	Base::Property<int> prop_iterations;
+
+	/// Maximal distance between corresponding points on finest level (in meters).
+	Base::Property<float> prop_distance_threshold;
+
+	/// Maximal angle between corresponding normals (in degrees).
+	Base::Property<float> prop_angle_threshold;
+
+	/// Tracking fails if less correspondences are found on finest level.
+	Base::Property<int> prop_min_correspondences;
+
+	/// Handler latency statistics
+	Types::ComponentStatistics m_stats;
+
+	// Handlers
+	void onNewCloud();
+	void onReset();
+
+private:
+	/// Fills pyramid, level 0 is the input itself.
+	void buildPyramid(const cv::Mat & xyz, const cv::Mat & normals, std::vector<cv::Mat> & xyz_pyr,
+			std::vector<cv::Mat> & normals_pyr);
+
+	/*!
+	 * Refines T (mapping current frame to previous one) on given level.
+	 * Returns number of correspondences in the last iteration.
+	 */
+	int align(int level, const cv::Matx33f & K, Eigen::Matrix4d & T);
+
+	std::vector<cv::Mat> m_xyz, m_normals;
+	std::vector<cv::Mat> m_prev_xyz, m_prev_normals;
+
+	/// Per-row partial sums of the linear system.
+	cv::Mat m_partial;
+
+	/// Current camera pose.
+	Eigen::Matrix4d m_pose;
+
+	bool m_reset;
+};
+
+} //: namespace IcpOdometry
+} //: namespace Processors
+
+/*
+ * Register processor component.
+ */
+REGISTER_COMPONENT("IcpOdometry", Processors::IcpOdometry::IcpOdometry)
+
+#endif /* ICPODOMETRY_HPP_ */
@@ -7,19 +7,63 @@
 #include <string>
 #include <iostream>
 #include <cmath>
+#include <algorithm>
 
 #include "NormalEstimator.hpp"
 #include "Common/Logger.hpp"
 #include "Common/Timer.hpp"
 
+#include "Types/PointValidity.hpp"
+#include "Types/CloudKernels.hpp"
+#include "Types/Decimation.hpp"
+#include "Types/ReferenceKernels.hpp"
+
+#include <boost/bind.hpp>
+
+#include <opencv2/imgproc/imgproc.hpp>
+
 namespace Processors {
 namespace NormalEstimator {
 
 NormalEstimator::NormalEstimator(const std::string & name) : Base::Component(name),
-		prop_radius("radius", 0.0075)
+		prop_radius("radius", 0.0075),
+		prop_dense("dense", true),
+		prop_publish_query("publish_query", false),
+		prop_adaptive("adaptive", false),
+		prop_window_scale("window_scale", 4.0f),
+		prop_min_window("min_window", 2),
+		prop_max_window("max_window", 12),
+		prop_decimation("decimation", 1),
+		prop_async("async", false),
+		prop_verify("verify", false),
+		prop_incremental("incremental", false),
+		prop_change_threshold("change_threshold", 0.005f),
+		prop_tile_size("tile_size", 32),
+		m_stats(name),
+		m_queried(false),
+		m_tiles_radius(0)
 {
 	LOG(LTRACE) << "Hello NormalEstimator\n";
 	registerProperty(prop_radius);
+	registerProperty(prop_dense);
+	registerProperty(prop_publish_query);
+	registerProperty(prop_adaptive);
+	registerProperty(prop_window_scale);
+	registerProperty(prop_min_window);
+	registerProperty(prop_max_window);
+	registerProperty(prop_decimation);
+	registerProperty(prop_async);
+	registerProperty(prop_verify);
+	registerProperty(prop_incremental);
+	registerProperty(prop_change_threshold);
+	registerProperty(prop_tile_size);
+	registerProperty(m_stats.prop_statistics);
+	registerProperty(m_stats.prop_statistics_period);
+	registerProperty(m_stats.prop_trace_file);
+	registerProperty(m_stats.prop_allocations);
+	registerProperty(m_stats.prop_frame_sync);
+	m_async_stats = m_stats.add("async");
+	m_verify_stats = m_stats.add("verify");
 }
 
 NormalEstimator::~NormalEstimator()
@@ -28,7 +72,7 @@ NormalEstimator::~NormalEstimator()
 }
 
 void NormalEstimator::prepareInterface() {
-	registerHandler("onNewImage", boost::bind(&NormalEstimator::onNewImage, this));
+	registerHandler("onNewImage", m_stats.wrap("onNewImage", boost::bind(&NormalEstimator::onNewImage, this)));
 
 	registerStream("in_cloud", &in_img);
 
@@ -37,18 +81,30 @@ void NormalEstimator::prepareInterface() {
 	registerStream("out_img", &out_img);
 	addDependency("onNewImage", &in_img);
 
+	registerStream("in_depth_cloud", &in_depth_cloud);
+	registerHandler("onNewCloud", m_stats.wrap("onNewCloud", boost::bind(&NormalEstimator::onNewCloud, this)));
+	addDependency("onNewCloud", &in_depth_cloud);
+
+	registerStream("in_edges", &in_edges);
+
+	registerStream("in_query", &in_query);
+	registerStream("out_query_normals", &out_query_normals);
+	registerStream("out_query", &out_query);
+	registerHandler("onQuery", m_stats.wrap("onQuery", boost::bind(&NormalEstimator::onQuery, this), false));
+	addDependency("onQuery", &in_query);
+
 	//newNormals = registerEvent("newNormals");
 
 	registerStream("out_normals", &out_normals);
+	registerStream("in_frame_info", &m_stats.in_frame_info);
+	registerStream("out_frame_info", &m_stats.out_frame_info);
 
 }
 
 bool NormalEstimator::onInit()
 {
 	LOG(LTRACE) << "NormalEstimator::initialize\n";
-
-
-
+	m_stats.init(boost::bind(&NormalEstimator::addDependency, this, _1, _2));
 	return true;
 }
 
@@ -67,11 +123,20 @@ bool NormalEstimator::onStep()
 
 bool NormalEstimator::onStop()
 {
+	if (m_async.running()) {
+		m_async.stop();
+		m_async.flush();
+		LOG(LINFO) << "Async worker dropped " << m_async.dropped() << " frames";
+	}
 	return true;
 }
 
 bool NormalEstimator::onStart()
 {
+	if (prop_adaptive)
+		LOG(LINFO) << "Adaptive windows, radius applies to queries only";
+	if (prop_async)
+		m_async.start(m_async_stats, m_stats.tracker());
 	return true;
 }
 
@@ -106,53 +171,281 @@ cv::Point3f calculateCross(cv::Point3f a, cv::Point3f b) {
 	return c;
 }
 
-cv::Point3f calculateNormal(cv::Mat img, cv::Mat der_row, cv::Mat der_col, int row, int col, float dist, int window) {
+/// Same as Types::windowNormal, but derivatives are computed only inside the window.
+cv::Point3f calculateNormalAt(const cv::Mat & img, int row, int col, float dist, int window) {
 	cv::Point3f ret;
 	cv::Point3f curpoint = img.at<cv::Point3f>(row, col);
 	cv::Point3f drow(0, 0, 0), dcol(0, 0, 0);
-	cv::Point3f pt;
-	float sum=0;
 
 	dist *= dist;
 	for (int i = -window; i <= window; ++i) {
-		cv::Point3f * drow_ptr = der_row.ptr<cv::Point3f>(row+i);
-		cv::Point3f * dcol_ptr = der_col.ptr<cv::Point3f>(row+i);
-		cv::Point3f * img_ptr = img.ptr<cv::Point3f>(row+i);
+		const cv::Point3f * img_ptr = img.ptr<cv::Point3f>(row+i);
+		const cv::Point3f * img_np = img.ptr<cv::Point3f>(row+i+1);
 		for (int j = -window; j <= window; ++j) {
-			pt = img_ptr[col+j];
+			cv::Point3f pt = img_ptr[col+j];
 			cv::Point3f tmp = curpoint-pt;
-			//float d = calculateDist(curpoint, pt);
-			//float dd = InvSqrt(tmp.x*tmp.x+tmp.y*tmp.y+tmp.z*tmp.z);
-			//float d = 1/dd;
 			float d = tmp.dot(tmp);
 			if (d <= dist) {
 				float sc = 1.0 - d/dist;
-				drow += drow_ptr[col+j] * sc;
-				dcol += dcol_ptr[col+j] * sc;
-				//sum += sc;
+				drow += Types::cloudDerivative(pt, img_ptr[col+j+1]) * sc;
+				dcol += Types::cloudDerivative(pt, img_np[col+j]) * sc;
 			}
 		}
 	}
-//	drow *= (1./sum);
-//	dcol *= (1./sum);
-
 
 	ret = calculateCross(drow, dcol);
 	if (ret.z < 0)
 		ret = -ret;
-	//if (norm(ret) > 0.001)
-	//	ret = cv::Point3f(-1, -1, -1);
-	//else
-		ret *= (1./norm(ret));
+	ret *= (1./norm(ret));
 
 	return ret;
 }
 
+/// Window used by estimator, normals closer to image border are not computed.
+static const int WINDOW = Types::NORMAL_WINDOW;
+
+/// Evaluates normals of img at given pixels, bound into Types::NormalQuery.
+static void queryNormals(const cv::Mat & img, const cv::Mat & edge_sum, float radius,
+		const std::vector<cv::Point> & pixels, std::vector<cv::Point3f> & normals) {
+	normals.resize(pixels.size());
+	for (size_t k = 0; k < pixels.size(); ++k) {
+		const cv::Point & p = pixels[k];
+		if (p.y < WINDOW || p.x < WINDOW || p.y >= img.rows-WINDOW-1 || p.x >= img.cols-WINDOW-1
+				|| (!edge_sum.empty() && Types::windowHasEdge(edge_sum, p.y, p.x, WINDOW)))
+			normals[k] = cv::Point3f(-1, -1, -1);
+		else
+			normals[k] = calculateNormalAt(img, p.y, p.x, radius, WINDOW);
+	}
+}
+
 void NormalEstimator::onNewImage() {
+	process(in_img.read());
+}
+
+void NormalEstimator::onNewCloud() {
+	// materialized into own buffer, never into the one shared with source
+	in_depth_cloud.read().materialize(m_cloud);
+	process(m_cloud);
+}
+
+void NormalEstimator::process(const cv::Mat & frame) {
+	cv::Mat edges, edge_sum;
+	readEdges(frame.size(), edges, edge_sum);
+
+	// own copy only if it outlives the handler, as input buffers are reused
+	// with next frames; shared (read only) by query callback and worker
+	bool query = prop_publish_query || m_queried;
+	cv::Mat copy = query || (prop_dense && m_async.running()) ? frame.clone() : frame;
+
+	// frame info goes with the dense map if there is one
+	if (!prop_dense)
+		m_stats.publish();
+
+	// queries are always served at full resolution
+	if (query)
+		publishQuery(copy, edge_sum);
+
+	if (prop_dense) {
+		if (m_async.running())
+			edges = edges.clone();
+		m_async.execute(boost::bind(&NormalEstimator::dense, this, copy, edges, edge_sum, params(), m_stats.frame(),
+				m_stats.current()));
+	}
+}
+
+NormalEstimator::Params NormalEstimator::params() const {
+	Params params;
+	params.radius = prop_radius;
+	params.adaptive = prop_adaptive;
+	params.window_scale = prop_window_scale;
+	params.min_window = std::max(1, (int) prop_min_window);
+	params.max_window = std::max(1, (int) prop_max_window);
+	params.decimation = prop_decimation;
+	params.verify = prop_verify;
+	params.incremental = prop_incremental;
+	params.change_threshold = prop_change_threshold;
+	params.tile_size = std::max((int) prop_tile_size, 8);
+	return params;
+}
+
+void NormalEstimator::dense(cv::Mat frame, cv::Mat edges, cv::Mat edge_sum, Params params, Types::FrameInfo info,
+		Types::HandlerStatistics * handler) {
+	m_info = info;
+	m_params = params;
+	img = frame;
+	m_edge_sum = edge_sum;
+	m_edges = edges;
+	decimate(edges);
+	// kernels address rows by common stride
+	if (!img.isContinuous())
+		img = img.clone();
+	if (!estimate()) {
+		// m_stats.skip() would race with the handler thread
+		if (handler)
+			handler->skip();
+		return;
+	}
+
+	// worker goes on with the next frame before these are written
+	m_async.complete(boost::bind(&NormalEstimator::write, this, out.clone(),
+			m_async.running() ? normals.clone() : normals, m_info));
+	if (m_params.verify && !m_params.adaptive)
+		verify();
+}
+
+void NormalEstimator::write(cv::Mat out, cv::Mat normals, Types::FrameInfo info) {
+	m_stats.publish(info);
+	out_img.write(out);
+	out_normals.write(normals);
+}
+
+void NormalEstimator::verify() {
+	Common::Timer timer;
+	timer.restart();
+
+	cv::Mat ref = Types::Reference::normals(img, m_params.radius, WINDOW);
+
+	// windows straddling edges are skipped by estimator only
+	if (!m_edge_sum.empty())
+		for (int i = WINDOW; i < img.rows - WINDOW - 1; ++i)
+			for (int j = WINDOW; j < img.cols - WINDOW - 1; ++j)
+				if (Types::windowHasEdge(m_edge_sum, i, j, WINDOW))
+					ref.at<cv::Point3f>(i, j) = cv::Point3f(-1, -1, -1);
+
+	// border normals are not computed
+	cv::Rect roi(WINDOW, WINDOW, img.cols - 2 * WINDOW - 1, img.rows - 2 * WINDOW - 1);
+	boost::int64_t ulp = 0;
+	if (roi.width > 0 && roi.height > 0)
+		ulp = Types::Reference::maxUlp(normals(roi), ref(roi));
+
+	m_verify_stats->call(timer.elapsed());
+	if (ulp > Types::Reference::NORMAL_ULP) {
+		LOG(LERROR) << "Normals differ from reference by " << ulp << " ULP";
+		m_verify_stats->skip();
+	}
+}
+
+void NormalEstimator::publishQuery(const cv::Mat & frame, const cv::Mat & edge_sum) {
+	m_query = boost::bind(&queryNormals, frame, edge_sum, (float) prop_radius, _1, _2);
+	m_query_size = frame.size();
+	if (prop_publish_query)
+		out_query.write(m_query);
+}
+
+void NormalEstimator::onQuery() {
+	cv::Mat query = in_query.read();
+	// frames are kept for queries from now on
+	m_queried = true;
+	if (m_query.empty()) {
+		LOG(LWARNING) << "No frame to query yet";
+		m_stats.skip();
+		return;
+	}
+
+	std::vector<cv::Point> pixels;
+	if (!Types::queryPixels(query, m_query_size, pixels)) {
+		LOG(LERROR) << "Wrong query, CV_32SC2 list or CV_8UC1 mask expected";
+		m_stats.skip();
+		return;
+	}
+
+	std::vector<cv::Point3f> result;
+	m_query(pixels, result);
+	out_query_normals.write(Types::queryResult(result));
+}
+
+bool NormalEstimator::readEdges(cv::Size size, cv::Mat & edges, cv::Mat & edge_sum) {
+	if (in_edges.empty())
+		return false;
+
+	cv::Mat mask = in_edges.read();
+	if (mask.size() != size || mask.type() != CV_8UC1) {
+		LOG(LWARNING) << "Edge mask doesn't match input, ignoring it";
+		return false;
+	}
+	edges = mask;
+	Types::edgeIntegral(edges, Types::EDGE_DISCONTINUITY, edge_sum);
+	return true;
+}
+
+int NormalEstimator::decimate(const cv::Mat & edges) {
+	int n = m_params.decimation;
+	if (n != 2 && n != 4) {
+		if (n != 1)
+			LOG(LWARNING) << "Decimation " << n << " not supported, using 1";
+		return 1;
+	}
+
+	img = Types::decimate(img, n);
+	if (!edges.empty()) {
+		// never written in place, full resolution sum is shared with queries
+		m_edge_sum.release();
+		m_edges = Types::decimateOr(edges, n);
+		Types::edgeIntegral(m_edges, Types::EDGE_DISCONTINUITY, m_edge_sum);
+	}
+	return n;
+}
+
+void NormalEstimator::estimateAdaptive() {
+	Types::estimateNormalsAdaptive(img, m_edge_sum, m_params.window_scale, m_params.min_window, m_params.max_window,
+			normals, &out);
+}
+
+void NormalEstimator::estimateIncremental() {
+	float radius = m_params.radius;
+	if (radius != m_tiles_radius) {
+		m_tiles.reset();
+		m_tiles_radius = radius;
+	}
+	m_tiles.update(img, m_edges, m_params.change_threshold, m_params.tile_size);
+
+	// from now on everything is computed from state, so that verification
+	// compares results with reference of the same input
+	img = m_tiles.state();
+	cv::Size size = img.size();
+	if (m_tiles.full()) {
+		out.create(size, CV_8UC3);
+		normals.create(size, CV_32FC3);
+		m_der_row.create(size, CV_32FC3);
+		m_der_col.create(size, CV_32FC3);
+	}
+
+	if (m_tiles.changed() > 0) {
+		// private buffer, queries use integral of the current edges
+		if (!m_tiles.edges().empty())
+			Types::edgeIntegral(m_tiles.edges(), Types::EDGE_DISCONTINUITY, m_tiles_edge_sum);
+		else
+			m_tiles_edge_sum.release();
+
+		// derivative depends on the pixel itself and its right and lower neighbours
+		for (size_t k = 0; k < m_tiles.changed(); ++k)
+			Types::cloudDerivatives(img, m_der_row, m_der_col, m_tiles.rect(k, 1, 0));
+
+		// normal depends on pixels up to WINDOW + 1 to the right and down
+		m_tiles.mask(WINDOW + 1, WINDOW, m_dirty);
+		Types::windowNormals(img, m_der_row, m_der_col, m_tiles_edge_sum, m_dirty, radius, normals, &out);
+	}
+	m_edge_sum = m_tiles_edge_sum;
+
+	LOG(LDEBUG) << m_tiles.changed() << " of " << m_tiles.tiles() << " tiles changed";
+}
+
+bool NormalEstimator::estimate() {
 	try {
+		if (m_params.incremental && !m_params.adaptive) {
+			estimateIncremental();
+			return true;
+		}
+		// normals don't match state any more
+		m_tiles.reset();
+
+		if (m_params.adaptive) {
+			estimateAdaptive();
+			return true;
+		}
+
 		Common::Timer timer;
 		timer.restart();
-		img = in_img.read();
 		cv::Size size = img.size();
 		out.create(size, CV_8UC3);
 		cv::Mat der_row;
@@ -160,44 +453,22 @@ void NormalEstimator::onNewImage() {
 		der_row.create(size, CV_32FC3);
 		der_col.create(size, CV_32FC3);
 		normals.create(size, CV_32FC3);
+		float radius = m_params.radius;
 
-		float t1, t2, t3, t4;
+		float t1, t2;
 
 		timer.restart();
-		for (int i = 0; i < size.height-1; i++) {
-			cv::Point3f* img_p = img.ptr <cv::Point3f> (i);
-			cv::Point3f* img_np =  img.ptr <cv::Point3f> (i+1);
-			cv::Point3f* p_row = der_row.ptr<cv::Point3f>(i);
-			cv::Point3f* p_col = der_col.ptr<cv::Point3f>(i);
-			for (int j = 0; j < size.width-1; ++j) {
-				p_row[j] = img_p[j+1] - img_p[j];
-				if (fabs(p_row[j].z) > 0.05) p_row[j]=cv::Point3f(0, 0, 0);
-				p_col[j] = img_np[j] - img_p[j];
-				if (fabs(p_col[j].z) > 0.05) p_col[j]=cv::Point3f(0, 0, 0);
-			}
-		}
+		Types::cloudDerivatives(img, der_row, der_col, cv::Rect(0, 0, size.width, size.height));
 		t1 = timer.elapsed();
 
-		int window = 6;
-		for (int i = window; i < size.height-window-1; i++) {
-			uchar * out_p = out.ptr<uchar>(i);
-			cv::Point3f * nptr = normals.ptr<cv::Point3f>(i);
-			for (int j = window; j < size.width-window-1; ++j) {
-				cv::Point3f normal = calculateNormal(img, der_row, der_col, i, j, prop_radius, window);
-				out_p[3*j+2] = 0.5*(normal.x+1) * 255;
-				out_p[3*j+1] = 0.5*(normal.y+1) * 255;
-				out_p[3*j+0] = 0.5*(normal.z+1) * 255;
-				//out_p[3*j+0] = der_row.at<cv::Point3f>(i, j).x * 400;
-				nptr[j] = normal;
-			}
-		}
+		Types::windowNormals(img, der_row, der_col, m_edge_sum, cv::Mat(), radius, normals, &out);
 		t2 = timer.elapsed();
 
 		LOG(LNOTICE) << t1 << ", " << t2-t1;
-		out_img.write(out.clone());
-		out_normals.write(normals);
+		return true;
 	} catch (const std::exception& ex) {
-		LOG(LERROR) << "NormalEstimator::onNewImage() failed. " << ex.what() << std::endl;
+		LOG(LERROR) << "NormalEstimator::estimate() failed. " << ex.what() << std::endl;
+		return false;
 	}
 }
 
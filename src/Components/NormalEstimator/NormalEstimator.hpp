@@ -11,6 +11,14 @@
 #include "Base/DataStream.hpp"
 #include "Base/Property.hpp"
 
+#include "Types/HandlerStatistics.hpp"
+#include "Types/DepthCloud.hpp"
+#include "Types/EdgeMask.hpp"
+#include "Types/NormalQuery.hpp"
+#include "Types/IntegralImage.hpp"
+#include "Types/AsyncStage.hpp"
+#include "Types/TileChanges.hpp"
+
 #include <string>
 
 #include <opencv2/core/core.hpp>
@@ -70,26 +78,165 @@ protected:
 
 	void onNewImage();
 
+	void onNewCloud();
+
+	void onQuery();
+
 	/// Event handler.
 //	Base::EventHandler <NormalEstimator> h_onNewImage;
 
 	/// Input data stream
 	Base::DataStreamIn <cv::Mat, Base::DataStreamBuffer::Newest> in_img;
 
+	/// Input data stream - lazy cloud
+	Base::DataStreamIn <Types::DepthCloud, Base::DataStreamBuffer::Newest> in_depth_cloud;
+
+	/// Input data stream - optional edge mask (DepthEdges), windows straddling
+	/// depth discontinuities are skipped
+	Base::DataStreamIn <cv::Mat, Base::DataStreamBuffer::Newest> in_edges;
+
+	/// Input data stream - pixels to evaluate normals at, list (CV_32SC2) or mask (CV_8UC1)
+	Base::DataStreamIn <cv::Mat> in_query;
+
 	/// Output data stream - processed image
 	Base::DataStreamOut <cv::Mat> out_img;
 
 	/// Output data stream - processed image
 	Base::DataStreamOut <cv::Mat> out_normals;
 
+	/// Output data stream - normals at pixels from in_query (Nx1, CV_32FC3)
+	Base::DataStreamOut <cv::Mat> out_query_normals;
+
+	/// Output data stream - callback evaluating normals of the last frame
+	Base::DataStreamOut <Types::NormalQuery> out_query;
+
+	/// Neighbourhood radius (in meters) of fixed windows and queries, adaptive dense map ignores it.
 	Base::Property<float> prop_radius;
 
+	/// Computes dense normal map, when off only queries are served.
+	Base::Property<bool> prop_dense;
+
+	/// Publishes out_query callback with every frame, which then keeps its own copy of the frame.
+	Base::Property<bool> prop_publish_query;
+
+	/// Window radius chosen per pixel from its depth (dense map only), instead of radius.
+	Base::Property<bool> prop_adaptive;
+
+	/// Adaptive window radius (in pixels) at 1 m, grows linearly with depth.
+	Base::Property<float> prop_window_scale;
+
+	/// Limits of adaptive window radius (in pixels).
+	Base::Property<int> prop_min_window;
+	Base::Property<int> prop_max_window;
+
+	/// Dense map computed on every n-th pixel (1, 2 or 4), output is n times smaller.
+	Base::Property<int> prop_decimation;
+
+	/// Dense map computed by worker thread, handlers return immediately (newest frame wins).
+	Base::Property<bool> prop_async;
+
+	/// Checks every dense map (fixed window only) against reference implementation.
+	Base::Property<bool> prop_verify;
+
+	/// Dense map (fixed window only) recomputed only around tiles changed since previous frame.
+	Base::Property<bool> prop_incremental;
+
+	/// Depth change (in meters) below which tile is treated as unchanged (incremental mode).
+	Base::Property<float> prop_change_threshold;
+
+	/// Tile size (in pixels) of change detection (incremental mode).
+	Base::Property<int> prop_tile_size;
+
+	/// Handler latency statistics
+	Types::ComponentStatistics m_stats;
+
 private:
+	/// Properties of dense estimation, read by handler for the worker.
+	struct Params {
+		float radius;
+		bool adaptive;
+		float window_scale;
+		int min_window;
+		int max_window;
+		int decimation;
+		bool verify;
+		bool incremental;
+		float change_threshold;
+		int tile_size;
+	};
+
+	/// Current values of properties of dense estimation.
+	Params params() const;
+
+	/// Reads edges, publishes query and (possibly asynchronously) estimates dense map of frame.
+	void process(const cv::Mat & frame);
+
+	/// Estimates dense map of frame, runs on worker thread in async mode. Failed frames are skipped in handler.
+	void dense(cv::Mat frame, cv::Mat edges, cv::Mat edge_sum, Params params, Types::FrameInfo info,
+			Types::HandlerStatistics * handler);
+
+	/// Writes dense map together with info of its frame, on handler thread.
+	void write(cv::Mat out, cv::Mat normals, Types::FrameInfo info);
+
+	/// Estimates normals of img, returns false if it failed.
+	bool estimate();
+
+	/// Estimates normals of img with depth adaptive windows.
+	void estimateAdaptive();
+
+	/// Estimates normals of img around tiles changed since previous frame.
+	void estimateIncremental();
+
+	/// Compares normals with Types::Reference::normals of img.
+	void verify();
+
+	/// Reads in_edges (if connected) and its integral, returns false if there are none.
+	bool readEdges(cv::Size size, cv::Mat & edges, cv::Mat & edge_sum);
+
+	/// Info of the frame img comes from and properties it is processed with.
+	Types::FrameInfo m_info;
+	Params m_params;
+
+	/// Integral image of discontinuity edges of img.
+	cv::Mat m_edge_sum;
+
+	/// Edge mask at resolution of img, empty if there are no edges.
+	cv::Mat m_edges;
+
+	/// Decimates img (and m_edge_sum) for dense map, returns decimation factor used.
+	int decimate(const cv::Mat & edges);
+
+	/// Publishes query callback bound to given frame.
+	void publishQuery(const cv::Mat & frame, const cv::Mat & edge_sum);
+
+	/// Callback for the last frame.
+	Types::NormalQuery m_query;
+	cv::Size m_query_size;
+
+	/// Set by the first in_query, frames are copied for queries only since then
+	bool m_queried;
+
 	cv::Mat img;
+	cv::Mat m_cloud;
 	cv::Mat out;
 	cv::Mat normals;
 
 	Algorithm m_algorithm;
+
+	/// Incremental mode: input with changed tiles only, its derivatives and edge integral
+	Types::TileChanges m_tiles;
+	cv::Mat m_der_row;
+	cv::Mat m_der_col;
+	cv::Mat m_tiles_edge_sum;
+	cv::Mat m_dirty;
+	float m_tiles_radius;
+
+	/// Time of verification, frames differing from reference are counted as skipped
+	Types::HandlerStatistics * m_verify_stats;
+
+	/// Worker of dense estimation (async mode), stopped before other members are destroyed
+	Types::HandlerStatistics * m_async_stats;
+	Types::AsyncStage m_async;
 };
 
 }//: namespace NormalEstimator
@@ -6,10 +6,14 @@
 
 #include <memory>
 #include <string>
+#include <algorithm>
+#include <cmath>
 
 #include "PassThrough.hpp"
 #include "Common/Logger.hpp"
 
+#include "Types/CloudKernels.hpp"
+
 #include <boost/bind.hpp>
 
 namespace Processors {
@@ -18,9 +22,15 @@ namespace PassThrough {
 PassThrough::PassThrough(const std::string & name) :
 		Base::Component(name) , 
 		z_min("z_min", 0), 
-		z_max("z_max", 10) {
+		z_max("z_max", 10),
+		m_stats(name) {
 	registerProperty(z_min);
 	registerProperty(z_max);
+	registerProperty(m_stats.prop_statistics);
+	registerProperty(m_stats.prop_statistics_period);
+	registerProperty(m_stats.prop_trace_file);
+	registerProperty(m_stats.prop_allocations);
+	registerProperty(m_stats.prop_frame_sync);
 
 }
 
@@ -32,14 +42,21 @@ void PassThrough::prepareInterface() {
 	registerStream("in_xyz", &in_xyz);
 	registerStream("out_xyz", &out_xyz);
 	registerStream("out_mask", &out_mask);
+	registerStream("in_cloud", &in_cloud);
+	registerStream("out_cloud", &out_cloud);
+	registerStream("in_frame_info", &m_stats.in_frame_info);
+	registerStream("out_frame_info", &m_stats.out_frame_info);
 	// Register handlers
-	registerHandler("onNewImage", boost::bind(&PassThrough::onNewImage, this));
+	registerHandler("onNewImage", m_stats.wrap("onNewImage", boost::bind(&PassThrough::onNewImage, this)));
 	addDependency("onNewImage", &in_xyz);
 
+	registerHandler("onNewCloud", m_stats.wrap("onNewCloud", boost::bind(&PassThrough::onNewCloud, this)));
+	addDependency("onNewCloud", &in_cloud);
+
 }
 
 bool PassThrough::onInit() {
-
+	m_stats.init(boost::bind(&PassThrough::addDependency, this, _1, _2));
 	return true;
 }
 
@@ -57,40 +74,39 @@ bool PassThrough::onStart() {
 
 void PassThrough::onNewImage() {
 	cv::Mat img = in_xyz.read().clone();
-	cv::Mat mask = cv::Mat::zeros(img.size(), CV_8UC1);
-	
-	int rows = img.rows;
-	int cols = img.cols;
-	
-	if (img.isContinuous() && mask.isContinuous()) {
-		cols *= rows;
-		rows = 1;
-	}
-	
-	int i,j;
-	float* p;
-	uchar* mp;
-		
-	for( i = 0; i < rows; ++i) {
-		p = img.ptr<float>(i);
-		mp = mask.ptr<uchar>(i);
-		for ( j = 0; j < cols; ++j) {
-			// read point coordinates 
-			float x = p[3*j];
-			float y = p[3*j + 1];
-			float z = p[3*j + 2];
-			
-			if ( (z < z_min) || (z > z_max) ) {
-				p[3*j] = 0;
-				p[3*j+1] = 0;
-				p[3*j+2] = 0;
-			} else if (std::isfinite(z)){
-				mp[j] = 255;
-			}
+	cv::Mat mask;
+	Types::passThrough(img, z_min, z_max, mask);
+
+	m_stats.publish();
+	out_xyz.write(img);
+	out_mask.write(mask);
+}
+
+void PassThrough::onNewCloud() {
+	Types::DepthCloud cloud = in_cloud.read();
+	cv::Mat depth(cloud.size(), CV_16UC1);
+	cv::Mat mask(cloud.size(), CV_8UC1);
+
+	// range in depth units, zero depth is always invalid
+	float scale = cloud.scale();
+	float lo = std::max(1.0f, std::ceil(z_min / scale));
+	float hi = std::min(65535.0f, std::floor(z_max / scale));
+	unsigned short d_min = lo > 65535 ? 65535 : (unsigned short) lo;
+	unsigned short d_max = hi < 0 ? 0 : (unsigned short) hi;
+
+	for (int i = 0; i < depth.rows; ++i) {
+		const unsigned short * src = cloud.depth().ptr<unsigned short>(i);
+		unsigned short * dst = depth.ptr<unsigned short>(i);
+		uchar * mp = mask.ptr<uchar>(i);
+		for (int j = 0; j < depth.cols; ++j) {
+			bool inside = (src[j] >= d_min) && (src[j] <= d_max);
+			dst[j] = inside ? src[j] : 0;
+			mp[j] = inside ? 255 : 0;
 		}
 	}
-	
-	out_xyz.write(img);
+
+	m_stats.publish();
+	out_cloud.write(cloud.withDepth(depth));
 	out_mask.write(mask);
 }
 
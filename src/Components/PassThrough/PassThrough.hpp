@@ -13,6 +13,9 @@
 #include "Base/Property.hpp"
 #include "Base/EventHandler2.hpp"
 
+#include "Types/HandlerStatistics.hpp"
+#include "Types/DepthCloud.hpp"
+
 #include <opencv2/opencv.hpp>
 
 
@@ -69,10 +72,12 @@ protected:
 
 	// Input data streams
 	Base::DataStreamIn<cv::Mat> in_xyz;
+	Base::DataStreamIn<Types::DepthCloud> in_cloud;
 
 	// Output data streams
 	Base::DataStreamOut<cv::Mat> out_xyz;
 	Base::DataStreamOut<cv::Mat> out_mask;
+	Base::DataStreamOut<Types::DepthCloud> out_cloud;
 
 	// Handlers
 
@@ -80,10 +85,16 @@ protected:
 	Base::Property<float> z_min;
 	Base::Property<float> z_max;
 
+	// Handler latency statistics
+	Types::ComponentStatistics m_stats;
+
 	
 	// Handlers
 	void onNewImage();
 
+	/// Filters lazy cloud directly on its depth map, without materializing points.
+	void onNewCloud();
+
 };
 
 } //: namespace PassThrough
@@ -0,0 +1,393 @@
+/*!
+ * \file
+ * \brief
+ */
+
+#include <memory>
+#include <string>
+#include <cmath>
+#include <algorithm>
+
+#include "PlaneExtractor.hpp"
+#include "Common/Logger.hpp"
+
+#include "Types/PointValidity.hpp"
+
+#include <boost/bind.hpp>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace Processors {
+namespace PlaneExtractor {
+
+/*!
+ * Counts grid points closer to the plane than thr, with normal deviating
+ * from plane normal less than acos(cos_thr).
+ */
+static int countInliers(const GridPoints & grid, const cv::Vec4f & plane, float thr, float cos_thr) {
+	const float * x = &grid.x[0];
+	const float * y = &grid.y[0];
+	const float * z = &grid.z[0];
+	const float * nx = &grid.nx[0];
+	const float * ny = &grid.ny[0];
+	const float * nz = &grid.nz[0];
+	int n = grid.size();
+	int count = 0;
+
+	int i = 0;
+#if defined(__SSE2__)
+	const __m128 a = _mm_set1_ps(plane[0]);
+	const __m128 b = _mm_set1_ps(plane[1]);
+	const __m128 c = _mm_set1_ps(plane[2]);
+	const __m128 d = _mm_set1_ps(plane[3]);
+	const __m128 vthr = _mm_set1_ps(thr);
+	const __m128 vcos = _mm_set1_ps(cos_thr);
+	const __m128 vabs = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	__m128i vcount = _mm_setzero_si128();
+	for (; i <= n - 4; i += 4) {
+		__m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, _mm_loadu_ps(x + i)), _mm_mul_ps(b, _mm_loadu_ps(y + i))),
+				_mm_add_ps(_mm_mul_ps(c, _mm_loadu_ps(z + i)), d));
+		__m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, _mm_loadu_ps(nx + i)), _mm_mul_ps(b, _mm_loadu_ps(ny + i))),
+				_mm_mul_ps(c, _mm_loadu_ps(nz + i)));
+		__m128 in = _mm_and_ps(_mm_cmplt_ps(_mm_and_ps(dist, vabs), vthr), _mm_cmpge_ps(_mm_and_ps(dot, vabs), vcos));
+		// mask is -1 for inliers
+		vcount = _mm_sub_epi32(vcount, _mm_castps_si128(in));
+	}
+	int partial[4];
+	_mm_storeu_si128((__m128i *) partial, vcount);
+	count = partial[0] + partial[1] + partial[2] + partial[3];
+#endif
+	for (; i < n; ++i) {
+		float dist = plane[0] * x[i] + plane[1] * y[i] + plane[2] * z[i] + plane[3];
+		float dot = plane[0] * nx[i] + plane[1] * ny[i] + plane[2] * nz[i];
+		if (std::fabs(dist) < thr && std::fabs(dot) >= cos_thr)
+			++count;
+	}
+
+	return count;
+}
+
+/*!
+ * Scores batch of plane hypotheses.
+ */
+class ScoreBody: public cv::ParallelLoopBody {
+public:
+	ScoreBody(const GridPoints & grid, const std::vector<cv::Vec4f> & hypotheses, std::vector<int> & scores, float thr,
+			float cos_thr) :
+		grid(grid), hypotheses(hypotheses), scores(scores), thr(thr), cos_thr(cos_thr) {
+	}
+
+	void operator()(const cv::Range & r) const {
+		for (int h = r.start; h < r.end; ++h)
+			scores[h] = countInliers(grid, hypotheses[h], thr, cos_thr);
+	}
+
+private:
+	const GridPoints & grid;
+	const std::vector<cv::Vec4f> & hypotheses;
+	std::vector<int> & scores;
+	float thr;
+	float cos_thr;
+};
+
+/*!
+ * Assigns every point of the cloud to the closest plane it is inlier of.
+ * Invalid normals don't rule the point out, only distance is checked then.
+ */
+class LabelBody: public cv::ParallelLoopBody {
+public:
+	LabelBody(const cv::Mat & cloud, const cv::Mat & normals, const std::vector<cv::Vec4f> & planes, cv::Mat & labels,
+			float thr, float cos_thr) :
+		cloud(cloud), normals(normals), planes(planes), labels(labels), thr(thr), cos_thr(cos_thr) {
+	}
+
+	void operator()(const cv::Range & r) const {
+		for (int i = r.start; i < r.end; ++i) {
+			const cv::Point3f * p = cloud.ptr<cv::Point3f>(i);
+			const cv::Point3f * n = normals.ptr<cv::Point3f>(i);
+			uchar * l = labels.ptr<uchar>(i);
+			for (int j = 0; j < cloud.cols; ++j) {
+				l[j] = 0;
+				if (!Types::validPoint(p[j]))
+					continue;
+				bool check_normal = Types::validNormal(n[j]);
+				float best = thr;
+				for (size_t k = 0; k < planes.size(); ++k) {
+					const cv::Vec4f & pl = planes[k];
+					float dist = std::fabs(pl[0] * p[j].x + pl[1] * p[j].y + pl[2] * p[j].z + pl[3]);
+					if (dist >= best)
+						continue;
+					if (check_normal) {
+						float dot = pl[0] * n[j].x + pl[1] * n[j].y + pl[2] * n[j].z;
+						if (std::fabs(dot) < cos_thr * cv::norm(n[j]))
+							continue;
+					}
+					best = dist;
+					l[j] = k + 1;
+				}
+			}
+		}
+	}
+
+private:
+	const cv::Mat & cloud;
+	const cv::Mat & normals;
+	const std::vector<cv::Vec4f> & planes;
+	cv::Mat & labels;
+	float thr;
+	float cos_thr;
+};
+
+PlaneExtractor::PlaneExtractor(const std::string & name) :
+		Base::Component(name),
+		prop_max_planes("max_planes", 4),
+		prop_distance_threshold("distance_threshold", 0.01f),
+		prop_angle_threshold("angle_threshold", 20.0f),
+		prop_min_inliers("min_inliers", 2000),
+		prop_grid_step("grid_step", 4),
+		prop_probability("probability", 0.99f),
+		prop_max_iterations("max_iterations", 512),
+		prop_batch_size("batch_size", 32),
+		m_stats(name) {
+	registerProperty(prop_max_planes);
+	registerProperty(prop_distance_threshold);
+	registerProperty(prop_angle_threshold);
+	registerProperty(prop_min_inliers);
+	registerProperty(prop_grid_step);
+	registerProperty(prop_probability);
+	registerProperty(prop_max_iterations);
+	registerProperty(prop_batch_size);
+	registerProperty(m_stats.prop_statistics);
+	registerProperty(m_stats.prop_statistics_period);
+	registerProperty(m_stats.prop_trace_file);
+	registerProperty(m_stats.prop_allocations);
+	registerProperty(m_stats.prop_frame_sync);
+}
+
+PlaneExtractor::~PlaneExtractor() {
+}
+
+void PlaneExtractor::prepareInterface() {
+	// Register data streams, events and event handlers HERE!
+	registerStream("in_xyz", &in_xyz);
+	registerStream("in_normals", &in_normals);
+	registerStream("out_planes", &out_planes);
+	registerStream("out_labels", &out_labels);
+	registerStream("in_frame_info", &m_stats.in_frame_info);
+	registerStream("out_frame_info", &m_stats.out_frame_info);
+
+	// Register handlers
+	registerHandler("onNewCloud", m_stats.wrap("onNewCloud", boost::bind(&PlaneExtractor::onNewCloud, this)));
+	addDependency("onNewCloud", &in_xyz);
+	addDependency("onNewCloud", &in_normals);
+}
+
+bool PlaneExtractor::onInit() {
+	m_stats.init(boost::bind(&PlaneExtractor::addDependency, this, _1, _2));
+	return true;
+}
+
+bool PlaneExtractor::onFinish() {
+	return true;
+}
+
+bool PlaneExtractor::onStop() {
+	return true;
+}
+
+bool PlaneExtractor::onStart() {
+	return true;
+}
+
+void PlaneExtractor::sample(const cv::Mat & cloud, const cv::Mat & normals) {
+	int step = std::max(1, (int) prop_grid_step);
+	m_grid.clear();
+	for (int i = step / 2; i < cloud.rows; i += step) {
+		const cv::Point3f * p = cloud.ptr<cv::Point3f>(i);
+		const cv::Point3f * n = normals.ptr<cv::Point3f>(i);
+		for (int j = step / 2; j < cloud.cols; j += step) {
+			if (!Types::validPoint(p[j]) || !Types::validNormal(n[j]))
+				continue;
+			m_grid.push_back(p[j], n[j] * (1.0f / cv::norm(n[j])));
+		}
+	}
+}
+
+int PlaneExtractor::findPlane(cv::Vec4f & plane) {
+	int n = m_grid.size();
+	if (n < 3)
+		return 0;
+
+	float thr = prop_distance_threshold;
+	float cos_thr = std::cos(prop_angle_threshold * CV_PI / 180);
+	int batch = std::max(1, (int) prop_batch_size);
+	int max_iterations = std::max(1, (int) prop_max_iterations);
+	double probability = std::min(std::max((double) prop_probability, 0.5), 0.9999);
+
+	m_hypotheses.resize(batch);
+	m_scores.resize(batch);
+
+	int best = 0;
+	int needed = max_iterations;
+	for (int it = 0; it < needed; it += batch) {
+		// single point with its normal is enough to define the plane
+		for (int h = 0; h < batch; ++h) {
+			int i = m_rng.uniform(0, n);
+			float a = m_grid.nx[i], b = m_grid.ny[i], c = m_grid.nz[i];
+			m_hypotheses[h] = cv::Vec4f(a, b, c, -(a * m_grid.x[i] + b * m_grid.y[i] + c * m_grid.z[i]));
+		}
+
+		cv::parallel_for_(cv::Range(0, batch), ScoreBody(m_grid, m_hypotheses, m_scores, thr, cos_thr));
+
+		for (int h = 0; h < batch; ++h) {
+			if (m_scores[h] > best) {
+				best = m_scores[h];
+				plane = m_hypotheses[h];
+			}
+		}
+
+		// adaptive termination, probability of drawing only outliers in all
+		// iterations has to drop below 1 - probability
+		double w = (double) best / n;
+		if (w >= 1)
+			break;
+		if (w > 0)
+			needed = std::min(max_iterations, (int) std::ceil(std::log(1 - probability) / std::log(1 - w)));
+	}
+
+	return best;
+}
+
+void PlaneExtractor::refine(cv::Vec4f & plane) {
+	float thr = prop_distance_threshold;
+	float cos_thr = std::cos(prop_angle_threshold * CV_PI / 180);
+
+	double cx = 0, cy = 0, cz = 0;
+	double xx = 0, xy = 0, xz = 0, yy = 0, yz = 0, zz = 0;
+	int count = 0;
+	for (size_t i = 0; i < m_grid.size(); ++i) {
+		float x = m_grid.x[i], y = m_grid.y[i], z = m_grid.z[i];
+		float dist = plane[0] * x + plane[1] * y + plane[2] * z + plane[3];
+		float dot = plane[0] * m_grid.nx[i] + plane[1] * m_grid.ny[i] + plane[2] * m_grid.nz[i];
+		if (std::fabs(dist) >= thr || std::fabs(dot) < cos_thr)
+			continue;
+		cx += x;
+		cy += y;
+		cz += z;
+		xx += x * x;
+		xy += x * y;
+		xz += x * z;
+		yy += y * y;
+		yz += y * z;
+		zz += z * z;
+		++count;
+	}
+	if (count < 3)
+		return;
+
+	cx /= count;
+	cy /= count;
+	cz /= count;
+	cv::Mat cov(3, 3, CV_64FC1);
+	cov.at<double>(0, 0) = xx / count - cx * cx;
+	cov.at<double>(0, 1) = cov.at<double>(1, 0) = xy / count - cx * cy;
+	cov.at<double>(0, 2) = cov.at<double>(2, 0) = xz / count - cx * cz;
+	cov.at<double>(1, 1) = yy / count - cy * cy;
+	cov.at<double>(1, 2) = cov.at<double>(2, 1) = yz / count - cy * cz;
+	cov.at<double>(2, 2) = zz / count - cz * cz;
+
+	// eigenvectors are sorted by descending eigenvalues, normal is the last one
+	cv::Mat values, vectors;
+	cv::eigen(cov, values, vectors);
+	double a = vectors.at<double>(2, 0), b = vectors.at<double>(2, 1), c = vectors.at<double>(2, 2);
+	if (a * plane[0] + b * plane[1] + c * plane[2] < 0) {
+		a = -a;
+		b = -b;
+		c = -c;
+	}
+	plane = cv::Vec4f(a, b, c, -(a * cx + b * cy + c * cz));
+}
+
+void PlaneExtractor::removeInliers(const cv::Vec4f & plane) {
+	float thr = prop_distance_threshold;
+	float cos_thr = std::cos(prop_angle_threshold * CV_PI / 180);
+
+	size_t k = 0;
+	for (size_t i = 0; i < m_grid.size(); ++i) {
+		float dist = plane[0] * m_grid.x[i] + plane[1] * m_grid.y[i] + plane[2] * m_grid.z[i] + plane[3];
+		float dot = plane[0] * m_grid.nx[i] + plane[1] * m_grid.ny[i] + plane[2] * m_grid.nz[i];
+		if (std::fabs(dist) < thr && std::fabs(dot) >= cos_thr)
+			continue;
+		m_grid.x[k] = m_grid.x[i];
+		m_grid.y[k] = m_grid.y[i];
+		m_grid.z[k] = m_grid.z[i];
+		m_grid.nx[k] = m_grid.nx[i];
+		m_grid.ny[k] = m_grid.ny[i];
+		m_grid.nz[k] = m_grid.nz[i];
+		++k;
+	}
+	m_grid.x.resize(k);
+	m_grid.y.resize(k);
+	m_grid.z.resize(k);
+	m_grid.nx.resize(k);
+	m_grid.ny.resize(k);
+	m_grid.nz.resize(k);
+}
+
+void PlaneExtractor::onNewCloud() {
+	cv::Mat cloud = in_xyz.read();
+	cv::Mat normals = in_normals.read();
+	if (cloud.type() != CV_32FC3 || normals.type() != CV_32FC3) {
+		CLOG(LERROR) << "Wrong cloud or normals type, CV_32FC3 expected";
+		m_stats.skip();
+		return;
+	}
+	if (cloud.size() != normals.size()) {
+		CLOG(LERROR) << "Cloud and normals sizes differ";
+		m_stats.skip();
+		return;
+	}
+
+	sample(cloud, normals);
+
+	// minimal number of inliers on the grid
+	int step = std::max(1, (int) prop_grid_step);
+	int min_inliers = std::max(3, prop_min_inliers / (step * step));
+	int max_planes = std::min((int) prop_max_planes, 255);
+
+	std::vector<cv::Vec4f> planes;
+	for (int k = 0; k < max_planes; ++k) {
+		cv::Vec4f plane;
+		if (findPlane(plane) < min_inliers)
+			break;
+
+		refine(plane);
+		removeInliers(plane);
+
+		// orient normal towards the camera
+		if (plane[3] < 0)
+			plane = cv::Vec4f(-plane[0], -plane[1], -plane[2], -plane[3]);
+		planes.push_back(plane);
+	}
+
+	cv::Mat labels(cloud.size(), CV_8UC1);
+	float cos_thr = std::cos(prop_angle_threshold * CV_PI / 180);
+	cv::parallel_for_(cv::Range(0, cloud.rows),
+			LabelBody(cloud, normals, planes, labels, prop_distance_threshold, cos_thr));
+
+	cv::Mat out(planes.size(), 4, CV_32FC1);
+	for (size_t k = 0; k < planes.size(); ++k)
+		for (int c = 0; c < 4; ++c)
+			out.at<float>(k, c) = planes[k][c];
+
+	CLOG(LDEBUG) << "PlaneExtractor: " << planes.size() << " planes";
+
+	m_stats.publish();
+	out_labels.write(labels);
+	out_planes.write(out);
+}
+
+} //: namespace PlaneExtractor
+} //: namespace Processors
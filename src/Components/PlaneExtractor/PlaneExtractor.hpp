@@ -0,0 +1,178 @@
+/*!
+ * \file
+ * \brief
+ */
+
+#ifndef PLANEEXTRACTOR_HPP_
+#define PLANEEXTRACTOR_HPP_
+
+#include "Base/Component_Aux.hpp"
+#include "Base/Component.hpp"
+#include "Base/DataStream.hpp"
+#include "Base/Property.hpp"
+#include "Base/EventHandler2.hpp"
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "Types/HandlerStatistics.hpp"
+
+namespace Processors {
+namespace PlaneExtractor {
+
+/// Points of subsampled grid, stored as separate arrays for vectorized scoring.
+struct GridPoints {
+	std::vector<float> x, y, z;
+	std::vector<float> nx, ny, nz;
+
+	size_t size() const {
+		return x.size();
+	}
+
+	void clear() {
+		x.clear();
+		y.clear();
+		z.clear();
+		nx.clear();
+		ny.clear();
+		nz.clear();
+	}
+
+	void push_back(const cv::Point3f & p, const cv::Point3f & n) {
+		x.push_back(p.x);
+		y.push_back(p.y);
+		z.push_back(p.z);
+		nx.push_back(n.x);
+		ny.push_back(n.y);
+		nz.push_back(n.z);
+	}
+};
+
+/*!
+ * \class PlaneExtractor
+ * \brief PlaneExtractor processor class.
+ *
+ * Extracts dominant planes from organized cloud (in_xyz) and its normals
+ * (in_normals, from NormalEstimator or DepthNormalEstimator). Planes are
+ * found one after another with RANSAC over points subsampled on regular
+ * grid. Each hypothesis is built from single point and its normal, batches
+ * of hypotheses are scored in parallel and sampling stops as soon as the
+ * best plane is found with given probability.
+ *
+ * out_planes holds one row (a, b, c, d) per plane, with ax + by + cz + d = 0
+ * and unit normal facing the camera. out_labels is CV_8UC1 image with index
+ * of the plane (starting from 1) each point belongs to, 0 for the rest.
+ */
+class PlaneExtractor: public Base::Component {
+public:
+	/*!
+	 * Constructor.
+	 */
+	PlaneExtractor(const std::string & name = "PlaneExtractor");
+
+	/*!
+	 * Destructor
+	 */
+	virtual ~PlaneExtractor();
+
+	/*!
+	 * Prepare components interface (register streams and handlers).
+	 * At this point, all properties are already initialized and loaded to
+	 * values set in config file.
+	 */
+	void prepareInterface();
+
+protected:
+
+	/*!
+	 * Connects source to given device.
+	 */
+	bool onInit();
+
+	/*!
+	 * Disconnect source from device, closes streams, etc.
+	 */
+	bool onFinish();
+
+	/*!
+	 * Start component
+	 */
+	bool onStart();
+
+	/*!
+	 * Stop component
+	 */
+	bool onStop();
+
+
+	// Input data streams
+	Base::DataStreamIn<cv::Mat> in_xyz;
+	Base::DataStreamIn<cv::Mat> in_normals;
+
+	// Output data streams
+	Base::DataStreamOut<cv::Mat> out_planes;
+	Base::DataStreamOut<cv::Mat> out_labels;
+
+	// Properties
+
+	/// Maximal number of planes extracted from single frame.
+	Base::Property<int> prop_max_planes;
+
+	/// Maximal point to plane distance of inliers (in meters).
+	Base::Property<float> prop_distance_threshold;
+
+	/// Maximal angle between point normal and plane normal of inliers (in degrees).
+	Base::Property<float> prop_angle_threshold;
+
+	/// Planes with less inliers (estimated on full image from grid count) are dropped.
+	Base::Property<int> prop_min_inliers;
+
+	/// Distance between grid points used for plane search (in pixels).
+	Base::Property<int> prop_grid_step;
+
+	/// Required probability of finding the best plane.
+	Base::Property<float> prop_probability;
+
+	/// Maximal number of hypotheses per plane.
+	Base::Property<int> prop_max_iterations;
+
+	/// Number of hypotheses scored in parallel.
+	Base::Property<int> prop_batch_size;
+
+	/// Handler latency statistics
+	Types::ComponentStatistics m_stats;
+
+	// Handlers
+	void onNewCloud();
+
+private:
+	/// Fills m_grid with valid points (and normals) from every grid_step pixel.
+	void sample(const cv::Mat & cloud, const cv::Mat & normals);
+
+	/// Finds best plane among remaining grid points, returns number of its inliers.
+	int findPlane(cv::Vec4f & plane);
+
+	/// Least squares fit to grid inliers of given plane.
+	void refine(cv::Vec4f & plane);
+
+	/// Removes inliers of given plane from grid.
+	void removeInliers(const cv::Vec4f & plane);
+
+	GridPoints m_grid;
+
+	std::vector<cv::Vec4f> m_hypotheses;
+	std::vector<int> m_scores;
+
+	cv::RNG m_rng;
+};
+
+} //: namespace PlaneExtractor
+} //: namespace Processors
+
+/*
+ * Register processor component.
+ */
+REGISTER_COMPONENT("PlaneExtractor", Processors::PlaneExtractor::PlaneExtractor)
+
+#endif /* PLANEEXTRACTOR_HPP_ */
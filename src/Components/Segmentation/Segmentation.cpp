@@ -5,13 +5,14 @@
 
 #include <memory>
 #include <string>
-#include <queue>
-#include <cstdlib>
-#include <functional>
-#include <numeric>
+#include <algorithm>
 
 #include "Segmentation.hpp"
 #include "Common/Logger.hpp"
+#include "Common/Timer.hpp"
+
+#include "Types/Decimation.hpp"
+#include "Types/ReferenceKernels.hpp"
 
 #include <boost/bind.hpp>
 
@@ -21,50 +22,22 @@ namespace Processors {
 namespace Segmentation {
 
 
-double compareNormals(unsigned char* v1, unsigned char* v2, double n) {
-	cv::Point3f * curn = (cv::Point3f*)v1;
-	cv::Point3f * desn = (cv::Point3f*)v2;
-	double dn = 180. / 3.14 * acos(curn->dot(*desn));
-	dn = (dn < 180 ? dn : 0);
-	return dn / n;
-}
-
-double compareColors(unsigned char* v1, unsigned char* v2, double n) {
-	typedef cv::Point3_<uchar> Point3u;
-	Point3u *curc = (Point3u*)v1;
-	Point3u *desc = (Point3u*)v2;
-
-	cv::Point3f distc = *desc;
-	cv::Point3f distc2 = *curc;
-	distc -= distc2;
-	distc *= 1. / 255;
-
-	return norm(distc) / n;
-}
-
-double comparePositions(unsigned char* v1, unsigned char* v2, double n) {
-	cv::Point3f *curp = (cv::Point3f*)v1;
-	cv::Point3f *desp = (cv::Point3f*)v2;
-	double dp = norm(*desp - *curp);
-	dp = (dp < 10 ? dp : 0);
-	return dp / n;
-}
-
-double accumulateSum(std::vector<double> values) {
-	return std::accumulate(values.begin(), values.end(), 0);
-}
-
-double accumulateMax(std::vector<double> values) {
-	return *std::max_element(values.begin(), values.end());
-}
-
 Segmentation::Segmentation(const std::string & name) :
 		Base::Component(name),
 		prop_ang_diff("ang_diff", 2.0f),
 		prop_dist_diff("dist_diff", 0.02f),
 		prop_color_diff("color_diff", 2.0f),
 		prop_std_diff("std_diff", 2.0f),
-		prop_threshold("threshold", 3.0f) {
+		prop_threshold("threshold", 3.0f),
+		prop_decimation("decimation", 1),
+		prop_async("async", false),
+		prop_verify("verify", false),
+		prop_algorithm("algorithm", std::string("growing")),
+		prop_graph_k("graph_k", 10.0f),
+		prop_min_size("min_size", 20),
+		prop_connectivity("connectivity", 4),
+		m_stats(name),
+		m_graph_buffers(new Types::RegionGrowing::GraphBuffers) {
 	LOG(LTRACE)<< "Hello Segmentation\n";
 
 	registerProperty(prop_ang_diff);
@@ -72,6 +45,21 @@ Segmentation::Segmentation(const std::string & name) :
 	registerProperty(prop_color_diff);
 	registerProperty(prop_std_diff);
 	registerProperty(prop_threshold);
+	registerProperty(prop_decimation);
+	registerProperty(prop_async);
+	registerProperty(prop_verify);
+	registerProperty(prop_algorithm);
+	registerProperty(prop_graph_k);
+	registerProperty(prop_min_size);
+	registerProperty(prop_connectivity);
+
+	registerProperty(m_stats.prop_statistics);
+	registerProperty(m_stats.prop_statistics_period);
+	registerProperty(m_stats.prop_trace_file);
+	registerProperty(m_stats.prop_allocations);
+	registerProperty(m_stats.prop_frame_sync);
+	m_async_stats = m_stats.add("async");
+	m_verify_stats = m_stats.add("verify");
 }
 
 Segmentation::~Segmentation() {
@@ -86,35 +74,63 @@ void Segmentation::prepareInterface() {
 	registerStream("in_normals", &in_normals);
 
 	registerStream("out_img", &out_img);
+	registerStream("out_labels", &out_labels);
+	registerStream("in_frame_info", &m_stats.in_frame_info);
+	registerStream("out_frame_info", &m_stats.out_frame_info);
 
-	h_onColor.setup(boost::bind(&Segmentation::onNewData, this, true, false, false));
+	h_onColor.setup(m_stats.wrap("onColor", boost::bind(&Segmentation::onNewData, this, true, false, false, false)));
 	registerHandler("onColor", &h_onColor);
 	addDependency("onColor", &in_color);
 
-	h_onColorDepth.setup(boost::bind(&Segmentation::onNewData, this, true, true, false));
+	h_onColorDepth.setup(m_stats.wrap("onColorDepth", boost::bind(&Segmentation::onNewData, this, true, true, false, false)));
 	registerHandler("onColorDepth", &h_onColorDepth);
 	addDependency("onColorDepth", &in_color);
 	addDependency("onColorDepth", &in_depth);
 
-	h_onColorDepthNormals.setup(boost::bind(&Segmentation::onNewData, this, true, true, true));
+	h_onColorDepthNormals.setup(m_stats.wrap("onColorDepthNormals", boost::bind(&Segmentation::onNewData, this, true, true, true, false)));
 	registerHandler("onColorDepthNormals", &h_onColorDepthNormals);
 	addDependency("onColorDepthNormals", &in_color);
 	addDependency("onColorDepthNormals", &in_depth);
 	addDependency("onColorDepthNormals", &in_normals);
 
-	h_onDepth.setup(boost::bind(&Segmentation::onNewData, this, false, true, false));
+	h_onDepth.setup(m_stats.wrap("onDepth", boost::bind(&Segmentation::onNewData, this, false, true, false, false)));
 	registerHandler("onDepth", &h_onDepth);
 	addDependency("onDepth", &in_depth);
 
-	h_onDepthNormals.setup(boost::bind(&Segmentation::onNewData, this, false, true, true));
+	h_onDepthNormals.setup(m_stats.wrap("onDepthNormals", boost::bind(&Segmentation::onNewData, this, false, true, true, false)));
 	registerHandler("onDepthNormals", &h_onDepthNormals);
 	addDependency("onDepthNormals", &in_depth);
 	addDependency("onDepthNormals", &in_normals);
+
+	registerStream("in_edges", &in_edges);
+
+	// lazy cloud variants, points are computed from depth only for compared pairs
+	registerStream("in_depth_cloud", &in_depth_cloud);
+
+	h_onColorDepthCloud.setup(m_stats.wrap("onColorDepthCloud", boost::bind(&Segmentation::onNewData, this, true, true, false, true)));
+	registerHandler("onColorDepthCloud", &h_onColorDepthCloud);
+	addDependency("onColorDepthCloud", &in_color);
+	addDependency("onColorDepthCloud", &in_depth_cloud);
+
+	h_onColorDepthCloudNormals.setup(m_stats.wrap("onColorDepthCloudNormals", boost::bind(&Segmentation::onNewData, this, true, true, true, true)));
+	registerHandler("onColorDepthCloudNormals", &h_onColorDepthCloudNormals);
+	addDependency("onColorDepthCloudNormals", &in_color);
+	addDependency("onColorDepthCloudNormals", &in_depth_cloud);
+	addDependency("onColorDepthCloudNormals", &in_normals);
+
+	h_onDepthCloud.setup(m_stats.wrap("onDepthCloud", boost::bind(&Segmentation::onNewData, this, false, true, false, true)));
+	registerHandler("onDepthCloud", &h_onDepthCloud);
+	addDependency("onDepthCloud", &in_depth_cloud);
+
+	h_onDepthCloudNormals.setup(m_stats.wrap("onDepthCloudNormals", boost::bind(&Segmentation::onNewData, this, false, true, true, true)));
+	registerHandler("onDepthCloudNormals", &h_onDepthCloudNormals);
+	addDependency("onDepthCloudNormals", &in_depth_cloud);
+	addDependency("onDepthCloudNormals", &in_normals);
 }
 
 bool Segmentation::onInit() {
 	LOG(LTRACE)<< "Segmentation::initialize\n";
-
+	m_stats.init(boost::bind(&Segmentation::addDependency, this, _1, _2));
 	return true;
 }
 
@@ -134,7 +150,7 @@ bool Segmentation::check(cv::Point point, cv::Point dir) {
 
 	cv::Point dest = point + dir;
 
-	if (!dest.inside(cv::Rect(0, 0, 639, 479)))
+	if (!dest.inside(cv::Rect(0, 0, m_normals.cols - 1, m_normals.rows - 1)))
 		return false;
 
 	if (m_closed.at<uchar>(dest) == 255)
@@ -166,140 +182,114 @@ bool Segmentation::check(cv::Point point, cv::Point dir) {
 	return difference < ts;
 }
 
-bool Segmentation::check(cv::Point point, cv::Point dir,
-		std::vector<cv::Mat> inputs, std::vector<Comparator> comparators,
-		std::vector<double> thresholds, Accumulator accumulator, double threshold) {
+void Segmentation::onNewData(bool color, bool depth, bool normals, bool cloud) {
+	CLOG(LTRACE) << "OnNewData " << color << depth << normals << cloud;
+	Types::RegionGrowing growing;
+	growing.setGraphBuffers(m_graph_buffers);
 
-	cv::Point dest = point + dir;
+	int n = prop_decimation;
+	if (n != 1 && n != 2 && n != 4) {
+		CLOG(LWARNING) << "Decimation " << n << " not supported, using 1";
+		n = 1;
+	}
+	growing.setDecimation(n);
 
-	// check, if given direction lays inside image
-	// TODO: check real size of image
-	if (!dest.inside(cv::Rect(0, 0, 639, 479)))
-		return false;
+	// worker needs own copies of all inputs, as their buffers are reused with next frames
+	bool async = m_async.running();
 
-	// ignore already segmented points
-	if (m_closed.at<uchar>(dest) == 255)
-		return false;
-
-	// mark point as segmented
-	m_closed.at<uchar>(dest) = 255;
+	// color is box averaged, geometry strided, so that invalid points aren't mixed in
+	cv::Size size;
+	if (color) {
+		cv::Mat img = in_color.read();
+		size = img.size();
+		growing.addInput(Types::decimateAverage(img, n).clone(), compareColors, prop_color_diff);
+	}
 
-	// intermediate results
-	std::vector<double> results;
+	if (depth && cloud) {
+		Types::DepthCloud depth_cloud = in_depth_cloud.read();
+		if (async)
+			depth_cloud = Types::DepthCloud(depth_cloud.depth().clone(), depth_cloud.rayTable(), depth_cloud.scale());
+		size = depth_cloud.depth().size();
+		growing.addLazyInput(depth_cloud, n, comparePositions, prop_dist_diff);
+	} else if (depth) {
+		cv::Mat img = in_depth.read();
+		size = img.size();
+		growing.addInput(Types::decimate(img, n).clone(), comparePositions, prop_dist_diff);
+	}
+	if (normals) {
+		cv::Mat img = in_normals.read();
+		size = img.size();
+		growing.addInput(Types::decimate(img, n).clone(), compareNormals, prop_ang_diff);
+	}
 
-	// iterate over all available inputs
-	for (int i = 0; i < inputs.size(); ++i) {
-		cv::Mat img = inputs[i];
-		unsigned char * v1 = img.data + point.y * img.step + point.x * img.elemSize();
-		unsigned char * v2 = img.data + dest.y * img.step + dest.x * img.elemSize();
-		results.push_back(comparators[i](v1, v2, thresholds[i]));
+	if (!growing.valid()) {
+		CLOG(LERROR) << "Input sizes don't match";
+		m_stats.skip();
+		return;
 	}
 
-	// accumulate intermediate results
-	double result = accumulator(results);
+	if (!in_edges.empty()) {
+		cv::Mat mask = in_edges.read();
+		if (mask.size() != size || mask.type() != CV_8UC1)
+			CLOG(LWARNING) << "Edge mask doesn't match input, ignoring it";
+		else
+			growing.setEdges(Types::decimateOr(async ? mask.clone() : mask, n));
+	}
 
-	return result < threshold;
+	m_async.execute(boost::bind(&Segmentation::segment, this, growing, params(), m_stats.frame()));
 }
 
-cv::Mat Segmentation::multimodalSegmentation(std::vector<cv::Mat> inputs,
-		std::vector<Comparator> comparators, std::vector<double> thresholds,
-		Accumulator accumulator, double threshold) {
-
-
-	typedef cv::Point3_<uchar> CvColor;
-
-	m_clusters = cv::Mat::zeros(cv::Size(640, 480), CV_8UC3);
-	m_closed = cv::Mat::zeros(cv::Size(640, 480), CV_8UC1);
-
-	CvColor empty(0, 0, 0);
-
-	std::queue<cv::Point> open;
-	std::queue<cv::Point> seed;
-
-	// initialize seeds in regular 10x10 grid
-	for (int x = 0; x < 640; x += 10)
-		for (int y = 0; y < 480; y += 10)
-			seed.push(cv::Point(x, y));
-
-	// definition of all possible directions
-	cv::Point right(1, 0);
-	cv::Point left(-1, 0);
-	cv::Point up(0, -1);
-	cv::Point down(0, 1);
-
-	// repeat until we still have some seed points
-	while (!seed.empty()) {
-		// create new, empty list of open points
-		open = std::queue<cv::Point>();
-
-		// get first seed
-		cv::Point pt = seed.front();
-		seed.pop();
-
-		// ignore already segmented seeds
-		if (m_clusters.at<CvColor>(pt) != empty) {
-			continue;
-		}
-
-		// generate random color for new segment
-		cv::Point3i id(0, rand() % 128, rand() % 128);
-
-		cv::Point3f point_mean(0, 0, 0);
-		open.push(pt);
-		float acc = 0;
-		float acc2 = 0;
-		float angle;
-
-		LOG(LDEBUG)<< "Growing";
-		// growing segment
-		while (!open.empty()) {
+Segmentation::Params Segmentation::params() const {
+	Params params;
+	std::string algorithm = prop_algorithm;
+	params.graph = algorithm == "graph";
+	if (!params.graph && algorithm != "growing")
+		CLOG(LWARNING) << "Unknown algorithm " << algorithm << ", using growing";
+
+	params.threshold = prop_threshold;
+	params.graph_k = prop_graph_k;
+	params.min_size = prop_min_size;
+	params.connectivity8 = prop_connectivity == 8;
+	params.verify = prop_verify;
+	return params;
+}
 
-			cv::Point curpoint = open.front();
-			open.pop();
-			if (m_clusters.at<CvColor>(curpoint) != empty)
-				continue;
+void Segmentation::segment(Types::RegionGrowing growing, Params params, Types::FrameInfo info) {
+	cv::Mat ret;
+	if (params.graph)
+		ret = growing.segmentGraph(accumulateSumExact, params.graph_k, params.min_size, params.connectivity8);
+	else
+		ret = growing.segment(accumulateSum, params.threshold);
 
-			m_clusters.at<CvColor>(curpoint) = id;
+	m_async.complete(boost::bind(&Segmentation::write, this, Types::LabelRuns(growing.labels()), ret.clone(), info));
 
-			if (check(curpoint, right, inputs, comparators, thresholds, accumulator, threshold))
-				open.push(curpoint + right);
-			if (check(curpoint, left, inputs, comparators, thresholds, accumulator, threshold))
-				open.push(curpoint + left);
-			if (check(curpoint, up, inputs, comparators, thresholds, accumulator, threshold))
-				open.push(curpoint + up);
-			if (check(curpoint, down, inputs, comparators, thresholds, accumulator, threshold))
-				open.push(curpoint + down);
-		}
-	}
+	// reference knows nothing about edges, nor about graph algorithm
+	if (params.verify && !params.graph && !growing.hasEdges())
+		verify(growing, params.threshold);
+}
 
-	return m_clusters;
+void Segmentation::write(Types::LabelRuns labels, cv::Mat img, Types::FrameInfo info) {
+	m_stats.publish(info);
+	out_labels.write(labels);
+	out_img.write(img);
 }
 
-void Segmentation::onNewData(bool color, bool depth, bool normals) {
-	CLOG(LTRACE) << "OnNewData " << color << depth << normals;
-	std::vector<cv::Mat> inputs;
-	std::vector<Comparator> comparators;
-	std::vector<double> thresholds;
+void Segmentation::verify(const Types::RegionGrowing & growing, float threshold) {
+	Common::Timer timer;
+	timer.restart();
 
-	if (color) {
-		inputs.push_back(in_color.read().clone());
-		comparators.push_back(compareColors);
-		thresholds.push_back(prop_color_diff);
-	}
-	if (depth) {
-		inputs.push_back(in_depth.read().clone());
-		comparators.push_back(comparePositions);
-		thresholds.push_back(prop_dist_diff);
-	}
-	if (normals) {
-		inputs.push_back(in_normals.read().clone());
-		comparators.push_back(compareNormals);
-		thresholds.push_back(prop_ang_diff);
+	Types::Reference::SegmentationCheck check = Types::Reference::compareSegmentation(growing, cv::theRNG().next(),
+			threshold);
+	if (check == Types::Reference::SEGMENTS_INCOMPARABLE) {
+		CLOG(LDEBUG) << "Segments not comparable with reference (comparator without reference copy)";
+		return;
 	}
 
-	cv::Mat ret = multimodalSegmentation(inputs, comparators, thresholds, accumulateSum, prop_threshold);
-
-	out_img.write(ret.clone());
+	m_verify_stats->call(timer.elapsed());
+	if (check == Types::Reference::SEGMENTS_DIFFER) {
+		CLOG(LERROR) << "Segments differ from reference";
+		m_verify_stats->skip();
+	}
 }
 
 bool Segmentation::newSeed(cv::Point point, cv::Point dir) {
@@ -307,10 +297,17 @@ bool Segmentation::newSeed(cv::Point point, cv::Point dir) {
 }
 
 bool Segmentation::onStop() {
+	if (m_async.running()) {
+		m_async.stop();
+		m_async.flush();
+		LOG(LINFO) << "Async worker dropped " << m_async.dropped() << " frames";
+	}
 	return true;
 }
 
 bool Segmentation::onStart() {
+	if (prop_async)
+		m_async.start(m_async_stats, m_stats.tracker());
 	return true;
 }
 
@@ -12,21 +12,29 @@
 #include "Base/Property.hpp"
 #include "Base/EventHandler2.hpp"
 
+#include "Types/HandlerStatistics.hpp"
+#include "Types/DepthCloud.hpp"
+#include "Types/EdgeMask.hpp"
+#include "Types/RegionGrowing.hpp"
+#include "Types/LabelRuns.hpp"
+#include "Types/AsyncStage.hpp"
+
+#include <string>
+
 #include <opencv2/core/core.hpp>
 
 namespace Processors {
 namespace Segmentation {
 
-typedef double (*Comparator)(unsigned char *, unsigned char *, double);
-
-double compareNormals(unsigned char * v1, unsigned char * v2, double n);
-double compareColors(unsigned char * v1, unsigned char * v2, double n);
-double comparePositions(unsigned char * v1, unsigned char * v2, double n);
-
-typedef double (*Accumulator)(std::vector<double>);
+using Types::Comparator;
+using Types::compareNormals;
+using Types::compareColors;
+using Types::comparePositions;
 
-double accumulateSum(std::vector<double> values);
-double accumulateMax(std::vector<double> values);
+using Types::Accumulator;
+using Types::accumulateSum;
+using Types::accumulateSumExact;
+using Types::accumulateMax;
 
 /*!
  * \class Segmentation
@@ -79,6 +87,14 @@ protected:
 
 	Base::EventHandler2 h_onDepthNormals;
 
+	Base::EventHandler2 h_onColorDepthCloud;
+
+	Base::EventHandler2 h_onColorDepthCloudNormals;
+
+	Base::EventHandler2 h_onDepthCloud;
+
+	Base::EventHandler2 h_onDepthCloudNormals;
+
 	/// Input data stream
 	Base::DataStreamIn<cv::Mat> in_depth;
 
@@ -88,9 +104,18 @@ protected:
 	/// Input data stream
 	Base::DataStreamIn<cv::Mat> in_normals;
 
+	/// Input data stream - lazy cloud, alternative to in_depth
+	Base::DataStreamIn<Types::DepthCloud> in_depth_cloud;
+
+	/// Input data stream - optional edge mask (DepthEdges), edges are never crossed
+	Base::DataStreamIn<cv::Mat, Base::DataStreamBuffer::Newest> in_edges;
+
 	/// Output data stream - processed image
 	Base::DataStreamOut<cv::Mat> out_img;
 
+	/// Output data stream - segment labels, run-length encoded
+	Base::DataStreamOut<Types::LabelRuns> out_labels;
+
 	// Tc
 	Base::Property<float> prop_color_diff;
 
@@ -105,12 +130,55 @@ protected:
 
 	Base::Property<float> prop_std_diff;
 
+	/// Segments every n-th pixel (1, 2 or 4), output is n times smaller.
+	Base::Property<int> prop_decimation;
+
+	/// Segmentation done by worker thread, handlers return immediately (newest frame wins).
+	Base::Property<bool> prop_async;
+
+	/// Checks every segmentation (without edges) against reference implementation.
+	Base::Property<bool> prop_verify;
+
+	/// Segmentation algorithm: growing (from seed grid) or graph (Felzenszwalb-Huttenlocher).
+	Base::Property<std::string> prop_algorithm;
+
+	/// Graph algorithm: scale of segments, larger values give larger ones.
+	Base::Property<float> prop_graph_k;
+
+	/// Graph algorithm: minimal segment size (in points of segmented grid).
+	Base::Property<int> prop_min_size;
+
+	/// Graph algorithm: neighbourhood, 4 or 8.
+	Base::Property<int> prop_connectivity;
+
+	/// Handler latency statistics
+	Types::ComponentStatistics m_stats;
+
 private:
 
-	void onNewData(bool color, bool depth, bool normals);
+	void onNewData(bool color, bool depth, bool normals, bool cloud);
+
+	/// Properties of segmentation, read by handler for the worker.
+	struct Params {
+		bool graph;
+		float threshold;
+		float graph_k;
+		int min_size;
+		bool connectivity8;
+		bool verify;
+	};
 
-	cv::Mat multimodalSegmentation(std::vector<cv::Mat> inputs, std::vector<Comparator> comparators, std::vector<double> thresholds, Accumulator accumulator, double threshold);
-	bool check(cv::Point point, cv::Point dir, std::vector<cv::Mat> inputs, std::vector<Comparator> comparators, std::vector<double> thresholds, Accumulator accumulator, double threshold);
+	/// Current values of properties of segmentation.
+	Params params() const;
+
+	/// Segments single frame, runs on worker thread in async mode.
+	void segment(Types::RegionGrowing growing, Params params, Types::FrameInfo info);
+
+	/// Writes segmentation together with info of its frame, on handler thread.
+	void write(Types::LabelRuns labels, cv::Mat img, Types::FrameInfo info);
+
+	/// Compares segments with Types::Reference::MultimodalSegmentation of the same inputs.
+	void verify(const Types::RegionGrowing & growing, float threshold);
 
 	bool check(cv::Point point, cv::Point dir);
 	bool newSeed(cv::Point point, cv::Point dir);
@@ -119,8 +187,17 @@ private:
 	cv::Mat m_depth;
 	cv::Mat m_color;
 
-	cv::Mat m_clusters;
 	cv::Mat m_closed;
+
+	/// Edges of graph algorithm, segmentations of the component run one at a time
+	boost::shared_ptr<Types::RegionGrowing::GraphBuffers> m_graph_buffers;
+
+	/// Time of verification, frames differing from reference are counted as skipped
+	Types::HandlerStatistics * m_verify_stats;
+
+	/// Worker of segmentation (async mode), stopped before other members are destroyed
+	Types::HandlerStatistics * m_async_stats;
+	Types::AsyncStage m_async;
 /*
 	bool m_normals_ready;
 	bool m_depth_ready;
@@ -0,0 +1,434 @@
+/*!
+ * \file
+ * \brief
+ */
+
+#include <memory>
+#include <string>
+#include <cmath>
+#include <algorithm>
+
+#include "TsdfFusion.hpp"
+#include "Common/Logger.hpp"
+
+#include "Types/PointValidity.hpp"
+
+#include <boost/bind.hpp>
+
+namespace Processors {
+namespace TsdfFusion {
+
+static const int BLOCK_VOXELS = BLOCK_SIZE * BLOCK_SIZE * BLOCK_SIZE;
+
+/// Block coordinate of given voxel coordinate (rounded towards minus infinity).
+static inline int blockCoord(int v) {
+	return (v >= 0 ? v : v - BLOCK_SIZE + 1) / BLOCK_SIZE;
+}
+
+/// Rigid transformation stored as row-major 3x4 matrix.
+struct Rigid {
+	float m[12];
+
+	explicit Rigid(const cv::Matx44f & H) {
+		for (int i = 0; i < 3; ++i)
+			for (int j = 0; j < 4; ++j)
+				m[4 * i + j] = H(i, j);
+	}
+
+	/// Inverse of rigid transformation.
+	Rigid inv() const {
+		Rigid r(*this);
+		for (int i = 0; i < 3; ++i) {
+			for (int j = 0; j < 3; ++j)
+				r.m[4 * i + j] = m[4 * j + i];
+			r.m[4 * i + 3] = -(m[i] * m[3] + m[4 + i] * m[7] + m[8 + i] * m[11]);
+		}
+		return r;
+	}
+
+	cv::Point3f operator()(const cv::Point3f & p) const {
+		return cv::Point3f(m[0] * p.x + m[1] * p.y + m[2] * p.z + m[3], m[4] * p.x + m[5] * p.y + m[6] * p.z + m[7],
+				m[8] * p.x + m[9] * p.y + m[10] * p.z + m[11]);
+	}
+
+	cv::Point3f rotate(const cv::Point3f & p) const {
+		return cv::Point3f(m[0] * p.x + m[1] * p.y + m[2] * p.z, m[4] * p.x + m[5] * p.y + m[6] * p.z,
+				m[8] * p.x + m[9] * p.y + m[10] * p.z);
+	}
+};
+
+/*!
+ * Read-only access to voxels, safe to use from many threads as long as
+ * no blocks are allocated.
+ */
+class Volume {
+public:
+	Volume(const std::vector<VoxelBlock> & pool, const BlockHash & hash, float voxel_size) :
+		pool(pool), hash(hash), inv_voxel(1.0f / voxel_size) {
+	}
+
+	/// Returns voxel containing given point, NULL if its block is not allocated.
+	const Voxel * voxel(const cv::Point3f & p) const {
+		int vx = cvFloor(p.x * inv_voxel), vy = cvFloor(p.y * inv_voxel), vz = cvFloor(p.z * inv_voxel);
+		int bx = blockCoord(vx), by = blockCoord(vy), bz = blockCoord(vz);
+		const int * idx = hash.find(bx, by, bz);
+		if (!idx)
+			return NULL;
+		vx -= bx * BLOCK_SIZE;
+		vy -= by * BLOCK_SIZE;
+		vz -= bz * BLOCK_SIZE;
+		return &pool[*idx].voxels[(vz * BLOCK_SIZE + vy) * BLOCK_SIZE + vx];
+	}
+
+	/// Returns tsdf at given point, false if it is not observed yet.
+	bool tsdf(const cv::Point3f & p, float & f) const {
+		const Voxel * v = voxel(p);
+		if (!v || v->weight <= 0)
+			return false;
+		f = v->tsdf;
+		return true;
+	}
+
+private:
+	const std::vector<VoxelBlock> & pool;
+	const BlockHash & hash;
+	float inv_voxel;
+};
+
+/*!
+ * Updates voxels of visible blocks with current measurement.
+ */
+class IntegrateBody: public cv::ParallelLoopBody {
+public:
+	IntegrateBody(std::vector<VoxelBlock> & pool, const std::vector<int> & visible, const cv::Mat & xyz,
+			const cv::Matx33f & K, const Rigid & world_to_camera, float voxel_size, float mu, float max_weight,
+			float z_min, float z_max) :
+		pool(pool), visible(visible), xyz(xyz), K(K), world_to_camera(world_to_camera), voxel_size(voxel_size), mu(mu),
+				max_weight(max_weight), z_min(z_min), z_max(z_max) {
+	}
+
+	void operator()(const cv::Range & r) const {
+		const float fx = K(0, 0), fy = K(1, 1), cx = K(0, 2), cy = K(1, 2);
+		for (int b = r.start; b < r.end; ++b) {
+			VoxelBlock & block = pool[visible[b]];
+			for (int z = 0; z < BLOCK_SIZE; ++z) {
+				for (int y = 0; y < BLOCK_SIZE; ++y) {
+					for (int x = 0; x < BLOCK_SIZE; ++x) {
+						cv::Point3f w((block.x * BLOCK_SIZE + x + 0.5f) * voxel_size,
+								(block.y * BLOCK_SIZE + y + 0.5f) * voxel_size, (block.z * BLOCK_SIZE + z + 0.5f) * voxel_size);
+						cv::Point3f c = world_to_camera(w);
+						if (c.z <= 0)
+							continue;
+
+						int u = cvRound(fx * c.x / c.z + cx);
+						int v = cvRound(fy * c.y / c.z + cy);
+						if (u < 0 || v < 0 || u >= xyz.cols || v >= xyz.rows)
+							continue;
+
+						const cv::Point3f & m = xyz.at<cv::Point3f>(v, u);
+						if (!Types::validPoint(m) || m.z < z_min || m.z > z_max)
+							continue;
+
+						float sdf = m.z - c.z;
+						if (sdf < -mu)
+							continue;
+
+						Voxel & voxel = block.voxels[(z * BLOCK_SIZE + y) * BLOCK_SIZE + x];
+						float f = std::min(1.0f, sdf / mu);
+						voxel.tsdf = (voxel.tsdf * voxel.weight + f) / (voxel.weight + 1);
+						voxel.weight = std::min(voxel.weight + 1, max_weight);
+					}
+				}
+			}
+		}
+	}
+
+private:
+	std::vector<VoxelBlock> & pool;
+	const std::vector<int> & visible;
+	const cv::Mat & xyz;
+	cv::Matx33f K;
+	Rigid world_to_camera;
+	float voxel_size;
+	float mu;
+	float max_weight;
+	float z_min;
+	float z_max;
+};
+
+/*!
+ * Casts ray through every pixel, looking for zero crossing of tsdf.
+ */
+class RaycastBody: public cv::ParallelLoopBody {
+public:
+	RaycastBody(const Volume & volume, const cv::Matx33f & K, const Rigid & camera_to_world, float voxel_size, float mu,
+			float z_min, float z_max, cv::Mat & xyz, cv::Mat & normals) :
+		volume(volume), K(K), camera_to_world(camera_to_world), voxel_size(voxel_size), mu(mu), z_min(z_min),
+				z_max(z_max), xyz(xyz), normals(normals) {
+	}
+
+	void operator()(const cv::Range & r) const {
+		const float fx = K(0, 0), fy = K(1, 1), cx = K(0, 2), cy = K(1, 2);
+		const cv::Point3f origin(camera_to_world.m[3], camera_to_world.m[7], camera_to_world.m[11]);
+		for (int v = r.start; v < r.end; ++v) {
+			cv::Point3f * p = xyz.ptr<cv::Point3f>(v);
+			cv::Point3f * n = normals.ptr<cv::Point3f>(v);
+			for (int u = 0; u < xyz.cols; ++u) {
+				p[u] = n[u] = cv::Point3f(0, 0, 0);
+
+				// ray is parametrized with depth, length of dir is not 1
+				cv::Point3f dir((u - cx) / fx, (v - cy) / fy, 1);
+				cv::Point3f wdir = camera_to_world.rotate(dir);
+				float step_scale = 1.0f / cv::norm(dir);
+
+				bool has_prev = false;
+				float prev_f = 0, prev_z = 0;
+				for (float z = z_min; z < z_max;) {
+					float f;
+					if (!volume.tsdf(origin + wdir * z, f)) {
+						has_prev = false;
+						z += mu * step_scale;
+						continue;
+					}
+
+					if (has_prev && prev_f > 0 && f <= 0) {
+						float zc = prev_z + (z - prev_z) * prev_f / (prev_f - f);
+						p[u] = dir * zc;
+						n[u] = normal(origin + wdir * zc);
+						break;
+					}
+					// surface seen from behind
+					if (has_prev && prev_f < 0 && f > 0)
+						break;
+
+					has_prev = true;
+					prev_f = f;
+					prev_z = z;
+					z += std::max(voxel_size, 0.8f * f * mu) * step_scale;
+				}
+			}
+		}
+	}
+
+private:
+	/// Normalized tsdf gradient in camera frame, zero if it can't be computed.
+	cv::Point3f normal(const cv::Point3f & w) const {
+		float h = voxel_size;
+		float fx0, fx1, fy0, fy1, fz0, fz1;
+		if (!volume.tsdf(w - cv::Point3f(h, 0, 0), fx0) || !volume.tsdf(w + cv::Point3f(h, 0, 0), fx1)
+				|| !volume.tsdf(w - cv::Point3f(0, h, 0), fy0) || !volume.tsdf(w + cv::Point3f(0, h, 0), fy1)
+				|| !volume.tsdf(w - cv::Point3f(0, 0, h), fz0) || !volume.tsdf(w + cv::Point3f(0, 0, h), fz1))
+			return cv::Point3f(0, 0, 0);
+
+		cv::Point3f g(fx1 - fx0, fy1 - fy0, fz1 - fz0);
+		// rotate back to camera frame with transposed rotation
+		const float * m = camera_to_world.m;
+		cv::Point3f c(m[0] * g.x + m[4] * g.y + m[8] * g.z, m[1] * g.x + m[5] * g.y + m[9] * g.z,
+				m[2] * g.x + m[6] * g.y + m[10] * g.z);
+		float len = cv::norm(c);
+		return len > 0 ? c * (1.0f / len) : cv::Point3f(0, 0, 0);
+	}
+
+	const Volume & volume;
+	cv::Matx33f K;
+	Rigid camera_to_world;
+	float voxel_size;
+	float mu;
+	float z_min;
+	float z_max;
+	cv::Mat & xyz;
+	cv::Mat & normals;
+};
+
+TsdfFusion::TsdfFusion(const std::string & name) :
+		Base::Component(name),
+		prop_fx("fx", 525.0f),
+		prop_fy("fy", 525.0f),
+		prop_cx("cx", 319.5f),
+		prop_cy("cy", 239.5f),
+		prop_voxel_size("voxel_size", 0.01f),
+		prop_truncation("truncation", 0.04f),
+		prop_max_weight("max_weight", 64.0f),
+		prop_z_min("z_min", 0.3f),
+		prop_z_max("z_max", 4.0f),
+		prop_raycast("raycast", true),
+		m_stats(name),
+		m_hash(1 << 16),
+		m_frame(0) {
+	registerProperty(prop_fx);
+	registerProperty(prop_fy);
+	registerProperty(prop_cx);
+	registerProperty(prop_cy);
+	registerProperty(prop_voxel_size);
+	registerProperty(prop_truncation);
+	registerProperty(prop_max_weight);
+	registerProperty(prop_z_min);
+	registerProperty(prop_z_max);
+	registerProperty(prop_raycast);
+	registerProperty(m_stats.prop_statistics);
+	registerProperty(m_stats.prop_statistics_period);
+	registerProperty(m_stats.prop_trace_file);
+	registerProperty(m_stats.prop_allocations);
+	registerProperty(m_stats.prop_frame_sync);
+}
+
+TsdfFusion::~TsdfFusion() {
+}
+
+void TsdfFusion::prepareInterface() {
+	// Register data streams, events and event handlers HERE!
+	registerStream("in_xyz", &in_xyz);
+	registerStream("in_homogMatrix", &in_homogMatrix);
+	registerStream("in_camera_info", &in_camera_info);
+	registerStream("out_xyz", &out_xyz);
+	registerStream("out_normals", &out_normals);
+	registerStream("in_frame_info", &m_stats.in_frame_info);
+	registerStream("out_frame_info", &m_stats.out_frame_info);
+
+	// Register handlers
+	registerHandler("onNewCloud", m_stats.wrap("onNewCloud", boost::bind(&TsdfFusion::onNewCloud, this)));
+	addDependency("onNewCloud", &in_xyz);
+	addDependency("onNewCloud", &in_homogMatrix);
+
+	registerHandler("onReset", boost::bind(&TsdfFusion::onReset, this));
+}
+
+bool TsdfFusion::onInit() {
+	m_stats.init(boost::bind(&TsdfFusion::addDependency, this, _1, _2));
+	return true;
+}
+
+bool TsdfFusion::onFinish() {
+	return true;
+}
+
+bool TsdfFusion::onStop() {
+	return true;
+}
+
+bool TsdfFusion::onStart() {
+	return true;
+}
+
+void TsdfFusion::onReset() {
+	CLOG(LINFO) << "Clearing model";
+	m_pool.clear();
+	m_hash.clear();
+	m_frame = 0;
+}
+
+cv::Matx33f TsdfFusion::cameraMatrix() {
+	cv::Matx33f K = cv::Matx33f::eye();
+	if (!in_camera_info.empty()) {
+		Types::CameraInfo info = in_camera_info.read();
+		K(0, 0) = info.fx();
+		K(1, 1) = info.fy();
+		K(0, 2) = info.cx();
+		K(1, 2) = info.cy();
+	} else {
+		K(0, 0) = prop_fx;
+		K(1, 1) = prop_fy;
+		K(0, 2) = prop_cx;
+		K(1, 2) = prop_cy;
+	}
+	return K;
+}
+
+void TsdfFusion::allocate(const cv::Mat & xyz, const cv::Matx44f & pose) {
+	Rigid camera_to_world(pose);
+	float mu = prop_truncation;
+	float z_min = prop_z_min, z_max = prop_z_max;
+	float inv_block = 1.0f / (prop_voxel_size * BLOCK_SIZE);
+	int steps = std::max(2, cvCeil(2 * mu * inv_block) + 1);
+
+	++m_frame;
+	m_visible.clear();
+
+	// neighbouring pixels mostly fall into the same block
+	boost::uint64_t last = BlockHash::empty();
+	for (int i = 0; i < xyz.rows; ++i) {
+		const cv::Point3f * p = xyz.ptr<cv::Point3f>(i);
+		for (int j = 0; j < xyz.cols; ++j) {
+			if (!Types::validPoint(p[j]) || p[j].z < z_min || p[j].z > z_max)
+				continue;
+
+			cv::Point3f dir = p[j] * (1.0f / cv::norm(p[j]));
+			for (int s = 0; s < steps; ++s) {
+				cv::Point3f w = camera_to_world(p[j] + dir * (mu * (2.0f * s / (steps - 1) - 1)));
+				int bx = cvFloor(w.x * inv_block), by = cvFloor(w.y * inv_block), bz = cvFloor(w.z * inv_block);
+				boost::uint64_t key = BlockHash::key(bx, by, bz);
+				if (key == last)
+					continue;
+				last = key;
+
+				size_t size = m_hash.size();
+				int & idx = m_hash.at(key);
+				if (m_hash.size() != size) {
+					idx = m_pool.size();
+					m_pool.resize(m_pool.size() + 1);
+					VoxelBlock & block = m_pool.back();
+					block.x = bx;
+					block.y = by;
+					block.z = bz;
+					block.frame = 0;
+					for (int v = 0; v < BLOCK_VOXELS; ++v) {
+						block.voxels[v].tsdf = 1;
+						block.voxels[v].weight = 0;
+					}
+				}
+
+				VoxelBlock & block = m_pool[idx];
+				if (block.frame != m_frame) {
+					block.frame = m_frame;
+					m_visible.push_back(idx);
+				}
+			}
+		}
+	}
+}
+
+void TsdfFusion::onNewCloud() {
+	cv::Mat xyz = in_xyz.read();
+	if (xyz.type() != CV_32FC3) {
+		CLOG(LERROR) << "Wrong cloud type, CV_32FC3 expected";
+		m_stats.skip();
+		return;
+	}
+
+	Types::HomogMatrix hm = in_homogMatrix.read();
+	cv::Matx44d Hd = hm;
+	cv::Matx44f H;
+	for (int i = 0; i < 4; ++i)
+		for (int j = 0; j < 4; ++j)
+			H(i, j) = Hd(i, j);
+
+	cv::Matx33f K = cameraMatrix();
+	float voxel_size = prop_voxel_size;
+	float mu = prop_truncation;
+	Rigid camera_to_world(H);
+
+	allocate(xyz, H);
+
+	cv::parallel_for_(cv::Range(0, m_visible.size()),
+			IntegrateBody(m_pool, m_visible, xyz, K, camera_to_world.inv(), voxel_size, mu, prop_max_weight, prop_z_min,
+					prop_z_max));
+
+	CLOG(LDEBUG) << "TsdfFusion: " << m_visible.size() << " visible blocks, " << m_pool.size() << " allocated ("
+			<< m_pool.size() * sizeof(VoxelBlock) / (1024 * 1024) << " MB)";
+
+	if (!prop_raycast)
+		return;
+
+	cv::Mat out(xyz.size(), CV_32FC3);
+	cv::Mat normals(xyz.size(), CV_32FC3);
+	Volume volume(m_pool, m_hash, voxel_size);
+	cv::parallel_for_(cv::Range(0, xyz.rows),
+			RaycastBody(volume, K, camera_to_world, voxel_size, mu, prop_z_min, prop_z_max, out, normals));
+
+	m_stats.publish();
+	out_normals.write(normals);
+	out_xyz.write(out);
+}
+
+} //: namespace TsdfFusion
+} //: namespace Processors
@@ -0,0 +1,167 @@
+/*!
+ * \file
+ * \brief
+ */
+
+#ifndef TSDFFUSION_HPP_
+#define TSDFFUSION_HPP_
+
+#include "Base/Component_Aux.hpp"
+#include "Base/Component.hpp"
+#include "Base/DataStream.hpp"
+#include "Base/Property.hpp"
+#include "Base/EventHandler2.hpp"
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include <Types/CameraInfo.hpp>
+#include "Types/HomogMatrix.hpp"
+#include "Types/HandlerStatistics.hpp"
+#include "Types/SpatialHash.hpp"
+
+namespace Processors {
+namespace TsdfFusion {
+
+/// Number of voxels along each edge of the block.
+static const int BLOCK_SIZE = 8;
+
+struct Voxel {
+	float tsdf;
+	float weight;
+};
+
+/// Dense block of voxels, allocated only near observed surfaces.
+struct VoxelBlock {
+	int x, y, z;
+
+	/// Last frame the block was seen in.
+	int frame;
+
+	Voxel voxels[BLOCK_SIZE * BLOCK_SIZE * BLOCK_SIZE];
+};
+
+/// Maps block coordinates to index in block pool.
+typedef Types::SpatialHash<int> BlockHash;
+
+/*!
+ * \class TsdfFusion
+ * \brief TsdfFusion processor class.
+ *
+ * Fuses organized clouds (in_xyz, in camera frame) taken from poses given
+ * in in_homogMatrix (camera to world, e.g. from IcpOdometry) into truncated
+ * signed distance function. Voxels are grouped into blocks kept in spatial
+ * hash, only blocks within truncation band of measured surface are
+ * allocated, so memory grows with observed surface. Visible blocks are
+ * integrated in parallel.
+ *
+ * After integration, model is raycast from the same pose into out_xyz and
+ * out_normals (organized, in camera frame, zeros where nothing was hit).
+ */
+class TsdfFusion: public Base::Component {
+public:
+	/*!
+	 * Constructor.
+	 */
+	TsdfFusion(const std::string & name = "TsdfFusion");
+
+	/*!
+	 * Destructor
+	 */
+	virtual ~TsdfFusion();
+
+	/*!
+	 * Prepare components interface (register streams and handlers).
+	 * At this point, all properties are already initialized and loaded to
+	 * values set in config file.
+	 */
+	void prepareInterface();
+
+protected:
+
+	/*!
+	 * Connects source to given device.
+	 */
+	bool onInit();
+
+	/*!
+	 * Disconnect source from device, closes streams, etc.
+	 */
+	bool onFinish();
+
+	/*!
+	 * Start component
+	 */
+	bool onStart();
+
+	/*!
+	 * Stop component
+	 */
+	bool onStop();
+
+
+	// Input data streams
+	Base::DataStreamIn<cv::Mat> in_xyz;
+	Base::DataStreamIn<Types::HomogMatrix, Base::DataStreamBuffer::Newest> in_homogMatrix;
+	Base::DataStreamIn<Types::CameraInfo, Base::DataStreamBuffer::Newest> in_camera_info;
+
+	// Output data streams
+	Base::DataStreamOut<cv::Mat> out_xyz;
+	Base::DataStreamOut<cv::Mat> out_normals;
+
+	// Properties
+
+	/// Intrinsics used when no camera info is connected.
+	Base::Property<float> prop_fx;
+	Base::Property<float> prop_fy;
+	Base::Property<float> prop_cx;
+	Base::Property<float> prop_cy;
+
+	/// Voxel edge length (in meters).
+	Base::Property<float> prop_voxel_size;
+
+	/// Truncation distance (in meters).
+	Base::Property<float> prop_truncation;
+
+	/// Weight of each voxel is limited to that, so that model can follow changes.
+	Base::Property<float> prop_max_weight;
+
+	/// Range of measurements used and raycast (in meters).
+	Base::Property<float> prop_z_min;
+	Base::Property<float> prop_z_max;
+
+	/// Produces raycast cloud after each integration.
+	Base::Property<bool> prop_raycast;
+
+	/// Handler latency statistics
+	Types::ComponentStatistics m_stats;
+
+	// Handlers
+	void onNewCloud();
+	void onReset();
+
+private:
+	/// Allocates blocks along truncation band of each measurement and fills m_visible.
+	void allocate(const cv::Mat & xyz, const cv::Matx44f & pose);
+
+	cv::Matx33f cameraMatrix();
+
+	std::vector<VoxelBlock> m_pool;
+	BlockHash m_hash;
+
+	/// Indices of blocks touched by current frame.
+	std::vector<int> m_visible;
+
+	int m_frame;
+};
+
+} //: namespace TsdfFusion
+} //: namespace Processors
+
+/*
+ * Register processor component.
+ */
+REGISTER_COMPONENT("TsdfFusion", Processors::TsdfFusion::TsdfFusion)
+
+#endif /* TSDFFUSION_HPP_ */
@@ -0,0 +1,200 @@
+/*!
+ * \file
+ * \brief
+ */
+
+#include <memory>
+#include <string>
+#include <cmath>
+#include <algorithm>
+
+#include "VoxelGrid.hpp"
+#include "Common/Logger.hpp"
+
+#include "Types/PointValidity.hpp"
+
+#include <boost/bind.hpp>
+
+namespace Processors {
+namespace VoxelGrid {
+
+/*!
+ * Fills one partial hash per stripe of rows.
+ */
+class AccumulateBody: public cv::ParallelLoopBody {
+public:
+	AccumulateBody(const cv::Mat & cloud, const cv::Mat & normals, std::vector<VoxelHash> & partial, float leaf) :
+		cloud(cloud), normals(normals), partial(partial), inv_leaf(1.0f / leaf) {
+	}
+
+	void operator()(const cv::Range & r) const {
+		int stripes = partial.size();
+		for (int s = r.start; s < r.end; ++s) {
+			VoxelHash & hash = partial[s];
+			hash.clear();
+
+			int row_start = s * cloud.rows / stripes;
+			int row_end = (s + 1) * cloud.rows / stripes;
+			for (int i = row_start; i < row_end; ++i) {
+				const cv::Point3f * p = cloud.ptr<cv::Point3f>(i);
+				const cv::Point3f * n = normals.empty() ? NULL : normals.ptr<cv::Point3f>(i);
+				for (int j = 0; j < cloud.cols; ++j) {
+					if (!Types::validPoint(p[j]))
+						continue;
+
+					VoxelAccumulator & acc = hash(cvFloor(p[j].x * inv_leaf), cvFloor(p[j].y * inv_leaf),
+							cvFloor(p[j].z * inv_leaf));
+					acc.x += p[j].x;
+					acc.y += p[j].y;
+					acc.z += p[j].z;
+					++acc.count;
+
+					if (n && Types::validNormal(n[j])) {
+						acc.nx += n[j].x;
+						acc.ny += n[j].y;
+						acc.nz += n[j].z;
+						++acc.normals;
+					}
+				}
+			}
+		}
+	}
+
+private:
+	const cv::Mat & cloud;
+	const cv::Mat & normals;
+	std::vector<VoxelHash> & partial;
+	float inv_leaf;
+};
+
+VoxelGrid::VoxelGrid(const std::string & name) :
+		Base::Component(name),
+		prop_leaf_size("leaf_size", 0.01f),
+		prop_min_points("min_points", 1),
+		m_stats(name),
+		m_voxels(1 << 16) {
+	registerProperty(prop_leaf_size);
+	registerProperty(prop_min_points);
+	registerProperty(m_stats.prop_statistics);
+	registerProperty(m_stats.prop_statistics_period);
+	registerProperty(m_stats.prop_trace_file);
+	registerProperty(m_stats.prop_allocations);
+	registerProperty(m_stats.prop_frame_sync);
+}
+
+VoxelGrid::~VoxelGrid() {
+}
+
+void VoxelGrid::prepareInterface() {
+	// Register data streams, events and event handlers HERE!
+	registerStream("in_xyz", &in_xyz);
+	registerStream("in_normals", &in_normals);
+	registerStream("out_points", &out_points);
+	registerStream("out_normals", &out_normals);
+	registerStream("in_frame_info", &m_stats.in_frame_info);
+	registerStream("out_frame_info", &m_stats.out_frame_info);
+
+	// Register handlers
+	registerHandler("onNewCloud", m_stats.wrap("onNewCloud", boost::bind(&VoxelGrid::onNewCloud, this)));
+	addDependency("onNewCloud", &in_xyz);
+
+	registerHandler("onNewCloudNormals", m_stats.wrap("onNewCloudNormals", boost::bind(&VoxelGrid::onNewCloudNormals, this)));
+	addDependency("onNewCloudNormals", &in_xyz);
+	addDependency("onNewCloudNormals", &in_normals);
+}
+
+bool VoxelGrid::onInit() {
+	m_partial.resize(std::max(1, cv::getNumThreads()), VoxelHash(1 << 14));
+	m_stats.init(boost::bind(&VoxelGrid::addDependency, this, _1, _2));
+	return true;
+}
+
+bool VoxelGrid::onFinish() {
+	return true;
+}
+
+bool VoxelGrid::onStop() {
+	return true;
+}
+
+bool VoxelGrid::onStart() {
+	return true;
+}
+
+void VoxelGrid::onNewCloud() {
+	downsample(in_xyz.read(), cv::Mat());
+}
+
+void VoxelGrid::onNewCloudNormals() {
+	cv::Mat cloud = in_xyz.read();
+	cv::Mat normals = in_normals.read();
+	if (normals.size() != cloud.size() || normals.type() != CV_32FC3) {
+		CLOG(LWARNING) << "Normals don't match cloud, ignoring them";
+		normals = cv::Mat();
+	}
+	downsample(cloud, normals);
+}
+
+void VoxelGrid::downsample(const cv::Mat & cloud, const cv::Mat & normals) {
+	if (cloud.type() != CV_32FC3) {
+		CLOG(LERROR) << "Wrong cloud type, CV_32FC3 expected";
+		m_stats.skip();
+		return;
+	}
+	if (m_partial.empty())
+		m_partial.resize(1);
+
+	cv::parallel_for_(cv::Range(0, m_partial.size()), AccumulateBody(cloud, normals, m_partial, prop_leaf_size));
+
+	// merge partial results
+	m_voxels.clear();
+	for (size_t s = 0; s < m_partial.size(); ++s) {
+		const std::vector<VoxelHash::Entry> & entries = m_partial[s].entries();
+		for (size_t i = 0; i < entries.size(); ++i) {
+			if (entries[i].key == VoxelHash::empty())
+				continue;
+			const VoxelAccumulator & src = entries[i].value;
+			VoxelAccumulator & dst = m_voxels.at(entries[i].key);
+			dst.x += src.x;
+			dst.y += src.y;
+			dst.z += src.z;
+			dst.nx += src.nx;
+			dst.ny += src.ny;
+			dst.nz += src.nz;
+			dst.count += src.count;
+			dst.normals += src.normals;
+		}
+	}
+
+	int min_points = std::max(1, (int) prop_min_points);
+	const std::vector<VoxelHash::Entry> & entries = m_voxels.entries();
+	int count = 0;
+	for (size_t i = 0; i < entries.size(); ++i)
+		if (entries[i].key != VoxelHash::empty() && entries[i].value.count >= min_points)
+			++count;
+
+	cv::Mat points(count, 1, CV_32FC3);
+	cv::Mat voxel_normals(count, 1, CV_32FC3);
+	for (size_t i = 0, k = 0; i < entries.size(); ++i) {
+		const VoxelAccumulator & acc = entries[i].value;
+		if (entries[i].key == VoxelHash::empty() || acc.count < min_points)
+			continue;
+
+		points.at<cv::Point3f>(k) = cv::Point3f(acc.x / acc.count, acc.y / acc.count, acc.z / acc.count);
+
+		cv::Point3f n(acc.nx, acc.ny, acc.nz);
+		float len = cv::norm(n);
+		voxel_normals.at<cv::Point3f>(k) = (acc.normals > 0 && len > 0) ? n * (1.0f / len) : cv::Point3f(0, 0, 0);
+		++k;
+	}
+
+	CLOG(LDEBUG) << "VoxelGrid: " << count << " voxels";
+
+	m_stats.publish();
+	if (!normals.empty())
+		out_normals.write(voxel_normals);
+	out_points.write(points);
+}
+
+} //: namespace VoxelGrid
+} //: namespace Processors
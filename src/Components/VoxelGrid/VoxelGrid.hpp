@@ -0,0 +1,135 @@
+/*!
+ * \file
+ * \brief
+ */
+
+#ifndef VOXELGRID_HPP_
+#define VOXELGRID_HPP_
+
+#include "Base/Component_Aux.hpp"
+#include "Base/Component.hpp"
+#include "Base/DataStream.hpp"
+#include "Base/Property.hpp"
+#include "Base/EventHandler2.hpp"
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "Types/HandlerStatistics.hpp"
+#include "Types/SpatialHash.hpp"
+
+namespace Processors {
+namespace VoxelGrid {
+
+/// Sums of points (and normals) falling into single voxel.
+struct VoxelAccumulator {
+	VoxelAccumulator() :
+		x(0), y(0), z(0), nx(0), ny(0), nz(0), count(0), normals(0) {
+	}
+
+	float x, y, z;
+	float nx, ny, nz;
+	int count;
+	int normals;
+};
+
+typedef Types::SpatialHash<VoxelAccumulator> VoxelHash;
+
+/*!
+ * \class VoxelGrid
+ * \brief VoxelGrid processor class.
+ *
+ * Downsamples organized cloud (in_xyz) into one centroid per occupied voxel.
+ * If normals are connected (onNewCloudNormals), averaged normal of each voxel
+ * is produced too. Invalid points in any of the conventions used in this DCL
+ * (NaN/inf, zeroed by PassThrough, INVALID_COORDINATE of DepthTransform) and
+ * invalid normals ((-1,-1,-1) of DepthNormalEstimator, zero, NaN) are skipped.
+ *
+ * Rows are split between threads, each filling its own hash, and partial
+ * hashes are merged at the end. Outputs are Nx1 CV_32FC3 matrices.
+ */
+class VoxelGrid: public Base::Component {
+public:
+	/*!
+	 * Constructor.
+	 */
+	VoxelGrid(const std::string & name = "VoxelGrid");
+
+	/*!
+	 * Destructor
+	 */
+	virtual ~VoxelGrid();
+
+	/*!
+	 * Prepare components interface (register streams and handlers).
+	 * At this point, all properties are already initialized and loaded to
+	 * values set in config file.
+	 */
+	void prepareInterface();
+
+protected:
+
+	/*!
+	 * Connects source to given device.
+	 */
+	bool onInit();
+
+	/*!
+	 * Disconnect source from device, closes streams, etc.
+	 */
+	bool onFinish();
+
+	/*!
+	 * Start component
+	 */
+	bool onStart();
+
+	/*!
+	 * Stop component
+	 */
+	bool onStop();
+
+
+	// Input data streams
+	Base::DataStreamIn<cv::Mat> in_xyz;
+	Base::DataStreamIn<cv::Mat> in_normals;
+
+	// Output data streams
+	Base::DataStreamOut<cv::Mat> out_points;
+	Base::DataStreamOut<cv::Mat> out_normals;
+
+	// Properties
+
+	/// Voxel edge length (in meters).
+	Base::Property<float> prop_leaf_size;
+
+	/// Voxels with less points are dropped.
+	Base::Property<int> prop_min_points;
+
+	/// Handler latency statistics
+	Types::ComponentStatistics m_stats;
+
+	// Handlers
+	void onNewCloud();
+	void onNewCloudNormals();
+
+private:
+	void downsample(const cv::Mat & cloud, const cv::Mat & normals);
+
+	/// Per-thread partial hashes, kept between frames.
+	std::vector<VoxelHash> m_partial;
+
+	/// Merged hash.
+	VoxelHash m_voxels;
+};
+
+} //: namespace VoxelGrid
+} //: namespace Processors
+
+/*
+ * Register processor component.
+ */
+REGISTER_COMPONENT("VoxelGrid", Processors::VoxelGrid::VoxelGrid)
+
+#endif /* VOXELGRID_HPP_ */
@@ -0,0 +1,684 @@
+/*!
+ * \file
+ * \brief Headless batch processing of recorded depth sequences.
+ *
+ * Runs chain of kernels of this DCL (the same as used by PassThrough,
+ * DepthTransform, NormalEstimator and Segmentation components) over every
+ * depth frame (16-bit PNG) of input directory, without DisCODe runtime.
+ * Frames are independent, so they are processed by all cores at once, while
+ * results are written in the order of input files. Number of frames loaded
+ * but not yet written is bounded, so memory use does not depend on sequence
+ * length.
+ *
+ * With --verify N, no sequence is processed; instead the kernels are run on N
+ * synthetic frames (of odd sizes too, with NaN, zero and INVALID_COORDINATE
+ * points) and compared with Types::Reference implementations.
+ * Exit code is non-zero if any of them differs; ctest runs it as
+ * depth_batch_verify.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdlib>
+
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include "Common/Timer.hpp"
+
+#include "Types/RayTable.hpp"
+#include "Types/DepthCloud.hpp"
+#include "Types/CloudKernels.hpp"
+#include "Types/FusedChain.hpp"
+#include "Types/DepthConversion.hpp"
+#include "Types/DepthNormalKernels.hpp"
+#include "Types/Decimation.hpp"
+#include "Types/TileChanges.hpp"
+#include "Types/RegionGrowing.hpp"
+#include "Types/ReferenceKernels.hpp"
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+struct Options {
+	Options() :
+		z_min(0), z_max(10), transform(false), inverse(false), radius(0.0075),
+		fx(525), fy(525), cx(319.5), cy(239.5), depth_scale(0.001),
+		dist_diff(0.02), ang_diff(2.0), threshold(3.0), graph_k(0), raw(false),
+		threads(boost::thread::hardware_concurrency()), in_flight(0), verify(0) {
+		chain.push_back("normals");
+	}
+
+	/// Stages run in given order: passthrough, transform, normals, segmentation
+	std::vector<std::string> chain;
+
+	/// PassThrough range
+	float z_min;
+	float z_max;
+
+	/// DepthTransform matrix
+	bool transform;
+	bool inverse;
+	cv::Matx44d H;
+
+	/// NormalEstimator radius
+	float radius;
+
+	/// Camera intrinsics and depth units (in meters)
+	double fx, fy, cx, cy;
+	float depth_scale;
+
+	/// Segmentation thresholds
+	double dist_diff;
+	double ang_diff;
+	double threshold;
+
+	/// Scale of graph segmentation, 0 segments by region growing
+	double graph_k;
+
+	/// Write clouds and normals as YAML too
+	bool raw;
+
+	int threads;
+	int in_flight;
+
+	/// Number of synthetic frames to verify kernels on, 0 processes sequence
+	int verify;
+};
+
+/// Single frame, from file name to encoded outputs.
+struct Frame {
+	Frame() :
+		index(0) {
+	}
+
+	size_t index;
+	fs::path input;
+
+	/// Output file names and their contents
+	std::vector<std::pair<std::string, std::vector<uchar> > > outputs;
+
+	/// Empty if frame was processed
+	std::string error;
+};
+
+typedef boost::shared_ptr<Frame> FramePtr;
+
+/*!
+ * Hands out frame indices to workers and returns processed frames in
+ * order. Worker can claim frame only if fewer than in_flight frames are
+ * claimed but not yet returned to the writer.
+ */
+class Scheduler {
+public:
+	Scheduler(size_t frames, size_t in_flight) :
+		m_frames(frames), m_in_flight(std::max<size_t>(1, in_flight)), m_next(0), m_written(0) {
+	}
+
+	/// Claims next frame to process, returns false if all frames are claimed.
+	bool claim(size_t & index) {
+		boost::unique_lock<boost::mutex> lock(m_mutex);
+		while (m_next < m_frames && m_next - m_written >= m_in_flight)
+			m_cond.wait(lock);
+		if (m_next >= m_frames)
+			return false;
+		index = m_next++;
+		return true;
+	}
+
+	void done(const FramePtr & frame) {
+		boost::unique_lock<boost::mutex> lock(m_mutex);
+		m_done[frame->index] = frame;
+		m_cond.notify_all();
+	}
+
+	/// Waits for next frame in order, returns empty pointer after the last one.
+	FramePtr next() {
+		boost::unique_lock<boost::mutex> lock(m_mutex);
+		if (m_written >= m_frames)
+			return FramePtr();
+		std::map<size_t, FramePtr>::iterator it;
+		while ((it = m_done.find(m_written)) == m_done.end())
+			m_cond.wait(lock);
+		FramePtr ret = it->second;
+		m_done.erase(it);
+		++m_written;
+		m_cond.notify_all();
+		return ret;
+	}
+
+private:
+	size_t m_frames;
+	size_t m_in_flight;
+	size_t m_next;
+	size_t m_written;
+
+	std::map<size_t, FramePtr> m_done;
+
+	boost::mutex m_mutex;
+	boost::condition_variable m_cond;
+};
+
+void encode(Frame & frame, const std::string & suffix, const cv::Mat & img) {
+	std::vector<uchar> buf;
+	cv::imencode(".png", img, buf);
+	frame.outputs.push_back(std::make_pair(frame.input.stem().string() + suffix + ".png", buf));
+}
+
+void encodeRaw(Frame & frame, const std::string & suffix, const cv::Mat & mat) {
+	cv::FileStorage storage(".yml", cv::FileStorage::WRITE + cv::FileStorage::MEMORY);
+	storage << suffix.substr(1) << mat;
+	std::string str = storage.releaseAndGetString();
+	frame.outputs.push_back(std::make_pair(frame.input.stem().string() + suffix + ".yml",
+			std::vector<uchar>(str.begin(), str.end())));
+}
+
+/// Loads frame and runs the whole chain on it, graph buffers are reused by frames of the worker.
+void process(const Options & opts, const boost::shared_ptr<const Types::RayTable> & rays,
+		const boost::shared_ptr<Types::RegionGrowing::GraphBuffers> & graph, Frame & frame) {
+	cv::Mat depth = cv::imread(frame.input.string(), CV_LOAD_IMAGE_ANYDEPTH);
+	if (depth.type() != CV_16UC1) {
+		frame.error = "not a 16-bit depth map";
+		return;
+	}
+	if (depth.size() != rays->size()) {
+		frame.error = "size differs from the first frame";
+		return;
+	}
+
+	cv::Mat cloud;
+	Types::DepthCloud(depth, rays, opts.depth_scale).materialize(cloud);
+
+	cv::Mat normals;
+	for (size_t i = 0; i < opts.chain.size(); ++i) {
+		const std::string & stage = opts.chain[i];
+		if (stage == "passthrough") {
+			cv::Mat mask;
+			Types::passThrough(cloud, opts.z_min, opts.z_max, mask);
+			encode(frame, "_mask", mask);
+		} else if (stage == "transform") {
+			Types::transformCloud(cloud, opts.H);
+		} else if (stage == "normals") {
+			cv::Mat out;
+			Types::estimateNormals(cloud, opts.radius, normals, &out);
+			encode(frame, "_normals", out);
+			if (opts.raw)
+				encodeRaw(frame, "_normals", normals);
+		} else if (stage == "segmentation") {
+			// colors depend on frame only, not on worker thread or order of frames
+			Types::RegionGrowing growing;
+			growing.setSeed(frame.index + 1);
+			growing.setGraphBuffers(graph);
+			growing.addInput(cloud, Types::comparePositions, opts.dist_diff);
+			if (!normals.empty())
+				growing.addInput(normals, Types::compareNormals, opts.ang_diff);
+			if (opts.graph_k > 0)
+				encode(frame, "_segments", growing.segmentGraph(Types::accumulateSumExact, opts.graph_k, 20, false));
+			else
+				encode(frame, "_segments", growing.segment(Types::accumulateSum, opts.threshold));
+		}
+	}
+
+	if (opts.raw)
+		encodeRaw(frame, "_xyz", cloud);
+}
+
+void worker(const Options & opts, const boost::shared_ptr<const Types::RayTable> & rays,
+		const std::vector<fs::path> & files, Scheduler & scheduler) {
+	boost::shared_ptr<Types::RegionGrowing::GraphBuffers> graph(new Types::RegionGrowing::GraphBuffers);
+	size_t index;
+	while (scheduler.claim(index)) {
+		FramePtr frame(new Frame);
+		frame->index = index;
+		frame->input = files[index];
+		try {
+			process(opts, rays, graph, *frame);
+		} catch (const std::exception & ex) {
+			frame->error = ex.what();
+		}
+		scheduler.done(frame);
+	}
+}
+
+/// Prints result of single check, returns true if it passed.
+bool report(const std::string & kernel, cv::Size size, boost::int64_t ulp, boost::int64_t max_ulp) {
+	bool ok = ulp <= max_ulp;
+	if (!ok)
+		std::cerr << kernel << " " << size.width << "x" << size.height << ": " << ulp << " ULP from reference\n";
+	return ok;
+}
+
+/// Prints result of single check against distance bound, returns true if it passed.
+bool reportDistance(const std::string & kernel, cv::Size size, double distance, double max_distance) {
+	bool ok = distance <= max_distance;
+	if (!ok)
+		std::cerr << kernel << " " << size.width << "x" << size.height << ": " << distance << " from reference\n";
+	return ok;
+}
+
+/// Rectangle of random position and size inside frame.
+cv::Rect randomRect(cv::Size size, cv::RNG & rng) {
+	int x = rng.uniform(0, size.width), y = rng.uniform(0, size.height);
+	return cv::Rect(x, y, rng.uniform(1, size.width - x + 1), rng.uniform(1, size.height - y + 1));
+}
+
+/*!
+ * Checks NormalEstimator variants (decimated, incremental and adaptive) and
+ * FusedNormals chain on cloud, returns number of failed checks.
+ */
+int verifyNormals(const Options & opts, const cv::Mat & cloud, const cv::Matx44d & H, cv::RNG & rng) {
+	using namespace Types::Reference;
+	cv::Size size = cloud.size();
+	int failed = 0;
+	cv::Mat normals, ref;
+
+	// decimated, every n-th point of every n-th row
+	for (int n = 2; n <= 4; n *= 2) {
+		Types::estimateNormals(Types::decimate(cloud, n), opts.radius, normals);
+		ref = Types::Reference::normals(decimate(cloud, n), opts.radius);
+		if (!report("normals decimated", size, maxUlp(normals, ref), NORMAL_ULP))
+			++failed;
+	}
+
+	// incremental, recomputed only around tiles changed by moving random rectangle
+	Types::TileChanges tiles;
+	tiles.update(cloud, cv::Mat(), 0.005, 32);
+	cv::Mat der_row(size, CV_32FC3), der_col(size, CV_32FC3), dirty;
+	normals.create(size, CV_32FC3);
+	normals.setTo(cv::Scalar::all(-1));
+	Types::cloudDerivatives(tiles.state(), der_row, der_col, cv::Rect(0, 0, size.width, size.height));
+	Types::windowNormals(tiles.state(), der_row, der_col, cv::Mat(), cv::Mat(), opts.radius, normals);
+	cv::Mat next = cloud.clone();
+	cv::Mat moved = next(randomRect(size, rng));
+	moved += cv::Scalar(0, 0, 0.1);
+	tiles.update(next, cv::Mat(), 0.005, 32);
+	for (size_t k = 0; k < tiles.changed(); ++k)
+		Types::cloudDerivatives(tiles.state(), der_row, der_col, tiles.rect(k, 1, 0));
+	tiles.mask(Types::NORMAL_WINDOW + 1, Types::NORMAL_WINDOW, dirty);
+	Types::windowNormals(tiles.state(), der_row, der_col, cv::Mat(), dirty, opts.radius, normals);
+	ref = Types::Reference::normals(tiles.state(), opts.radius);
+	if (!report("normals incremental", size, maxUlp(normals, ref), NORMAL_ULP))
+		++failed;
+
+	// adaptive windows, window sums come from integral images
+	Types::estimateNormalsAdaptive(cloud, cv::Mat(), 4.0f, 2, 6, normals);
+	ref = adaptiveNormals(cloud, 4.0f, 2, 6);
+	if (!reportDistance("normals adaptive", size, maxDistance(normals, ref), NORMAL_DISTANCE))
+		++failed;
+
+	// fused chain, tiles of several shapes, by one and by all threads
+	static const int TILES[][3] = { { 32, 128, 0 }, { 7, 13, 1 }, { 5, 1000, 0 } };
+	cv::Mat ref_mask;
+	cv::Mat ref_xyz = depthTransformation(passThrough(cloud, opts.z_min, opts.z_max, ref_mask), H);
+	for (size_t t = 0; t < sizeof(TILES) / sizeof(TILES[0]); ++t) {
+		cv::Mat xyz, mask, out;
+		Types::fusedChain(cloud, H, true, opts.z_min, opts.z_max, opts.radius, TILES[t][0], TILES[t][1], TILES[t][2],
+				xyz, mask, normals, out);
+		// transformed points are checked on their own, normals of the same points
+		if (!report("fused xyz", size, maxUlp(xyz, ref_xyz), POINT_ULP)
+				|| !report("fused mask", size, cv::norm(mask, ref_mask, cv::NORM_INF) == 0 ? 0 : 1, 0)
+				|| !report("fused normals", size, maxUlp(normals, Types::Reference::normals(xyz, opts.radius)),
+						NORMAL_ULP))
+			++failed;
+	}
+	return failed;
+}
+
+/*!
+ * Checks DepthConverter and DepthNormalEstimator (fixed window, decimated,
+ * incremental and adaptive) on depth map, returns number of failed checks.
+ */
+int verifyDepth(const Options & opts, const cv::Mat & depth, const cv::Matx44d & H, cv::RNG & rng) {
+	using namespace Types::Reference;
+	cv::Size size = depth.size();
+	int failed = 0;
+
+	// DepthConverter, SSE rows against point by point conversion
+	cv::Mat camera_matrix = (cv::Mat_<double>(3, 3) << opts.fx, 0, opts.cx, 0, opts.fy, opts.cy, 0, 0, 1);
+	Types::RayTable rays(camera_matrix, cv::Mat(), size);
+	cv::Matx44f Hf;
+	for (int i = 0; i < 4; ++i)
+		for (int j = 0; j < 4; ++j)
+			Hf(i, j) = H(i, j);
+	for (int t = 0; t < 2; ++t) {
+		// range filter without transformation, transformation without range filter
+		const cv::Matx44f * h = t ? &Hf : NULL;
+		cv::Mat cloud, mask, ref_mask;
+		Types::convertDepth(depth, rays, opts.depth_scale, !t, opts.z_min, opts.z_max, h, cloud, mask);
+		cv::Mat ref = depthConversion(depth, rays, opts.depth_scale, !t, opts.z_min, opts.z_max, h, ref_mask);
+		if (!report("conversion", size, maxUlp(cloud, ref), POINT_ULP)
+				|| !report("conversion mask", size, cv::norm(mask, ref_mask, cv::NORM_INF) == 0 ? 0 : 1, 0))
+			++failed;
+	}
+
+	// DepthNormalEstimator, reference has focal length 530 built in
+	const int threshold = 20;
+	cv::Mat normals;
+	Types::estimateDepthNormals(depth, cv::Mat(), 530, threshold, normals);
+	if (!report("depth normals", size, maxUlp(normals, depthNormals(depth, threshold)), NORMAL_ULP))
+		++failed;
+
+	// decimated, threshold grows as neighbours get further apart
+	for (int n = 2; n <= 4; n *= 2) {
+		Types::estimateDepthNormals(Types::decimate(depth, n), cv::Mat(), 530, threshold * n, normals);
+		if (!report("depth normals decimated", size, maxUlp(normals, depthNormals(decimate(depth, n),
+				threshold * n)), NORMAL_ULP))
+			++failed;
+	}
+
+	// incremental, recomputed only around tiles changed by moving random rectangle
+	Types::TileChanges tiles;
+	tiles.update(depth, cv::Mat(), 5, 32);
+	Types::estimateDepthNormals(tiles.state(), cv::Mat(), 530, threshold, normals);
+	cv::Mat next = depth.clone(), dirty;
+	cv::Mat moved = next(randomRect(size, rng));
+	moved += cv::Scalar(50);
+	tiles.update(next, cv::Mat(), 5, 32);
+	tiles.mask(Types::DEPTH_NORMAL_SPACING, Types::DEPTH_NORMAL_SPACING, dirty);
+	Types::updateDepthNormals(tiles.state(), cv::Mat(), dirty, 530, threshold, normals);
+	if (!report("depth normals incremental", size, maxUlp(normals, depthNormals(tiles.state(), threshold)),
+			NORMAL_ULP))
+		++failed;
+
+	// adaptive windows, means of exact integer sums, so the same as summed point by point
+	Types::estimateDepthNormalsAdaptive(depth, cv::Mat(), 530, threshold, 4.0f, 2, 6, normals);
+	if (!report("depth normals adaptive", size, maxUlp(normals, adaptiveDepthNormals(depth, 530, threshold, 4.0f, 2,
+			6)), NORMAL_ULP))
+		++failed;
+	return failed;
+}
+
+/*!
+ * Runs kernels of the chain and their variants (of all components whose
+ * kernels live in Types) on synthetic frames and compares them with
+ * reference implementations, returns number of failed checks.
+ */
+int verify(const Options & opts) {
+	// first sizes cover odd and degenerate frames, the rest is random
+	static const int SIZES[][2] = { { 640, 480 }, { 641, 479 }, { 17, 13 }, { 13, 1 }, { 1, 1 } };
+	const int fixed = sizeof(SIZES) / sizeof(SIZES[0]);
+
+	cv::RNG rng(0x5eed);
+	int failed = 0;
+	for (int k = 0; k < opts.verify; ++k) {
+		cv::Size size = k < fixed ? cv::Size(SIZES[k][0], SIZES[k][1])
+				: cv::Size(rng.uniform(1, 700), rng.uniform(1, 500));
+		cv::Mat cloud = Types::Reference::syntheticCloud(size, rng);
+
+		// PassThrough, exact
+		cv::Mat mask, ref_mask;
+		cv::Mat ref = Types::Reference::passThrough(cloud, opts.z_min, opts.z_max, ref_mask);
+		cv::Mat xyz = cloud.clone();
+		Types::passThrough(xyz, opts.z_min, opts.z_max, mask);
+		if (!report("passthrough", size, Types::Reference::maxUlp(xyz, ref), 0)
+				|| !report("passthrough mask", size, cv::norm(mask, ref_mask, cv::NORM_INF) == 0 ? 0 : 1, 0))
+			++failed;
+
+		// DepthTransform, random rigid transformation
+		double a = rng.uniform(-3.14, 3.14), b = rng.uniform(-3.14, 3.14);
+		cv::Matx44d H(cos(a), -sin(a) * cos(b), sin(a) * sin(b), rng.uniform(-1.0, 1.0),
+				sin(a), cos(a) * cos(b), -cos(a) * sin(b), rng.uniform(-1.0, 1.0),
+				0, sin(b), cos(b), rng.uniform(-1.0, 1.0),
+				0, 0, 0, 1);
+		ref = Types::Reference::depthTransformation(cloud, H);
+		xyz = cloud.clone();
+		Types::transformCloud(xyz, H);
+		if (!report("transform", size, Types::Reference::maxUlp(xyz, ref), Types::Reference::POINT_ULP))
+			++failed;
+
+		// NormalEstimator
+		cv::Mat normals;
+		Types::estimateNormals(cloud, opts.radius, normals);
+		ref = Types::Reference::normals(cloud, opts.radius);
+		if (!report("normals", size, Types::Reference::maxUlp(normals, ref), Types::Reference::NORMAL_ULP))
+			++failed;
+
+		// Segmentation, the same segments
+		Types::RegionGrowing growing;
+		growing.addInput(cloud, Types::comparePositions, opts.dist_diff);
+		growing.addInput(normals, Types::compareNormals, opts.ang_diff);
+		growing.segment(Types::accumulateSum, opts.threshold);
+		Types::Reference::SegmentationCheck check = Types::Reference::compareSegmentation(growing, k + 1,
+				opts.threshold);
+		if (check != Types::Reference::SEGMENTS_SAME) {
+			std::cerr << "segmentation " << size.width << "x" << size.height << ": segments "
+					<< (check == Types::Reference::SEGMENTS_DIFFER ? "differ from" : "not comparable with")
+					<< " reference\n";
+			++failed;
+		}
+
+		failed += verifyNormals(opts, cloud, H, rng);
+		failed += verifyDepth(opts, Types::Reference::syntheticDepth(size, rng), H, rng);
+	}
+
+	std::cout << opts.verify << " frames verified, " << failed << " checks failed\n";
+	return failed;
+}
+
+void usage(const char * name) {
+	Options opts;
+	std::cerr << "Usage: " << name << " [options] <input_dir> <output_dir>\n"
+			<< "Processes every 16-bit PNG depth map of input_dir, in name order.\n\n"
+			<< "  --chain LIST        comma separated stages, run in given order:\n"
+			<< "                      passthrough, transform, normals, segmentation (normals)\n"
+			<< "  --z-min Z, --z-max Z  PassThrough range in meters (" << opts.z_min << ", " << opts.z_max << ")\n"
+			<< "  --transform FILE    YAML file with 4x4 matrix H, used by transform stage\n"
+			<< "  --inverse           use inverse of the matrix\n"
+			<< "  --radius R          normal neighbourhood radius in meters (" << opts.radius << ")\n"
+			<< "  --fx, --fy, --cx, --cy V  camera intrinsics (" << opts.fx << ", " << opts.fy << ", " << opts.cx
+			<< ", " << opts.cy << ")\n"
+			<< "  --depth-scale S     depth units in meters (" << opts.depth_scale << ")\n"
+			<< "  --dist-diff D, --ang-diff A, --threshold T  segmentation thresholds (" << opts.dist_diff << ", "
+			<< opts.ang_diff << ", " << opts.threshold << ")\n"
+			<< "  --graph K           graph-based segmentation of scale K instead of region growing\n"
+			<< "  --threads N         worker threads (number of cores)\n"
+			<< "  --in-flight N       frames loaded but not yet written (2 x threads)\n"
+			<< "  --raw               write clouds and normals as YAML too\n"
+			<< "  --verify N          check kernels against reference on N synthetic frames, no directories needed\n";
+}
+
+template<typename T>
+bool parse(const std::string & str, T & value) {
+	std::istringstream ss(str);
+	ss >> value;
+	return !ss.fail() && ss.eof();
+}
+
+bool parseArgs(int argc, char * argv[], Options & opts, std::vector<std::string> & positional) {
+	std::string matrix_file;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg.compare(0, 2, "--") != 0) {
+			positional.push_back(arg);
+			continue;
+		}
+		if (arg == "--inverse") {
+			opts.inverse = true;
+			continue;
+		}
+		if (arg == "--raw") {
+			opts.raw = true;
+			continue;
+		}
+		if (i + 1 >= argc) {
+			std::cerr << "Missing value of " << arg << "\n";
+			return false;
+		}
+		std::string val = argv[++i];
+		bool ok = true;
+		if (arg == "--chain") {
+			opts.chain.clear();
+			std::istringstream ss(val);
+			std::string stage;
+			while (std::getline(ss, stage, ',')) {
+				if (stage != "passthrough" && stage != "transform" && stage != "normals" && stage != "segmentation") {
+					std::cerr << "Unknown stage " << stage << "\n";
+					return false;
+				}
+				opts.chain.push_back(stage);
+			}
+		} else if (arg == "--transform") {
+			matrix_file = val;
+		} else if (arg == "--z-min") {
+			ok = parse(val, opts.z_min);
+		} else if (arg == "--z-max") {
+			ok = parse(val, opts.z_max);
+		} else if (arg == "--radius") {
+			ok = parse(val, opts.radius);
+		} else if (arg == "--fx") {
+			ok = parse(val, opts.fx);
+		} else if (arg == "--fy") {
+			ok = parse(val, opts.fy);
+		} else if (arg == "--cx") {
+			ok = parse(val, opts.cx);
+		} else if (arg == "--cy") {
+			ok = parse(val, opts.cy);
+		} else if (arg == "--depth-scale") {
+			ok = parse(val, opts.depth_scale);
+		} else if (arg == "--dist-diff") {
+			ok = parse(val, opts.dist_diff);
+		} else if (arg == "--ang-diff") {
+			ok = parse(val, opts.ang_diff);
+		} else if (arg == "--threshold") {
+			ok = parse(val, opts.threshold);
+		} else if (arg == "--graph") {
+			ok = parse(val, opts.graph_k) && opts.graph_k > 0;
+		} else if (arg == "--threads") {
+			ok = parse(val, opts.threads) && opts.threads > 0;
+		} else if (arg == "--in-flight") {
+			ok = parse(val, opts.in_flight) && opts.in_flight > 0;
+		} else if (arg == "--verify") {
+			ok = parse(val, opts.verify) && opts.verify > 0;
+		} else {
+			std::cerr << "Unknown option " << arg << "\n";
+			return false;
+		}
+		if (!ok) {
+			std::cerr << "Wrong value of " << arg << ": " << val << "\n";
+			return false;
+		}
+	}
+
+	if (std::find(opts.chain.begin(), opts.chain.end(), "transform") != opts.chain.end()) {
+		if (matrix_file.empty()) {
+			std::cerr << "Transform stage requires --transform\n";
+			return false;
+		}
+		cv::FileStorage storage(matrix_file, cv::FileStorage::READ);
+		cv::Mat H;
+		if (storage.isOpened())
+			storage["H"] >> H;
+		if (H.rows != 4 || H.cols != 4) {
+			std::cerr << "No 4x4 matrix H in " << matrix_file << "\n";
+			return false;
+		}
+		H.convertTo(H, CV_64F);
+		if (opts.inverse)
+			H = H.inv();
+		opts.H = cv::Matx44d((double*) H.data);
+		opts.transform = true;
+	}
+
+	if (opts.threads < 1)
+		opts.threads = 1;
+	if (opts.in_flight < 1)
+		opts.in_flight = 2 * opts.threads;
+
+	return opts.verify > 0 || positional.size() == 2;
+}
+
+} //: namespace
+
+int main(int argc, char * argv[]) {
+	Options opts;
+	std::vector<std::string> positional;
+	if (!parseArgs(argc, argv, opts, positional)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (opts.verify > 0)
+		return verify(opts) ? 1 : 0;
+
+	fs::path input_dir(positional[0]);
+	fs::path output_dir(positional[1]);
+	if (!fs::is_directory(input_dir)) {
+		std::cerr << input_dir.string() << " is not a directory\n";
+		return 1;
+	}
+	fs::create_directories(output_dir);
+
+	std::vector<fs::path> files;
+	for (fs::directory_iterator it(input_dir), end; it != end; ++it)
+		if (fs::is_regular_file(it->status()) && it->path().extension() == ".png")
+			files.push_back(it->path());
+	std::sort(files.begin(), files.end());
+	if (files.empty()) {
+		std::cerr << "No PNG files in " << input_dir.string() << "\n";
+		return 1;
+	}
+
+	// all frames share ray table of the first one
+	cv::Mat first = cv::imread(files[0].string(), CV_LOAD_IMAGE_ANYDEPTH);
+	if (first.empty()) {
+		std::cerr << "Can't read " << files[0].string() << "\n";
+		return 1;
+	}
+	cv::Mat camera_matrix = (cv::Mat_<double>(3, 3) << opts.fx, 0, opts.cx, 0, opts.fy, opts.cy, 0, 0, 1);
+	boost::shared_ptr<const Types::RayTable> rays(new Types::RayTable(camera_matrix, cv::Mat(), first.size()));
+	first.release();
+
+	// parallelism is across frames, kernels themselves run single threaded
+	cv::setNumThreads(0);
+
+	Common::Timer timer;
+	timer.restart();
+
+	Scheduler scheduler(files.size(), opts.in_flight);
+	boost::thread_group workers;
+	for (int i = 0; i < opts.threads; ++i)
+		workers.create_thread(boost::bind(&worker, boost::cref(opts), boost::cref(rays), boost::cref(files),
+				boost::ref(scheduler)));
+
+	// write results in order, as they become available
+	size_t failed = 0;
+	for (FramePtr frame = scheduler.next(); frame; frame = scheduler.next()) {
+		if (!frame->error.empty()) {
+			std::cerr << frame->input.string() << ": " << frame->error << "\n";
+			++failed;
+			continue;
+		}
+		bool written = true;
+		for (size_t i = 0; i < frame->outputs.size(); ++i) {
+			fs::path path = output_dir / frame->outputs[i].first;
+			std::ofstream out(path.string().c_str(), std::ios::binary);
+			const std::vector<uchar> & buf = frame->outputs[i].second;
+			if (!buf.empty())
+				out.write((const char*) &buf[0], buf.size());
+			if (!out) {
+				std::cerr << "Can't write " << path.string() << "\n";
+				written = false;
+			}
+		}
+		if (!written)
+			++failed;
+	}
+	workers.join_all();
+
+	double elapsed = timer.elapsed();
+	std::cout << files.size() - failed << "/" << files.size() << " frames in " << elapsed << " s ("
+			<< files.size() / elapsed << " fps, " << opts.threads << " threads)\n";
+
+	return failed ? 1 : 0;
+}
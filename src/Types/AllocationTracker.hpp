@@ -0,0 +1,256 @@
+/*!
+ * \file
+ * \brief Accounting of matrix allocations made by event handlers.
+ */
+
+#ifndef ALLOCATIONTRACKER_HPP_
+#define ALLOCATIONTRACKER_HPP_
+
+#include <cstring>
+#include <typeinfo>
+#include <algorithm>
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/thread/tss.hpp>
+
+#include <opencv2/core/core.hpp>
+#if CV_MAJOR_VERSION >= 3
+#include <opencv2/core/utility.hpp>
+#endif
+
+namespace Types {
+
+/*!
+ * \struct AllocationScope
+ * \brief Allocations made by a thread during single handler invocation.
+ *
+ * Live bytes are counted from the beginning of invocation, so buffers freed
+ * then but allocated earlier make them negative.
+ */
+struct AllocationScope {
+	AllocationScope() :
+		bytes(0), count(0), live(0), peak(0) {
+	}
+
+	void allocated(size_t size) {
+		bytes += size;
+		++count;
+		live += size;
+		peak = std::max(peak, live);
+	}
+
+	void freed(size_t size) {
+		live -= size;
+	}
+
+	boost::uint64_t bytes;
+	boost::uint64_t count;
+	boost::int64_t live;
+	boost::int64_t peak;
+};
+
+/*!
+ * \class AllocationCounter
+ * \brief Allocation totals of single handler, updated after every invocation.
+ */
+class AllocationCounter {
+public:
+	AllocationCounter() :
+		m_calls(0), m_free_calls(0), m_bytes(0), m_count(0), m_peak(0) {
+	}
+
+	void record(const AllocationScope & scope) {
+		m_calls.fetch_add(1, boost::memory_order_relaxed);
+		if (scope.count == 0)
+			m_free_calls.fetch_add(1, boost::memory_order_relaxed);
+		m_bytes.fetch_add(scope.bytes, boost::memory_order_relaxed);
+		m_count.fetch_add(scope.count, boost::memory_order_relaxed);
+
+		boost::int64_t prev = m_peak.load(boost::memory_order_relaxed);
+		while (scope.peak > prev && !m_peak.compare_exchange_weak(prev, scope.peak, boost::memory_order_relaxed))
+			;
+	}
+
+	/// Number of tracked invocations.
+	boost::uint64_t calls() const {
+		return m_calls.load(boost::memory_order_relaxed);
+	}
+
+	/// Number of invocations without any allocation.
+	boost::uint64_t freeCalls() const {
+		return m_free_calls.load(boost::memory_order_relaxed);
+	}
+
+	/// Mean number of allocations per invocation.
+	double count() const {
+		boost::uint64_t calls = this->calls();
+		return calls ? (double) m_count.load(boost::memory_order_relaxed) / calls : 0;
+	}
+
+	/// Mean number of allocated bytes per invocation.
+	double bytes() const {
+		boost::uint64_t calls = this->calls();
+		return calls ? (double) m_bytes.load(boost::memory_order_relaxed) / calls : 0;
+	}
+
+	/// Maximal number of bytes live at once in single invocation.
+	boost::int64_t peak() const {
+		return m_peak.load(boost::memory_order_relaxed);
+	}
+
+private:
+	boost::atomic<boost::uint64_t> m_calls;
+	boost::atomic<boost::uint64_t> m_free_calls;
+	boost::atomic<boost::uint64_t> m_bytes;
+	boost::atomic<boost::uint64_t> m_count;
+	boost::atomic<boost::int64_t> m_peak;
+};
+
+#if CV_MAJOR_VERSION >= 3
+
+#if CV_MAJOR_VERSION >= 4
+typedef cv::AccessFlag AccessFlags;
+#else
+typedef int AccessFlags;
+#endif
+
+/*!
+ * \class AllocationTracker
+ * \brief Default matrix allocator counting allocations into scope of calling thread.
+ *
+ * Wraps allocator that was the default one before install(), so every
+ * cv::Mat data buffer (including temporaries made inside OpenCV functions)
+ * passes through it. Allocations made while no scope is entered are not
+ * counted, so the overhead outside of tracked handlers is a single
+ * thread-local lookup.
+ *
+ * Scopes are per thread, so allocations made by workers of cv::parallel_for_
+ * (or any thread the handler hands work to) are not counted in the scope of
+ * the handler.
+ *
+ * Tracker is shared by all components of the process. Component libraries
+ * have their own copies of this class (and of its statics), so installed
+ * tracker is recognized by type name and used through virtual calls only,
+ * and install() is serialized by the initialization mutex of OpenCV, the
+ * only lock all of them share.
+ */
+class AllocationTracker: public cv::MatAllocator {
+public:
+	/// Returns tracker, installing it as default allocator on first call.
+	static AllocationTracker * install() {
+		cv::AutoLock lock(cv::getInitializationMutex());
+		cv::MatAllocator * current = cv::Mat::getDefaultAllocator();
+		if (current && std::strcmp(typeid(*current).name(), typeid(AllocationTracker).name()) == 0)
+			return static_cast<AllocationTracker *>(current);
+
+		// never deleted, matrices allocated by it may outlive any component
+		AllocationTracker * tracker = new AllocationTracker(current ? current : cv::Mat::getStdAllocator());
+		cv::Mat::setDefaultAllocator(tracker);
+		return tracker;
+	}
+
+	/// Makes given scope current for calling thread, returns previous one.
+	virtual AllocationScope * enter(AllocationScope * scope) {
+		AllocationScope * prev = m_scope.get();
+		m_scope.reset(scope);
+		return prev;
+	}
+
+	/// Restores scope returned by enter().
+	virtual void leave(AllocationScope * prev) {
+		m_scope.reset(prev);
+	}
+
+	cv::UMatData * allocate(int dims, const int * sizes, int type, void * data, size_t * step, AccessFlags flags,
+			cv::UMatUsageFlags usage) const {
+		cv::UMatData * u = m_parent->allocate(dims, sizes, type, data, step, flags, usage);
+		if (!u)
+			return u;
+		// deallocation goes through tracker as well
+		u->currAllocator = this;
+		AllocationScope * scope = m_scope.get();
+		if (scope && !(u->flags & cv::UMatData::USER_ALLOCATED))
+			scope->allocated(u->size);
+		return u;
+	}
+
+	bool allocate(cv::UMatData * data, AccessFlags flags, cv::UMatUsageFlags usage) const {
+		return m_parent->allocate(data, flags, usage);
+	}
+
+	void deallocate(cv::UMatData * u) const {
+		if (!u)
+			return;
+		AllocationScope * scope = m_scope.get();
+		if (scope && !(u->flags & cv::UMatData::USER_ALLOCATED))
+			scope->freed(u->size);
+		m_parent->deallocate(u);
+	}
+
+	void map(cv::UMatData * data, AccessFlags flags) const {
+		m_parent->map(data, flags);
+	}
+
+	void unmap(cv::UMatData * data) const {
+		m_parent->unmap(data);
+	}
+
+	void download(cv::UMatData * data, void * dst, int dims, const size_t sz[], const size_t srcofs[],
+			const size_t srcstep[], const size_t dststep[]) const {
+		m_parent->download(data, dst, dims, sz, srcofs, srcstep, dststep);
+	}
+
+	void upload(cv::UMatData * data, const void * src, int dims, const size_t sz[], const size_t dstofs[],
+			const size_t dststep[], const size_t srcstep[]) const {
+		m_parent->upload(data, src, dims, sz, dstofs, dststep, srcstep);
+	}
+
+	void copy(cv::UMatData * src, cv::UMatData * dst, int dims, const size_t sz[], const size_t srcofs[],
+			const size_t srcstep[], const size_t dstofs[], const size_t dststep[], bool sync) const {
+		m_parent->copy(src, dst, dims, sz, srcofs, srcstep, dstofs, dststep, sync);
+	}
+
+	cv::BufferPoolController * getBufferPoolController(const char * id = NULL) const {
+		return m_parent->getBufferPoolController(id);
+	}
+
+private:
+	explicit AllocationTracker(const cv::MatAllocator * parent) :
+		m_parent(parent), m_scope(&AllocationTracker::release) {
+	}
+
+	/// Scopes are owned by handlers, thread exit doesn't delete them.
+	static void release(AllocationScope *) {
+	}
+
+	const cv::MatAllocator * m_parent;
+
+	mutable boost::thread_specific_ptr<AllocationScope> m_scope;
+};
+
+#else
+
+/*!
+ * \class AllocationTracker
+ * \brief Placeholder, OpenCV 2.x has no default matrix allocator to replace.
+ */
+class AllocationTracker {
+public:
+	static AllocationTracker * install() {
+		return NULL;
+	}
+
+	AllocationScope * enter(AllocationScope *) {
+		return NULL;
+	}
+
+	void leave(AllocationScope *) {
+	}
+};
+
+#endif
+
+} //: namespace Types
+
+#endif /* ALLOCATIONTRACKER_HPP_ */
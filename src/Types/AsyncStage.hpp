@@ -0,0 +1,202 @@
+/*!
+ * \file
+ * \brief Worker thread running heavy part of handlers off the executor thread.
+ */
+
+#ifndef ASYNCSTAGE_HPP_
+#define ASYNCSTAGE_HPP_
+
+#include <exception>
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+#include "Common/Logger.hpp"
+#include "Common/Timer.hpp"
+
+#include "Types/HandlerStatistics.hpp"
+
+namespace Types {
+
+/*!
+ * \class AsyncStage
+ * \brief Single worker thread with double-buffered, newest-wins input slot.
+ *
+ * Handler reads its inputs, binds them (by value) into a job and hands it to
+ * execute(), which returns immediately. While the worker processes one job,
+ * the next one waits in the slot; newer job replaces the waiting one, which
+ * is counted as dropped. Consecutive stages of a pipeline work on different
+ * frames concurrently then, so throughput is bounded by the slowest stage
+ * instead of the sum of all of them.
+ *
+ * Job doesn't write outputs itself, it hands their writes to complete(). They
+ * are run by the handler thread with its next execute() (or flush()), so that
+ * downstream components never run on the worker and every output is written
+ * together with its frame info. Properties used by the job have to be read by
+ * the handler and bound into the job as well.
+ *
+ * When the worker isn't started, jobs and their outputs are executed in place.
+ */
+class AsyncStage {
+public:
+	typedef boost::function<void()> Job;
+
+	AsyncStage() :
+		m_stats(NULL), m_tracker(NULL), m_pending(false), m_stop(false), m_dropped(0) {
+	}
+
+	~AsyncStage() {
+		stop();
+	}
+
+	/*!
+	 * Starts the worker. Optional stats record time of every job, dropped
+	 * jobs are recorded there as skipped. With tracker, allocations of
+	 * every job are recorded there as well.
+	 */
+	void start(HandlerStatistics * stats = NULL, AllocationTracker * tracker = NULL) {
+		if (running())
+			return;
+		m_stats = stats;
+		m_tracker = stats ? tracker : NULL;
+		m_stop = false;
+		m_pending = false;
+		m_thread = boost::thread(boost::bind(&AsyncStage::run, this));
+	}
+
+	/// Stops the worker after current job, waiting one is dropped. Its outputs
+	/// are kept until flush().
+	void stop() {
+		if (!running())
+			return;
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			m_stop = true;
+		}
+		m_cond.notify_one();
+		m_thread.join();
+		m_thread = boost::thread();
+	}
+
+	bool running() const {
+		return m_thread.joinable();
+	}
+
+	/// Hands job to the worker if it runs, executes it in place otherwise.
+	/// Outputs of the last finished job are written first.
+	void execute(const Job & job) {
+		if (!running()) {
+			job();
+			return;
+		}
+
+		flush();
+
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			if (m_pending) {
+				m_dropped.fetch_add(1, boost::memory_order_relaxed);
+				if (m_stats)
+					m_stats->skip();
+			}
+			m_slot = job;
+			m_pending = true;
+		}
+		m_cond.notify_one();
+	}
+
+	/*!
+	 * Called by job with writes of its outputs. On the worker they wait for
+	 * the handler thread, replacing (and dropping) outputs nobody wrote yet,
+	 * anywhere else they are run in place.
+	 */
+	void complete(const Job & output) {
+		if (boost::this_thread::get_id() != m_thread.get_id()) {
+			output();
+			return;
+		}
+
+		boost::mutex::scoped_lock lock(m_mutex);
+		if (m_output) {
+			m_dropped.fetch_add(1, boost::memory_order_relaxed);
+			if (m_stats)
+				m_stats->skip();
+		}
+		m_output = output;
+	}
+
+	/// Writes outputs of the last finished job, if they weren't written yet.
+	void flush() {
+		Job output;
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			output.swap(m_output);
+		}
+		if (output)
+			output();
+	}
+
+	/// Number of jobs (or their outputs) replaced by newer ones before they were started (written).
+	boost::uint64_t dropped() const {
+		return m_dropped.load(boost::memory_order_relaxed);
+	}
+
+private:
+	void run() {
+		for (;;) {
+			Job job;
+			{
+				boost::mutex::scoped_lock lock(m_mutex);
+				while (!m_pending && !m_stop)
+					m_cond.wait(lock);
+				if (m_stop)
+					return;
+				job.swap(m_slot);
+				m_pending = false;
+			}
+
+			AllocationScope scope;
+			AllocationScope * prev_scope = m_tracker ? m_tracker->enter(&scope) : NULL;
+			Common::Timer timer;
+			timer.restart();
+			// nobody above would catch it, so exception ends only this job
+			try {
+				job();
+			} catch (const std::exception & ex) {
+				LOG(LERROR) << "Asynchronous job failed: " << ex.what();
+			} catch (...) {
+				LOG(LERROR) << "Asynchronous job failed";
+			}
+			if (m_stats)
+				m_stats->call(timer.elapsed());
+			if (m_tracker) {
+				m_tracker->leave(prev_scope);
+				m_stats->allocated(scope);
+			}
+		}
+	}
+
+	HandlerStatistics * m_stats;
+	AllocationTracker * m_tracker;
+
+	boost::thread m_thread;
+	boost::mutex m_mutex;
+	boost::condition_variable m_cond;
+
+	/// Job waiting for the worker
+	Job m_slot;
+
+	/// Outputs of finished job waiting for the handler thread
+	Job m_output;
+	bool m_pending;
+	bool m_stop;
+
+	boost::atomic<boost::uint64_t> m_dropped;
+};
+
+} //: namespace Types
+
+#endif /* ASYNCSTAGE_HPP_ */
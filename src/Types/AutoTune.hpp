@@ -0,0 +1,176 @@
+/*!
+ * \file
+ * \brief Micro-benchmarking of kernel settings, with results cached per CPU model.
+ */
+
+#ifndef AUTOTUNE_HPP_
+#define AUTOTUNE_HPP_
+
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+
+#include <boost/filesystem.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+#include "Common/Timer.hpp"
+
+namespace Types {
+
+/// CPU model name (from /proc/cpuinfo) and number of cores, e.g. "Intel(R) Core(TM) i5-4570 CPU @ 3.20GHz x4".
+inline std::string cpuModel() {
+	std::string model = "unknown";
+	std::ifstream cpuinfo("/proc/cpuinfo");
+	std::string line;
+	while (std::getline(cpuinfo, line)) {
+		if (line.compare(0, 10, "model name") != 0)
+			continue;
+		size_t colon = line.find(':');
+		if (colon != std::string::npos && colon + 2 <= line.size())
+			model = line.substr(colon + 2);
+		break;
+	}
+	std::ostringstream ss;
+	ss << model << " x" << boost::thread::hardware_concurrency();
+	return ss.str();
+}
+
+/*!
+ * Shortest time (in seconds) of repeated runs of given function, after a
+ * single warm-up run (which allocates buffers, starts thread pool etc.).
+ */
+inline double measure(const boost::function<void()> & fun, int repeats = 3) {
+	fun();
+	double best = 0;
+	Common::Timer timer;
+	for (int i = 0; i < repeats; ++i) {
+		timer.restart();
+		fun();
+		double t = timer.elapsed();
+		if (i == 0 || t < best)
+			best = t;
+	}
+	return best;
+}
+
+/*!
+ * \class FileLock
+ * \brief Exclusive flock() of given file (created if needed), held while in scope.
+ *
+ * Unlike a static mutex, which every shared library including this header
+ * gets its own copy of, it is shared by all components and processes. Every
+ * instance opens the file on its own, so threads of one process exclude each
+ * other as well. If the file can't be opened, nothing is locked.
+ */
+class FileLock: boost::noncopyable {
+public:
+	FileLock(const std::string & path) :
+		m_fd(::open(path.c_str(), O_RDWR | O_CREAT, 0666)) {
+		if (m_fd >= 0)
+			while (::flock(m_fd, LOCK_EX) != 0 && errno == EINTR)
+				;
+	}
+
+	~FileLock() {
+		// closing the file releases the lock
+		if (m_fd >= 0)
+			::close(m_fd);
+	}
+
+private:
+	int m_fd;
+};
+
+/*!
+ * \class TuningCache
+ * \brief Text file with tuned settings, one "key = values" line per entry.
+ *
+ * Keys contain component, resolution and CPU model, so one file can be
+ * shared by all components and machines (e.g. over NFS home directory).
+ * File is rewritten as a whole on every store. Loads and stores hold lock of
+ * file with ".lock" appended (see FileLock), so they are serialized across
+ * components and processes.
+ */
+class TuningCache {
+public:
+	/// Empty path selects ~/.discode_depth_tuning.
+	TuningCache(const std::string & path = std::string()) :
+		m_path(path) {
+		if (m_path.empty()) {
+			const char * home = std::getenv("HOME");
+			m_path = std::string(home ? home : ".") + "/.discode_depth_tuning";
+		}
+	}
+
+	const std::string & path() const {
+		return m_path;
+	}
+
+	/// Reads values stored under given key, returns false if there are none.
+	bool load(const std::string & key, std::vector<int> & values) const {
+		FileLock lock(m_path + ".lock");
+		std::map<std::string, std::string> entries = read();
+		std::map<std::string, std::string>::const_iterator it = entries.find(key);
+		if (it == entries.end())
+			return false;
+
+		values.clear();
+		std::istringstream ss(it->second);
+		int v;
+		while (ss >> v)
+			values.push_back(v);
+		return !values.empty();
+	}
+
+	/// Stores values under given key, returns false if file can't be written.
+	bool store(const std::string & key, const std::vector<int> & values) const {
+		FileLock lock(m_path + ".lock");
+		std::map<std::string, std::string> entries = read();
+		std::ostringstream ss;
+		for (size_t i = 0; i < values.size(); ++i)
+			ss << (i ? " " : "") << values[i];
+		entries[key] = ss.str();
+
+		// write whole file aside and replace the old one, so readers never see partial file
+		std::string tmp = m_path + ".tmp";
+		{
+			std::ofstream out(tmp.c_str());
+			for (std::map<std::string, std::string>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+				out << it->first << " = " << it->second << "\n";
+			if (!out)
+				return false;
+		}
+		boost::system::error_code ec;
+		boost::filesystem::rename(tmp, m_path, ec);
+		return !ec;
+	}
+
+private:
+	std::map<std::string, std::string> read() const {
+		std::map<std::string, std::string> entries;
+		std::ifstream in(m_path.c_str());
+		std::string line;
+		while (std::getline(in, line)) {
+			size_t sep = line.rfind(" = ");
+			if (sep != std::string::npos)
+				entries[line.substr(0, sep)] = line.substr(sep + 3);
+		}
+		return entries;
+	}
+
+	std::string m_path;
+};
+
+} //: namespace Types
+
+#endif /* AUTOTUNE_HPP_ */
@@ -0,0 +1,307 @@
+/*!
+ * \file
+ * \brief Kernels of PassThrough, DepthTransform and NormalEstimator, usable outside of components.
+ */
+
+#ifndef CLOUDKERNELS_HPP_
+#define CLOUDKERNELS_HPP_
+
+#include <cmath>
+#include <cfloat>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "Types/PointValidity.hpp"
+#include "Types/EdgeMask.hpp"
+#include "Types/IntegralImage.hpp"
+
+namespace Types {
+
+/// Normal window radius (in pixels), as in NormalEstimator.
+static const int NORMAL_WINDOW = 6;
+
+/// Range filter of PassThrough, zeroes point outside [z_min, z_max], returns its mask value.
+inline uchar passPoint(cv::Point3f & p, float z_min, float z_max) {
+	if ((p.z < z_min) || (p.z > z_max)) {
+		p = cv::Point3f(0, 0, 0);
+		return 0;
+	}
+	return std::isfinite(p.z) ? 255 : 0;
+}
+
+/// Transformation of DepthTransform, i.e. cv::perspectiveTransform followed by range check.
+inline void transformPoint(cv::Point3f & p, const double * m) {
+	double w = p.x * m[12] + p.y * m[13] + p.z * m[14] + m[15];
+	float x = 0, y = 0, z = 0;
+	if (std::fabs(w) > FLT_EPSILON) {
+		w = 1. / w;
+		x = (float) ((p.x * m[0] + p.y * m[1] + p.z * m[2] + m[3]) * w);
+		y = (float) ((p.x * m[4] + p.y * m[5] + p.z * m[6] + m[7]) * w);
+		z = (float) ((p.x * m[8] + p.y * m[9] + p.z * m[10] + m[11]) * w);
+	}
+	if ((std::fabs(x) > POINT_MAX_RANGE) || (std::fabs(y) > POINT_MAX_RANGE) || (std::fabs(z) > POINT_MAX_RANGE))
+		x = y = z = INVALID_COORDINATE;
+	p = cv::Point3f(x, y, z);
+}
+
+/// Derivative between neighbouring points of NormalEstimator, zeroed across depth jumps.
+inline cv::Point3f cloudDerivative(const cv::Point3f & from, const cv::Point3f & to) {
+	cv::Point3f d = to - from;
+	if (std::fabs(d.z) > 0.05)
+		d = cv::Point3f(0, 0, 0);
+	return d;
+}
+
+/*!
+ * Normal of NormalEstimator, for point at (row, col) of cloud and its
+ * derivatives given as buffers with common stride (in points). Window
+ * points are weighted by distance, those farther than dist are skipped.
+ */
+inline cv::Point3f windowNormal(const cv::Point3f * pts, const cv::Point3f * der_row, const cv::Point3f * der_col,
+		int stride, int row, int col, float dist, int window) {
+	cv::Point3f ret;
+	cv::Point3f curpoint = pts[row * stride + col];
+	cv::Point3f drow(0, 0, 0), dcol(0, 0, 0);
+
+	dist *= dist;
+	for (int i = -window; i <= window; ++i) {
+		const cv::Point3f * drow_ptr = der_row + (row + i) * stride;
+		const cv::Point3f * dcol_ptr = der_col + (row + i) * stride;
+		const cv::Point3f * img_ptr = pts + (row + i) * stride;
+		for (int j = -window; j <= window; ++j) {
+			cv::Point3f tmp = curpoint - img_ptr[col + j];
+			float d = tmp.dot(tmp);
+			if (d <= dist) {
+				float sc = 1.0 - d / dist;
+				drow += drow_ptr[col + j] * sc;
+				dcol += dcol_ptr[col + j] * sc;
+			}
+		}
+	}
+
+	ret.x = drow.y * dcol.z - drow.z * dcol.y;
+	ret.y = drow.z * dcol.x - drow.x * dcol.z;
+	ret.z = drow.x * dcol.y - drow.y * dcol.x;
+	if (ret.z < 0)
+		ret = -ret;
+	ret *= (1. / norm(ret));
+
+	return ret;
+}
+
+/// Writes normal and its BGR visualization, in the same way as NormalEstimator.
+inline void writeNormal(const cv::Point3f & normal, cv::Point3f & n, uchar * out) {
+	out[2] = 0.5 * (normal.x + 1) * 255;
+	out[1] = 0.5 * (normal.y + 1) * 255;
+	out[0] = 0.5 * (normal.z + 1) * 255;
+	n = normal;
+}
+
+/// PassThrough over whole cloud (CV_32FC3, in place), mask is CV_8UC1.
+inline void passThrough(cv::Mat & cloud, float z_min, float z_max, cv::Mat & mask) {
+	mask.create(cloud.size(), CV_8UC1);
+	for (int i = 0; i < cloud.rows; ++i) {
+		cv::Point3f * p = cloud.ptr<cv::Point3f>(i);
+		uchar * mp = mask.ptr<uchar>(i);
+		for (int j = 0; j < cloud.cols; ++j)
+			mp[j] = passPoint(p[j], z_min, z_max);
+	}
+}
+
+/// DepthTransform over whole cloud (CV_32FC3, in place).
+inline void transformCloud(cv::Mat & cloud, const cv::Matx44d & H) {
+	for (int i = 0; i < cloud.rows; ++i) {
+		cv::Point3f * p = cloud.ptr<cv::Point3f>(i);
+		for (int j = 0; j < cloud.cols; ++j)
+			transformPoint(p[j], H.val);
+	}
+}
+
+/// Derivatives of cloud (along rows and columns) in rect, clipped to points having both neighbours.
+inline void cloudDerivatives(const cv::Mat & cloud, cv::Mat & der_row, cv::Mat & der_col, cv::Rect rect) {
+	rect = rect & cv::Rect(0, 0, cloud.cols - 1, cloud.rows - 1);
+	for (int i = rect.y; i < rect.y + rect.height; ++i) {
+		const cv::Point3f * img_p = cloud.ptr<cv::Point3f>(i);
+		const cv::Point3f * img_np = cloud.ptr<cv::Point3f>(i + 1);
+		cv::Point3f * p_row = der_row.ptr<cv::Point3f>(i);
+		cv::Point3f * p_col = der_col.ptr<cv::Point3f>(i);
+		for (int j = rect.x; j < rect.x + rect.width; ++j) {
+			p_row[j] = cloudDerivative(img_p[j], img_p[j + 1]);
+			p_col[j] = cloudDerivative(img_p[j], img_np[j]);
+		}
+	}
+}
+
+/*!
+ * Normals (and visualization, optional) of NormalEstimator at points not
+ * closer than NORMAL_WINDOW to the border, only at those set in dirty mask
+ * (CV_8UC1) if it's not empty. Windows straddling edges (if edge integral
+ * is not empty) get (-1, -1, -1) and black. Cloud and derivatives have to
+ * be continuous, other points are left as they are.
+ */
+inline void windowNormals(const cv::Mat & cloud, const cv::Mat & der_row, const cv::Mat & der_col,
+		const cv::Mat & edge_sum, const cv::Mat & dirty, float radius, cv::Mat & normals, cv::Mat * out = NULL) {
+	const int window = NORMAL_WINDOW;
+	for (int i = window; i < cloud.rows - window - 1; ++i) {
+		const uchar * d = dirty.empty() ? NULL : dirty.ptr<uchar>(i);
+		cv::Point3f * nptr = normals.ptr<cv::Point3f>(i);
+		uchar * out_p = out ? out->ptr<uchar>(i) : NULL;
+		for (int j = window; j < cloud.cols - window - 1; ++j) {
+			if (d && !d[j])
+				continue;
+			// window straddles depth discontinuity
+			if (!edge_sum.empty() && windowHasEdge(edge_sum, i, j, window)) {
+				nptr[j] = cv::Point3f(-1, -1, -1);
+				if (out_p)
+					out_p[3 * j + 2] = out_p[3 * j + 1] = out_p[3 * j + 0] = 0;
+				continue;
+			}
+			cv::Point3f normal = windowNormal(cloud.ptr<cv::Point3f>(0), der_row.ptr<cv::Point3f>(0),
+					der_col.ptr<cv::Point3f>(0), cloud.cols, i, j, radius, window);
+			if (out_p)
+				writeNormal(normal, nptr[j], out_p + 3 * j);
+			else
+				nptr[j] = normal;
+		}
+	}
+}
+
+/*!
+ * NormalEstimator over whole cloud (CV_32FC3). Normals (CV_32FC3) closer than
+ * window to the border are (-1, -1, -1), visualization (CV_8UC3, optional)
+ * is black there.
+ */
+inline void estimateNormals(const cv::Mat & cloud, float radius, cv::Mat & normals, cv::Mat * out = NULL) {
+	cv::Size size = cloud.size();
+
+	// continuous copy, windowNormal addresses rows by common stride
+	cv::Mat pts = cloud.isContinuous() ? cloud : cloud.clone();
+	cv::Mat der_row(size, CV_32FC3, cv::Scalar::all(0));
+	cv::Mat der_col(size, CV_32FC3, cv::Scalar::all(0));
+	cloudDerivatives(pts, der_row, der_col, cv::Rect(0, 0, size.width, size.height));
+
+	normals.create(size, CV_32FC3);
+	normals.setTo(cv::Scalar::all(-1));
+	if (out) {
+		out->create(size, CV_8UC3);
+		out->setTo(cv::Scalar::all(0));
+	}
+	windowNormals(pts, der_row, der_col, cv::Mat(), cv::Mat(), radius, normals, out);
+}
+
+/*!
+ * Sums derivatives over window, which radius grows with depth of the point.
+ * Sums come from integral images, so cost doesn't depend on window size.
+ */
+class AdaptiveNormalsBody: public cv::ParallelLoopBody {
+public:
+	AdaptiveNormalsBody(const cv::Mat & cloud, const cv::Mat & sum_row, const cv::Mat & sum_col,
+			const cv::Mat & edge_sum, cv::Mat & normals, cv::Mat * out, float scale, int min_window, int max_window) :
+		cloud(cloud), sum_row(sum_row), sum_col(sum_col), edge_sum(edge_sum), normals(normals), out(out),
+		scale(scale), min_window(min_window), max_window(max_window) {
+	}
+
+	void operator()(const cv::Range & r) const {
+		for (int i = r.start; i < r.end; ++i) {
+			const cv::Point3f * img_p = cloud.ptr<cv::Point3f>(i);
+			cv::Point3f * nptr = normals.ptr<cv::Point3f>(i);
+			uchar * out_p = out ? out->ptr<uchar>(i) : NULL;
+			for (int j = 0; j < cloud.cols; ++j) {
+				cv::Point3f normal = normalAt(img_p[j], i, j);
+				if (out_p)
+					writeNormal(normal, nptr[j], out_p + 3 * j);
+				else
+					nptr[j] = normal;
+			}
+		}
+	}
+
+private:
+	cv::Point3f normalAt(const cv::Point3f & p, int i, int j) const {
+		const cv::Point3f invalid(-1, -1, -1);
+		if (!validPoint(p) || p.z <= 0)
+			return invalid;
+
+		// derivatives are defined up to the last but one row and column
+		int w = std::min(std::max(cvRound(scale * p.z), min_window), max_window);
+		w = std::min(std::min(w, std::min(i, j)), std::min(cloud.rows - 2 - i, cloud.cols - 2 - j));
+		if (!edge_sum.empty())
+			while (w > 0 && windowHasEdge(edge_sum, i, j, w))
+				--w;
+		if (w < 1)
+			return invalid;
+
+		cv::Vec3d dr = boxSum<cv::Vec3d>(sum_row, i - w, j - w, i + w + 1, j + w + 1);
+		cv::Vec3d dc = boxSum<cv::Vec3d>(sum_col, i - w, j - w, i + w + 1, j + w + 1);
+		cv::Point3f drow(dr[0], dr[1], dr[2]), dcol(dc[0], dc[1], dc[2]);
+		cv::Point3f ret;
+		ret.x = drow.y * dcol.z - drow.z * dcol.y;
+		ret.y = drow.z * dcol.x - drow.x * dcol.z;
+		ret.z = drow.x * dcol.y - drow.y * dcol.x;
+		float len = norm(ret);
+		if (!(len > 0))
+			return invalid;
+		if (ret.z < 0)
+			ret = -ret;
+		return ret * (1.0f / len);
+	}
+
+	const cv::Mat & cloud;
+	const cv::Mat & sum_row;
+	const cv::Mat & sum_col;
+	const cv::Mat & edge_sum;
+	cv::Mat & normals;
+	cv::Mat * out;
+	float scale;
+	int min_window;
+	int max_window;
+};
+
+/// Derivatives (CV_32FC3) of NormalEstimator with depth adaptive windows, zero at invalid points and depth jumps.
+inline void validDerivatives(const cv::Mat & cloud, cv::Mat & der_row, cv::Mat & der_col) {
+	cv::Size size = cloud.size();
+	der_row = cv::Mat::zeros(size, CV_32FC3);
+	der_col = cv::Mat::zeros(size, CV_32FC3);
+	for (int i = 0; i < size.height - 1; ++i) {
+		const cv::Point3f * img_p = cloud.ptr<cv::Point3f>(i);
+		const cv::Point3f * img_np = cloud.ptr<cv::Point3f>(i + 1);
+		cv::Point3f * p_row = der_row.ptr<cv::Point3f>(i);
+		cv::Point3f * p_col = der_col.ptr<cv::Point3f>(i);
+		for (int j = 0; j < size.width - 1; ++j) {
+			if (!validPoint(img_p[j]))
+				continue;
+			if (validPoint(img_p[j + 1]) && std::fabs(img_p[j + 1].z - img_p[j].z) <= 0.05)
+				p_row[j] = img_p[j + 1] - img_p[j];
+			if (validPoint(img_np[j]) && std::fabs(img_np[j].z - img_p[j].z) <= 0.05)
+				p_col[j] = img_np[j] - img_p[j];
+		}
+	}
+}
+
+/*!
+ * NormalEstimator with depth adaptive windows, radius is scale pixels at
+ * 1 m, limited to [min_window, max_window]. Every normal (CV_32FC3) and its
+ * visualization (optional) is computed, invalid ones are (-1, -1, -1).
+ */
+inline void estimateNormalsAdaptive(const cv::Mat & cloud, const cv::Mat & edge_sum, float scale, int min_window,
+		int max_window, cv::Mat & normals, cv::Mat * out = NULL) {
+	normals.create(cloud.size(), CV_32FC3);
+	if (out)
+		out->create(cloud.size(), CV_8UC3);
+
+	// derivatives of valid points only, so that integrals are not spoiled
+	cv::Mat der_row, der_col;
+	validDerivatives(cloud, der_row, der_col);
+
+	cv::Mat sum_row, sum_col;
+	cv::integral(der_row, sum_row, CV_64F);
+	cv::integral(der_col, sum_col, CV_64F);
+
+	cv::parallel_for_(cv::Range(0, cloud.rows), AdaptiveNormalsBody(cloud, sum_row, sum_col, edge_sum, normals, out,
+			scale, min_window, max_window));
+}
+
+} //: namespace Types
+
+#endif /* CLOUDKERNELS_HPP_ */
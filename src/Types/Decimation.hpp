@@ -0,0 +1,62 @@
+/*!
+ * \file
+ * \brief Reduction of image resolution by integer factor, for preview processing.
+ */
+
+#ifndef DECIMATION_HPP_
+#define DECIMATION_HPP_
+
+#include <cstring>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+namespace Types {
+
+/*!
+ * Takes every n-th pixel of every n-th row. Suitable for depth maps, clouds
+ * and normals, as invalid points are never mixed with valid ones.
+ */
+inline cv::Mat decimate(const cv::Mat & src, int n) {
+	if (n <= 1)
+		return src;
+
+	cv::Mat dst(src.rows / n, src.cols / n, src.type());
+	size_t elem = src.elemSize();
+	for (int i = 0; i < dst.rows; ++i) {
+		const uchar * s = src.ptr<uchar>(i * n);
+		uchar * d = dst.ptr<uchar>(i);
+		for (int j = 0; j < dst.cols; ++j)
+			std::memcpy(d + j * elem, s + j * n * elem, elem);
+	}
+	return dst;
+}
+
+/// Averages n x n blocks, suitable for color images.
+inline cv::Mat decimateAverage(const cv::Mat & src, int n) {
+	if (n <= 1)
+		return src;
+
+	cv::Mat dst;
+	cv::resize(src, dst, cv::Size(src.cols / n, src.rows / n), 0, 0, cv::INTER_AREA);
+	return dst;
+}
+
+/// ORs n x n blocks of CV_8UC1 mask, so that no marked pixel is lost.
+inline cv::Mat decimateOr(const cv::Mat & src, int n) {
+	if (n <= 1)
+		return src;
+
+	cv::Mat dst = cv::Mat::zeros(src.rows / n, src.cols / n, CV_8UC1);
+	for (int i = 0; i < dst.rows * n; ++i) {
+		const uchar * s = src.ptr<uchar>(i);
+		uchar * d = dst.ptr<uchar>(i / n);
+		for (int j = 0; j < dst.cols * n; ++j)
+			d[j / n] |= s[j];
+	}
+	return dst;
+}
+
+} //: namespace Types
+
+#endif /* DECIMATION_HPP_ */
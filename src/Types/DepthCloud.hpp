@@ -0,0 +1,121 @@
+/*!
+ * \file
+ * \brief Organized cloud represented by depth map and shared ray table.
+ */
+
+#ifndef DEPTHCLOUD_HPP_
+#define DEPTHCLOUD_HPP_
+
+#include <boost/shared_ptr.hpp>
+
+#include <opencv2/core/core.hpp>
+
+#include "Types/RayTable.hpp"
+
+namespace Types {
+
+/*!
+ * \class DepthCloud
+ * \brief Organized cloud holding only 16-bit depth and reference to ray table.
+ *
+ * Takes 2 bytes per pixel instead of 12 of CV_32FC3 cloud. XYZ coordinates
+ * are computed on demand, per point, per row or per tile. Points with zero
+ * depth are invalid and are materialized as (0, 0, 0). Copies are shallow,
+ * as for cv::Mat.
+ */
+class DepthCloud {
+public:
+	DepthCloud() :
+		m_scale(0.001f) {
+	}
+
+	DepthCloud(const cv::Mat & depth, const boost::shared_ptr<const RayTable> & rays, float scale) :
+		m_depth(depth), m_rays(rays), m_scale(scale) {
+		CV_Assert(depth.type() == CV_16UC1 && rays && rays->size() == depth.size());
+	}
+
+	/// Raw depth map (CV_16UC1).
+	const cv::Mat & depth() const {
+		return m_depth;
+	}
+
+	const RayTable & rays() const {
+		return *m_rays;
+	}
+
+	const boost::shared_ptr<const RayTable> & rayTable() const {
+		return m_rays;
+	}
+
+	/// Depth units in meters.
+	float scale() const {
+		return m_scale;
+	}
+
+	/// Focal length (in pixels) along x axis.
+	double focal() const {
+		return m_rays->cameraMatrix().at<double>(0, 0);
+	}
+
+	cv::Size size() const {
+		return m_depth.size();
+	}
+
+	bool empty() const {
+		return m_depth.empty();
+	}
+
+	bool valid(int row, int col) const {
+		return m_depth.at<unsigned short>(row, col) != 0;
+	}
+
+	float z(int row, int col) const {
+		return m_depth.at<unsigned short>(row, col) * m_scale;
+	}
+
+	cv::Point3f point(int row, int col) const {
+		float z = this->z(row, col);
+		return cv::Point3f(z * m_rays->x(row)[col], z * m_rays->y(row)[col], z);
+	}
+
+	/// Materializes columns [col_start, col_end) of given row.
+	void row(int row, cv::Point3f * out, int col_start = 0, int col_end = -1) const {
+		if (col_end < 0)
+			col_end = m_depth.cols;
+		const unsigned short * d = m_depth.ptr<unsigned short>(row);
+		const float * rx = m_rays->x(row);
+		const float * ry = m_rays->y(row);
+		for (int c = col_start; c < col_end; ++c, ++out) {
+			float z = d[c] * m_scale;
+			out->x = z * rx[c];
+			out->y = z * ry[c];
+			out->z = z;
+		}
+	}
+
+	/// Materializes given tile into CV_32FC3 matrix of tile size (reusing its buffer if possible).
+	void materialize(cv::Mat & out, const cv::Rect & tile) const {
+		out.create(tile.size(), CV_32FC3);
+		for (int r = 0; r < tile.height; ++r)
+			row(tile.y + r, out.ptr<cv::Point3f>(r), tile.x, tile.x + tile.width);
+	}
+
+	/// Materializes whole cloud into CV_32FC3 matrix.
+	void materialize(cv::Mat & out) const {
+		materialize(out, cv::Rect(0, 0, m_depth.cols, m_depth.rows));
+	}
+
+	/// Returns new cloud sharing ray table, but with other depth map.
+	DepthCloud withDepth(const cv::Mat & depth) const {
+		return DepthCloud(depth, m_rays, m_scale);
+	}
+
+private:
+	cv::Mat m_depth;
+	boost::shared_ptr<const RayTable> m_rays;
+	float m_scale;
+};
+
+} //: namespace Types
+
+#endif /* DEPTHCLOUD_HPP_ */
@@ -0,0 +1,165 @@
+/*!
+ * \file
+ * \brief Conversion of depth map into organized cloud, as run by DepthConverter.
+ */
+
+#ifndef DEPTHCONVERSION_HPP_
+#define DEPTHCONVERSION_HPP_
+
+#include <cmath>
+
+#include <opencv2/core/core.hpp>
+
+#include "Types/RayTable.hpp"
+#include "Types/PointValidity.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace Types {
+
+/*!
+ * Converts rows of depth map into cloud and mask, four points at once with SSE2.
+ */
+class DepthConvertBody: public cv::ParallelLoopBody {
+public:
+	DepthConvertBody(const cv::Mat & depth, const RayTable & rays, cv::Mat & cloud, cv::Mat & mask,
+			float scale, bool range, float z_min, float z_max, const cv::Matx44f * H) :
+		depth(depth), rays(rays), cloud(cloud), mask(mask), scale(scale), range(range), z_min(z_min), z_max(z_max), H(H) {
+	}
+
+	void operator()(const cv::Range & r) const {
+		for (int v = r.start; v < r.end; ++v)
+			row(v);
+	}
+
+private:
+	void row(int v) const {
+		const unsigned short * d = depth.ptr<unsigned short>(v);
+		const float * rx = rays.x(v);
+		const float * ry = rays.y(v);
+		float * p = cloud.ptr<float>(v);
+		uchar * m = mask.ptr<uchar>(v);
+
+		int u = 0;
+#if defined(__SSE2__)
+		const __m128 vscale = _mm_set1_ps(scale);
+		const __m128 vzero = _mm_setzero_ps();
+		const __m128 vzmin = _mm_set1_ps(range ? z_min : 0);
+		const __m128 vzmax = _mm_set1_ps(range ? z_max : 1e30f);
+		const __m128 vmax = _mm_set1_ps(POINT_MAX_RANGE);
+		const __m128 vinv = _mm_set1_ps(INVALID_COORDINATE);
+		const __m128 vabs = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+		for (; u <= depth.cols - 4; u += 4) {
+			__m128i d16 = _mm_loadl_epi64((const __m128i *) (d + u));
+			__m128 z = _mm_cvtepi32_ps(_mm_unpacklo_epi16(d16, _mm_setzero_si128()));
+			__m128 valid = _mm_cmpgt_ps(z, vzero);
+			z = _mm_mul_ps(z, vscale);
+			valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(z, vzmin), _mm_cmple_ps(z, vzmax)));
+			__m128 x = _mm_mul_ps(z, _mm_loadu_ps(rx + u));
+			__m128 y = _mm_mul_ps(z, _mm_loadu_ps(ry + u));
+			__m128 bad = vzero;
+
+			if (H) {
+				const cv::Matx44f & h = *H;
+				__m128 tx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(h(0, 0))), _mm_mul_ps(y, _mm_set1_ps(h(0, 1)))),
+						_mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(h(0, 2))), _mm_set1_ps(h(0, 3))));
+				__m128 ty = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(h(1, 0))), _mm_mul_ps(y, _mm_set1_ps(h(1, 1)))),
+						_mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(h(1, 2))), _mm_set1_ps(h(1, 3))));
+				__m128 tz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(h(2, 0))), _mm_mul_ps(y, _mm_set1_ps(h(2, 1)))),
+						_mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(h(2, 2))), _mm_set1_ps(h(2, 3))));
+				__m128 inside = _mm_and_ps(_mm_cmple_ps(_mm_and_ps(tx, vabs), vmax),
+						_mm_and_ps(_mm_cmple_ps(_mm_and_ps(ty, vabs), vmax), _mm_cmple_ps(_mm_and_ps(tz, vabs), vmax)));
+				bad = _mm_andnot_ps(inside, valid);
+				valid = _mm_and_ps(valid, inside);
+				x = tx;
+				y = ty;
+				z = tz;
+			}
+
+			__m128 fill = _mm_and_ps(bad, vinv);
+			x = _mm_or_ps(_mm_and_ps(valid, x), fill);
+			y = _mm_or_ps(_mm_and_ps(valid, y), fill);
+			z = _mm_or_ps(_mm_and_ps(valid, z), fill);
+
+			// interleave x, y, z into 12 consecutive floats
+			__m128 xy_lo = _mm_unpacklo_ps(x, y);
+			__m128 xy_hi = _mm_unpackhi_ps(x, y);
+			__m128 t0 = _mm_shuffle_ps(z, xy_lo, _MM_SHUFFLE(2, 2, 0, 0));
+			__m128 t1 = _mm_shuffle_ps(xy_lo, z, _MM_SHUFFLE(1, 1, 3, 3));
+			__m128 t2 = _mm_shuffle_ps(z, xy_hi, _MM_SHUFFLE(2, 2, 2, 2));
+			__m128 t3 = _mm_shuffle_ps(xy_hi, z, _MM_SHUFFLE(3, 3, 3, 3));
+			_mm_storeu_ps(p + 3 * u, _mm_shuffle_ps(xy_lo, t0, _MM_SHUFFLE(2, 0, 1, 0)));
+			_mm_storeu_ps(p + 3 * u + 4, _mm_shuffle_ps(t1, xy_hi, _MM_SHUFFLE(1, 0, 2, 0)));
+			_mm_storeu_ps(p + 3 * u + 8, _mm_shuffle_ps(t2, t3, _MM_SHUFFLE(2, 0, 2, 0)));
+
+			int bits = _mm_movemask_ps(valid);
+			m[u] = (bits & 1) ? 255 : 0;
+			m[u + 1] = (bits & 2) ? 255 : 0;
+			m[u + 2] = (bits & 4) ? 255 : 0;
+			m[u + 3] = (bits & 8) ? 255 : 0;
+		}
+#endif
+		for (; u < depth.cols; ++u) {
+			float z = d[u] * scale;
+			if (d[u] == 0 || (range && (z < z_min || z > z_max))) {
+				p[3 * u] = p[3 * u + 1] = p[3 * u + 2] = 0;
+				m[u] = 0;
+				continue;
+			}
+
+			float x = z * rx[u];
+			float y = z * ry[u];
+			m[u] = 255;
+
+			if (H) {
+				const cv::Matx44f & h = *H;
+				// summed in the same order as by SSE, so that results don't depend on column
+				float tx = (x * h(0, 0) + y * h(0, 1)) + (z * h(0, 2) + h(0, 3));
+				float ty = (x * h(1, 0) + y * h(1, 1)) + (z * h(1, 2) + h(1, 3));
+				float tz = (x * h(2, 0) + y * h(2, 1)) + (z * h(2, 2) + h(2, 3));
+				if (fabs(tx) > POINT_MAX_RANGE || fabs(ty) > POINT_MAX_RANGE
+						|| fabs(tz) > POINT_MAX_RANGE) {
+					tx = ty = tz = INVALID_COORDINATE;
+					m[u] = 0;
+				}
+				x = tx;
+				y = ty;
+				z = tz;
+			}
+
+			p[3 * u] = x;
+			p[3 * u + 1] = y;
+			p[3 * u + 2] = z;
+		}
+	}
+
+	const cv::Mat & depth;
+	const RayTable & rays;
+	cv::Mat & cloud;
+	cv::Mat & mask;
+	float scale;
+	bool range;
+	float z_min;
+	float z_max;
+	const cv::Matx44f * H;
+};
+
+/*!
+ * Converts depth map (CV_16UC1, in scale units) into cloud (CV_32FC3) and
+ * mask (CV_8UC1) of the same size. Invalid depth and points outside of
+ * [z_min, z_max] (if range is set) are (0, 0, 0), points transformed (by H,
+ * if given) out of range are INVALID_COORDINATE, mask is 0 for both.
+ */
+inline void convertDepth(const cv::Mat & depth, const RayTable & rays, float scale, bool range, float z_min,
+		float z_max, const cv::Matx44f * H, cv::Mat & cloud, cv::Mat & mask) {
+	cloud.create(depth.size(), CV_32FC3);
+	mask.create(depth.size(), CV_8UC1);
+	DepthConvertBody body(depth, rays, cloud, mask, scale, range, z_min, z_max, H);
+	cv::parallel_for_(cv::Range(0, depth.rows), body);
+}
+
+} //: namespace Types
+
+#endif /* DEPTHCONVERSION_HPP_ */
@@ -0,0 +1,256 @@
+/*!
+ * \file
+ * \brief Kernels of DepthNormalEstimator, usable outside of components.
+ */
+
+#ifndef DEPTHNORMALKERNELS_HPP_
+#define DEPTHNORMALKERNELS_HPP_
+
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "Types/EdgeMask.hpp"
+#include "Types/IntegralImage.hpp"
+
+namespace Types {
+
+/// Depth (in mm) above which normals are not computed.
+static const long DEPTH_NORMAL_MAX_DEPTH = 2000;
+
+/// Distance of sampled neighbours, normals closer to the border are not computed.
+static const int DEPTH_NORMAL_SPACING = 5; // used to be 7
+
+inline void accumBilateral(long delta, long i, long j, long * A, long * b, int threshold) {
+	long f = std::abs(delta) < threshold ? 1 : 0;
+
+	const long fi = f * i;
+	const long fj = f * j;
+
+	A[0] += fi * i;
+	A[1] += fi * j;
+	A[3] += fj * j;
+	b[0] += fi * delta;
+	b[1] += fj * delta;
+}
+
+/*!
+ * Normal at (l_x, l_y) of raw depth map, (-1, -1, -1) if it can't be
+ * estimated. Point has to be at least DEPTH_NORMAL_SPACING pixels from the
+ * border.
+ */
+inline cv::Point3f depthNormalAt(const cv::Mat & depth, int l_x, int l_y, double focal, int difference_threshold) {
+	const int l_r = DEPTH_NORMAL_SPACING;
+	const int l_W = depth.step1();
+	const unsigned short * lp_line = depth.ptr<unsigned short>(l_y) + l_x;
+	long l_d = lp_line[0];
+
+	if (l_d >= DEPTH_NORMAL_MAX_DEPTH)
+		return cv::Point3f(-1, -1, -1);
+
+	const int l_offset0 = -l_r - l_r * l_W;
+	const int l_offset1 = 0 - l_r * l_W;
+	const int l_offset2 = +l_r - l_r * l_W;
+	const int l_offset3 = -l_r;
+	const int l_offset4 = +l_r;
+	const int l_offset5 = -l_r + l_r * l_W;
+	const int l_offset6 = 0 + l_r * l_W;
+	const int l_offset7 = +l_r + l_r * l_W;
+
+	// accum
+	long l_A[4];
+	l_A[0] = l_A[1] = l_A[2] = l_A[3] = 0;
+	long l_b[2];
+	l_b[0] = l_b[1] = 0;
+	accumBilateral(lp_line[l_offset0] - l_d, -l_r, -l_r, l_A, l_b,
+			difference_threshold);
+	accumBilateral(lp_line[l_offset1] - l_d, 0, -l_r, l_A, l_b,
+			difference_threshold);
+	accumBilateral(lp_line[l_offset2] - l_d, +l_r, -l_r, l_A, l_b,
+			difference_threshold);
+	accumBilateral(lp_line[l_offset3] - l_d, -l_r, 0, l_A, l_b,
+			difference_threshold);
+	accumBilateral(lp_line[l_offset4] - l_d, +l_r, 0, l_A, l_b,
+			difference_threshold);
+	accumBilateral(lp_line[l_offset5] - l_d, -l_r, +l_r, l_A, l_b,
+			difference_threshold);
+	accumBilateral(lp_line[l_offset6] - l_d, 0, +l_r, l_A, l_b,
+			difference_threshold);
+	accumBilateral(lp_line[l_offset7] - l_d, +l_r, +l_r, l_A, l_b,
+			difference_threshold);
+
+	// solve
+	long l_det = l_A[0] * l_A[3] - l_A[1] * l_A[1];
+	long l_ddx = l_A[3] * l_b[0] - l_A[1] * l_b[1];
+	long l_ddy = -l_A[1] * l_b[0] + l_A[0] * l_b[1];
+
+	/// Focal length, for raw depth input it is assumed to be 530
+	/// (Kinect in VGA mode, 1150 in SXGA).
+	float l_nx = static_cast<float>(focal * l_ddx);
+	float l_ny = static_cast<float>(focal * l_ddy);
+	float l_nz = static_cast<float>(-l_det * l_d);
+
+	float l_sqrt = sqrt(l_nx * l_nx + l_ny * l_ny + l_nz * l_nz);
+
+	if (l_sqrt > 0) {
+		float l_norminv = 1.0f / (l_sqrt);
+
+		l_nx *= l_norminv;
+		l_ny *= l_norminv;
+		l_nz *= l_norminv;
+
+		return cv::Point3f(-l_nx, -l_ny, -l_nz);
+	} else {
+		return cv::Point3f(-1, -1, -1);
+	}
+}
+
+/// Normal at (l_x, l_y), (-1, -1, -1) if window straddles depth discontinuity.
+inline cv::Point3f depthNormalPixel(const cv::Mat & depth, const cv::Mat & edge_sum, int l_x, int l_y,
+		double focal, int difference_threshold) {
+	if (!edge_sum.empty() && windowHasEdge(edge_sum, l_y, l_x, DEPTH_NORMAL_SPACING))
+		return cv::Point3f(-1, -1, -1);
+	return depthNormalAt(depth, l_x, l_y, focal, difference_threshold);
+}
+
+/*!
+ * Recomputes normals (CV_32FC3, of depth size) at pixels set in dirty mask
+ * (CV_8UC1), or at all of them if it's empty. Edge integral may be empty.
+ */
+inline void updateDepthNormals(const cv::Mat & depth, const cv::Mat & edge_sum, const cv::Mat & dirty, double focal,
+		int difference_threshold, cv::Mat & normals) {
+	const int l_r = DEPTH_NORMAL_SPACING;
+	for (int l_y = l_r; l_y < depth.rows - l_r - 1; ++l_y) {
+		const uchar * d = dirty.empty() ? NULL : dirty.ptr<uchar>(l_y);
+		cv::Point3f * lp_normals = normals.ptr<cv::Point3f>(l_y);
+		for (int l_x = l_r; l_x < depth.cols - l_r - 1; ++l_x)
+			if (!d || d[l_x])
+				lp_normals[l_x] = depthNormalPixel(depth, edge_sum, l_x, l_y, focal, difference_threshold);
+	}
+}
+
+/*!
+ * DepthNormalEstimator with fixed window over whole depth map (CV_16UC1).
+ * Normals closer than DEPTH_NORMAL_SPACING to the border are zero, invalid
+ * ones and those of windows straddling edges are (-1, -1, -1).
+ */
+inline void estimateDepthNormals(const cv::Mat & depth, const cv::Mat & edge_sum, double focal,
+		int difference_threshold, cv::Mat & normals) {
+	normals = cv::Mat::zeros(depth.size(), CV_32FC3);
+	updateDepthNormals(depth, edge_sum, cv::Mat(), focal, difference_threshold, normals);
+}
+
+/*!
+ * Depth gradient from mean depths of window halves (left/right, upper/lower),
+ * window radius grows with depth. Means come from integral images, so cost
+ * doesn't depend on window size.
+ */
+class AdaptiveDepthNormalsBody: public cv::ParallelLoopBody {
+public:
+	AdaptiveDepthNormalsBody(const cv::Mat & depth, const cv::Mat & sum, const cv::Mat & count,
+			const cv::Mat & edge_sum, cv::Mat & normals, double focal, int difference_threshold, float scale,
+			int min_window, int max_window) :
+		depth(depth), sum(sum), count(count), edge_sum(edge_sum), normals(normals), focal(focal),
+		difference_threshold(difference_threshold), scale(scale), min_window(min_window), max_window(max_window) {
+	}
+
+	void operator()(const cv::Range & r) const {
+		for (int l_y = r.start; l_y < r.end; ++l_y) {
+			const unsigned short * lp_line = depth.ptr<unsigned short>(l_y);
+			cv::Point3f * lp_normals = normals.ptr<cv::Point3f>(l_y);
+			for (int l_x = 0; l_x < depth.cols; ++l_x)
+				lp_normals[l_x] = normalAt(lp_line[l_x], l_x, l_y);
+		}
+	}
+
+private:
+	/// Mean depth in rows [r0, r1) and columns [c0, c1), false if there are no valid pixels.
+	bool mean(int r0, int c0, int r1, int c1, double & m) const {
+		int n = boxSum<int>(count, r0, c0, r1, c1);
+		if (n == 0)
+			return false;
+		m = boxSum<double>(sum, r0, c0, r1, c1) / n;
+		return true;
+	}
+
+	cv::Point3f normalAt(long l_d, int l_x, int l_y) const {
+		const cv::Point3f invalid(-1, -1, -1);
+		if (l_d == 0 || l_d >= DEPTH_NORMAL_MAX_DEPTH)
+			return invalid;
+
+		int w = std::min(std::max(cvRound(scale * l_d * 0.001), min_window), max_window);
+		w = std::min(std::min(w, std::min(l_x, l_y)), std::min(depth.cols - 1 - l_x, depth.rows - 1 - l_y));
+		if (!edge_sum.empty())
+			while (w > 0 && windowHasEdge(edge_sum, l_y, l_x, w))
+				--w;
+		if (w < 1)
+			return invalid;
+
+		double left, right, up, down;
+		if (!mean(l_y - w, l_x - w, l_y + w + 1, l_x, left) || !mean(l_y - w, l_x + 1, l_y + w + 1, l_x + w + 1, right)
+				|| !mean(l_y - w, l_x - w, l_y, l_x + w + 1, up)
+				|| !mean(l_y + 1, l_x - w, l_y + w + 1, l_x + w + 1, down))
+			return invalid;
+
+		// centres of halves are (w + 1) / 2 pixels away, same slope limit as
+		// in bilateral version (difference_threshold over l_r pixels)
+		double limit = difference_threshold * 0.5 * (w + 1) / DEPTH_NORMAL_SPACING;
+		if (std::fabs(left - l_d) > limit || std::fabs(right - l_d) > limit || std::fabs(up - l_d) > limit
+				|| std::fabs(down - l_d) > limit)
+			return invalid;
+
+		double gx = (right - left) / (w + 1);
+		double gy = (down - up) / (w + 1);
+		double l_nx = -focal * gx, l_ny = -focal * gy, l_nz = l_d;
+		double l_norminv = 1.0 / sqrt(l_nx * l_nx + l_ny * l_ny + l_nz * l_nz);
+		return cv::Point3f(l_nx * l_norminv, l_ny * l_norminv, l_nz * l_norminv);
+	}
+
+	const cv::Mat & depth;
+	const cv::Mat & sum;
+	const cv::Mat & count;
+	const cv::Mat & edge_sum;
+	cv::Mat & normals;
+	double focal;
+	int difference_threshold;
+	float scale;
+	int min_window;
+	int max_window;
+};
+
+/*!
+ * DepthNormalEstimator with depth adaptive windows, radius is scale pixels
+ * at 1 m, limited to [min_window, max_window]. Every normal (CV_32FC3) is
+ * computed, invalid ones are (-1, -1, -1).
+ */
+inline void estimateDepthNormalsAdaptive(const cv::Mat & depth, const cv::Mat & edge_sum, double focal,
+		int difference_threshold, float scale, int min_window, int max_window, cv::Mat & normals) {
+	normals.create(depth.size(), CV_32FC3);
+
+	// only valid depth is summed, count of valid pixels is kept separately
+	cv::Mat valid_depth(depth.size(), CV_32FC1);
+	cv::Mat valid(depth.size(), CV_8UC1);
+	for (int i = 0; i < depth.rows; ++i) {
+		const unsigned short * d = depth.ptr<unsigned short>(i);
+		float * vd = valid_depth.ptr<float>(i);
+		uchar * v = valid.ptr<uchar>(i);
+		for (int j = 0; j < depth.cols; ++j) {
+			v[j] = (d[j] > 0 && d[j] < DEPTH_NORMAL_MAX_DEPTH) ? 1 : 0;
+			vd[j] = v[j] ? d[j] : 0;
+		}
+	}
+
+	cv::Mat sum, count;
+	cv::integral(valid_depth, sum, CV_64F);
+	cv::integral(valid, count, CV_32S);
+
+	cv::parallel_for_(cv::Range(0, depth.rows), AdaptiveDepthNormalsBody(depth, sum, count, edge_sum, normals, focal,
+			difference_threshold, scale, min_window, max_window));
+}
+
+} //: namespace Types
+
+#endif /* DEPTHNORMALKERNELS_HPP_ */
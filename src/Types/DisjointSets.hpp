@@ -0,0 +1,77 @@
+/*!
+ * \file
+ * \brief Union-find over integer elements.
+ */
+
+#ifndef DISJOINTSETS_HPP_
+#define DISJOINTSETS_HPP_
+
+#include <vector>
+#include <algorithm>
+
+namespace Types {
+
+/*!
+ * \class DisjointSets
+ * \brief Disjoint sets of elements 0..n-1, with union by rank and path halving.
+ *
+ * Any sequence of operations runs in nearly linear time. Sizes are kept for
+ * representatives (roots) only.
+ */
+class DisjointSets {
+public:
+	explicit DisjointSets(int n = 0) {
+		reset(n);
+	}
+
+	/// Makes every element a separate set.
+	void reset(int n) {
+		m_parent.resize(n);
+		for (int i = 0; i < n; ++i)
+			m_parent[i] = i;
+		m_rank.assign(n, 0);
+		m_size.assign(n, 1);
+		m_sets = n;
+	}
+
+	/// Representative of set containing x.
+	int find(int x) {
+		while (m_parent[x] != x) {
+			m_parent[x] = m_parent[m_parent[x]];
+			x = m_parent[x];
+		}
+		return x;
+	}
+
+	/// Joins sets with representatives a and b (a != b), returns representative of the union.
+	int join(int a, int b) {
+		if (m_rank[a] < m_rank[b])
+			std::swap(a, b);
+		if (m_rank[a] == m_rank[b])
+			++m_rank[a];
+		m_parent[b] = a;
+		m_size[a] += m_size[b];
+		--m_sets;
+		return a;
+	}
+
+	/// Number of elements in set with representative x.
+	int size(int x) const {
+		return m_size[x];
+	}
+
+	/// Number of sets.
+	int sets() const {
+		return m_sets;
+	}
+
+private:
+	std::vector<int> m_parent;
+	std::vector<int> m_rank;
+	std::vector<int> m_size;
+	int m_sets;
+};
+
+} //: namespace Types
+
+#endif /* DISJOINTSETS_HPP_ */
@@ -0,0 +1,57 @@
+/*!
+ * \file
+ * \brief Bits of edge mask produced by DepthEdges and helpers for its consumers.
+ */
+
+#ifndef EDGEMASK_HPP_
+#define EDGEMASK_HPP_
+
+#include <algorithm>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+namespace Types {
+
+/*!
+ * Edge mask is CV_8UC1 image, each pixel holds OR of the following bits.
+ */
+enum EdgeType {
+	/// Nearer side of depth discontinuity (object border).
+	EDGE_OCCLUDING = 1,
+	/// Farther side of depth discontinuity (shadowed background).
+	EDGE_OCCLUDED = 2,
+	/// Crease on continuous surface.
+	EDGE_CURVATURE = 4,
+
+	EDGE_DISCONTINUITY = EDGE_OCCLUDING | EDGE_OCCLUDED
+};
+
+/*!
+ * Computes integral image of pixels having any of given edge bits set,
+ * so that windows can be tested with windowHasEdge in constant time.
+ */
+inline void edgeIntegral(const cv::Mat & edges, int types, cv::Mat & sum) {
+	cv::Mat mask(edges.size(), CV_8UC1);
+	for (int i = 0; i < edges.rows; ++i) {
+		const uchar * e = edges.ptr<uchar>(i);
+		uchar * m = mask.ptr<uchar>(i);
+		for (int j = 0; j < edges.cols; ++j)
+			m[j] = (e[j] & types) ? 1 : 0;
+	}
+	cv::integral(mask, sum, CV_32S);
+}
+
+/*!
+ * Checks, if square window of given radius centered at (row, col) contains
+ * any edge pixel. Window is clipped to the image.
+ */
+inline bool windowHasEdge(const cv::Mat & sum, int row, int col, int radius) {
+	int r0 = std::max(row - radius, 0), r1 = std::min(row + radius + 1, sum.rows - 1);
+	int c0 = std::max(col - radius, 0), c1 = std::min(col + radius + 1, sum.cols - 1);
+	return sum.at<int>(r1, c1) - sum.at<int>(r0, c1) - sum.at<int>(r1, c0) + sum.at<int>(r0, c0) > 0;
+}
+
+} //: namespace Types
+
+#endif /* EDGEMASK_HPP_ */
@@ -0,0 +1,67 @@
+/*!
+ * \file
+ * \brief Frame metadata passed along the processing pipeline.
+ */
+
+#ifndef FRAMEINFO_HPP_
+#define FRAMEINFO_HPP_
+
+#include <ostream>
+
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <opencv2/core/core.hpp>
+
+namespace Types {
+
+/*!
+ * \struct FrameInfo
+ * \brief Frame envelope: sequence number, capture timestamp and ROI.
+ *
+ * Created by the source of the frame and propagated unchanged by every
+ * processing component (always written before the payload it describes),
+ * so that sinks can compute capture-to-output latency and detect frames
+ * lost on Newest-buffered inputs.
+ */
+struct FrameInfo {
+	FrameInfo() :
+		seq(0), timestamp(0), valid(false) {
+	}
+
+	FrameInfo(boost::uint64_t s, double ts, cv::Rect r) :
+		seq(s), timestamp(ts), roi(r), valid(true) {
+	}
+
+	/// Current time in seconds, same clock as used for capture timestamps.
+	static double now() {
+		static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+		return (boost::posix_time::microsec_clock::universal_time() - epoch).total_microseconds() * 1e-6;
+	}
+
+	/// Seconds elapsed since capture.
+	double age() const {
+		return now() - timestamp;
+	}
+
+	/// Frame sequence number, incremented by source for each frame.
+	boost::uint64_t seq;
+
+	/// Capture time in seconds since epoch.
+	double timestamp;
+
+	/// Region of the sensor image covered by the payload.
+	cv::Rect roi;
+
+	/// Set if frame info was filled by source.
+	bool valid;
+};
+
+inline std::ostream & operator<<(std::ostream & os, const FrameInfo & info) {
+	return os << "#" << info.seq << " @" << info.timestamp << " [" << info.roi.x << ", " << info.roi.y
+			<< ", " << info.roi.width << "x" << info.roi.height << "]";
+}
+
+} //: namespace Types
+
+#endif /* FRAMEINFO_HPP_ */
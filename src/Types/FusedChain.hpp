@@ -0,0 +1,156 @@
+/*!
+ * \file
+ * \brief PassThrough, DepthTransform and NormalEstimator fused into one tiled pass, as run by FusedNormals.
+ */
+
+#ifndef FUSEDCHAIN_HPP_
+#define FUSEDCHAIN_HPP_
+
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
+#include <opencv2/core/core.hpp>
+
+#include "Types/CloudKernels.hpp"
+
+namespace Types {
+
+/// Tile rows [r0, r1) and columns [c0, c1), extended with halo needed by normal windows.
+struct ChainTile {
+	ChainTile(cv::Size size, int index, int rows, int cols) {
+		int tiles_x = (size.width + cols - 1) / cols;
+		r0 = (index / tiles_x) * rows;
+		c0 = (index % tiles_x) * cols;
+		r1 = std::min(r0 + rows, size.height);
+		c1 = std::min(c0 + cols, size.width);
+		// window reaches NORMAL_WINDOW points away, derivatives one more
+		hr0 = std::max(0, r0 - NORMAL_WINDOW);
+		hc0 = std::max(0, c0 - NORMAL_WINDOW);
+		hr1 = std::min(size.height, r1 + NORMAL_WINDOW + 1);
+		hc1 = std::min(size.width, c1 + NORMAL_WINDOW + 1);
+	}
+
+	static int count(cv::Size size, int rows, int cols) {
+		return ((size.height + rows - 1) / rows) * ((size.width + cols - 1) / cols);
+	}
+
+	int r0, r1, c0, c1;
+	int hr0, hr1, hc0, hc1;
+};
+
+/*!
+ * Filters, transforms and estimates normals tile by tile. Intermediate
+ * results live in per-thread buffers of a single tile.
+ */
+class FusedChainBody: public cv::ParallelLoopBody {
+public:
+	FusedChainBody(const cv::Mat & src, const double * m, bool transform, float z_min, float z_max, float radius,
+			int tile_rows, int tile_cols, cv::Mat & xyz, cv::Mat & mask, cv::Mat & normals, cv::Mat & out) :
+		src(src), m(m), transform(transform), z_min(z_min), z_max(z_max), radius(radius),
+		tile_rows(tile_rows), tile_cols(tile_cols), xyz(xyz), mask(mask), normals(normals), out(out) {
+	}
+
+	void operator()(const cv::Range & r) const {
+		int max_points = (tile_rows + 2 * NORMAL_WINDOW + 1) * (tile_cols + 2 * NORMAL_WINDOW + 1);
+		std::vector<cv::Point3f> pts(max_points), der_row(max_points), der_col(max_points);
+		for (int t = r.start; t < r.end; ++t)
+			tile(ChainTile(src.size(), t, tile_rows, tile_cols), &pts[0], &der_row[0], &der_col[0]);
+	}
+
+private:
+	void tile(const ChainTile & t, cv::Point3f * pts, cv::Point3f * der_row, cv::Point3f * der_col) const {
+		int w = t.hc1 - t.hc0;
+		int h = t.hr1 - t.hr0;
+
+		// range filter and transformation, mask is written for own points only
+		for (int i = t.hr0; i < t.hr1; ++i) {
+			const cv::Point3f * s = src.ptr<cv::Point3f>(i);
+			cv::Point3f * p = pts + (i - t.hr0) * w - t.hc0;
+			uchar * mp = (i >= t.r0 && i < t.r1) ? mask.ptr<uchar>(i) : NULL;
+			for (int j = t.hc0; j < t.hc1; ++j) {
+				cv::Point3f q = s[j];
+				uchar v = passPoint(q, z_min, z_max);
+				if (transform)
+					transformPoint(q, m);
+				p[j] = q;
+				if (mp && j >= t.c0 && j < t.c1)
+					mp[j] = v;
+			}
+		}
+
+		for (int i = t.r0; i < t.r1; ++i)
+			std::memcpy(xyz.ptr<cv::Point3f>(i) + t.c0, pts + (i - t.hr0) * w + (t.c0 - t.hc0),
+					(t.c1 - t.c0) * sizeof(cv::Point3f));
+
+		for (int i = 0; i < h - 1; ++i) {
+			const cv::Point3f * p = pts + i * w;
+			cv::Point3f * p_row = der_row + i * w;
+			cv::Point3f * p_col = der_col + i * w;
+			for (int j = 0; j < w - 1; ++j) {
+				p_row[j] = cloudDerivative(p[j], p[j + 1]);
+				p_col[j] = cloudDerivative(p[j], p[j + w]);
+			}
+		}
+
+		// normals are estimated where NormalEstimator does
+		int rows = src.rows;
+		int cols = src.cols;
+		for (int i = t.r0; i < t.r1; ++i) {
+			cv::Point3f * nptr = normals.ptr<cv::Point3f>(i);
+			uchar * out_p = out.ptr<uchar>(i);
+			for (int j = t.c0; j < t.c1; ++j) {
+				if (i < NORMAL_WINDOW || j < NORMAL_WINDOW || i >= rows - NORMAL_WINDOW - 1
+						|| j >= cols - NORMAL_WINDOW - 1) {
+					nptr[j] = cv::Point3f(-1, -1, -1);
+					out_p[3 * j + 2] = out_p[3 * j + 1] = out_p[3 * j + 0] = 0;
+					continue;
+				}
+				cv::Point3f normal = windowNormal(pts, der_row, der_col, w, i - t.hr0, j - t.hc0, radius,
+						NORMAL_WINDOW);
+				writeNormal(normal, nptr[j], out_p + 3 * j);
+			}
+		}
+	}
+
+	const cv::Mat & src;
+	const double * m;
+	bool transform;
+	float z_min;
+	float z_max;
+	float radius;
+	int tile_rows;
+	int tile_cols;
+	cv::Mat & xyz;
+	cv::Mat & mask;
+	cv::Mat & normals;
+	cv::Mat & out;
+};
+
+/*!
+ * Runs fused chain over cloud (CV_32FC3) in tiles of given size, by given
+ * number of threads (0 uses all of them). Outputs are the same as of
+ * separate passThrough(), transformCloud() (if transform is set) and
+ * estimateNormals() with visualization.
+ */
+inline void fusedChain(const cv::Mat & src, const cv::Matx44d & H, bool transform, float z_min, float z_max,
+		float radius, int tile_rows, int tile_cols, int threads, cv::Mat & xyz, cv::Mat & mask, cv::Mat & normals,
+		cv::Mat & out) {
+	xyz.create(src.size(), CV_32FC3);
+	mask.create(src.size(), CV_8UC1);
+	normals.create(src.size(), CV_32FC3);
+	out.create(src.size(), CV_8UC3);
+
+	FusedChainBody body(src, H.val, transform, z_min, z_max, radius, tile_rows, tile_cols, xyz, mask, normals, out);
+	cv::Range tiles(0, ChainTile::count(src.size(), tile_rows, tile_cols));
+
+	// every stripe is run by one thread, so number of stripes limits number of threads
+	if (threads == 1)
+		body(tiles);
+	else
+		cv::parallel_for_(tiles, body, threads > 0 ? threads : -1);
+}
+
+} //: namespace Types
+
+#endif /* FUSEDCHAIN_HPP_ */
@@ -0,0 +1,503 @@
+/*!
+ * \file
+ * \brief Lock-free latency histograms and per-handler call statistics.
+ */
+
+#ifndef HANDLERSTATISTICS_HPP_
+#define HANDLERSTATISTICS_HPP_
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iomanip>
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "Base/DataStream.hpp"
+#include "Base/Property.hpp"
+#include "Common/Logger.hpp"
+#include "Common/Timer.hpp"
+
+#include "Types/FrameInfo.hpp"
+#include "Types/Trace.hpp"
+#include "Types/AllocationTracker.hpp"
+
+namespace Types {
+
+/*!
+ * \class LatencyHistogram
+ * \brief Log-linear histogram of latencies, in microseconds.
+ *
+ * Each power of two is split into 16 linear buckets, so reported
+ * percentiles are within ~6% of the real value. Recording is a couple of
+ * relaxed atomic operations, so the histogram can be read from any thread
+ * while the owning handler keeps writing to it.
+ */
+class LatencyHistogram {
+public:
+	static const int SUB_BITS = 4;
+	static const int SUB_BUCKETS = 1 << SUB_BITS;
+	static const int BUCKETS = (32 - SUB_BITS + 1) * SUB_BUCKETS;
+
+	LatencyHistogram() {
+		reset();
+	}
+
+	/// Adds single measurement (in seconds).
+	void record(double seconds) {
+		double us = seconds * 1e6;
+		boost::uint32_t v = us < 0 ? 0 : (us > 4294967295.0 ? 0xffffffffu : (boost::uint32_t) us);
+
+		m_buckets[bucket(v)].fetch_add(1, boost::memory_order_relaxed);
+		m_count.fetch_add(1, boost::memory_order_relaxed);
+		m_sum.fetch_add(v, boost::memory_order_relaxed);
+
+		boost::uint32_t prev = m_max.load(boost::memory_order_relaxed);
+		while (v > prev && !m_max.compare_exchange_weak(prev, v, boost::memory_order_relaxed))
+			;
+	}
+
+	/// Returns latency (in seconds) below which lies given fraction of measurements.
+	double percentile(double p) const {
+		boost::uint64_t total = count();
+		if (total == 0)
+			return 0;
+
+		boost::uint64_t rank = (boost::uint64_t) (p * total);
+		if (rank >= total)
+			rank = total - 1;
+
+		boost::uint64_t acc = 0;
+		for (int i = 0; i < BUCKETS; ++i) {
+			acc += m_buckets[i].load(boost::memory_order_relaxed);
+			if (acc > rank)
+				return upperBound(i) * 1e-6;
+		}
+		return max();
+	}
+
+	/// Number of recorded measurements.
+	boost::uint64_t count() const {
+		return m_count.load(boost::memory_order_relaxed);
+	}
+
+	/// Maximal recorded latency (in seconds).
+	double max() const {
+		return m_max.load(boost::memory_order_relaxed) * 1e-6;
+	}
+
+	/// Mean latency (in seconds).
+	double mean() const {
+		boost::uint64_t total = count();
+		return total ? m_sum.load(boost::memory_order_relaxed) * 1e-6 / total : 0;
+	}
+
+	void reset() {
+		for (int i = 0; i < BUCKETS; ++i)
+			m_buckets[i].store(0, boost::memory_order_relaxed);
+		m_count.store(0, boost::memory_order_relaxed);
+		m_sum.store(0, boost::memory_order_relaxed);
+		m_max.store(0, boost::memory_order_relaxed);
+	}
+
+private:
+	static int bucket(boost::uint32_t v) {
+		if (v < (boost::uint32_t) SUB_BUCKETS)
+			return v;
+		int msb = 31 - __builtin_clz(v);
+		int shift = msb - SUB_BITS;
+		return (shift + 1) * SUB_BUCKETS + ((v >> shift) & (SUB_BUCKETS - 1));
+	}
+
+	static double upperBound(int idx) {
+		if (idx < SUB_BUCKETS)
+			return idx;
+		int shift = idx / SUB_BUCKETS - 1;
+		int sub = idx % SUB_BUCKETS;
+		return (double) (((boost::uint64_t) (SUB_BUCKETS + sub + 1) << shift) - 1);
+	}
+
+	boost::atomic<boost::uint64_t> m_buckets[BUCKETS];
+	boost::atomic<boost::uint64_t> m_count;
+	boost::atomic<boost::uint64_t> m_sum;
+	boost::atomic<boost::uint32_t> m_max;
+};
+
+/*!
+ * \class HandlerStatistics
+ * \brief Statistics of single event handler.
+ */
+class HandlerStatistics {
+public:
+	HandlerStatistics(const std::string & name) :
+		m_name(name), m_calls(0), m_skipped(0) {
+	}
+
+	const std::string & name() const {
+		return m_name;
+	}
+
+	void call(double seconds) {
+		m_calls.fetch_add(1, boost::memory_order_relaxed);
+		m_latency.record(seconds);
+	}
+
+	void skip() {
+		m_skipped.fetch_add(1, boost::memory_order_relaxed);
+	}
+
+	boost::uint64_t calls() const {
+		return m_calls.load(boost::memory_order_relaxed);
+	}
+
+	boost::uint64_t skipped() const {
+		return m_skipped.load(boost::memory_order_relaxed);
+	}
+
+	const LatencyHistogram & latency() const {
+		return m_latency;
+	}
+
+	/// Adds allocations of single call.
+	void allocated(const AllocationScope & scope) {
+		m_allocations.record(scope);
+	}
+
+	const AllocationCounter & allocations() const {
+		return m_allocations;
+	}
+
+	/// One-line summary, latencies in milliseconds.
+	std::string summary() const {
+		std::ostringstream ss;
+		ss << std::fixed << std::setprecision(3) << m_name
+		   << ": calls=" << calls()
+		   << " skipped=" << skipped()
+		   << " p50=" << m_latency.percentile(0.50) * 1000
+		   << " p95=" << m_latency.percentile(0.95) * 1000
+		   << " p99=" << m_latency.percentile(0.99) * 1000
+		   << " max=" << m_latency.max() * 1000;
+		if (m_allocations.calls() > 0)
+			ss << std::setprecision(1)
+			   << " allocs=" << m_allocations.count()
+			   << " alloc_kB=" << m_allocations.bytes() / 1024
+			   << " peak_kB=" << m_allocations.peak() / 1024.0
+			   << " alloc_free=" << m_allocations.freeCalls();
+		return ss.str();
+	}
+
+private:
+	std::string m_name;
+	boost::atomic<boost::uint64_t> m_calls;
+	boost::atomic<boost::uint64_t> m_skipped;
+	LatencyHistogram m_latency;
+	AllocationCounter m_allocations;
+};
+
+/*!
+ * \class ComponentStatistics
+ * \brief Instruments all handlers of a component.
+ *
+ * Handlers are wrapped with wrap() before registration. Summary of all of
+ * them is published in read-only "statistics" property and logged every
+ * "statistics_period" seconds (0 disables logging). If "trace_file" is set,
+ * begin and end of every call is also recorded by Types::Tracer. If
+ * "allocations" is set, matrix allocations of every call (count, bytes and
+ * peak of live bytes) are counted by Types::AllocationTracker and reported
+ * per handler as well (allocs and alloc_kB are means per call). Only
+ * allocations of the thread running the handler are counted, not of
+ * cv::parallel_for_ workers, which the summary notes.
+ *
+ * Component registers in_frame_info and out_frame_info streams as well. Frame
+ * info is read before each wrapped frame handler runs, gaps in sequence
+ * numbers are counted as dropped frames. By default it is the newest info
+ * received, which may already describe the next frame if the source runs
+ * ahead; with "frame_sync" set, init() makes in_frame_info a dependency of
+ * all frame handlers, so each call gets the info written with its payload.
+ * Component calls publish() right before writing outputs of a frame (from
+ * whichever thread writes them), which forwards the info and records frame
+ * age at that moment. Frames without outputs are not forwarded, so they are
+ * counted as dropped downstream.
+ */
+class ComponentStatistics {
+public:
+	ComponentStatistics(const std::string & name) :
+		prop_statistics("statistics", std::string()),
+		prop_statistics_period("statistics_period", 5.0f),
+		prop_trace_file("trace_file", std::string()),
+		prop_allocations("allocations", false),
+		prop_frame_sync("frame_sync", false),
+		m_name(name),
+		m_current(NULL),
+		m_trace_checked(false),
+		m_tracker(NULL),
+		m_frames(0),
+		m_dropped(0),
+		m_published(0) {
+		m_report_timer.restart();
+	}
+
+	/// Adds dependency of handler (given by name) on stream, e.g. bound Component::addDependency.
+	typedef boost::function<void(const std::string &, Base::DataStreamInterface *)> Dependency;
+
+	/*!
+	 * Returns handler measuring every call of the given one. Frame handlers
+	 * read frame info, other ones (e.g. of queries) don't.
+	 */
+	boost::function<void()> wrap(const std::string & handler, const boost::function<void()> & fun,
+			bool frames = true) {
+		boost::shared_ptr<HandlerStatistics> stats(new HandlerStatistics(handler));
+		m_handlers.push_back(stats);
+		if (frames)
+			m_frame_handlers.push_back(handler);
+
+		Invocation inv;
+		inv.owner = this;
+		inv.stats = stats.get();
+		inv.fun = fun;
+		inv.frames = frames;
+		return inv;
+	}
+
+	/*!
+	 * Called from onInit of component, properties are loaded then. Installs
+	 * allocation tracker if allocations are counted. With frame_sync, makes
+	 * in_frame_info a dependency of all frame handlers.
+	 */
+	void init(const Dependency & depend) {
+		if (prop_allocations) {
+			m_tracker = AllocationTracker::install();
+			if (!m_tracker)
+				LOG(LWARNING) << m_name << ": allocation statistics need OpenCV 3 or newer";
+		}
+
+		if (!prop_frame_sync)
+			return;
+		for (size_t i = 0; i < m_frame_handlers.size(); ++i)
+			depend(m_frame_handlers[i], &in_frame_info);
+	}
+
+	/*!
+	 * Returns statistics of work not run by a wrapped handler (e.g. of
+	 * asynchronous worker), reported together with all handlers.
+	 */
+	HandlerStatistics * add(const std::string & name) {
+		boost::shared_ptr<HandlerStatistics> stats(new HandlerStatistics(name));
+		m_handlers.push_back(stats);
+		return stats.get();
+	}
+
+	/*!
+	 * Marks currently processed frame as skipped (rejected without output).
+	 * Handler thread only, jobs of other threads skip through statistics of
+	 * their handler, bound into the job (see current()).
+	 */
+	void skip() {
+		if (m_current)
+			m_current->skip();
+	}
+
+	/// Statistics of handler being run, NULL outside of wrapped handlers. Handler thread only.
+	HandlerStatistics * current() const {
+		return m_current;
+	}
+
+	/// Returns statistics of handler with given name, NULL if not wrapped.
+	const HandlerStatistics * handler(const std::string & name) const {
+		for (size_t i = 0; i < m_handlers.size(); ++i)
+			if (m_handlers[i]->name() == name)
+				return m_handlers[i].get();
+		return NULL;
+	}
+
+	/// Returns allocation tracker installed by init(), NULL if allocations aren't counted.
+	AllocationTracker * tracker() const {
+		return m_tracker;
+	}
+
+	/// Info of currently processed frame (invalid if source provides none).
+	const FrameInfo & frame() const {
+		return m_frame;
+	}
+
+	/// Forwards info of currently processed frame, called right before its outputs are written.
+	void publish() {
+		publish(m_frame);
+	}
+
+	/*!
+	 * Forwards given frame info and records its age, called right before
+	 * outputs of the frame are written (also from worker threads). Frames
+	 * older than the last published one are not forwarded again.
+	 */
+	void publish(const FrameInfo & info) {
+		if (!info.valid)
+			return;
+		boost::mutex::scoped_lock lock(m_publish_mutex);
+		if (m_published != 0 && info.seq <= m_published)
+			return;
+		m_published = info.seq;
+		out_frame_info.write(info);
+		m_age.record(info.age());
+	}
+
+	std::string summary() const {
+		std::string ret;
+		if (m_frames > 0) {
+			std::ostringstream ss;
+			ss << std::fixed << std::setprecision(3)
+			   << "frames=" << m_frames
+			   << " dropped=" << m_dropped
+			   << " age_p50=" << m_age.percentile(0.50) * 1000
+			   << " age_p99=" << m_age.percentile(0.99) * 1000
+			   << " age_max=" << m_age.max() * 1000;
+			ret = ss.str();
+		}
+		for (size_t i = 0; i < m_handlers.size(); ++i) {
+			if (m_handlers[i]->calls() == 0)
+				continue;
+			if (!ret.empty())
+				ret += "; ";
+			ret += m_handlers[i]->summary();
+		}
+		if (m_tracker && !ret.empty())
+			ret += "; allocs of handler threads only, parallel_for_ workers not counted";
+		return ret;
+	}
+
+	/// Summary of all handlers (read-only)
+	Base::Property<std::string> prop_statistics;
+
+	/// Logging period in seconds
+	Base::Property<float> prop_statistics_period;
+
+	/// Chrome trace output file, empty disables tracing
+	Base::Property<std::string> prop_trace_file;
+
+	/// Counts matrix allocations of every call
+	Base::Property<bool> prop_allocations;
+
+	/// Frame handlers wait for frame info written with their payload
+	Base::Property<bool> prop_frame_sync;
+
+	/// Input frame info, optional
+	Base::DataStreamIn<FrameInfo, Base::DataStreamBuffer::Newest> in_frame_info;
+
+	/// Output frame info, written by publish() before payload
+	Base::DataStreamOut<FrameInfo> out_frame_info;
+
+private:
+	struct Invocation {
+		ComponentStatistics * owner;
+		HandlerStatistics * stats;
+		boost::function<void()> fun;
+		bool frames;
+
+		void operator()() const {
+			HandlerStatistics * prev = owner->m_current;
+			owner->m_current = stats;
+			if (frames)
+				owner->receiveFrame();
+			boost::uint64_t frame = frames && owner->m_frame.valid ? owner->m_frame.seq : stats->calls();
+			bool trace = owner->tracing();
+			if (trace)
+				Tracer::instance().begin(owner->m_name, stats->name(), frame);
+			AllocationTracker * tracker = owner->tracker();
+			AllocationScope scope;
+			AllocationScope * prev_scope = tracker ? tracker->enter(&scope) : NULL;
+			Common::Timer timer;
+			timer.restart();
+			try {
+				fun();
+			} catch (...) {
+				stats->call(timer.elapsed());
+				if (tracker)
+					tracker->leave(prev_scope);
+				if (trace)
+					Tracer::instance().end(owner->m_name, stats->name(), frame);
+				owner->m_current = prev;
+				throw;
+			}
+			stats->call(timer.elapsed());
+			if (tracker) {
+				tracker->leave(prev_scope);
+				stats->allocated(scope);
+			}
+			if (trace)
+				Tracer::instance().end(owner->m_name, stats->name(), frame);
+			owner->m_current = prev;
+			owner->report();
+		}
+	};
+
+	/// Reads frame info, counts frames missing in sequence.
+	void receiveFrame() {
+		if (in_frame_info.empty())
+			return;
+
+		FrameInfo info = in_frame_info.read();
+		if (!info.valid || (m_frame.valid && info.seq == m_frame.seq))
+			return;
+
+		if (m_frame.valid && info.seq > m_frame.seq)
+			m_dropped += info.seq - m_frame.seq - 1;
+		++m_frames;
+		m_frame = info;
+	}
+
+	/// Opens trace file on first call, properties are already loaded then.
+	bool tracing() {
+		if (!m_trace_checked) {
+			m_trace_checked = true;
+			std::string path = prop_trace_file;
+			if (!path.empty())
+				Tracer::instance().open(path);
+		}
+		return Tracer::instance().enabled();
+	}
+
+	void report() {
+		float period = prop_statistics_period;
+		// property is refreshed every second even if logging is disabled
+		if (m_report_timer.elapsed() < (period > 0 ? period : 1.0f))
+			return;
+		m_report_timer.restart();
+
+		prop_statistics = summary();
+		if (period > 0)
+			LOG(LINFO) << m_name << " statistics [ms] " << (std::string) prop_statistics;
+	}
+
+	std::string m_name;
+
+	std::vector<boost::shared_ptr<HandlerStatistics> > m_handlers;
+
+	/// Names of handlers reading frame info
+	std::vector<std::string> m_frame_handlers;
+
+	HandlerStatistics * m_current;
+
+	bool m_trace_checked;
+
+	/// Installed by init(), never changed afterwards
+	AllocationTracker * m_tracker;
+
+	FrameInfo m_frame;
+	boost::uint64_t m_frames;
+	boost::uint64_t m_dropped;
+
+	/// Age of frames at publishing, sequence number of the last published one
+	LatencyHistogram m_age;
+	boost::uint64_t m_published;
+	boost::mutex m_publish_mutex;
+
+	Common::Timer m_report_timer;
+};
+
+} //: namespace Types
+
+#endif /* HANDLERSTATISTICS_HPP_ */
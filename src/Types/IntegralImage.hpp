@@ -0,0 +1,25 @@
+/*!
+ * \file
+ * \brief Constant time box sums over integral images.
+ */
+
+#ifndef INTEGRALIMAGE_HPP_
+#define INTEGRALIMAGE_HPP_
+
+#include <opencv2/core/core.hpp>
+
+namespace Types {
+
+/*!
+ * Sum of pixels in rows [r0, r1) and columns [c0, c1) of the image, given
+ * its integral (as computed by cv::integral, one row and column larger).
+ * T is element type of the integral, e.g. double, int or cv::Vec3d.
+ */
+template <typename T>
+inline T boxSum(const cv::Mat & sum, int r0, int c0, int r1, int c1) {
+	return sum.at<T>(r1, c1) - sum.at<T>(r0, c1) - sum.at<T>(r1, c0) + sum.at<T>(r0, c0);
+}
+
+} //: namespace Types
+
+#endif /* INTEGRALIMAGE_HPP_ */
@@ -0,0 +1,172 @@
+/*!
+ * \file
+ * \brief Row-wise run-length encoding of segment labels.
+ */
+
+#ifndef LABELRUNS_HPP_
+#define LABELRUNS_HPP_
+
+#include <vector>
+#include <algorithm>
+
+#include <boost/shared_ptr.hpp>
+
+#include <opencv2/core/core.hpp>
+
+namespace Types {
+
+/*!
+ * \class LabelRuns
+ * \brief Segment labels as runs of equal labels in every row.
+ *
+ * Unlabeled pixels (label 0) are not stored. Segments are large contiguous
+ * areas, so frame takes a few thousand runs (tens of kB) instead of a full
+ * label or color image, and masks and areas can be computed directly on
+ * runs. Copies are shallow, once encoded instance isn't modified, so it can
+ * be shared by consumers.
+ */
+class LabelRuns {
+public:
+	struct Run {
+		int col;
+		int length;
+		int label;
+	};
+
+	LabelRuns() :
+		m_labels(0), m_rows(new std::vector<int>(1, 0)), m_runs(new std::vector<Run>) {
+	}
+
+	/// Encodes label image (CV_32SC1).
+	explicit LabelRuns(const cv::Mat & labels) :
+		m_size(labels.size()), m_labels(0), m_rows(new std::vector<int>), m_runs(new std::vector<Run>) {
+		CV_Assert(labels.type() == CV_32SC1);
+		std::vector<int> & rows = *m_rows;
+		std::vector<Run> & runs = *m_runs;
+		rows.reserve(labels.rows + 1);
+		for (int i = 0; i < labels.rows; ++i) {
+			rows.push_back(runs.size());
+			const int * l = labels.ptr<int>(i);
+			for (int j = 0; j < labels.cols;) {
+				int start = j;
+				while (j < labels.cols && l[j] == l[start])
+					++j;
+				if (l[start] == 0)
+					continue;
+				Run run = { start, j - start, l[start] };
+				runs.push_back(run);
+				m_labels = std::max(m_labels, l[start]);
+			}
+		}
+		rows.push_back(runs.size());
+	}
+
+	/// Size of encoded image.
+	cv::Size size() const {
+		return m_size;
+	}
+
+	/// Largest label, labels are in [1, count()].
+	int count() const {
+		return m_labels;
+	}
+
+	/// Runs of given row.
+	const Run * begin(int row) const {
+		return data() + (*m_rows)[row];
+	}
+
+	const Run * end(int row) const {
+		return data() + (*m_rows)[row + 1];
+	}
+
+	size_t runs() const {
+		return m_runs->size();
+	}
+
+	/// Size of encoded data (in bytes).
+	size_t bytes() const {
+		return m_runs->size() * sizeof(Run) + m_rows->size() * sizeof(int);
+	}
+
+	/// Decodes into label image (CV_32SC1), unlabeled pixels are 0.
+	cv::Mat decode() const {
+		cv::Mat ret = cv::Mat::zeros(m_size, CV_32SC1);
+		for (int i = 0; i < m_size.height; ++i) {
+			int * l = ret.ptr<int>(i);
+			for (const Run * r = begin(i); r != end(i); ++r)
+				std::fill(l + r->col, l + r->col + r->length, r->label);
+		}
+		return ret;
+	}
+
+	/// Mask (CV_8UC1) of given segment.
+	cv::Mat mask(int label) const {
+		cv::Mat ret = cv::Mat::zeros(m_size, CV_8UC1);
+		for (int i = 0; i < m_size.height; ++i) {
+			uchar * m = ret.ptr<uchar>(i);
+			for (const Run * r = begin(i); r != end(i); ++r)
+				if (r->label == label)
+					std::fill(m + r->col, m + r->col + r->length, 255);
+		}
+		return ret;
+	}
+
+	/// Area (in pixels) of every segment, indexed by label (0 is always empty).
+	std::vector<int> areas() const {
+		std::vector<int> ret(m_labels + 1, 0);
+		for (size_t k = 0; k < m_runs->size(); ++k)
+			ret[(*m_runs)[k].label] += (*m_runs)[k].length;
+		return ret;
+	}
+
+	/// Labels restricted to non-zero pixels of mask (CV_8UC1 of the same size), runs are split at its gaps.
+	LabelRuns intersect(const cv::Mat & mask) const {
+		CV_Assert(mask.type() == CV_8UC1 && mask.size() == m_size);
+		LabelRuns ret;
+		ret.m_size = m_size;
+		ret.m_labels = m_labels;
+		std::vector<int> & rows = *ret.m_rows;
+		std::vector<Run> & runs = *ret.m_runs;
+		rows.clear();
+		for (int i = 0; i < m_size.height; ++i) {
+			rows.push_back(runs.size());
+			const uchar * m = mask.ptr<uchar>(i);
+			for (const Run * r = begin(i); r != end(i); ++r) {
+				int last = r->col + r->length;
+				for (int j = r->col; j < last;) {
+					while (j < last && !m[j])
+						++j;
+					int start = j;
+					while (j < last && m[j])
+						++j;
+					if (j > start) {
+						Run run = { start, j - start, r->label };
+						runs.push_back(run);
+					}
+				}
+			}
+		}
+		rows.push_back(runs.size());
+		return ret;
+	}
+
+private:
+	const Run * data() const {
+		return m_runs->empty() ? NULL : &(*m_runs)[0];
+	}
+
+	cv::Size m_size;
+
+	/// Largest label
+	int m_labels;
+
+	/// Index of the first run of every row, followed by total number of runs
+	boost::shared_ptr<std::vector<int> > m_rows;
+
+	boost::shared_ptr<std::vector<Run> > m_runs;
+};
+
+} //: namespace Types
+
+#endif /* LABELRUNS_HPP_ */
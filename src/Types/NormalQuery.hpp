@@ -0,0 +1,63 @@
+/*!
+ * \file
+ * \brief Sparse normal queries, served by normal estimators.
+ */
+
+#ifndef NORMALQUERY_HPP_
+#define NORMALQUERY_HPP_
+
+#include <vector>
+
+#include <boost/function.hpp>
+
+#include <opencv2/core/core.hpp>
+
+namespace Types {
+
+/*!
+ * Evaluates normals at given pixels of the frame it was published with,
+ * invalid normals are (-1, -1, -1). Callback holds its own copy of the
+ * frame, so it can be called from any thread, any time later.
+ */
+typedef boost::function<void(const std::vector<cv::Point> &, std::vector<cv::Point3f> &)> NormalQuery;
+
+/*!
+ * Converts query into list of pixels. Query is either list of points
+ * (CV_32SC2, any shape) or mask of the image size (CV_8UC1), in which case
+ * nonzero pixels are taken in row-major order. Returns false if query
+ * doesn't match any of these.
+ */
+inline bool queryPixels(const cv::Mat & query, cv::Size size, std::vector<cv::Point> & pixels) {
+	pixels.clear();
+	if (query.type() == CV_32SC2) {
+		for (int i = 0; i < query.rows; ++i) {
+			const cv::Point * p = query.ptr<cv::Point>(i);
+			pixels.insert(pixels.end(), p, p + query.cols);
+		}
+		return true;
+	}
+
+	if (query.type() == CV_8UC1 && query.size() == size) {
+		for (int i = 0; i < query.rows; ++i) {
+			const uchar * m = query.ptr<uchar>(i);
+			for (int j = 0; j < query.cols; ++j)
+				if (m[j])
+					pixels.push_back(cv::Point(j, i));
+		}
+		return true;
+	}
+
+	return false;
+}
+
+/// Packs result of the query into Nx1 CV_32FC3 matrix.
+inline cv::Mat queryResult(const std::vector<cv::Point3f> & normals) {
+	cv::Mat out(normals.size(), 1, CV_32FC3);
+	for (size_t i = 0; i < normals.size(); ++i)
+		out.at<cv::Point3f>(i) = normals[i];
+	return out;
+}
+
+} //: namespace Types
+
+#endif /* NORMALQUERY_HPP_ */
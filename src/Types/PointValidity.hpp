@@ -0,0 +1,45 @@
+/*!
+ * \file
+ * \brief Validity tests for points and normals, covering all invalid-value conventions of this DCL.
+ */
+
+#ifndef POINTVALIDITY_HPP_
+#define POINTVALIDITY_HPP_
+
+#include <cmath>
+
+#include <opencv2/core/core.hpp>
+
+namespace Types {
+
+/// Coordinates outside <-MAX_RANGE, MAX_RANGE> (in meters) are invalid, as in DepthTransform.
+static const float POINT_MAX_RANGE = 300;
+
+/// Coordinate of points transformed out of range, as in DepthTransform.
+static const float INVALID_COORDINATE = 100000;
+
+/*!
+ * Point is invalid if it is not finite (CameraNUI), zeroed (PassThrough)
+ * or set to INVALID_COORDINATE (DepthTransform).
+ */
+inline bool validPoint(const cv::Point3f & p) {
+	// comparisons with NaN are false, so NaNs are rejected here too
+	if (!(std::fabs(p.x) < POINT_MAX_RANGE && std::fabs(p.y) < POINT_MAX_RANGE && std::fabs(p.z) < POINT_MAX_RANGE))
+		return false;
+	return p.x != 0 || p.y != 0 || p.z != 0;
+}
+
+/*!
+ * Normal is invalid if it is not finite, zero or set to (-1, -1, -1)
+ * (DepthNormalEstimator).
+ */
+inline bool validNormal(const cv::Point3f & n) {
+	float len2 = n.x * n.x + n.y * n.y + n.z * n.z;
+	if (!(len2 > 0.25f && len2 < 2.0f))
+		return false;
+	return !(n.x == -1 && n.y == -1 && n.z == -1);
+}
+
+} //: namespace Types
+
+#endif /* POINTVALIDITY_HPP_ */
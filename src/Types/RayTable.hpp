@@ -0,0 +1,117 @@
+/*!
+ * \file
+ * \brief Per-pixel viewing rays computed from camera intrinsics.
+ */
+
+#ifndef RAYTABLE_HPP_
+#define RAYTABLE_HPP_
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+namespace Types {
+
+/*!
+ * \class RayTable
+ * \brief Cached x/z and y/z ratio of viewing ray for every pixel.
+ *
+ * Point seen at pixel (u, v) at depth z is (z * x(v)[u], z * y(v)[u], z).
+ * Both components are stored as separate planes, so that conversion loops
+ * can load them directly into SIMD registers. Lens distortion is taken into
+ * account if distortion coefficients are given. Table is immutable once
+ * built, so it can be shared between frames and components.
+ */
+class RayTable {
+public:
+	RayTable(const cv::Mat & camera_matrix, const cv::Mat & dist_coeffs, cv::Size size) {
+		camera_matrix.convertTo(m_camera_matrix, CV_64F);
+		if (!dist_coeffs.empty())
+			dist_coeffs.convertTo(m_dist_coeffs, CV_64F);
+
+		m_x.create(size, CV_32FC1);
+		m_y.create(size, CV_32FC1);
+
+		double fx = m_camera_matrix.at<double>(0, 0);
+		double fy = m_camera_matrix.at<double>(1, 1);
+		double cx = m_camera_matrix.at<double>(0, 2);
+		double cy = m_camera_matrix.at<double>(1, 2);
+
+		if (m_dist_coeffs.empty() || cv::countNonZero(m_dist_coeffs) == 0) {
+			for (int v = 0; v < size.height; ++v) {
+				float * px = m_x.ptr<float>(v);
+				float * py = m_y.ptr<float>(v);
+				for (int u = 0; u < size.width; ++u) {
+					px[u] = (u - cx) / fx;
+					py[u] = (v - cy) / fy;
+				}
+			}
+		} else {
+			std::vector<cv::Point2f> pixels, rays;
+			pixels.reserve(size.area());
+			for (int v = 0; v < size.height; ++v)
+				for (int u = 0; u < size.width; ++u)
+					pixels.push_back(cv::Point2f(u, v));
+
+			// without P matrix result is in normalized coordinates, i.e. x/z and y/z
+			cv::undistortPoints(pixels, rays, m_camera_matrix, m_dist_coeffs);
+
+			for (int v = 0, i = 0; v < size.height; ++v) {
+				float * px = m_x.ptr<float>(v);
+				float * py = m_y.ptr<float>(v);
+				for (int u = 0; u < size.width; ++u, ++i) {
+					px[u] = rays[i].x;
+					py[u] = rays[i].y;
+				}
+			}
+		}
+	}
+
+	/// Checks, if table was built for given intrinsics and image size.
+	bool matches(const cv::Mat & camera_matrix, const cv::Mat & dist_coeffs, cv::Size size) const {
+		if (size != m_x.size())
+			return false;
+
+		cv::Mat k, d;
+		camera_matrix.convertTo(k, CV_64F);
+		if (cv::norm(k, m_camera_matrix) > 1e-9)
+			return false;
+
+		if (dist_coeffs.empty() || m_dist_coeffs.empty())
+			return (dist_coeffs.empty() || cv::countNonZero(dist_coeffs) == 0)
+					&& (m_dist_coeffs.empty() || cv::countNonZero(m_dist_coeffs) == 0);
+
+		dist_coeffs.convertTo(d, CV_64F);
+		return d.size() == m_dist_coeffs.size() && cv::norm(d, m_dist_coeffs) < 1e-9;
+	}
+
+	/// Horizontal ray components (x/z) of given row.
+	const float * x(int row) const {
+		return m_x.ptr<float>(row);
+	}
+
+	/// Vertical ray components (y/z) of given row.
+	const float * y(int row) const {
+		return m_y.ptr<float>(row);
+	}
+
+	cv::Size size() const {
+		return m_x.size();
+	}
+
+	const cv::Mat & cameraMatrix() const {
+		return m_camera_matrix;
+	}
+
+private:
+	cv::Mat m_camera_matrix;
+	cv::Mat m_dist_coeffs;
+
+	cv::Mat m_x;
+	cv::Mat m_y;
+};
+
+} //: namespace Types
+
+#endif /* RAYTABLE_HPP_ */
@@ -0,0 +1,792 @@
+/*!
+ * \file
+ * \brief Frozen scalar kernels and comparison helpers, for checking optimized variants.
+ *
+ * Kernels below are copies of the original implementations of
+ * NormalEstimator, DepthNormalEstimator, PassThrough, DepthTransform and
+ * Segmentation. They must not be optimized or changed, as optimized
+ * variants are checked against them (see verify property of the components
+ * and --verify option of depth_batch). Variants with no original (depth
+ * conversion, decimation, adaptive windows) are checked against the
+ * plainest, point by point versions below.
+ */
+
+#ifndef REFERENCEKERNELS_HPP_
+#define REFERENCEKERNELS_HPP_
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <queue>
+#include <vector>
+#include <numeric>
+#include <utility>
+#include <algorithm>
+
+#include <boost/cstdint.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <opencv2/core/core.hpp>
+
+#include "Types/PointValidity.hpp"
+#include "Types/RayTable.hpp"
+#include "Types/CloudKernels.hpp"
+#include "Types/RegionGrowing.hpp"
+
+namespace Types {
+namespace Reference {
+
+/// Largest distance (in ULPs) of normals and transformed points from reference.
+static const boost::int64_t NORMAL_ULP = 4;
+static const boost::int64_t POINT_ULP = 1;
+
+/// Largest distance of normals summed in other order (integral images) from reference.
+static const double NORMAL_DISTANCE = 1e-5;
+
+/// Distance of two floats in units in the last place, NaNs are equal to each other.
+inline boost::int64_t ulpDistance(float a, float b) {
+	if (a != a || b != b)
+		return (a != a && b != b) ? 0 : std::numeric_limits<boost::int64_t>::max();
+
+	// map floats to integers with the same ordering
+	boost::int32_t ia, ib;
+	std::memcpy(&ia, &a, sizeof(a));
+	std::memcpy(&ib, &b, sizeof(b));
+	boost::int64_t oa = ia < 0 ? (boost::int64_t) std::numeric_limits<boost::int32_t>::min() - ia : ia;
+	boost::int64_t ob = ib < 0 ? (boost::int64_t) std::numeric_limits<boost::int32_t>::min() - ib : ib;
+	return oa > ob ? oa - ob : ob - oa;
+}
+
+/// Largest ULP distance of elements of two float matrices (of any number of channels).
+inline boost::int64_t maxUlp(const cv::Mat & a, const cv::Mat & b) {
+	if (a.size() != b.size() || a.type() != b.type() || a.depth() != CV_32F)
+		return std::numeric_limits<boost::int64_t>::max();
+
+	boost::int64_t ret = 0;
+	int n = a.cols * a.channels();
+	for (int i = 0; i < a.rows; ++i) {
+		const float * pa = a.ptr<float>(i);
+		const float * pb = b.ptr<float>(i);
+		for (int j = 0; j < n; ++j)
+			ret = std::max(ret, ulpDistance(pa[j], pb[j]));
+	}
+	return ret;
+}
+
+/// Largest distance of corresponding points of two CV_32FC3 matrices, points with NaNs are equal to each other.
+inline double maxDistance(const cv::Mat & a, const cv::Mat & b) {
+	if (a.size() != b.size() || a.type() != b.type() || a.type() != CV_32FC3)
+		return std::numeric_limits<double>::infinity();
+
+	double ret = 0;
+	for (int i = 0; i < a.rows; ++i) {
+		const cv::Point3f * pa = a.ptr<cv::Point3f>(i);
+		const cv::Point3f * pb = b.ptr<cv::Point3f>(i);
+		for (int j = 0; j < a.cols; ++j) {
+			bool na = pa[j] != pa[j], nb = pb[j] != pb[j];
+			if (na || nb) {
+				if (na != nb)
+					return std::numeric_limits<double>::infinity();
+				continue;
+			}
+			double d = norm(pa[j] - pb[j]);
+			if (!(d <= ret))
+				ret = d;
+		}
+	}
+	return ret;
+}
+
+/*!
+ * Organized cloud (CV_32FC3) of slanted planes at different depths, with
+ * noise and all kinds of invalid points: NaN, (0, 0, 0) and
+ * INVALID_COORDINATE.
+ */
+inline cv::Mat syntheticCloud(cv::Size size, cv::RNG & rng) {
+	cv::Mat cloud(size, CV_32FC3);
+	double f = 525.0 * size.width / 640;
+	float nan = std::numeric_limits<float>::quiet_NaN();
+	for (int i = 0; i < size.height; ++i) {
+		cv::Point3f * p = cloud.ptr<cv::Point3f>(i);
+		for (int j = 0; j < size.width; ++j) {
+			int kind = rng.uniform(0, 100);
+			if (kind == 0) {
+				p[j] = cv::Point3f(nan, nan, nan);
+			} else if (kind == 1) {
+				p[j] = cv::Point3f(0, 0, 0);
+			} else if (kind == 2) {
+				p[j] = cv::Point3f(INVALID_COORDINATE, INVALID_COORDINATE, INVALID_COORDINATE);
+			} else {
+				// three planes, split by depth jumps
+				int plane = 3 * j / std::max(1, size.width);
+				double z = 0.8 + plane * 0.7 + 0.3 * i / std::max(1, size.height) + rng.gaussian(0.002);
+				p[j] = cv::Point3f((j - 0.5 * size.width) * z / f, (i - 0.5 * size.height) * z / f, z);
+			}
+		}
+	}
+	return cloud;
+}
+
+/// Depth map (CV_16UC1, in mm) with the same scene, invalid points are 0 or beyond 2 m.
+inline cv::Mat syntheticDepth(cv::Size size, cv::RNG & rng) {
+	cv::Mat depth(size, CV_16UC1);
+	for (int i = 0; i < size.height; ++i) {
+		unsigned short * d = depth.ptr<unsigned short>(i);
+		for (int j = 0; j < size.width; ++j) {
+			if (rng.uniform(0, 100) == 0) {
+				d[j] = 0;
+				continue;
+			}
+			int plane = 3 * j / std::max(1, size.width);
+			double z = 800 + plane * 700 + 300.0 * i / std::max(1, size.height) + rng.gaussian(2);
+			d[j] = cv::saturate_cast<unsigned short>(z);
+		}
+	}
+	return depth;
+}
+
+/// NormalEstimator normal at (row, col), derivatives are given as whole images.
+inline cv::Point3f calculateNormal(cv::Mat img, cv::Mat der_row, cv::Mat der_col, int row, int col, float dist,
+		int window) {
+	cv::Point3f ret;
+	cv::Point3f curpoint = img.at<cv::Point3f>(row, col);
+	cv::Point3f drow(0, 0, 0), dcol(0, 0, 0);
+	cv::Point3f pt;
+
+	dist *= dist;
+	for (int i = -window; i <= window; ++i) {
+		cv::Point3f * drow_ptr = der_row.ptr<cv::Point3f>(row + i);
+		cv::Point3f * dcol_ptr = der_col.ptr<cv::Point3f>(row + i);
+		cv::Point3f * img_ptr = img.ptr<cv::Point3f>(row + i);
+		for (int j = -window; j <= window; ++j) {
+			pt = img_ptr[col + j];
+			cv::Point3f tmp = curpoint - pt;
+			float d = tmp.dot(tmp);
+			if (d <= dist) {
+				float sc = 1.0 - d / dist;
+				drow += drow_ptr[col + j] * sc;
+				dcol += dcol_ptr[col + j] * sc;
+			}
+		}
+	}
+
+	ret.x = drow.y * dcol.z - drow.z * dcol.y;
+	ret.y = drow.z * dcol.x - drow.x * dcol.z;
+	ret.z = drow.x * dcol.y - drow.y * dcol.x;
+	if (ret.z < 0)
+		ret = -ret;
+	ret *= (1. / norm(ret));
+
+	return ret;
+}
+
+/*!
+ * NormalEstimator over whole cloud (CV_32FC3), with fixed window. Normals
+ * closer than window to the border are not computed, they are (-1, -1, -1).
+ */
+inline cv::Mat normals(const cv::Mat & img, float radius, int window = NORMAL_WINDOW) {
+	cv::Size size = img.size();
+	cv::Mat der_row(size, CV_32FC3), der_col(size, CV_32FC3);
+	cv::Mat ret(size, CV_32FC3, cv::Scalar::all(-1));
+	for (int i = 0; i < size.height - 1; i++) {
+		const cv::Point3f * img_p = img.ptr<cv::Point3f>(i);
+		const cv::Point3f * img_np = img.ptr<cv::Point3f>(i + 1);
+		cv::Point3f * p_row = der_row.ptr<cv::Point3f>(i);
+		cv::Point3f * p_col = der_col.ptr<cv::Point3f>(i);
+		for (int j = 0; j < size.width - 1; ++j) {
+			p_row[j] = img_p[j + 1] - img_p[j];
+			if (fabs(p_row[j].z) > 0.05)
+				p_row[j] = cv::Point3f(0, 0, 0);
+			p_col[j] = img_np[j] - img_p[j];
+			if (fabs(p_col[j].z) > 0.05)
+				p_col[j] = cv::Point3f(0, 0, 0);
+		}
+	}
+
+	for (int i = window; i < size.height - window - 1; i++) {
+		cv::Point3f * nptr = ret.ptr<cv::Point3f>(i);
+		for (int j = window; j < size.width - window - 1; ++j)
+			nptr[j] = calculateNormal(img, der_row, der_col, i, j, radius, window);
+	}
+	return ret;
+}
+
+inline void accumBilateral(long delta, long i, long j, long * A, long * b, int threshold) {
+	long f = std::abs(delta) < threshold ? 1 : 0;
+
+	const long fi = f * i;
+	const long fj = f * j;
+
+	A[0] += fi * i;
+	A[1] += fi * j;
+	A[3] += fj * j;
+	b[0] += fi * delta;
+	b[1] += fj * delta;
+}
+
+/*!
+ * DepthNormalEstimator over whole depth map (CV_16UC1), focal length of
+ * Kinect in VGA mode (530) is built in. Normals not computed near the border
+ * are zero, invalid ones are (-1, -1, -1).
+ */
+inline cv::Mat depthNormals(const cv::Mat & depth, int difference_threshold) {
+	// rows are addressed by width
+	cv::Mat img = depth.isContinuous() ? depth : depth.clone();
+	cv::Mat normals = cv::Mat::zeros(img.size(), CV_32FC3);
+
+	long distance_threshold = 2000;
+
+	unsigned short * lp_depth = (unsigned short *) img.data;
+
+	const int l_W = img.cols;
+	const int l_H = img.rows;
+
+	const int l_r = 5; // used to be 7
+	const int l_offset0 = -l_r - l_r * l_W;
+	const int l_offset1 = 0 - l_r * l_W;
+	const int l_offset2 = +l_r - l_r * l_W;
+	const int l_offset3 = -l_r;
+	const int l_offset4 = +l_r;
+	const int l_offset5 = -l_r + l_r * l_W;
+	const int l_offset6 = 0 + l_r * l_W;
+	const int l_offset7 = +l_r + l_r * l_W;
+
+	for (int l_y = l_r; l_y < l_H - l_r - 1; ++l_y) {
+		unsigned short * lp_line = lp_depth + (l_y * l_W + l_r);
+
+		for (int l_x = l_r; l_x < l_W - l_r - 1; ++l_x) {
+			long l_d = lp_line[0];
+
+			if (l_d < distance_threshold) {
+				// accum
+				long l_A[4];
+				l_A[0] = l_A[1] = l_A[2] = l_A[3] = 0;
+				long l_b[2];
+				l_b[0] = l_b[1] = 0;
+				accumBilateral(lp_line[l_offset0] - l_d, -l_r, -l_r, l_A, l_b,
+						difference_threshold);
+				accumBilateral(lp_line[l_offset1] - l_d, 0, -l_r, l_A, l_b,
+						difference_threshold);
+				accumBilateral(lp_line[l_offset2] - l_d, +l_r, -l_r, l_A, l_b,
+						difference_threshold);
+				accumBilateral(lp_line[l_offset3] - l_d, -l_r, 0, l_A, l_b,
+						difference_threshold);
+				accumBilateral(lp_line[l_offset4] - l_d, +l_r, 0, l_A, l_b,
+						difference_threshold);
+				accumBilateral(lp_line[l_offset5] - l_d, -l_r, +l_r, l_A, l_b,
+						difference_threshold);
+				accumBilateral(lp_line[l_offset6] - l_d, 0, +l_r, l_A, l_b,
+						difference_threshold);
+				accumBilateral(lp_line[l_offset7] - l_d, +l_r, +l_r, l_A, l_b,
+						difference_threshold);
+
+				// solve
+				long l_det = l_A[0] * l_A[3] - l_A[1] * l_A[1];
+				long l_ddx = l_A[3] * l_b[0] - l_A[1] * l_b[1];
+				long l_ddy = -l_A[1] * l_b[0] + l_A[0] * l_b[1];
+
+				/// @todo Magic number 1150 is focal length? This is something like
+				/// f in SXGA mode, but in VGA is more like 530.
+				float l_nx = static_cast<float>(530 * l_ddx);
+				float l_ny = static_cast<float>(530 * l_ddy);
+				float l_nz = static_cast<float>(-l_det * l_d);
+
+				float l_sqrt = sqrt(l_nx * l_nx + l_ny * l_ny + l_nz * l_nz);
+
+				if (l_sqrt > 0) {
+					float l_norminv = 1.0f / (l_sqrt);
+
+					l_nx *= l_norminv;
+					l_ny *= l_norminv;
+					l_nz *= l_norminv;
+
+					normals.at<cv::Point3f>(l_y, l_x) = cv::Point3f(-l_nx,
+							-l_ny, -l_nz);
+
+				} else {
+					normals.at<cv::Point3f>(l_y, l_x) = cv::Point3f(-1, -1, -1);
+				}
+			} else {
+				normals.at<cv::Point3f>(l_y, l_x) = cv::Point3f(-1, -1, -1);
+			}
+			++lp_line;
+		}
+	}
+	return normals;
+}
+
+/// PassThrough, returns filtered copy of cloud (CV_32FC3) and its mask.
+inline cv::Mat passThrough(const cv::Mat & cloud, float z_min, float z_max, cv::Mat & mask) {
+	cv::Mat img = cloud.clone();
+	mask = cv::Mat::zeros(img.size(), CV_8UC1);
+	for (int i = 0; i < img.rows; ++i) {
+		float * p = img.ptr<float>(i);
+		uchar * mp = mask.ptr<uchar>(i);
+		for (int j = 0; j < img.cols; ++j) {
+			float z = p[3 * j + 2];
+			if ((z < z_min) || (z > z_max)) {
+				p[3 * j] = 0;
+				p[3 * j + 1] = 0;
+				p[3 * j + 2] = 0;
+			} else if (std::isfinite(z)) {
+				mp[j] = 255;
+			}
+		}
+	}
+	return img;
+}
+
+/// DepthTransform of cloud (CV_32FC3), points out of range are INVALID_COORDINATE.
+inline cv::Mat depthTransformation(const cv::Mat & img, const cv::Matx44d & H) {
+	cv::Mat out_img;
+	perspectiveTransform(img, out_img, H);
+	for (int i = 0; i < out_img.rows; ++i) {
+		float * p = out_img.ptr<float>(i);
+		for (int j = 0; j < out_img.cols; ++j) {
+			if ((fabs(p[3 * j]) > POINT_MAX_RANGE) || (fabs(p[3 * j + 1]) > POINT_MAX_RANGE)
+					|| (fabs(p[3 * j + 2]) > POINT_MAX_RANGE))
+				p[3 * j] = p[3 * j + 1] = p[3 * j + 2] = INVALID_COORDINATE;
+		}
+	}
+	return out_img;
+}
+
+/// Takes every n-th pixel of every n-th row, one by one.
+inline cv::Mat decimate(const cv::Mat & src, int n) {
+	cv::Mat ret(src.rows / n, src.cols / n, src.type());
+	for (int i = 0; i < ret.rows; ++i)
+		for (int j = 0; j < ret.cols; ++j)
+			std::memcpy(ret.ptr(i, j), src.ptr(i * n, j * n), src.elemSize());
+	return ret;
+}
+
+/*!
+ * DepthConverter, point by point. Cloud (CV_32FC3) and mask (CV_8UC1) have
+ * size of depth (CV_16UC1), H is optional.
+ */
+inline cv::Mat depthConversion(const cv::Mat & depth, const RayTable & rays, float scale, bool range, float z_min,
+		float z_max, const cv::Matx44f * H, cv::Mat & mask) {
+	cv::Mat cloud(depth.size(), CV_32FC3);
+	mask.create(depth.size(), CV_8UC1);
+	for (int v = 0; v < depth.rows; ++v) {
+		for (int u = 0; u < depth.cols; ++u) {
+			unsigned short d = depth.at<unsigned short>(v, u);
+			float z = d * scale;
+			cv::Point3f & p = cloud.at<cv::Point3f>(v, u);
+			uchar & m = mask.at<uchar>(v, u);
+			if (d == 0 || (range && (z < z_min || z > z_max))) {
+				p = cv::Point3f(0, 0, 0);
+				m = 0;
+				continue;
+			}
+
+			float x = z * rays.x(v)[u];
+			float y = z * rays.y(v)[u];
+			m = 255;
+			if (H) {
+				const cv::Matx44f & h = *H;
+				float tx = (x * h(0, 0) + y * h(0, 1)) + (z * h(0, 2) + h(0, 3));
+				float ty = (x * h(1, 0) + y * h(1, 1)) + (z * h(1, 2) + h(1, 3));
+				float tz = (x * h(2, 0) + y * h(2, 1)) + (z * h(2, 2) + h(2, 3));
+				if (fabs(tx) > POINT_MAX_RANGE || fabs(ty) > POINT_MAX_RANGE || fabs(tz) > POINT_MAX_RANGE) {
+					tx = ty = tz = INVALID_COORDINATE;
+					m = 0;
+				}
+				x = tx;
+				y = ty;
+				z = tz;
+			}
+			p = cv::Point3f(x, y, z);
+		}
+	}
+	return cloud;
+}
+
+/// Mean of valid depth (0 < d < 2000) in rows [r0, r1) and columns [c0, c1), false if there is none.
+inline bool windowMean(const cv::Mat & depth, int r0, int c0, int r1, int c1, double & m) {
+	double sum = 0;
+	int n = 0;
+	for (int i = r0; i < r1; ++i)
+		for (int j = c0; j < c1; ++j) {
+			unsigned short d = depth.at<unsigned short>(i, j);
+			if (d > 0 && d < 2000) {
+				sum += d;
+				++n;
+			}
+		}
+	if (n == 0)
+		return false;
+	m = sum / n;
+	return true;
+}
+
+/*!
+ * DepthNormalEstimator with depth adaptive windows, means of window halves
+ * summed pixel by pixel. Invalid normals are (-1, -1, -1).
+ */
+inline cv::Mat adaptiveDepthNormals(const cv::Mat & depth, double focal, int difference_threshold, float scale,
+		int min_window, int max_window) {
+	const int l_r = 5;
+	cv::Mat normals(depth.size(), CV_32FC3, cv::Scalar::all(-1));
+	for (int l_y = 0; l_y < depth.rows; ++l_y) {
+		for (int l_x = 0; l_x < depth.cols; ++l_x) {
+			long l_d = depth.at<unsigned short>(l_y, l_x);
+			if (l_d == 0 || l_d >= 2000)
+				continue;
+
+			int w = std::min(std::max(cvRound(scale * l_d * 0.001), min_window), max_window);
+			w = std::min(std::min(w, std::min(l_x, l_y)), std::min(depth.cols - 1 - l_x, depth.rows - 1 - l_y));
+			if (w < 1)
+				continue;
+
+			double left, right, up, down;
+			if (!windowMean(depth, l_y - w, l_x - w, l_y + w + 1, l_x, left)
+					|| !windowMean(depth, l_y - w, l_x + 1, l_y + w + 1, l_x + w + 1, right)
+					|| !windowMean(depth, l_y - w, l_x - w, l_y, l_x + w + 1, up)
+					|| !windowMean(depth, l_y + 1, l_x - w, l_y + w + 1, l_x + w + 1, down))
+				continue;
+
+			double limit = difference_threshold * 0.5 * (w + 1) / l_r;
+			if (std::fabs(left - l_d) > limit || std::fabs(right - l_d) > limit || std::fabs(up - l_d) > limit
+					|| std::fabs(down - l_d) > limit)
+				continue;
+
+			double gx = (right - left) / (w + 1);
+			double gy = (down - up) / (w + 1);
+			double l_nx = -focal * gx, l_ny = -focal * gy, l_nz = l_d;
+			double l_norminv = 1.0 / sqrt(l_nx * l_nx + l_ny * l_ny + l_nz * l_nz);
+			normals.at<cv::Point3f>(l_y, l_x) = cv::Point3f(l_nx * l_norminv, l_ny * l_norminv, l_nz * l_norminv);
+		}
+	}
+	return normals;
+}
+
+/*!
+ * NormalEstimator with depth adaptive windows, derivatives (of valid points,
+ * not across depth jumps) summed point by point. Invalid normals are
+ * (-1, -1, -1).
+ */
+inline cv::Mat adaptiveNormals(const cv::Mat & img, float scale, int min_window, int max_window) {
+	cv::Size size = img.size();
+	cv::Mat der_row(size, CV_32FC3, cv::Scalar::all(0)), der_col(size, CV_32FC3, cv::Scalar::all(0));
+	for (int i = 0; i < size.height - 1; i++) {
+		for (int j = 0; j < size.width - 1; ++j) {
+			cv::Point3f p = img.at<cv::Point3f>(i, j);
+			cv::Point3f right = img.at<cv::Point3f>(i, j + 1);
+			cv::Point3f down = img.at<cv::Point3f>(i + 1, j);
+			if (!validPoint(p))
+				continue;
+			if (validPoint(right) && fabs(right.z - p.z) <= 0.05)
+				der_row.at<cv::Point3f>(i, j) = right - p;
+			if (validPoint(down) && fabs(down.z - p.z) <= 0.05)
+				der_col.at<cv::Point3f>(i, j) = down - p;
+		}
+	}
+
+	cv::Mat normals(size, CV_32FC3, cv::Scalar::all(-1));
+	for (int i = 0; i < size.height; ++i) {
+		for (int j = 0; j < size.width; ++j) {
+			cv::Point3f p = img.at<cv::Point3f>(i, j);
+			if (!validPoint(p) || p.z <= 0)
+				continue;
+
+			int w = std::min(std::max(cvRound(scale * p.z), min_window), max_window);
+			w = std::min(std::min(w, std::min(i, j)), std::min(size.height - 2 - i, size.width - 2 - j));
+			if (w < 1)
+				continue;
+
+			cv::Vec3d dr(0, 0, 0), dc(0, 0, 0);
+			for (int k = i - w; k <= i + w; ++k)
+				for (int l = j - w; l <= j + w; ++l) {
+					cv::Point3f r = der_row.at<cv::Point3f>(k, l);
+					cv::Point3f c = der_col.at<cv::Point3f>(k, l);
+					dr += cv::Vec3d(r.x, r.y, r.z);
+					dc += cv::Vec3d(c.x, c.y, c.z);
+				}
+
+			cv::Point3f drow(dr[0], dr[1], dr[2]), dcol(dc[0], dc[1], dc[2]);
+			cv::Point3f n;
+			n.x = drow.y * dcol.z - drow.z * dcol.y;
+			n.y = drow.z * dcol.x - drow.x * dcol.z;
+			n.z = drow.x * dcol.y - drow.y * dcol.x;
+			float len = norm(n);
+			if (!(len > 0))
+				continue;
+			if (n.z < 0)
+				n = -n;
+			normals.at<cv::Point3f>(i, j) = n * (1.0f / len);
+		}
+	}
+	return normals;
+}
+
+/// Segmentation comparators and accumulator, as in the original (sum is truncated to int).
+inline double compareNormals(unsigned char* v1, unsigned char* v2, double n) {
+	cv::Point3f * curn = (cv::Point3f*)v1;
+	cv::Point3f * desn = (cv::Point3f*)v2;
+	double dn = 180. / 3.14 * acos(curn->dot(*desn));
+	dn = (dn < 180 ? dn : 0);
+	return dn / n;
+}
+
+inline double compareColors(unsigned char* v1, unsigned char* v2, double n) {
+	typedef cv::Point3_<uchar> Point3u;
+	Point3u *curc = (Point3u*)v1;
+	Point3u *desc = (Point3u*)v2;
+
+	cv::Point3f distc = *desc;
+	cv::Point3f distc2 = *curc;
+	distc -= distc2;
+	distc *= 1. / 255;
+
+	return norm(distc) / n;
+}
+
+inline double comparePositions(unsigned char* v1, unsigned char* v2, double n) {
+	cv::Point3f *curp = (cv::Point3f*)v1;
+	cv::Point3f *desp = (cv::Point3f*)v2;
+	double dp = norm(*desp - *curp);
+	dp = (dp < 10 ? dp : 0);
+	return dp / n;
+}
+
+inline double accumulateSum(std::vector<double> values) {
+	return std::accumulate(values.begin(), values.end(), 0);
+}
+
+/// Reference copy of comparator of RegionGrowing, NULL if there is none.
+inline Comparator comparator(Comparator optimized) {
+	if (optimized == Types::compareNormals)
+		return compareNormals;
+	if (optimized == Types::compareColors)
+		return compareColors;
+	if (optimized == Types::comparePositions)
+		return comparePositions;
+	return NULL;
+}
+
+/*!
+ * \class MultimodalSegmentation
+ * \brief Region growing of Segmentation, its members turned into fields.
+ *
+ * Segments are told apart by random colors (drawn by rand()) only, pixels
+ * of color (0, 0, 0) are not segmented yet. The original was limited to
+ * 640x480 frames with seeds every 10th pixel, here size comes from inputs
+ * and seed step is given; last row and column are not grown into, as in
+ * the original. Only unused locals and debug log are left out.
+ */
+class MultimodalSegmentation {
+public:
+	cv::Mat multimodalSegmentation(std::vector<cv::Mat> inputs,
+			std::vector<Comparator> comparators, std::vector<double> thresholds,
+			Accumulator accumulator, double threshold, int step = 10) {
+
+
+		typedef cv::Point3_<uchar> CvColor;
+
+		m_size = inputs[0].size();
+		m_clusters = cv::Mat::zeros(m_size, CV_8UC3);
+		m_closed = cv::Mat::zeros(m_size, CV_8UC1);
+
+		CvColor empty(0, 0, 0);
+
+		std::queue<cv::Point> open;
+		std::queue<cv::Point> seed;
+
+		// initialize seeds in regular grid
+		for (int x = 0; x < m_size.width; x += step)
+			for (int y = 0; y < m_size.height; y += step)
+				seed.push(cv::Point(x, y));
+
+		// definition of all possible directions
+		cv::Point right(1, 0);
+		cv::Point left(-1, 0);
+		cv::Point up(0, -1);
+		cv::Point down(0, 1);
+
+		// repeat until we still have some seed points
+		while (!seed.empty()) {
+			// create new, empty list of open points
+			open = std::queue<cv::Point>();
+
+			// get first seed
+			cv::Point pt = seed.front();
+			seed.pop();
+
+			// ignore already segmented seeds
+			if (m_clusters.at<CvColor>(pt) != empty) {
+				continue;
+			}
+
+			// generate random color for new segment
+			cv::Point3i id(0, rand() % 128, rand() % 128);
+
+			open.push(pt);
+
+			// growing segment
+			while (!open.empty()) {
+
+				cv::Point curpoint = open.front();
+				open.pop();
+				if (m_clusters.at<CvColor>(curpoint) != empty)
+					continue;
+
+				m_clusters.at<CvColor>(curpoint) = id;
+
+				if (check(curpoint, right, inputs, comparators, thresholds, accumulator, threshold))
+					open.push(curpoint + right);
+				if (check(curpoint, left, inputs, comparators, thresholds, accumulator, threshold))
+					open.push(curpoint + left);
+				if (check(curpoint, up, inputs, comparators, thresholds, accumulator, threshold))
+					open.push(curpoint + up);
+				if (check(curpoint, down, inputs, comparators, thresholds, accumulator, threshold))
+					open.push(curpoint + down);
+			}
+		}
+
+		return m_clusters;
+	}
+
+	bool check(cv::Point point, cv::Point dir,
+			std::vector<cv::Mat> inputs, std::vector<Comparator> comparators,
+			std::vector<double> thresholds, Accumulator accumulator, double threshold) {
+
+		cv::Point dest = point + dir;
+
+		// check, if given direction lays inside image
+		if (!dest.inside(cv::Rect(0, 0, m_size.width - 1, m_size.height - 1)))
+			return false;
+
+		// ignore already segmented points
+		if (m_closed.at<uchar>(dest) == 255)
+			return false;
+
+		// mark point as segmented
+		m_closed.at<uchar>(dest) = 255;
+
+		// intermediate results
+		std::vector<double> results;
+
+		// iterate over all available inputs
+		for (int i = 0; i < inputs.size(); ++i) {
+			cv::Mat img = inputs[i];
+			unsigned char * v1 = img.data + point.y * img.step + point.x * img.elemSize();
+			unsigned char * v2 = img.data + dest.y * img.step + dest.x * img.elemSize();
+			results.push_back(comparators[i](v1, v2, thresholds[i]));
+		}
+
+		// accumulate intermediate results
+		double result = accumulator(results);
+
+		return result < threshold;
+	}
+
+	cv::Size m_size;
+	cv::Mat m_clusters;
+	cv::Mat m_closed;
+};
+
+/// Result of compareSegmentation().
+enum SegmentationCheck {
+	SEGMENTS_SAME, SEGMENTS_DIFFER, SEGMENTS_INCOMPARABLE
+};
+
+/*!
+ * Draws colors of segments 1..segments as MultimodalSegmentation does after
+ * srand(seed), returns false if any is black (such segment is grown over
+ * again) or neighbouring segments share color (reference can't tell them
+ * apart).
+ */
+inline bool drawColors(unsigned int seed, int segments, const std::vector<std::pair<int, int> > & neighbours,
+		std::vector<cv::Point3_<uchar> > & colors) {
+	srand(seed);
+	colors.assign(segments + 1, cv::Point3_<uchar>(0, 0, 0));
+	for (int k = 1; k <= segments; ++k) {
+		// the same expression as in reference
+		cv::Point3i id(0, rand() % 128, rand() % 128);
+		if (id == cv::Point3i(0, 0, 0))
+			return false;
+		colors[k] = id;
+	}
+	for (size_t i = 0; i < neighbours.size(); ++i)
+		if (colors[neighbours[i].first] == colors[neighbours[i].second])
+			return false;
+	return true;
+}
+
+/*!
+ * Runs MultimodalSegmentation on inputs of growing, segmented by
+ * RegionGrowing::segment() with accumulateSum, and compares partitions.
+ *
+ * Both number segments in the same (seed) order, k-th segment of reference
+ * gets k-th color drawn by rand(). Starting from given seed, rand() is
+ * seeded with the first value which gives no black color and different
+ * colors to every pair of neighbouring segments of growing. Every point
+ * of reference has to have color of its label, so reference can neither
+ * join segments of growing (neighbours have different colors) nor split
+ * them, or number them differently. Frames are not comparable only if
+ * growing uses comparators without reference copy, or if no such seed is
+ * found.
+ */
+inline SegmentationCheck compareSegmentation(const RegionGrowing & growing, unsigned int seed, double threshold) {
+	typedef cv::Point3_<uchar> CvColor;
+
+	std::vector<cv::Mat> inputs = growing.materializedInputs();
+	std::vector<Comparator> comparators;
+	for (size_t i = 0; i < growing.comparators().size(); ++i) {
+		comparators.push_back(comparator(growing.comparators()[i]));
+		if (!comparators.back())
+			return SEGMENTS_INCOMPARABLE;
+	}
+	if (inputs.empty())
+		return SEGMENTS_INCOMPARABLE;
+
+	const cv::Mat & labels = growing.labels();
+	int segments = 0;
+	std::vector<std::pair<int, int> > neighbours;
+	for (int i = 0; i < labels.rows; ++i) {
+		const int * pl = labels.ptr<int>(i);
+		const int * pn = i + 1 < labels.rows ? labels.ptr<int>(i + 1) : NULL;
+		for (int j = 0; j < labels.cols; ++j) {
+			segments = std::max(segments, pl[j]);
+			if (j + 1 < labels.cols && pl[j] != pl[j + 1])
+				neighbours.push_back(std::make_pair(std::min(pl[j], pl[j + 1]), std::max(pl[j], pl[j + 1])));
+			if (pn && pl[j] != pn[j])
+				neighbours.push_back(std::make_pair(std::min(pl[j], pn[j]), std::max(pl[j], pn[j])));
+		}
+	}
+	std::sort(neighbours.begin(), neighbours.end());
+	neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+
+	// rand() is shared by the whole process, reference is its only user
+	static boost::mutex mutex;
+	boost::mutex::scoped_lock lock(mutex);
+
+	std::vector<CvColor> colors;
+	const int ATTEMPTS = 1000;
+	int attempt = 0;
+	while (attempt < ATTEMPTS && !drawColors(seed + attempt, segments, neighbours, colors))
+		++attempt;
+	if (attempt == ATTEMPTS)
+		return SEGMENTS_INCOMPARABLE;
+
+	srand(seed + attempt);
+	MultimodalSegmentation reference;
+	cv::Mat clusters = reference.multimodalSegmentation(inputs, comparators, growing.thresholds(),
+			accumulateSum, threshold, growing.seedStep());
+
+	for (int i = 0; i < labels.rows; ++i) {
+		const int * pl = labels.ptr<int>(i);
+		const CvColor * pc = clusters.ptr<CvColor>(i);
+		for (int j = 0; j < labels.cols; ++j)
+			if (colors[pl[j]] != pc[j])
+				return SEGMENTS_DIFFER;
+	}
+	return SEGMENTS_SAME;
+}
+
+} //: namespace Reference
+} //: namespace Types
+
+#endif /* REFERENCEKERNELS_HPP_ */
@@ -0,0 +1,508 @@
+/*!
+ * \file
+ * \brief Multimodal region growing of Segmentation, usable outside of components.
+ */
+
+#ifndef REGIONGROWING_HPP_
+#define REGIONGROWING_HPP_
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+
+#include <opencv2/core/core.hpp>
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "Common/Logger.hpp"
+
+#include "Types/DepthCloud.hpp"
+#include "Types/Decimation.hpp"
+#include "Types/EdgeMask.hpp"
+#include "Types/DisjointSets.hpp"
+
+namespace Types {
+
+/// Difference of two pixel values, relative to given threshold.
+typedef double (*Comparator)(unsigned char *, unsigned char *, double);
+
+inline double compareNormals(unsigned char* v1, unsigned char* v2, double n) {
+	cv::Point3f * curn = (cv::Point3f*)v1;
+	cv::Point3f * desn = (cv::Point3f*)v2;
+	double dn = 180. / 3.14 * acos(curn->dot(*desn));
+	dn = (dn < 180 ? dn : 0);
+	return dn / n;
+}
+
+inline double compareColors(unsigned char* v1, unsigned char* v2, double n) {
+	typedef cv::Point3_<uchar> Point3u;
+	Point3u *curc = (Point3u*)v1;
+	Point3u *desc = (Point3u*)v2;
+
+	cv::Point3f distc = *desc;
+	cv::Point3f distc2 = *curc;
+	distc -= distc2;
+	distc *= 1. / 255;
+
+	return norm(distc) / n;
+}
+
+inline double comparePositions(unsigned char* v1, unsigned char* v2, double n) {
+	cv::Point3f *curp = (cv::Point3f*)v1;
+	cv::Point3f *desp = (cv::Point3f*)v2;
+	double dp = norm(*desp - *curp);
+	dp = (dp < 10 ? dp : 0);
+	return dp / n;
+}
+
+/// Combines differences of all inputs into one.
+typedef double (*Accumulator)(std::vector<double>);
+
+/// Sum truncated to integer, as in the original growing, thresholds of segment() are tuned for it.
+inline double accumulateSum(std::vector<double> values) {
+	return std::accumulate(values.begin(), values.end(), 0);
+}
+
+/// Exact sum, for segmentGraph(), which compares fractions of thresholds.
+inline double accumulateSumExact(std::vector<double> values) {
+	return std::accumulate(values.begin(), values.end(), 0.0);
+}
+
+inline double accumulateMax(std::vector<double> values) {
+	return *std::max_element(values.begin(), values.end());
+}
+
+/*!
+ * \class RegionGrowing
+ * \brief Segments grown from seeds in regular grid over any set of inputs.
+ *
+ * Segment grows into 4-neighbour as long as differences of all inputs,
+ * combined by accumulator, stay below threshold. Edges (if set) are hard
+ * barriers. Lazy cloud is materialized only at compared points. Copies are
+ * shallow, so prepared instance can be handed to another thread (graph
+ * buffers, if set, are shared by copies too).
+ *
+ * Alternatively, the same inputs can be segmented by graph-based algorithm
+ * (segmentGraph()), which doesn't depend on seeds.
+ *
+ * Besides colored image, segment labels are kept; segments are told apart
+ * by them, so a segment which happens to get black color is not grown over
+ * again. Colors come from own generator, seeded from generator of the
+ * creating thread (or by setSeed()), so that instances can segment on
+ * different threads at the same time.
+ */
+class RegionGrowing {
+public:
+	/// Neighbourhood graph edge, points are indices in row-major order.
+	struct GraphEdge {
+		int a;
+		int b;
+		double weight;
+	};
+
+	/*!
+	 * Edges of segmentGraph() and their sorting buffers. Sharing them by
+	 * segmentations run one at a time (e.g. of single component) keeps
+	 * their capacity between frames.
+	 */
+	struct GraphBuffers {
+		std::vector<GraphEdge> edges;
+		std::vector<GraphEdge> sorted;
+		std::vector<int> counts;
+	};
+
+	RegionGrowing() :
+		m_lazy_input(-1), m_decimation(1), m_rng(cv::theRNG().next()) {
+	}
+
+	/// Seeds generator of segment colors, same seed gives the same colors.
+	void setSeed(uint64 seed) {
+		m_rng = cv::RNG(seed);
+	}
+
+	/// Adds image, pixels of which are compared by comparator.
+	void addInput(const cv::Mat & img, Comparator comparator, double threshold) {
+		m_inputs.push_back(img);
+		m_comparators.push_back(comparator);
+		m_thresholds.push_back(threshold);
+	}
+
+	/*!
+	 * Adds lazy cloud (only one is supported), its points are compared by
+	 * comparator. Segmented grid is every decimation-th pixel of the cloud.
+	 */
+	void addLazyInput(const DepthCloud & cloud, int decimation, Comparator comparator, double threshold) {
+		m_depth_cloud = cloud;
+		m_lazy_input = m_inputs.size();
+		addInput(decimate(cloud.depth(), decimation), comparator, threshold);
+	}
+
+	/// Decimation of inputs, scales seed grid and lazy cloud lookups.
+	void setDecimation(int decimation) {
+		m_decimation = std::max(1, decimation);
+	}
+
+	/// Buffers of segmentGraph(), allocated by each call if not set.
+	void setGraphBuffers(const boost::shared_ptr<GraphBuffers> & buffers) {
+		m_graph = buffers;
+	}
+
+	/// Edge mask (Types::EdgeType bits) of segmented grid, edges are never crossed.
+	void setEdges(const cv::Mat & edges) {
+		m_edges = edges;
+	}
+
+	bool hasEdges() const {
+		return !m_edges.empty();
+	}
+
+	/// Returns false if there are no inputs or their sizes differ.
+	bool valid() const {
+		if (m_inputs.empty())
+			return false;
+		for (size_t i = 1; i < m_inputs.size(); ++i)
+			if (m_inputs[i].size() != m_inputs[0].size())
+				return false;
+		return true;
+	}
+
+	/// Inputs, with lazy cloud materialized (at segmented grid).
+	std::vector<cv::Mat> materializedInputs() const {
+		std::vector<cv::Mat> ret = m_inputs;
+		if (m_lazy_input >= 0) {
+			int n = m_decimation;
+			cv::Mat & cloud = ret[m_lazy_input];
+			cloud.create(m_inputs[m_lazy_input].size(), CV_32FC3);
+			for (int i = 0; i < cloud.rows; ++i) {
+				cv::Point3f * p = cloud.ptr<cv::Point3f>(i);
+				for (int j = 0; j < cloud.cols; ++j)
+					p[j] = m_depth_cloud.point(i * n, j * n);
+			}
+		}
+		return ret;
+	}
+
+	const std::vector<Comparator> & comparators() const {
+		return m_comparators;
+	}
+
+	const std::vector<double> & thresholds() const {
+		return m_thresholds;
+	}
+
+	/// Distance of seeds (in points of segmented grid).
+	int seedStep() const {
+		return std::max(1, 10 / m_decimation);
+	}
+
+	/// Segments inputs, returns CV_8UC3 image with random color of each segment.
+	cv::Mat segment(Accumulator accumulator, double threshold) {
+		m_size = m_inputs[0].size();
+		m_clusters = cv::Mat::zeros(m_size, CV_8UC3);
+		m_labels = cv::Mat::zeros(m_size, CV_32SC1);
+		m_closed = cv::Mat::zeros(m_size, CV_8UC1);
+
+		std::queue<cv::Point> open;
+		std::queue<cv::Point> seed;
+
+		// initialize seeds in regular 10x10 grid (of full resolution pixels)
+		int step = seedStep();
+		for (int x = 0; x < m_size.width; x += step)
+			for (int y = 0; y < m_size.height; y += step)
+				seed.push(cv::Point(x, y));
+
+		// definition of all possible directions
+		cv::Point right(1, 0);
+		cv::Point left(-1, 0);
+		cv::Point up(0, -1);
+		cv::Point down(0, 1);
+
+		int label = 0;
+
+		// repeat until we still have some seed points
+		while (!seed.empty()) {
+			// create new, empty list of open points
+			open = std::queue<cv::Point>();
+
+			// get first seed
+			cv::Point pt = seed.front();
+			seed.pop();
+
+			// ignore already segmented seeds
+			if (m_labels.at<int>(pt) != 0) {
+				continue;
+			}
+
+			// generate random color for new segment
+			cv::Point3i id(0, m_rng.uniform(0, 128), m_rng.uniform(0, 128));
+			++label;
+
+			open.push(pt);
+
+			LOG(LDEBUG)<< "Growing";
+			// growing segment
+			while (!open.empty()) {
+
+				cv::Point curpoint = open.front();
+				open.pop();
+				if (m_labels.at<int>(curpoint) != 0)
+					continue;
+
+				m_clusters.at<cv::Point3_<uchar> >(curpoint) = id;
+				m_labels.at<int>(curpoint) = label;
+
+				if (check(curpoint, right, accumulator, threshold))
+					open.push(curpoint + right);
+				if (check(curpoint, left, accumulator, threshold))
+					open.push(curpoint + left);
+				if (check(curpoint, up, accumulator, threshold))
+					open.push(curpoint + up);
+				if (check(curpoint, down, accumulator, threshold))
+					open.push(curpoint + down);
+			}
+		}
+
+		return m_clusters;
+	}
+
+	/*!
+	 * Segments inputs with graph-based algorithm of Felzenszwalb and
+	 * Huttenlocher, returns CV_8UC3 image with random color of each segment.
+	 *
+	 * Neighbours (4- or 8-connected) are joined by edges weighted with
+	 * accumulated differences of all inputs, pairs separated by edges of the
+	 * mask get none. Edges are processed in order of increasing weight
+	 * (radix sorted, equal weights in raster order) and join two
+	 * segments if weight doesn't exceed internal difference of any of them
+	 * (the largest weight joined so far) plus k divided by its size, so
+	 * larger k gives larger segments. Finally, segments smaller than
+	 * min_size points are joined to their neighbours. Every point gets a
+	 * label, runtime is nearly linear in number of points.
+	 */
+	cv::Mat segmentGraph(Accumulator accumulator, double k, int min_size, bool eight) {
+		m_size = m_inputs[0].size();
+		int w = m_size.width, h = m_size.height;
+
+		// every point is compared anyway, so lazy cloud is materialized at once
+		std::vector<cv::Mat> inputs = materializedInputs();
+
+		// right and down neighbours, diagonal ones for 8-connectivity
+		static const int dx[] = { 1, 0, 1, -1 };
+		static const int dy[] = { 0, 1, 1, 1 };
+		int dirs = eight ? 4 : 2;
+
+		if (!m_graph)
+			m_graph.reset(new GraphBuffers);
+		std::vector<GraphEdge> & edges = m_graph->edges;
+		edges.clear();
+		edges.reserve((size_t) w * h * dirs);
+		std::vector<double> results(inputs.size());
+		for (int y = 0; y < h; ++y) {
+			for (int x = 0; x < w; ++x) {
+				cv::Point point(x, y);
+				for (int d = 0; d < dirs; ++d) {
+					cv::Point dest(x + dx[d], y + dy[d]);
+					if (dest.x < 0 || dest.x >= w || dest.y >= h)
+						continue;
+					if (!m_edges.empty() && separated(point, dest))
+						continue;
+
+					for (size_t i = 0; i < inputs.size(); ++i) {
+						const cv::Mat & img = inputs[i];
+						unsigned char * v1 = img.data + point.y * img.step + point.x * img.elemSize();
+						unsigned char * v2 = img.data + dest.y * img.step + dest.x * img.elemSize();
+						results[i] = m_comparators[i](v1, v2, m_thresholds[i]);
+					}
+					GraphEdge edge = { y * w + x, dest.y * w + dest.x, accumulator(results) };
+					// NaN (e.g. of invalid normals) is no difference, as in comparators; -0 would sort last
+					if (!(edge.weight > 0))
+						edge.weight = 0;
+					edges.push_back(edge);
+				}
+			}
+		}
+		sortEdges(*m_graph);
+
+		DisjointSets sets(w * h);
+		std::vector<double> limit(w * h, k);
+		for (size_t i = 0; i < edges.size(); ++i) {
+			int a = sets.find(edges[i].a);
+			int b = sets.find(edges[i].b);
+			if (a == b || edges[i].weight > limit[a] || edges[i].weight > limit[b])
+				continue;
+			int root = sets.join(a, b);
+			// edges come sorted, so the weight is the largest inside the union
+			limit[root] = edges[i].weight + k / sets.size(root);
+		}
+
+		for (size_t i = 0; min_size > 1 && i < edges.size(); ++i) {
+			int a = sets.find(edges[i].a);
+			int b = sets.find(edges[i].b);
+			if (a != b && (sets.size(a) < min_size || sets.size(b) < min_size))
+				sets.join(a, b);
+		}
+
+		// labels in raster order of the first point of segment
+		m_clusters = cv::Mat::zeros(m_size, CV_8UC3);
+		m_labels = cv::Mat::zeros(m_size, CV_32SC1);
+		std::vector<int> label(w * h, 0);
+		std::vector<cv::Point3i> ids;
+		for (int y = 0; y < h; ++y) {
+			int * l = m_labels.ptr<int>(y);
+			cv::Point3_<uchar> * c = m_clusters.ptr<cv::Point3_<uchar> >(y);
+			for (int x = 0; x < w; ++x) {
+				int root = sets.find(y * w + x);
+				if (label[root] == 0) {
+					ids.push_back(cv::Point3i(0, m_rng.uniform(0, 128), m_rng.uniform(0, 128)));
+					label[root] = ids.size();
+				}
+				l[x] = label[root];
+				c[x] = ids[label[root] - 1];
+			}
+		}
+
+		return m_clusters;
+	}
+
+	/// Segment labels (CV_32SC1, from 1) of the last segmentation.
+	const cv::Mat & labels() const {
+		return m_labels;
+	}
+
+private:
+	/// Bits of non-negative weight, ordered as the weights are.
+	static boost::uint64_t weightKey(double weight) {
+		boost::uint64_t key;
+		std::memcpy(&key, &weight, sizeof(key));
+		return key;
+	}
+
+	/*!
+	 * Sorts buffers.edges by weight, with LSD radix sort of bits of weights
+	 * (16 bits per pass), linear in number of edges. Passes over digits
+	 * shared by all weights are left out. Sort is stable, so edges of equal
+	 * weight stay in raster order.
+	 */
+	static void sortEdges(GraphBuffers & buffers) {
+		const int BITS = 16;
+		const int DIGITS = 1 << BITS;
+		const int PASSES = 64 / BITS;
+		std::vector<GraphEdge> & edges = buffers.edges;
+		std::vector<GraphEdge> & sorted = buffers.sorted;
+		std::vector<int> & counts = buffers.counts;
+		if (edges.empty())
+			return;
+
+		counts.assign(PASSES * DIGITS, 0);
+		for (size_t i = 0; i < edges.size(); ++i) {
+			boost::uint64_t key = weightKey(edges[i].weight);
+			for (int p = 0; p < PASSES; ++p)
+				++counts[p * DIGITS + ((key >> (p * BITS)) & (DIGITS - 1))];
+		}
+
+		sorted.resize(edges.size());
+		for (int p = 0; p < PASSES; ++p) {
+			int * start = &counts[p * DIGITS];
+			int shift = p * BITS;
+			if (start[(weightKey(edges[0].weight) >> shift) & (DIGITS - 1)] == (int) edges.size())
+				continue;
+
+			for (int d = 0, sum = 0; d < DIGITS; ++d) {
+				int count = start[d];
+				start[d] = sum;
+				sum += count;
+			}
+			for (size_t i = 0; i < edges.size(); ++i)
+				sorted[start[(weightKey(edges[i].weight) >> shift) & (DIGITS - 1)]++] = edges[i];
+			edges.swap(sorted);
+		}
+	}
+
+	bool check(cv::Point point, cv::Point dir, Accumulator accumulator, double threshold) {
+		cv::Point dest = point + dir;
+
+		// check, if given direction lays inside image
+		if (!dest.inside(cv::Rect(0, 0, m_size.width - 1, m_size.height - 1)))
+			return false;
+
+		// ignore already segmented points
+		if (m_closed.at<uchar>(dest) == 255)
+			return false;
+
+		// edges are hard barriers, such pairs are never compared
+		if (!m_edges.empty() && separated(point, dest))
+			return false;
+
+		// mark point as segmented
+		m_closed.at<uchar>(dest) = 255;
+
+		// intermediate results
+		std::vector<double> results;
+
+		// iterate over all available inputs
+		for (int i = 0; i < (int) m_inputs.size(); ++i) {
+			if (i == m_lazy_input) {
+				// lazy cloud - materialize only compared points (at full resolution)
+				int n = m_decimation;
+				cv::Point3f p1 = m_depth_cloud.point(point.y * n, point.x * n);
+				cv::Point3f p2 = m_depth_cloud.point(dest.y * n, dest.x * n);
+				results.push_back(m_comparators[i]((unsigned char *) &p1, (unsigned char *) &p2, m_thresholds[i]));
+				continue;
+			}
+			const cv::Mat & img = m_inputs[i];
+			unsigned char * v1 = img.data + point.y * img.step + point.x * img.elemSize();
+			unsigned char * v2 = img.data + dest.y * img.step + dest.x * img.elemSize();
+			results.push_back(m_comparators[i](v1, v2, m_thresholds[i]));
+		}
+
+		// accumulate intermediate results
+		double result = accumulator(results);
+
+		return result < threshold;
+	}
+
+	/// Checks, if pair of neighbouring points is separated by an edge, symmetric in the points
+	bool separated(cv::Point point, cv::Point dest) const {
+		uchar e = m_edges.at<uchar>(point) | m_edges.at<uchar>(dest);
+
+		// depth jump lies between nearer (occluding) and farther (occluded) side
+		if ((e & EDGE_OCCLUDING) && (e & EDGE_OCCLUDED))
+			return true;
+
+		// creases are not joined with any neighbour
+		return (e & EDGE_CURVATURE) != 0;
+	}
+
+	std::vector<cv::Mat> m_inputs;
+	std::vector<Comparator> m_comparators;
+	std::vector<double> m_thresholds;
+
+	/// Lazy cloud and its index in inputs (-1 if not used)
+	DepthCloud m_depth_cloud;
+	int m_lazy_input;
+
+	int m_decimation;
+
+	/// Generator of segment colors
+	cv::RNG m_rng;
+
+	/// Edge mask of segmented grid, empty if not set
+	cv::Mat m_edges;
+
+	/// Buffers of segmentGraph(), possibly shared with other instances
+	boost::shared_ptr<GraphBuffers> m_graph;
+
+	cv::Size m_size;
+	cv::Mat m_clusters;
+	cv::Mat m_labels;
+	cv::Mat m_closed;
+};
+
+} //: namespace Types
+
+#endif /* REGIONGROWING_HPP_ */
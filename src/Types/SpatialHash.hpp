@@ -0,0 +1,142 @@
+/*!
+ * \file
+ * \brief Open-addressing hash map indexed by integer 3D cell coordinates.
+ */
+
+#ifndef SPATIALHASH_HPP_
+#define SPATIALHASH_HPP_
+
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+namespace Types {
+
+/*!
+ * \class SpatialHash
+ * \brief Hash map from integer (x, y, z) cell to value, with linear probing.
+ *
+ * Coordinates are packed into single 64-bit key (21 bits each, so cells in
+ * range [-2^20, 2^20) are supported). Entries are stored in one flat array,
+ * which is grown twice when more than half full. clear() keeps the memory,
+ * so the map can be reused between frames without allocations.
+ */
+template <typename T>
+class SpatialHash {
+public:
+	struct Entry {
+		boost::uint64_t key;
+		T value;
+	};
+
+	static boost::uint64_t empty() {
+		return ~(boost::uint64_t) 0;
+	}
+
+	SpatialHash(size_t capacity = 1024) :
+		m_size(0) {
+		size_t cap = 16;
+		while (cap < capacity)
+			cap *= 2;
+		m_entries.resize(cap);
+		clear();
+	}
+
+	void clear() {
+		for (size_t i = 0; i < m_entries.size(); ++i)
+			m_entries[i].key = empty();
+		m_size = 0;
+	}
+
+	/// Returns value of given cell, inserting default one if it doesn't exist.
+	T & operator()(int x, int y, int z) {
+		return at(key(x, y, z));
+	}
+
+	T & at(boost::uint64_t k) {
+		if (2 * (m_size + 1) > m_entries.size())
+			grow();
+
+		size_t mask = m_entries.size() - 1;
+		for (size_t i = hash(k) & mask;; i = (i + 1) & mask) {
+			if (m_entries[i].key == k)
+				return m_entries[i].value;
+			if (m_entries[i].key == empty()) {
+				m_entries[i].key = k;
+				m_entries[i].value = T();
+				++m_size;
+				return m_entries[i].value;
+			}
+		}
+	}
+
+	/// Returns value of given cell, NULL if it doesn't exist.
+	T * find(int x, int y, int z) {
+		return find(key(x, y, z));
+	}
+
+	T * find(boost::uint64_t k) {
+		size_t mask = m_entries.size() - 1;
+		for (size_t i = hash(k) & mask;; i = (i + 1) & mask) {
+			if (m_entries[i].key == k)
+				return &m_entries[i].value;
+			if (m_entries[i].key == empty())
+				return NULL;
+		}
+	}
+
+	const T * find(int x, int y, int z) const {
+		return const_cast<SpatialHash *>(this)->find(x, y, z);
+	}
+
+	size_t size() const {
+		return m_size;
+	}
+
+	/// Raw table, slots with key equal to empty() are unused.
+	const std::vector<Entry> & entries() const {
+		return m_entries;
+	}
+
+	std::vector<Entry> & entries() {
+		return m_entries;
+	}
+
+	static boost::uint64_t key(int x, int y, int z) {
+		const boost::uint64_t mask = (1 << 21) - 1;
+		return ((boost::uint64_t) ((x + (1 << 20)) & mask) << 42) | ((boost::uint64_t) ((y + (1 << 20)) & mask) << 21)
+				| (boost::uint64_t) ((z + (1 << 20)) & mask);
+	}
+
+	static void unpack(boost::uint64_t k, int & x, int & y, int & z) {
+		const boost::uint64_t mask = (1 << 21) - 1;
+		x = (int) ((k >> 42) & mask) - (1 << 20);
+		y = (int) ((k >> 21) & mask) - (1 << 20);
+		z = (int) (k & mask) - (1 << 20);
+	}
+
+private:
+	static size_t hash(boost::uint64_t k) {
+		k ^= k >> 33;
+		k *= 0xff51afd7ed558ccdULL;
+		k ^= k >> 33;
+		return (size_t) k;
+	}
+
+	void grow() {
+		std::vector<Entry> old;
+		old.swap(m_entries);
+		m_entries.resize(old.size() * 2);
+		clear();
+		for (size_t i = 0; i < old.size(); ++i)
+			if (old[i].key != empty())
+				at(old[i].key) = old[i].value;
+	}
+
+	std::vector<Entry> m_entries;
+	size_t m_size;
+};
+
+} //: namespace Types
+
+#endif /* SPATIALHASH_HPP_ */
@@ -0,0 +1,175 @@
+/*!
+ * \file
+ * \brief Detection of image tiles changed between frames, for incremental processing.
+ */
+
+#ifndef TILECHANGES_HPP_
+#define TILECHANGES_HPP_
+
+#include <vector>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+#include <opencv2/core/core.hpp>
+
+#include "Types/PointValidity.hpp"
+
+namespace Types {
+
+/*!
+ * \class TileChanges
+ * \brief Input state updated only in tiles that changed beyond sensor noise.
+ *
+ * Keeps state image (raw depth, CV_16UC1, or cloud, CV_32FC3) and optional
+ * edge mask. Every update compares new input with state tile by tile, tile
+ * is changed if depth of any pixel differs by more than tolerance (in
+ * input units), pixel validity differs or edge mask differs. Only changed
+ * tiles are copied into state, so results computed from state are exactly
+ * those of a full computation on it, and unchanged tiles keep accumulating
+ * against the same reference (slow drift below tolerance is not followed).
+ *
+ * Components keep their results between frames and recompute them only in
+ * changed tiles grown by their window radius (see rect() and mask()).
+ */
+class TileChanges {
+public:
+	TileChanges() :
+		m_tile(0), m_full(true) {
+	}
+
+	/// Drops state, next update replaces it completely.
+	void reset() {
+		m_state.release();
+		m_edges.release();
+	}
+
+	/*!
+	 * Updates state with tiles of input (and edges, may be empty) changed by
+	 * more than tolerance. Whole state is replaced (and all tiles reported
+	 * as changed) if size, type or tile size differs, or edges are connected
+	 * or disconnected.
+	 */
+	void update(const cv::Mat & input, const cv::Mat & edges, double tolerance, int tile) {
+		CV_Assert(input.type() == CV_16UC1 || input.type() == CV_32FC3);
+		m_changed.clear();
+		m_full = m_state.empty() || m_state.size() != input.size() || m_state.type() != input.type()
+				|| m_edges.empty() != edges.empty() || m_tile != tile;
+		m_tile = tile;
+
+		if (m_full) {
+			input.copyTo(m_state);
+			if (edges.empty())
+				m_edges.release();
+			else
+				edges.copyTo(m_edges);
+		}
+
+		for (int y = 0; y < input.rows; y += tile) {
+			for (int x = 0; x < input.cols; x += tile) {
+				cv::Rect rect(x, y, std::min(tile, input.cols - x), std::min(tile, input.rows - y));
+				if (m_full) {
+					m_changed.push_back(rect);
+					continue;
+				}
+
+				bool changed = input.type() == CV_16UC1 ? depthChanged(input, rect, tolerance) : cloudChanged(input,
+						rect, tolerance);
+				if (!changed && !edges.empty())
+					changed = cv::norm(edges(rect), m_edges(rect), cv::NORM_INF) != 0;
+				if (!changed)
+					continue;
+
+				cv::Mat state = m_state(rect);
+				input(rect).copyTo(state);
+				if (!edges.empty()) {
+					cv::Mat state_edges = m_edges(rect);
+					edges(rect).copyTo(state_edges);
+				}
+				m_changed.push_back(rect);
+			}
+		}
+	}
+
+	const cv::Mat & state() const {
+		return m_state;
+	}
+
+	/// Edge mask matching state, empty if there are no edges.
+	const cv::Mat & edges() const {
+		return m_edges;
+	}
+
+	/// True if the last update replaced whole state.
+	bool full() const {
+		return m_full;
+	}
+
+	/// Number of tiles changed by the last update.
+	size_t changed() const {
+		return m_changed.size();
+	}
+
+	/// Number of all tiles.
+	size_t tiles() const {
+		if (m_state.empty())
+			return 0;
+		return (size_t) ((m_state.rows + m_tile - 1) / m_tile) * ((m_state.cols + m_tile - 1) / m_tile);
+	}
+
+	/// Changed tile k grown by before (up and left) and after (down and right) pixels, clipped to image.
+	cv::Rect rect(size_t k, int before, int after) const {
+		cv::Rect r = m_changed[k];
+		r = cv::Rect(r.x - before, r.y - before, r.width + before + after, r.height + before + after);
+		return r & cv::Rect(0, 0, m_state.cols, m_state.rows);
+	}
+
+	/// Mask (CV_8UC1) of all changed tiles, grown as in rect().
+	void mask(int before, int after, cv::Mat & mask) const {
+		mask.create(m_state.size(), CV_8UC1);
+		mask = cv::Scalar::all(0);
+		for (size_t k = 0; k < m_changed.size(); ++k) {
+			cv::Mat roi = mask(rect(k, before, after));
+			roi = cv::Scalar::all(255);
+		}
+	}
+
+private:
+	/// Raw depth, 0 is invalid.
+	bool depthChanged(const cv::Mat & input, const cv::Rect & rect, double tolerance) const {
+		for (int i = rect.y; i < rect.y + rect.height; ++i) {
+			const unsigned short * a = input.ptr<unsigned short>(i);
+			const unsigned short * b = m_state.ptr<unsigned short>(i);
+			for (int j = rect.x; j < rect.x + rect.width; ++j)
+				if ((a[j] == 0) != (b[j] == 0) || std::abs((int) a[j] - (int) b[j]) > tolerance)
+					return true;
+		}
+		return false;
+	}
+
+	/// Cloud, only depth (z) is compared, x and y follow it.
+	bool cloudChanged(const cv::Mat & input, const cv::Rect & rect, double tolerance) const {
+		for (int i = rect.y; i < rect.y + rect.height; ++i) {
+			const cv::Point3f * a = input.ptr<cv::Point3f>(i);
+			const cv::Point3f * b = m_state.ptr<cv::Point3f>(i);
+			for (int j = rect.x; j < rect.x + rect.width; ++j) {
+				bool valid = validPoint(a[j]);
+				if (valid != validPoint(b[j]) || (valid && std::fabs(a[j].z - b[j].z) > tolerance))
+					return true;
+			}
+		}
+		return false;
+	}
+
+	cv::Mat m_state;
+	cv::Mat m_edges;
+	int m_tile;
+	bool m_full;
+
+	/// Tiles changed by the last update
+	std::vector<cv::Rect> m_changed;
+};
+
+} //: namespace Types
+
+#endif /* TILECHANGES_HPP_ */
@@ -0,0 +1,237 @@
+/*!
+ * \file
+ * \brief Chrome trace-event recorder for pipeline stages.
+ */
+
+#ifndef TRACE_HPP_
+#define TRACE_HPP_
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "Common/Logger.hpp"
+
+namespace Types {
+
+/*!
+ * \struct TraceEvent
+ * \brief Single begin/end event, names are copied so that events outlive their sources.
+ */
+struct TraceEvent {
+	char name[48];
+	char cat[32];
+	char phase;
+	boost::uint64_t ts;
+	boost::uint64_t frame;
+};
+
+/*!
+ * \class TraceBuffer
+ * \brief Single-producer, single-consumer ring of trace events owned by one thread.
+ *
+ * When the writer thread lags behind, newest events are dropped (and counted)
+ * instead of blocking the producing handler.
+ */
+class TraceBuffer {
+public:
+	static const int CAPACITY = 4096;
+
+	TraceBuffer(int tid) :
+		m_tid(tid), m_head(0), m_tail(0), m_dropped(0) {
+	}
+
+	bool push(const TraceEvent & ev) {
+		boost::uint32_t head = m_head.load(boost::memory_order_relaxed);
+		boost::uint32_t tail = m_tail.load(boost::memory_order_acquire);
+		if (head - tail >= (boost::uint32_t) CAPACITY) {
+			m_dropped.fetch_add(1, boost::memory_order_relaxed);
+			return false;
+		}
+		m_events[head % CAPACITY] = ev;
+		m_head.store(head + 1, boost::memory_order_release);
+		return true;
+	}
+
+	bool pop(TraceEvent & ev) {
+		boost::uint32_t tail = m_tail.load(boost::memory_order_relaxed);
+		boost::uint32_t head = m_head.load(boost::memory_order_acquire);
+		if (tail == head)
+			return false;
+		ev = m_events[tail % CAPACITY];
+		m_tail.store(tail + 1, boost::memory_order_release);
+		return true;
+	}
+
+	int tid() const {
+		return m_tid;
+	}
+
+	boost::uint64_t dropped() const {
+		return m_dropped.load(boost::memory_order_relaxed);
+	}
+
+private:
+	int m_tid;
+	boost::atomic<boost::uint32_t> m_head;
+	boost::atomic<boost::uint32_t> m_tail;
+	boost::atomic<boost::uint64_t> m_dropped;
+	TraceEvent m_events[CAPACITY];
+};
+
+/*!
+ * \class Tracer
+ * \brief Process-wide trace recorder.
+ *
+ * Each thread records into its own TraceBuffer, a background thread drains
+ * all buffers periodically and appends them to a file in Chrome trace-event
+ * JSON array format (viewable in chrome://tracing or Perfetto). The closing
+ * bracket is optional in this format, so the file is valid at any moment.
+ */
+class Tracer {
+public:
+	static Tracer & instance() {
+		static Tracer tracer;
+		return tracer;
+	}
+
+	/// Starts writing events to given file. Subsequent calls with other paths are ignored.
+	bool open(const std::string & path) {
+		boost::mutex::scoped_lock lock(m_mutex);
+		if (m_file)
+			return path == m_path;
+
+		m_file = fopen(path.c_str(), "w");
+		if (!m_file) {
+			LOG(LERROR) << "Tracer: can't open " << path;
+			return false;
+		}
+		fputs("[\n", m_file);
+		m_path = path;
+		m_running = true;
+		m_enabled.store(true, boost::memory_order_release);
+		m_writer = boost::thread(boost::bind(&Tracer::run, this));
+		LOG(LNOTICE) << "Tracer: writing trace to " << path;
+		return true;
+	}
+
+	void close() {
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			if (!m_file)
+				return;
+			m_enabled.store(false, boost::memory_order_release);
+			m_running = false;
+		}
+		m_writer.join();
+
+		boost::mutex::scoped_lock lock(m_mutex);
+		flush();
+		fclose(m_file);
+		m_file = NULL;
+	}
+
+	bool enabled() const {
+		return m_enabled.load(boost::memory_order_acquire);
+	}
+
+	void begin(const std::string & cat, const std::string & name, boost::uint64_t frame) {
+		record('B', cat, name, frame);
+	}
+
+	void end(const std::string & cat, const std::string & name, boost::uint64_t frame) {
+		record('E', cat, name, frame);
+	}
+
+	~Tracer() {
+		close();
+	}
+
+private:
+	Tracer() :
+		m_file(NULL), m_running(false), m_enabled(false), m_next_tid(1), m_local(&Tracer::noDelete) {
+		m_start = boost::posix_time::microsec_clock::universal_time();
+	}
+
+	void record(char phase, const std::string & cat, const std::string & name, boost::uint64_t frame) {
+		if (!enabled())
+			return;
+
+		TraceEvent ev;
+		strncpy(ev.name, name.c_str(), sizeof(ev.name) - 1);
+		ev.name[sizeof(ev.name) - 1] = 0;
+		strncpy(ev.cat, cat.c_str(), sizeof(ev.cat) - 1);
+		ev.cat[sizeof(ev.cat) - 1] = 0;
+		ev.phase = phase;
+		ev.ts = (boost::posix_time::microsec_clock::universal_time() - m_start).total_microseconds();
+		ev.frame = frame;
+		buffer()->push(ev);
+	}
+
+	TraceBuffer * buffer() {
+		TraceBuffer * buf = m_local.get();
+		if (!buf) {
+			boost::mutex::scoped_lock lock(m_mutex);
+			boost::shared_ptr<TraceBuffer> ptr(new TraceBuffer(m_next_tid++));
+			m_buffers.push_back(ptr);
+			buf = ptr.get();
+			// buffers are owned by tracer, so they outlive their threads
+			m_local.reset(buf);
+		}
+		return buf;
+	}
+
+	static void noDelete(TraceBuffer *) {
+	}
+
+	void run() {
+		for (;;) {
+			boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+			boost::mutex::scoped_lock lock(m_mutex);
+			if (!m_running)
+				return;
+			flush();
+		}
+	}
+
+	/// Drains all buffers, must be called with m_mutex held.
+	void flush() {
+		TraceEvent ev;
+		for (size_t i = 0; i < m_buffers.size(); ++i) {
+			while (m_buffers[i]->pop(ev)) {
+				fprintf(m_file,
+						"{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%llu,\"pid\":1,\"tid\":%d,\"args\":{\"frame\":%llu}},\n",
+						ev.name, ev.cat, ev.phase, (unsigned long long) ev.ts, m_buffers[i]->tid(),
+						(unsigned long long) ev.frame);
+			}
+		}
+		fflush(m_file);
+	}
+
+	FILE * m_file;
+	std::string m_path;
+	bool m_running;
+	boost::atomic<bool> m_enabled;
+	int m_next_tid;
+
+	boost::posix_time::ptime m_start;
+
+	boost::mutex m_mutex;
+	boost::thread m_writer;
+
+	std::vector<boost::shared_ptr<TraceBuffer> > m_buffers;
+	boost::thread_specific_ptr<TraceBuffer> m_local;
+};
+
+} //: namespace Types
+
+#endif /* TRACE_HPP_ */